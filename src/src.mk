@@ -23,14 +23,25 @@ $(info src.mk: *** SO_FILE_LIBWRH5 was not found.)
 $(error Execute make at the root level only.)
 endif
 
-all:	$(LIB_DIR_LIBWRH5)/$(SO_FILE_LIBWRH5)
+ifndef SO_FILE_LIBWRH5C
+$(info src.mk: *** SO_FILE_LIBWRH5C was not found.)
+$(error Execute make at the root level only.)
+endif
+
+all:	$(LIB_DIR_LIBWRH5)/$(SO_FILE_LIBWRH5) $(LIB_DIR_LIBWRH5)/$(SO_FILE_LIBWRH5C)
+
+$(LIB_DIR_LIBWRH5)/$(SO_FILE_LIBWRH5): wrh5_open.o wrh5_close.o wrh5_write.o wrh5_util.o wrh5_cc_index.o wrh5_pool.o wrh5_writev.o wrh5_stage.o wrh5_detect.o wrh5_quant.o wrh5_bypass.o wrh5_valid.o wrh5_resume.o wrh5_rechunk.o wrh5_sk.o wrh5_budget.o wrh5_uring.o wrh5_serve.o wrh5_client.o wrh5_manager.o wrh5_vds.o wrh5_mmap.o wrh5_trace.o wrh5_metrics.o wrh5_record.o wrh5_affinity.o wrh5_chans.o
+	mkdir -p $(LIB_DIR_LIBWRH5)
+	gcc -shared -Wl,-soname,$(SONAME_LIBWRH5) -o $(LIB_DIR_LIBWRH5)/$(SONAME_LIBWRH5) $^ ${LINK_LIBHDF5} -lpthread -lm -lz -lrt
+	ln -sf $(SONAME_LIBWRH5) $@
 
-$(LIB_DIR_LIBWRH5)/$(SO_FILE_LIBWRH5): wrh5_open.o wrh5_close.o wrh5_write.o wrh5_util.o
+# --- Producer library of the shared-memory streams: no HDF5
+$(LIB_DIR_LIBWRH5)/$(SO_FILE_LIBWRH5C): wrh5_client.o
 	mkdir -p $(LIB_DIR_LIBWRH5)
-	gcc -shared -o $@ $^ ${LINK_LIBHDF5}
+	gcc -shared -o $@ $^ -lrt
 
 # --- Generate anyfile.o from anyfile.c
-%.o:	%.c wrh5_defs.h src.mk
+%.o:	%.c wrh5_defs.h wrh5_hdr.h wrh5_shm.h src.mk
 	gcc $(CFLAGS) -I . -I $(INC_DIR_LIBHDF5) $<
 
 clean:
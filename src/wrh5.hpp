@@ -0,0 +1,308 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5.hpp                                                                    *
+ * --------                                                                    *
+ * Header-only C++17 layer over the libwrh5 C API.                             *
+ *                                                                             *
+ * wrh5::Writer<T, NIFS, NCHANS> owns one writing context (RAII, move-only):   *
+ * - T (uint8_t, uint16_t, float or double) fixes nbits at compile time; an    *
+ *   unsupported element type does not compile.                               *
+ * - NIFS, and optionally NCHANS, fix the shape of a time integration, so that *
+ *   tint_elems(), tint_bytes() and chunk_bytes() are constexpr.               *
+ * - Buffers are passed as wrh5::span<const T> (std::span when the standard    *
+ *   library has it) straight to the C functions: no copy is made.             *
+ * - The batched (wrh5_writev), zero-copy pool (wrh5_pool_get, wrh5_submit),   *
+ *   detection (wrh5_write_detect) and missing data (wrh5_write_missing) entry *
+ *   points are exposed as member functions.                                   *
+ * Errors are thrown as wrh5::error; the C library has logged the details.     *
+ * The destructor closes a context that is still open, ignoring failures.      *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef wrh5_HPP
+#define wrh5_HPP
+
+#include <array>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#if __has_include(<span>)
+#include <span>
+#endif
+
+#include "wrh5_defs.h"
+
+
+namespace wrh5 {
+
+/*
+ * Contiguous view of elements: std::span if available (C++20), else a minimal equivalent.
+ */
+inline constexpr std::size_t dynamic_extent = static_cast<std::size_t>(-1);
+
+#if defined(__cpp_lib_span) && __cpp_lib_span >= 202002L
+template<typename T>
+using span = std::span<T>;
+#else
+template<typename T>
+class span {
+public:
+    using element_type = T;
+
+    constexpr span() noexcept : p_data(nullptr), n_elems(0) {}
+    constexpr span(T * p, std::size_t n) noexcept : p_data(p), n_elems(n) {}
+    template<std::size_t N>
+    constexpr span(T (&array)[N]) noexcept : p_data(array), n_elems(N) {}
+    template<typename C, typename = std::enable_if_t<
+             std::is_convertible_v<decltype(std::declval<C &>().data()), T *>
+             && !std::is_same_v<std::remove_cv_t<C>, span>>>
+    constexpr span(C & container) noexcept : p_data(container.data()), n_elems(container.size()) {}
+    template<typename U, typename = std::enable_if_t<std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(const span<U> & other) noexcept : p_data(other.data()), n_elems(other.size()) {}
+
+    constexpr T * data() const noexcept { return p_data; }
+    constexpr std::size_t size() const noexcept { return n_elems; }
+    constexpr std::size_t size_bytes() const noexcept { return n_elems * sizeof(T); }
+    constexpr bool empty() const noexcept { return n_elems == 0; }
+    constexpr T & operator[](std::size_t ix) const noexcept { return p_data[ix]; }
+    constexpr T * begin() const noexcept { return p_data; }
+    constexpr T * end() const noexcept { return p_data + n_elems; }
+    constexpr span first(std::size_t n) const noexcept { return span(p_data, n); }
+
+private:
+    T *         p_data;
+    std::size_t n_elems;
+};
+#endif
+
+
+/*
+ * Failure of a libwrh5 call.
+ */
+class error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+
+/*
+ * Element types: nbits of the header.  Not defined for other types.
+ */
+template<typename T> struct element_traits;
+template<> struct element_traits<std::uint8_t>  { static constexpr int nbits = 8; };
+template<> struct element_traits<std::uint16_t> { static constexpr int nbits = 16; };
+template<> struct element_traits<float>         { static constexpr int nbits = 32; };
+template<> struct element_traits<double>        { static constexpr int nbits = 64; };
+
+
+/*
+ * One Filterbank HDF5 writing context.
+ */
+template<typename T, int NIFS, std::size_t NCHANS = dynamic_extent>
+class Writer {
+    static_assert(NIFS >= 1, "wrh5::Writer: NIFS must be >= 1");
+    static_assert(NCHANS > 0, "wrh5::Writer: NCHANS must be > 0");
+
+public:
+    using value_type = T;
+    static constexpr int nbits = element_traits<T>::nbits;
+    static constexpr int nifs = NIFS;
+
+    /*
+     * Shape arithmetic.
+     */
+    static constexpr std::size_t tint_elems(std::size_t nchans) noexcept { return NIFS * nchans; }
+    static constexpr std::size_t tint_bytes(std::size_t nchans) noexcept { return tint_elems(nchans) * sizeof(T); }
+    static constexpr std::size_t chunk_bytes(const user_chunking_t & chunking) noexcept {
+        return chunking.n_time * chunking.n_nifs * chunking.n_fine_chan * sizeof(T);
+    }
+    template<std::size_t N = NCHANS, typename = std::enable_if_t<N != dynamic_extent>>
+    static constexpr std::size_t tint_elems() noexcept { return tint_elems(N); }
+    template<std::size_t N = NCHANS, typename = std::enable_if_t<N != dynamic_extent>>
+    static constexpr std::size_t tint_bytes() noexcept { return tint_bytes(N); }
+
+    /*
+     * Open (wrh5_open_ext).  The header's nbits and nifs are set from T and NIFS, and its nchans from NCHANS if fixed.
+     */
+    Writer() noexcept = default;
+    Writer(const std::string & path,
+           const wrh5_hdr_t & hdr,
+           const user_chunking_t * p_chunking = nullptr,
+           const user_caching_t * p_caching = nullptr,
+           const user_options_t * p_options = nullptr,
+           bool debug = false)
+        : p_ctx(new wrh5_context_t()), header(hdr), debugging(debug ? 1 : 0) {
+        user_chunking_t chunking {};
+        user_caching_t  caching {};
+        user_options_t  options {};
+
+        header.nbits = nbits;
+        header.nifs = NIFS;
+        if constexpr (NCHANS != dynamic_extent) {
+            if(header.nchans != 0 && static_cast<std::size_t>(header.nchans) != NCHANS)
+                throw error("wrh5::Writer: header nchans does not match NCHANS");
+            header.nchans = static_cast<int>(NCHANS);
+        }
+        if(p_chunking != nullptr)
+            chunking = *p_chunking;
+        if(p_caching != nullptr)
+            caching = *p_caching;
+        if(p_options != nullptr)
+            options = *p_options;
+        if(wrh5_open_ext(p_ctx.get(), &header, const_cast<char *>(path.c_str()),
+                         p_chunking ? &chunking : nullptr,
+                         p_caching ? &caching : nullptr,
+                         p_options ? &options : nullptr,
+                         debugging) != 0) {
+            p_ctx.reset();
+            throw error("wrh5::Writer: wrh5_open_ext of '" + path + "' failed");
+        }
+    }
+
+    /*
+     * Move-only.
+     */
+    Writer(const Writer &) = delete;
+    Writer & operator=(const Writer &) = delete;
+    Writer(Writer && other) noexcept = default;
+    Writer & operator=(Writer && other) noexcept {
+        if(this != &other) {
+            abandon();
+            p_ctx = std::move(other.p_ctx);
+            header = other.header;
+            debugging = other.debugging;
+        }
+        return *this;
+    }
+    ~Writer() { abandon(); }
+
+    /*
+     * State.
+     */
+    bool is_open() const noexcept { return p_ctx != nullptr; }
+    std::size_t nchans() const noexcept {
+        if constexpr (NCHANS != dynamic_extent)
+            return NCHANS;
+        else
+            return static_cast<std::size_t>(header.nchans);
+    }
+    hsize_t ntints() const noexcept { return p_ctx ? p_ctx->offset_dims[0] : 0; }
+    wrh5_context_t & context() { return *checked(); }
+    const wrh5_hdr_t & hdr() const noexcept { return header; }
+    wrh5_mem_usage_t memory_usage() {
+        wrh5_mem_usage_t usage {};
+        if(p_ctx && wrh5_memory_usage(p_ctx.get(), &usage) != 0)
+            throw error("wrh5::Writer: wrh5_memory_usage failed");
+        return usage;
+    }
+
+    /*
+     * Write whole time integrations, laid out as the input_layout option says (wrh5_write).
+     */
+    void write(span<const T> data) {
+        check_tints(data.size(), "write");
+        if(wrh5_write(checked(), &header, const_cast<T *>(data.data()), data.size_bytes(), debugging) != 0)
+            throw error("wrh5::Writer: wrh5_write failed");
+    }
+
+    /*
+     * Write several buffers of whole time integrations as one dump (wrh5_writev).
+     */
+    template<typename... Segments, typename = std::enable_if_t<
+             (std::is_constructible_v<span<const T>, const Segments &> && ...)>>
+    void writev(const Segments &... segments) {
+        static_assert(sizeof...(Segments) > 0, "wrh5::Writer::writev: no segment");
+        std::array<wrh5_iovec_t, sizeof...(Segments)> iov = {segment(span<const T>(segments))...};
+        for(const wrh5_iovec_t & seg : iov)
+            check_tints(seg.len / sizeof(T), "writev");
+        writev(iov.data(), static_cast<int>(iov.size()));
+    }
+    void writev(const wrh5_iovec_t * p_iov, int iovcnt) {
+        if(wrh5_writev(checked(), &header, p_iov, iovcnt, debugging) != 0)
+            throw error("wrh5::Writer: wrh5_writev failed");
+    }
+    static wrh5_iovec_t segment(span<const T> data, int role = WRH5_ROLE_TINTS) noexcept {
+        return wrh5_iovec_t{data.data(), data.size_bytes(), role};
+    }
+
+    /*
+     * Zero-copy pool buffers (wrh5_pool_get, wrh5_submit).  get_buffer returns an empty span
+     * if wait is false and no buffer is free.
+     */
+    span<T> get_buffer(bool wait = true) {
+        wrh5_context_t * p_wrh5_ctx = checked();
+        if(p_wrh5_ctx->p_pool == nullptr)
+            throw error("wrh5::Writer: the context has no buffer pool (pool_nbufs or p_pool option)");
+        void * p_buffer = wrh5_pool_get(p_wrh5_ctx->p_pool, wait ? 1 : 0);
+        if(p_buffer == nullptr)
+            return span<T>();
+        return span<T>(static_cast<T *>(p_buffer), p_wrh5_ctx->p_pool->bufsize / sizeof(T));
+    }
+    void submit(span<T> buffer) {
+        if(buffer.empty() || buffer.size() % tint_elems(nchans()) != 0) {
+            wrh5_pool_put(checked()->p_pool, buffer.data());
+            throw error("wrh5::Writer: submit: not a whole number of time integrations");
+        }
+        if(wrh5_submit(checked(), &header, buffer.data(), buffer.size_bytes(), debugging) != 0)
+            throw error("wrh5::Writer: wrh5_submit failed");
+    }
+
+    /*
+     * Detection stage: nspectra spectra of nchans complex64 values per polarization (wrh5_write_detect).
+     */
+    template<typename U = T>
+    std::enable_if_t<std::is_same_v<U, float>> write_detect(span<const std::complex<float>> x,
+                                                           span<const std::complex<float>> y) {
+        if(x.size() != y.size() || x.size() % nchans() != 0)
+            throw error("wrh5::Writer: write_detect needs X and Y of the same whole number of spectra");
+        if(wrh5_write_detect(checked(), &header, reinterpret_cast<const float *>(x.data()),
+                             reinterpret_cast<const float *>(y.data()), x.size() / nchans(), debugging) != 0)
+            throw error("wrh5::Writer: wrh5_write_detect failed");
+    }
+
+    /*
+     * Append missing time integrations (wrh5_write_missing).
+     */
+    void write_missing(std::size_t ntints) {
+        if(wrh5_write_missing(checked(), &header, ntints, debugging) != 0)
+            throw error("wrh5::Writer: wrh5_write_missing failed");
+    }
+
+    /*
+     * Close (wrh5_close).  The writer is closed even if this throws.
+     */
+    void close() {
+        std::unique_ptr<wrh5_context_t> p_closing = std::move(p_ctx);
+        if(p_closing == nullptr)
+            return;
+        if(wrh5_close(p_closing.get(), debugging) != 0)
+            throw error("wrh5::Writer: wrh5_close failed");
+    }
+
+private:
+    std::unique_ptr<wrh5_context_t> p_ctx;
+    wrh5_hdr_t header {};
+    int debugging = 0;
+
+    wrh5_context_t * checked() const {
+        if(p_ctx == nullptr)
+            throw error("wrh5::Writer: not open");
+        return p_ctx.get();
+    }
+    void check_tints(std::size_t nelems, const char * caller) const {
+        if(nelems == 0 || nelems % tint_elems(nchans()) != 0)
+            throw error(std::string("wrh5::Writer: ") + caller + ": not a whole number of time integrations");
+    }
+    void abandon() noexcept {
+        if(p_ctx != nullptr)
+            wrh5_close(p_ctx.get(), debugging);
+        p_ctx.reset();
+    }
+};
+
+}   // namespace wrh5
+
+#endif
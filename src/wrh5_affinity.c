@@ -0,0 +1,288 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_affinity.c                                                             *
+ * ---------------                                                             *
+ * Placement of the library's threads and buffers on a multi-socket machine.   *
+ *                                                                             *
+ * CPU and NUMA node lists are strings as given to taskset -c and numactl,     *
+ * E.g. "0-7,16-23"; an empty list means no placement.                         *
+ * - wrh5_pin_self restricts the calling thread to a CPU list.                 *
+ * - wrh5_numa_self makes a node the preferred one for the calling thread's    *
+ *   allocations (E.g. the HDF5 chunk cache of the manager's I/O thread).      *
+ * - wrh5_numa_bind binds a page-aligned buffer (a pool, an encoding area) to  *
+ *   the nodes of a list, moving the pages already faulted in.                 *
+ * Placement is best effort: a list naming no online CPU or node, a kernel     *
+ * without NUMA support or a machine with a single node only costs a warning   *
+ * (or nothing); the threads and buffers work unplaced.                        *
+ * The memory policy system calls are made directly: no libnuma dependency.    *
+ * Placement is Linux only: elsewhere wrh5_open_ext and wrh5_manager_create    *
+ * refuse the CPU and node lists, and these functions place nothing.           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#define _GNU_SOURCE
+#include "wrh5_defs.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#endif
+
+#define NODE_WORDS  ((WRH5_MAX_NODES + 63) / 64)
+
+
+/***
+	Parse a CPU or node list ("0-3,8,10-11") into a bit mask of nbits bits (p_mask may be NULL: syntax check only).
+	Returns 1 if the list is malformed or names a number >= nbits.
+***/
+int wrh5_parse_list(const char * list, uint64_t * p_mask, int nbits) {
+    const char * p = list;
+    char *  p_end;
+    long    first, last, ix;
+
+    if(p_mask != NULL)
+        memset(p_mask, 0, (nbits + 63) / 64 * sizeof(uint64_t));
+    while(*p != '\0') {
+        first = strtol(p, &p_end, 10);
+        if(p_end == p || first < 0)
+            return 1;
+        last = first;
+        p = p_end;
+        if(*p == '-') {
+            last = strtol(p + 1, &p_end, 10);
+            if(p_end == p + 1 || last < first)
+                return 1;
+            p = p_end;
+        }
+        if(last >= nbits)
+            return 1;
+        if(p_mask != NULL)
+            for(ix = first; ix <= last; ix++)
+                p_mask[ix / 64] |= 1ULL << (ix % 64);
+        if(*p == ',' && p[1] != '\0')
+            p += 1;
+        else if(*p != '\0')
+            return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Mask of the online NUMA nodes; returns their number (1 if the kernel shows no node).
+***/
+static int online_nodes(uint64_t * p_mask) {
+    FILE *  p_file = fopen("/sys/devices/system/node/online", "r");
+    char    line[256];
+    int     ix, count = 0;
+
+    memset(p_mask, 0, NODE_WORDS * sizeof(uint64_t));
+    if(p_file != NULL) {
+        if(fgets(line, sizeof(line), p_file) != NULL) {
+            line[strcspn(line, "\n")] = '\0';
+            if(wrh5_parse_list(line, p_mask, WRH5_MAX_NODES) != 0)
+                memset(p_mask, 0, NODE_WORDS * sizeof(uint64_t));
+        }
+        fclose(p_file);
+    }
+    for(ix = 0; ix < WRH5_MAX_NODES; ix++)
+        count += (p_mask[ix / 64] >> (ix % 64)) & 1;
+    if(count == 0) {
+        p_mask[0] = 1;
+        count = 1;
+    }
+    return count;
+}
+
+
+#ifdef __linux__
+/***
+	The online nodes of list in p_mask.  Returns 0 if there are some and the machine has more than one node.
+***/
+static int usable_nodes(const char * list, uint64_t * p_mask, const char * who, int debugging) {
+    uint64_t online[NODE_WORDS];
+    char    msgstr[256];
+    int     ix, any = 0;
+
+    if(wrh5_parse_list(list, p_mask, WRH5_MAX_NODES) != 0) {
+        sprintf(msgstr, "%s: malformed NUMA node list '%.100s'", who, list);
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(online_nodes(online) < 2) {
+        if(debugging)
+            wrh5_info("%s: single NUMA node; nothing to bind\n", who);
+        return 1;
+    }
+    for(ix = 0; ix < NODE_WORDS; ix++) {
+        p_mask[ix] &= online[ix];
+        any |= (p_mask[ix] != 0);
+    }
+    if(!any) {
+        sprintf(msgstr, "%s: NUMA node list '%.100s' names no online node; memory is not bound", who, list);
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Restrict the calling thread to the CPUs of list.  Returns 1 if it is pinned, 0 if not (empty list or failure).
+***/
+int wrh5_pin_self(const char * list, const char * who, int debugging) {
+    uint64_t  mask[(WRH5_MAX_CPUS + 63) / 64];
+    cpu_set_t cpus;
+    char      msgstr[256];
+    int       ix, rc;
+
+    if(list == NULL || list[0] == '\0')
+        return 0;
+    if(wrh5_parse_list(list, mask, WRH5_MAX_CPUS) != 0) {
+        sprintf(msgstr, "%s: malformed CPU list '%.100s'", who, list);
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+        return 0;
+    }
+    CPU_ZERO(&cpus);
+    for(ix = 0; ix < WRH5_MAX_CPUS && ix < CPU_SETSIZE; ix++)
+        if((mask[ix / 64] >> (ix % 64)) & 1)
+            CPU_SET(ix, &cpus);
+    rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if(rc != 0) {
+        sprintf(msgstr, "%s: CPU list '%.100s' cannot be used (%s); the thread is not pinned", who, list, strerror(rc));
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+        return 0;
+    }
+    if(debugging)
+        wrh5_info("%s: pinned to CPUs %s\n", who, list);
+    return 1;
+}
+
+
+/***
+	Prefer the first online node of list for the calling thread's allocations (preferred, not bound: no OOM if it is full).
+***/
+void wrh5_numa_self(const char * list, const char * who, int debugging) {
+    uint64_t mask[NODE_WORDS];
+    char    msgstr[256];
+    int     ix;
+
+    if(list == NULL || list[0] == '\0' || usable_nodes(list, mask, who, debugging) != 0)
+        return;
+    for(ix = 0; !((mask[ix / 64] >> (ix % 64)) & 1); ix++)
+        ;
+    memset(mask, 0, sizeof(mask));
+    mask[ix / 64] = 1ULL << (ix % 64);
+    if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, (unsigned long) WRH5_MAX_NODES + 1) != 0) {
+        sprintf(msgstr, "%s: set_mempolicy FAILED (%s)", who, strerror(errno));
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+    } else if(debugging)
+        wrh5_info("%s: allocations prefer NUMA node %d\n", who, ix);
+}
+
+
+/***
+	Bind nbytes at the page-aligned address p_addr to the nodes of list, moving the pages already faulted in.
+***/
+void wrh5_numa_bind(void * p_addr, size_t nbytes, const char * list, const char * who, int debugging) {
+    uint64_t mask[NODE_WORDS];
+    char    msgstr[256];
+
+    if(list == NULL || list[0] == '\0' || p_addr == NULL || nbytes == 0 || usable_nodes(list, mask, who, debugging) != 0)
+        return;
+    if(syscall(SYS_mbind, p_addr, nbytes, MPOL_BIND, mask, (unsigned long) WRH5_MAX_NODES + 1, MPOL_MF_MOVE) != 0) {
+        sprintf(msgstr, "%s: mbind of %ld bytes to NUMA nodes %.100s FAILED (%s)", who, (long) nbytes, list, strerror(errno));
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+    } else if(debugging)
+        wrh5_info("%s: %ld bytes bound to NUMA nodes %s\n", who, (long) nbytes, list);
+}
+#else   // Not Linux: no placement (the lists were refused by the callers)
+int wrh5_pin_self(const char * list, const char * who, int debugging) {
+    (void) list;
+    (void) who;
+    (void) debugging;
+    return 0;
+}
+
+void wrh5_numa_self(const char * list, const char * who, int debugging) {
+    (void) list;
+    (void) who;
+    (void) debugging;
+}
+
+void wrh5_numa_bind(void * p_addr, size_t nbytes, const char * list, const char * who, int debugging) {
+    (void) p_addr;
+    (void) nbytes;
+    (void) list;
+    (void) who;
+    (void) debugging;
+}
+#endif
+
+
+/***
+	NUMA node of a CPU (-1: unknown).
+***/
+static int cpu_node(int cpu) {
+    uint64_t online[NODE_WORDS];
+    uint64_t cpus[(WRH5_MAX_CPUS + 63) / 64];
+    FILE *  p_file;
+    char    path[128], line[1024];
+    int     node, found = -1;
+
+    if(cpu < 0 || cpu >= WRH5_MAX_CPUS)
+        return -1;
+    online_nodes(online);
+    for(node = 0; node < WRH5_MAX_NODES && found < 0; node++) {
+        if(!((online[node / 64] >> (node % 64)) & 1))
+            continue;
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+        p_file = fopen(path, "r");
+        if(p_file == NULL)
+            continue;
+        if(fgets(line, sizeof(line), p_file) != NULL) {
+            line[strcspn(line, "\n")] = '\0';
+            if(wrh5_parse_list(line, cpus, WRH5_MAX_CPUS) == 0 && ((cpus[cpu / 64] >> (cpu % 64)) & 1))
+                found = node;
+        }
+        fclose(p_file);
+    }
+    return found;
+}
+
+
+/***
+	Statistics of one of the library's threads: CPU time, and the CPU (and its node) it last ran on.
+***/
+void wrh5_thread_stats(pthread_t thread, long tid, const char * name, int pinned, wrh5_thread_stats_t * p_stats) {
+    clockid_t       clock_id;
+    struct timespec ts;
+    FILE *          p_file;
+    char            path[64], line[1024];
+    char *          p_field;
+    int             ix;
+
+    memset(p_stats, 0, sizeof(wrh5_thread_stats_t));
+    snprintf(p_stats->name, sizeof(p_stats->name), "%s", name);
+    p_stats->tid = tid;
+    p_stats->pinned = pinned;
+    p_stats->cpu = -1;
+    if(pthread_getcpuclockid(thread, &clock_id) == 0 && clock_gettime(clock_id, &ts) == 0)
+        p_stats->cpu_seconds = (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+
+    // Field 39 of /proc/self/task/<tid>/stat, counted after the parenthesized command name.
+    sprintf(path, "/proc/self/task/%ld/stat", tid);
+    p_file = fopen(path, "r");
+    if(p_file != NULL) {
+        if(fgets(line, sizeof(line), p_file) != NULL && (p_field = strrchr(line, ')')) != NULL) {
+            for(ix = 2; ix < 39 && p_field != NULL; ix++)
+                p_field = strchr(p_field + 1, ' ');
+            if(p_field != NULL)
+                p_stats->cpu = atoi(p_field + 1);
+        }
+        fclose(p_file);
+    }
+    p_stats->node = cpu_node(p_stats->cpu);
+}
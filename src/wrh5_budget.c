@@ -0,0 +1,193 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_budget.c                                                               *
+ * -------------                                                               *
+ * Process-wide memory budget shared by every buffer pool and writer context.  *
+ *                                                                             *
+ * Every pool mapping (wrh5_pool_create) and every context's chunk buffer and  *
+ * HDF5 chunk cache (wrh5_open_ext) are reserved here before they exist and    *
+ * released when they are destroyed.  With a budget set, a reservation that    *
+ * does not fit waits for others to be released (backpressure) instead of      *
+ * growing the process, and gives up after the budget's wait time.             *
+ * The chunk cache is the elastic part: each context is granted a fair share   *
+ * of what is free, between one chunk and what it asked for.                   *
+ * Without a budget (the default), reservations are only counted.              *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <errno.h>
+#include <time.h>
+
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  budget_released = PTHREAD_COND_INITIALIZER;
+static wrh5_budget_t   budget;      // Protected by budget_lock
+
+
+/***
+	Set the process-wide memory budget: nbytes = 0 means unlimited (the default).
+	A reservation that does not fit waits up to wait_seconds (< 0: for ever) before failing.
+***/
+int wrh5_budget_set(size_t nbytes, double wait_seconds, int debugging) {
+    char msgstr[256];
+
+    pthread_mutex_lock(&budget_lock);
+    budget.budget = nbytes;
+    budget.wait_seconds = wait_seconds;
+    if(nbytes > 0 && budget.reserved > nbytes) {
+        sprintf(msgstr, "wrh5_budget_set: %ld bytes are already reserved, more than the new budget of %ld bytes",
+                (long) budget.reserved, (long) nbytes);
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+    }
+    // A larger budget may let waiting reservations through.
+    pthread_cond_broadcast(&budget_released);
+    pthread_mutex_unlock(&budget_lock);
+    if(debugging)
+        wrh5_info("wrh5_budget_set: budget = %ld bytes, wait = %.3f seconds\n", (long) nbytes, wait_seconds);
+    return 0;
+}
+
+
+/***
+	Report the process-wide budget and its current use.
+***/
+void wrh5_budget_get(wrh5_budget_t * p_budget) {
+    pthread_mutex_lock(&budget_lock);
+    memcpy(p_budget, &budget, sizeof(wrh5_budget_t));
+    pthread_mutex_unlock(&budget_lock);
+}
+
+
+/***
+	Reserve nbytes plus an elastic amount in [extra_min, extra_max], returned in *p_extra (may be NULL if both are 0).
+	The elastic amount is a fair share of the free budget: free / (reservations + 1).
+	Waits for releases while even the minimum does not fit.
+***/
+int wrh5_budget_acquire(size_t nbytes, size_t extra_min, size_t extra_max, size_t * p_extra,
+                        const char * caller, int debugging) {
+    char            msgstr[256];
+    struct timespec deadline;
+    size_t          avail, extra;
+    int             rc = 0;
+
+    pthread_mutex_lock(&budget_lock);
+    if(budget.budget > 0 && nbytes + extra_min > budget.budget) {
+        budget.nrefused += 1;
+        pthread_mutex_unlock(&budget_lock);
+        sprintf(msgstr, "%s: %ld bytes can never fit in the memory budget of %ld bytes",
+                caller, (long) (nbytes + extra_min), (long) budget.budget);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(budget.wait_seconds > 0.0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t) budget.wait_seconds;
+        deadline.tv_nsec += (long) ((budget.wait_seconds - (double) (time_t) budget.wait_seconds) * 1e9);
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    // Backpressure: wait until the minimum fits.
+    while(budget.budget > 0 && budget.reserved + nbytes + extra_min > budget.budget) {
+        if(budget.wait_seconds == 0.0) {
+            rc = 1;
+            break;
+        }
+        if(debugging)
+            wrh5_info("%s: waiting for %ld bytes of the memory budget (%ld of %ld reserved)\n",
+                      caller, (long) (nbytes + extra_min), (long) budget.reserved, (long) budget.budget);
+        budget.nwaiting += 1;
+        if(budget.wait_seconds < 0.0)
+            pthread_cond_wait(&budget_released, &budget_lock);
+        else if(pthread_cond_timedwait(&budget_released, &budget_lock, &deadline) == ETIMEDOUT)
+            rc = (budget.reserved + nbytes + extra_min > budget.budget);
+        budget.nwaiting -= 1;
+        if(rc != 0)
+            break;
+    }
+    if(rc != 0) {
+        budget.nrefused += 1;
+        sprintf(msgstr, "%s: %ld bytes do not fit in the memory budget (%ld of %ld bytes reserved)",
+                caller, (long) (nbytes + extra_min), (long) budget.reserved, (long) budget.budget);
+        pthread_mutex_unlock(&budget_lock);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+
+    // Grant the elastic share.
+    extra = extra_max;
+    if(budget.budget > 0) {
+        avail = budget.budget - budget.reserved - nbytes;
+        if(extra > avail / (budget.nreservations + 1))
+            extra = avail / (budget.nreservations + 1);
+        if(extra < extra_min)
+            extra = extra_min;
+    }
+    budget.reserved += nbytes + extra;
+    if(budget.reserved > budget.peak)
+        budget.peak = budget.reserved;
+    budget.nreservations += 1;
+    pthread_mutex_unlock(&budget_lock);
+
+    if(p_extra != NULL)
+        *p_extra = extra;
+    if(debugging)
+        wrh5_info("%s: reserved %ld + %ld bytes of the memory budget\n", caller, (long) nbytes, (long) extra);
+    return 0;
+}
+
+
+/***
+	Release a reservation made by wrh5_budget_acquire (nbytes = its fixed and elastic parts together).
+***/
+void wrh5_budget_release(size_t nbytes) {
+    pthread_mutex_lock(&budget_lock);
+    budget.reserved = (nbytes < budget.reserved) ? budget.reserved - nbytes : 0;
+    if(budget.nreservations > 0)
+        budget.nreservations -= 1;
+    pthread_cond_broadcast(&budget_released);
+    pthread_mutex_unlock(&budget_lock);
+}
+
+
+/***
+	Report the memory held by one context (all zero once it is closed).
+***/
+int wrh5_memory_usage(wrh5_context_t * p_wrh5_ctx, wrh5_mem_usage_t * p_usage) {
+    size_t nelems, nchans;
+
+    if(p_wrh5_ctx->elem_size == 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_memory_usage: the context was never opened");
+        return 1;
+    }
+    memset(p_usage, 0, sizeof(wrh5_mem_usage_t));
+    if(p_wrh5_ctx->pool_owned)
+        p_usage->pool = p_wrh5_ctx->p_pool->map_size;
+    else if(p_wrh5_ctx->p_staging != NULL)
+        p_usage->pool = p_wrh5_ctx->p_pool->bufsize;    // The staging buffer held from a shared pool
+    if(p_wrh5_ctx->p_chunk != NULL)
+        p_usage->chunk_buffer = p_wrh5_ctx->chunk_bytes;
+    p_usage->chunk_cache = p_wrh5_ctx->chunk_cache_bytes;
+    if(p_wrh5_ctx->usable) {
+        wrh5_io_stats_t io_stats;
+        if(wrh5_io_stats(p_wrh5_ctx, &io_stats) == 0)
+            p_usage->io_queue = io_stats.queue_bytes;
+    }
+
+    // Small per-channel vectors and the valid bitmap are not budgeted.
+    nelems = p_wrh5_ctx->tint_size / p_wrh5_ctx->elem_size;
+    nchans = p_wrh5_ctx->filesz_dims[2];
+    if(p_wrh5_ctx->quant_offset != NULL)
+        p_usage->other += nelems * (3 * sizeof(float) + 2 * sizeof(double));
+    if(p_wrh5_ctx->quant_hold != NULL)
+        p_usage->other += p_wrh5_ctx->quant_nint * nelems * sizeof(float);     // Budgeted (wrh5_quant.c)
+    if(p_wrh5_ctx->sk_acc != NULL)
+        p_usage->other += nchans * (2 * sizeof(double) + sizeof(float) + sizeof(unsigned char));
+    p_usage->other += p_wrh5_ctx->valid_size;
+    if(p_wrh5_ctx->p_chan_index != NULL)
+        p_usage->other += nchans * sizeof(uint32_t) + p_wrh5_ctx->nchan_runs * 2 * sizeof(uint32_t);
+
+    p_usage->total = p_usage->pool + p_usage->chunk_buffer + p_usage->chunk_cache + p_usage->io_queue + p_usage->other;
+    return 0;
+}
@@ -0,0 +1,238 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_bypass.c                                                               *
+ * -------------                                                               *
+ * Write a block of whole time integrations, storing incompressible chunks raw *
+ * and leaving all-fill chunks unallocated.                                    *
+ *                                                                             *
+ * With the bypass_min_ratio user option, every chunk that the block covers    *
+ * completely is judged on its own:                                            *
+ * - A sample of up to SAMPLE_MAX elements gives the fraction of ones in each  *
+ *   bit plane.  Bitshuffle groups bit planes, so the sum of the plane         *
+ *   entropies estimates the compressed size, hence the compression ratio.     *
+ * - Below bypass_min_ratio, the chunk is gathered and stored as is with       *
+ *   H5Dwrite_chunk and filter mask 1: the Bitshuffle filter is skipped on     *
+ *   write, and the mask tells readers to skip it on read too.                 *
+ * - Else, the chunk is written through the filter pipeline with H5Dwrite.     *
+ * Partial chunks (time integrations before the first or after the last whole  *
+ * chunk row) are written through the filter pipeline.                         *
+ *                                                                             *
+ * When the filter is not available, every whole chunk is a direct raw write.  *
+ *                                                                             *
+ * With the elide_fill user option, a whole chunk whose bytes are all zero is  *
+ * not written at all: it stays unallocated and reads back as the fill value.  *
+ *                                                                             *
+ * HDF 5 library functions used:                                               *
+ * - H5Dwrite_chunk       - Store one chunk as given, with a filter mask       *
+ * - H5Dwrite             - Write one chunk region through the filters         *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <math.h>
+
+#define SAMPLE_MAX 4096
+
+
+/***
+	Estimate the Bitshuffle compression ratio of the chunk region [count] at [start] (block-relative)
+	of a [ntints][nifs][nchans] block of elements of esz bytes.
+***/
+static double estimate_ratio(const char * p_block, size_t esz, hsize_t * p_dims, hsize_t * p_start, hsize_t * p_count) {
+    unsigned long ones[64];
+    uint64_t      u;
+    size_t        total, step, k, nsamples = 0;
+    size_t        t, i, c, b, nbits = 8 * esz;
+    double        p, bits = 0.0;
+
+    memset(ones, 0, sizeof(ones));
+    total = p_count[0] * p_count[1] * p_count[2];
+    step = (total > SAMPLE_MAX) ? total / SAMPLE_MAX : 1;
+    for(k = 0; k < total; k += step) {
+        t = k / (p_count[1] * p_count[2]);
+        i = (k / p_count[2]) % p_count[1];
+        c = k % p_count[2];
+        u = 0;
+        memcpy(&u, p_block + (((p_start[0] + t) * p_dims[1] + p_start[1] + i) * p_dims[2] + p_start[2] + c) * esz, esz);
+        while(u != 0) {
+            ones[__builtin_ctzll(u)] += 1;
+            u &= u - 1;
+        }
+        nsamples++;
+    }
+    for(b = 0; b < nbits; b++) {
+        p = (double) ones[b] / nsamples;
+        if(p > 0.0 && p < 1.0)
+            bits += -p * log2(p) - (1.0 - p) * log2(1.0 - p);
+    }
+    if(bits < 0.01 * nbits)
+        bits = 0.01 * nbits;    // LZ4 does not get much below 1 byte per 100
+    return nbits / bits;
+}
+
+
+/***
+	Gather a chunk region into the zero-padded chunk buffer [cdims[0]][cdims[1]][cdims[2]].
+***/
+static void gather_chunk(wrh5_context_t * p_wrh5_ctx, const char * p_block, size_t esz,
+                         hsize_t * p_dims, hsize_t * p_start, hsize_t * p_count) {
+    hsize_t * cdims = p_wrh5_ctx->cdims;
+    size_t    t, i;
+
+    if(p_count[1] < cdims[1] || p_count[2] < cdims[2])
+        memset(p_wrh5_ctx->p_chunk, 0, p_wrh5_ctx->chunk_bytes);
+    for(t = 0; t < p_count[0]; t++)
+        for(i = 0; i < p_count[1]; i++)
+            memcpy(p_wrh5_ctx->p_chunk + ((t * cdims[1] + i) * cdims[2]) * esz,
+                   p_block + (((p_start[0] + t) * p_dims[1] + p_start[1] + i) * p_dims[2] + p_start[2]) * esz,
+                   p_count[2] * esz);
+}
+
+
+/***
+	Write the region [count] at block-relative [start] of the block, which begins at time integration tint_start.
+***/
+static int write_region(wrh5_context_t * p_wrh5_ctx, const void * p_block, hsize_t tint_start,
+                        hsize_t * p_dims, hsize_t * p_start, hsize_t * p_count) {
+    hsize_t file_start[NDIMS];
+    hid_t   memspace_id, filespace_id;
+    herr_t  status;
+    double  cpu_0;      // Thread CPU seconds before H5Dwrite
+
+    file_start[0] = tint_start + p_start[0];
+    file_start[1] = p_start[1];
+    file_start[2] = p_start[2];
+    memspace_id = H5Screate_simple(NDIMS, p_dims, NULL);
+    filespace_id = H5Dget_space(p_wrh5_ctx->dataset_id);
+    if(memspace_id < 0 || filespace_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_block: H5Screate_simple/H5Dget_space FAILED");
+        return 1;
+    }
+    status = H5Sselect_hyperslab(memspace_id, H5S_SELECT_SET, p_start, NULL, p_count, NULL);
+    if(status >= 0)
+        status = H5Sselect_hyperslab(filespace_id, H5S_SELECT_SET, file_start, NULL, p_count, NULL);
+    if(status >= 0) {
+        // The filter runs here, or when the chunk cache evicts the chunk (during a later write or at close).
+        cpu_0 = wrh5_thread_cpu_seconds();
+        status = H5Dwrite(p_wrh5_ctx->dataset_id, p_wrh5_ctx->elem_type, memspace_id, filespace_id, H5P_DEFAULT, p_block);
+        p_wrh5_ctx->filter_seconds += wrh5_thread_cpu_seconds() - cpu_0;
+        p_wrh5_ctx->filter_bytes += (double) (p_count[0] * p_count[1] * p_count[2] * p_wrh5_ctx->elem_size);
+    }
+    H5Sclose(memspace_id);
+    H5Sclose(filespace_id);
+    if(status < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_block: H5Dwrite of a chunk region FAILED");
+        return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Main entry point.
+	Write ntints time integrations, in on-disk order, starting at time integration tint_start.
+	The dataset must already have been extended.
+***/
+int wrh5_write_block(wrh5_context_t * p_wrh5_ctx, hsize_t tint_start, size_t ntints, const void * p_block, int debugging) {
+    hsize_t * cdims = p_wrh5_ctx->cdims;
+    hsize_t   dims[NDIMS];          // Block shape
+    hsize_t   start[NDIMS];         // Block-relative region offset
+    hsize_t   count[NDIMS];         // Region shape
+    hsize_t   offset[NDIMS];        // Chunk coordinates in the file
+    hsize_t   row_first, row_end;   // Whole chunk rows, block-relative: [row_first, row_end)
+    size_t    esz = H5Tget_size(p_wrh5_ctx->elem_type);
+    size_t    region_bytes;
+    size_t    t, i;
+    int       fill;
+    uint64_t  trace_t0;
+    herr_t    status;
+
+    dims[0] = ntints;
+    dims[1] = p_wrh5_ctx->filesz_dims[1];
+    dims[2] = p_wrh5_ctx->filesz_dims[2];
+    if(wrh5_valid_mark(p_wrh5_ctx, tint_start, ntints, p_block, 1) != 0)
+        return 1;
+    if(p_wrh5_ctx->bypass_min_ratio <= 0.0 && !p_wrh5_ctx->elide_fill) {
+        start[0] = tint_start;
+        start[1] = start[2] = 0;
+        return wrh5_write_hyperslab(p_wrh5_ctx, start, dims, p_block);
+    }
+
+    /*
+     * Time integrations outside whole chunk rows go through the filter pipeline.
+     */
+    row_first = (tint_start + cdims[0] - 1) / cdims[0] * cdims[0] - tint_start;
+    row_end = (tint_start + ntints) / cdims[0] * cdims[0];
+    row_end = (row_end > tint_start) ? row_end - tint_start : 0;
+    if(row_first >= row_end) {
+        row_first = row_end = ntints;
+    }
+    start[1] = start[2] = 0;
+    count[1] = dims[1];
+    count[2] = dims[2];
+    if(row_first > 0) {
+        start[0] = 0;
+        count[0] = row_first;
+        if(write_region(p_wrh5_ctx, p_block, tint_start, dims, start, count) != 0)
+            return 1;
+    }
+    if(row_end < ntints) {
+        start[0] = row_end;
+        count[0] = ntints - row_end;
+        if(write_region(p_wrh5_ctx, p_block, tint_start, dims, start, count) != 0)
+            return 1;
+    }
+
+    /*
+     * Judge and write each whole chunk.
+     */
+    count[0] = cdims[0];
+    for(start[0] = row_first; start[0] < row_end; start[0] += cdims[0])
+        for(start[1] = 0; start[1] < dims[1]; start[1] += cdims[1])
+            for(start[2] = 0; start[2] < dims[2]; start[2] += cdims[2]) {
+                count[1] = (start[1] + cdims[1] <= dims[1]) ? cdims[1] : dims[1] - start[1];
+                count[2] = (start[2] + cdims[2] <= dims[2]) ? cdims[2] : dims[2] - start[2];
+                region_bytes = count[0] * count[1] * count[2] * esz;
+                if(p_wrh5_ctx->elide_fill) {
+                    fill = 1;
+                    for(t = 0; t < count[0] && fill; t++)
+                        for(i = 0; i < count[1] && fill; i++)
+                            fill = wrh5_is_fill((const char *) p_block
+                                                + (((start[0] + t) * dims[1] + start[1] + i) * dims[2] + start[2]) * esz,
+                                                count[2] * esz);
+                    if(fill) {
+                        p_wrh5_ctx->elided_chunks += 1;
+                        continue;
+                    }
+                }
+                if(p_wrh5_ctx->bypass_min_ratio > 0.0 && (!p_wrh5_ctx->filtered
+                   || estimate_ratio(p_block, esz, dims, start, count) < p_wrh5_ctx->bypass_min_ratio)) {
+                    trace_t0 = WRH5_TRACE_BEGIN();
+                    gather_chunk(p_wrh5_ctx, p_block, esz, dims, start, count);
+                    offset[0] = tint_start + start[0];
+                    offset[1] = start[1];
+                    offset[2] = start[2];
+                    status = H5Dwrite_chunk(p_wrh5_ctx->dataset_id, H5P_DEFAULT,
+                                            p_wrh5_ctx->filtered ? 1 : 0,   // Skip filter 0 (Bitshuffle)
+                                            offset, p_wrh5_ctx->chunk_bytes, p_wrh5_ctx->p_chunk);
+                    if(status < 0) {
+                        wrh5_error(__FILE__, __LINE__, "wrh5_write_block: H5Dwrite_chunk FAILED");
+                        p_wrh5_ctx->usable = 0;
+                        return 1;
+                    }
+                    WRH5_TRACE_END(trace_t0, "H5Dwrite_chunk", p_wrh5_ctx->chunk_bytes);
+                    p_wrh5_ctx->bypass_chunks += 1;
+                    p_wrh5_ctx->bypass_bytes += region_bytes;
+                } else {
+                    if(write_region(p_wrh5_ctx, p_block, tint_start, dims, start, count) != 0) {
+                        p_wrh5_ctx->usable = 0;
+                        return 1;
+                    }
+                    p_wrh5_ctx->compress_chunks += 1;
+                    p_wrh5_ctx->compress_bytes += region_bytes;
+                }
+            }
+    if(debugging)
+        wrh5_info("wrh5_write_block: %ld time integrations at %lld, so far %ld chunks stored raw, %ld compressed, %ld elided\n",
+                  (long) ntints, tint_start, p_wrh5_ctx->bypass_chunks, p_wrh5_ctx->compress_chunks, p_wrh5_ctx->elided_chunks);
+    return 0;
+}
@@ -0,0 +1,174 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_cc_index.c                                                             *
+ * ---------------                                                             *
+ * Write the coarse channel index dataset "cc_index".                          *
+ *                                                                             *
+ * Each row maps one stored chunk of dataset "data" to its coarse channel,     *
+ * chunk coordinates, file address, and stored (compressed) byte size.         *
+ * A reader can then extract exactly one coarse channel with H5Dread_chunk     *
+ * (or a plain pread) without touching the neighbouring coarse channels.       *
+ *                                                                             *
+ * HDF 5 library functions used:                                               *
+ * - H5Dget_num_chunks    - Count the allocated chunks of "data"               *
+ * - H5Dget_chunk_info    - Get the coordinates/address/size of each chunk     *
+ * - H5Dcreate            - Create "cc_index" (compound datatype)              *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+
+#define CC_INDEX_NAME "cc_index"
+
+
+/***
+	qsort comparison: coarse channel, then time, then IF.
+***/
+static int cmp_cc_index(const void * p1, const void * p2) {
+    const wrh5_cc_index_t * r1 = (const wrh5_cc_index_t *) p1;
+    const wrh5_cc_index_t * r2 = (const wrh5_cc_index_t *) p2;
+
+    if(r1->coarse_chan != r2->coarse_chan)
+        return (r1->coarse_chan < r2->coarse_chan) ? -1 : 1;
+    if(r1->time_offset != r2->time_offset)
+        return (r1->time_offset < r2->time_offset) ? -1 : 1;
+    if(r1->ifs_offset != r2->ifs_offset)
+        return (r1->ifs_offset < r2->ifs_offset) ? -1 : 1;
+    return 0;
+}
+
+
+/***
+	Create the HDF5 compound datatype that matches wrh5_cc_index_t.
+***/
+static hid_t make_cc_index_type(void) {
+    hid_t dtype;
+
+    dtype = H5Tcreate(H5T_COMPOUND, sizeof(wrh5_cc_index_t));
+    if(dtype < 0)
+        return dtype;
+    H5Tinsert(dtype, "coarse_chan", HOFFSET(wrh5_cc_index_t, coarse_chan), H5T_NATIVE_UINT32);
+    H5Tinsert(dtype, "filter_mask", HOFFSET(wrh5_cc_index_t, filter_mask), H5T_NATIVE_UINT32);
+    H5Tinsert(dtype, "time_offset", HOFFSET(wrh5_cc_index_t, time_offset), H5T_NATIVE_UINT64);
+    H5Tinsert(dtype, "ifs_offset", HOFFSET(wrh5_cc_index_t, ifs_offset), H5T_NATIVE_UINT64);
+    H5Tinsert(dtype, "chan_offset", HOFFSET(wrh5_cc_index_t, chan_offset), H5T_NATIVE_UINT64);
+    H5Tinsert(dtype, "file_addr", HOFFSET(wrh5_cc_index_t, file_addr), H5T_NATIVE_UINT64);
+    H5Tinsert(dtype, "nbytes", HOFFSET(wrh5_cc_index_t, nbytes), H5T_NATIVE_UINT64);
+    return dtype;
+}
+
+
+/***
+	Main entry point - called by wrh5_close while "data" is still open.
+***/
+int wrh5_write_cc_index(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    herr_t          status;         // Status from HDF5 function call
+    hsize_t         nchunks;        // Number of allocated chunks in "data"
+    hsize_t         ix;             // Chunk index
+    hsize_t         offset[NDIMS];  // Chunk coordinates
+    hsize_t         index_dims[1];  // "cc_index" shape
+    unsigned        filter_mask;    // Chunk filter mask
+    haddr_t         addr;           // Chunk file address
+    hsize_t         size;           // Chunk stored size
+    hid_t           filespace_id;   // Dataspace of "data"
+    hid_t           dtype_id, space_id, index_id;
+    wrh5_cc_index_t * p_rows;       // Index rows
+    int             rc = 0;         // Return code
+    int             nfpc;           // Fine channels per coarse channel
+    char            msgstr[256];    // sprintf target
+
+    /*
+     * Make sure every cached chunk has been stored so that addresses and sizes are final.
+     */
+    status = H5Dflush(p_wrh5_ctx->dataset_id);
+    if(status < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_cc_index: H5Dflush FAILED");
+        return 1;
+    }
+    filespace_id = H5Dget_space(p_wrh5_ctx->dataset_id);
+    if(filespace_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_cc_index: H5Dget_space FAILED");
+        return 1;
+    }
+    status = H5Dget_num_chunks(p_wrh5_ctx->dataset_id, filespace_id, &nchunks);
+    if(status < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_cc_index: H5Dget_num_chunks FAILED");
+        H5Sclose(filespace_id);
+        return 1;
+    }
+    if(debugging)
+        wrh5_info("wrh5_write_cc_index: %lld chunks to index\n", nchunks);
+
+    /*
+     * Collect one row per allocated chunk.
+     */
+    p_rows = malloc((nchunks > 0 ? nchunks : 1) * sizeof(wrh5_cc_index_t));
+    if(p_rows == NULL) {
+        sprintf(msgstr, "wrh5_write_cc_index: malloc of %lld rows FAILED", nchunks);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        H5Sclose(filespace_id);
+        return 1;
+    }
+    nfpc = p_wrh5_ctx->nfpc;
+    for(ix = 0; ix < nchunks; ix++) {
+        status = H5Dget_chunk_info(p_wrh5_ctx->dataset_id, filespace_id, ix, offset, &filter_mask, &addr, &size);
+        if(status < 0) {
+            sprintf(msgstr, "wrh5_write_cc_index: H5Dget_chunk_info(%lld) FAILED", ix);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            H5Sclose(filespace_id);
+            free(p_rows);
+            return 1;
+        }
+        p_rows[ix].coarse_chan = (uint32_t) (offset[2] / nfpc);
+        p_rows[ix].filter_mask = (uint32_t) filter_mask;
+        p_rows[ix].time_offset = offset[0];
+        p_rows[ix].ifs_offset = offset[1];
+        p_rows[ix].chan_offset = offset[2];
+        p_rows[ix].file_addr = (uint64_t) addr;
+        p_rows[ix].nbytes = (uint64_t) size;
+    }
+    H5Sclose(filespace_id);
+    qsort(p_rows, nchunks, sizeof(wrh5_cc_index_t), cmp_cc_index);
+
+    /*
+     * Create and write "cc_index".
+     */
+    dtype_id = make_cc_index_type();
+    if(dtype_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_cc_index: H5Tcreate FAILED");
+        free(p_rows);
+        return 1;
+    }
+    index_dims[0] = nchunks;
+    space_id = H5Screate_simple(1, index_dims, NULL);
+    if(space_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_cc_index: H5Screate_simple FAILED");
+        H5Tclose(dtype_id);
+        free(p_rows);
+        return 1;
+    }
+    index_id = H5Dcreate(p_wrh5_ctx->file_id, CC_INDEX_NAME, dtype_id, space_id,
+                         H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if(index_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_cc_index: H5Dcreate FAILED");
+        rc = 1;
+    } else {
+        if(nchunks > 0) {
+            status = H5Dwrite(index_id, dtype_id, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_rows);
+            if(status < 0) {
+                wrh5_error(__FILE__, __LINE__, "wrh5_write_cc_index: H5Dwrite FAILED");
+                rc = 1;
+            }
+        }
+        wrh5_set_dataset_int_attr(index_id, "nfpc", &nfpc, debugging);
+        if(H5Dclose(index_id) < 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_write_cc_index: H5Dclose FAILED; ignored");
+    }
+
+    /*
+     * Bye-bye.
+     */
+    H5Sclose(space_id);
+    H5Tclose(dtype_id);
+    free(p_rows);
+    return rc;
+}
@@ -0,0 +1,234 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_chans.c                                                                *
+ * ------------                                                                *
+ * Channel selection (keep_chans and guard_chans options): store only some of  *
+ * the fine channels presented to wrh5_write, without a trimmed copy.          *
+ *                                                                             *
+ * wrh5_chans_init lists, at open, the presented channels to keep:             *
+ * - keep_chans names them, E.g. "1024-64511" (all of them if empty);          *
+ * - guard_chans drops that many channels at both edges of every coarse        *
+ *   channel (nfpc), E.g. the DC and roll-off channels of a filterbank.        *
+ * A channel is kept if it passes both.  The stored header describes the kept  *
+ * channels: nchans is their number and fch1 the frequency of the first one;   *
+ * nfpc is kept (reduced) only if every coarse channel left keeps the same     *
+ * fine channels, else it is 0.  The uint32 dataset "chan_index" holds the     *
+ * presented channel number of every stored channel.                           *
+ *                                                                             *
+ * The kept channels form runs of consecutive channels (E.g. one per coarse    *
+ * channel with guard_chans).  wrh5_chans_gather copies every run of every IF  *
+ * row with one memmove, which the C library runs with vector loads and        *
+ * stores: the data crosses memory once, at copy speed.                        *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+
+#define CHAN_INDEX_NAME "chan_index"
+#define BIT(mask, ix)   (((mask)[(ix) / 64] >> ((ix) % 64)) & 1)
+
+
+/***
+	nfpc of the kept channels: the number kept per coarse channel if every coarse channel
+	that keeps any keeps the same fine channels, else 0.
+***/
+static int kept_nfpc(const uint64_t * p_mask, int nchans, int nfpc) {
+    int     cc, ref = -1, off, count = 0, any;
+
+    if(nfpc < 1)
+        return 0;
+    for(cc = 0; cc < nchans / nfpc; cc++) {
+        any = 0;
+        for(off = 0; off < nfpc && !any; off++)
+            any = BIT(p_mask, cc * nfpc + off);
+        if(!any)
+            continue;
+        if(ref < 0) {
+            ref = cc;
+            for(off = 0; off < nfpc; off++)
+                count += BIT(p_mask, cc * nfpc + off);
+            continue;
+        }
+        for(off = 0; off < nfpc; off++)
+            if(BIT(p_mask, cc * nfpc + off) != BIT(p_mask, ref * nfpc + off))
+                return 0;
+    }
+    return count;
+}
+
+
+/***
+	Build the channel selection of a context from the keep_chans and guard_chans options.
+	p_file_hdr receives the header of the stored channels (a copy of p_wrh5_hdr if nothing is selected).
+***/
+int wrh5_chans_init(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, user_options_t * p_options,
+                    wrh5_hdr_t * p_file_hdr, int debugging) {
+    int         nchans = p_wrh5_hdr->nchans;
+    int         nfpc = p_wrh5_hdr->nfpc;
+    int         guard = p_options->guard_chans;
+    uint64_t *  p_mask;
+    size_t      nwords = ((size_t) nchans + 63) / 64;
+    size_t      nkeep = 0, nruns = 0, ix;
+    int         chan;
+    char        msgstr[256];
+
+    memcpy(p_file_hdr, p_wrh5_hdr, sizeof(wrh5_hdr_t));
+    p_wrh5_ctx->in_nchans = nchans;
+    p_options->keep_chans[sizeof(p_options->keep_chans) - 1] = '\0';
+    if(p_options->keep_chans[0] == '\0' && guard == 0)
+        return 0;
+
+    /*
+     * Validate the options.
+     */
+    if(guard < 0 || (guard > 0 && (nfpc < 1 || 2 * guard >= nfpc))) {
+        sprintf(msgstr, "wrh5_open: guard_chans must be in [0, nfpc / 2) with nfpc > 0 but I saw %d with nfpc = %d", guard, nfpc);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(p_options->detect != WRH5_DETECT_NONE || p_options->resume) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: keep_chans and guard_chans exclude detect and resume");
+        return 1;
+    }
+    p_mask = malloc(nwords * sizeof(uint64_t));
+    if(p_mask == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: malloc of the channel mask FAILED");
+        return 1;
+    }
+    if(p_options->keep_chans[0] == '\0')
+        memset(p_mask, 0xff, nwords * sizeof(uint64_t));
+    else if(wrh5_parse_list(p_options->keep_chans, p_mask, nchans) != 0) {
+        sprintf(msgstr, "wrh5_open: keep_chans must be a channel list like \"16-1007\" within [0, %d) but I saw '%.100s'",
+                nchans, p_options->keep_chans);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        free(p_mask);
+        return 1;
+    }
+
+    /*
+     * Drop the guard channels; count the kept channels and their runs.
+     */
+    for(chan = 0; chan < nchans; chan++) {
+        if(guard > 0 && (chan % nfpc < guard || chan % nfpc >= nfpc - guard))
+            p_mask[chan / 64] &= ~(1ULL << (chan % 64));
+        if(BIT(p_mask, chan)) {
+            nkeep += 1;
+            nruns += (chan == 0 || !BIT(p_mask, chan - 1));
+        }
+    }
+    if(nkeep == 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: keep_chans and guard_chans leave no channel");
+        free(p_mask);
+        return 1;
+    }
+    if(nkeep == (size_t) nchans) {
+        free(p_mask);
+        return 0;
+    }
+
+    /*
+     * Index of the kept channels and their runs (first presented channel, count).
+     */
+    p_wrh5_ctx->p_chan_index = malloc(nkeep * sizeof(uint32_t));
+    p_wrh5_ctx->p_chan_runs = malloc(2 * nruns * sizeof(uint32_t));
+    if(p_wrh5_ctx->p_chan_index == NULL || p_wrh5_ctx->p_chan_runs == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: malloc of the channel index FAILED");
+        free(p_mask);
+        wrh5_chans_close(p_wrh5_ctx);
+        return 1;
+    }
+    nkeep = nruns = 0;
+    for(chan = 0; chan < nchans; chan++) {
+        if(!BIT(p_mask, chan))
+            continue;
+        if(chan == 0 || !BIT(p_mask, chan - 1)) {
+            p_wrh5_ctx->p_chan_runs[2 * nruns] = (uint32_t) chan;
+            p_wrh5_ctx->p_chan_runs[2 * nruns + 1] = 0;
+            nruns += 1;
+        }
+        p_wrh5_ctx->p_chan_runs[2 * nruns - 1] += 1;
+        p_wrh5_ctx->p_chan_index[nkeep++] = (uint32_t) chan;
+    }
+    p_wrh5_ctx->nchan_runs = nruns;
+
+    /*
+     * Header of the stored channels.
+     */
+    p_file_hdr->nchans = (int) nkeep;
+    p_file_hdr->fch1 = p_wrh5_hdr->fch1 + p_wrh5_hdr->foff * p_wrh5_ctx->p_chan_index[0];
+    p_file_hdr->nfpc = kept_nfpc(p_mask, nchans, nfpc);
+    free(p_mask);
+    if(debugging) {
+        wrh5_info("wrh5_open: %ld of %d channels kept in %ld runs, fch1 = %.9f, nfpc = %d\n",
+                  (long) nkeep, nchans, (long) nruns, p_file_hdr->fch1, p_file_hdr->nfpc);
+        for(ix = 0; ix < nruns && ix < 8; ix++)
+            wrh5_info("wrh5_open: channels %u-%u\n", p_wrh5_ctx->p_chan_runs[2 * ix],
+                      p_wrh5_ctx->p_chan_runs[2 * ix] + p_wrh5_ctx->p_chan_runs[2 * ix + 1] - 1);
+    }
+    return 0;
+}
+
+
+/***
+	Write dataset "chan_index": the presented channel number of every stored channel.
+***/
+int wrh5_chans_write_index(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    hsize_t dims[1];
+    hid_t   space_id, index_id;
+    herr_t  status;
+
+    dims[0] = p_wrh5_ctx->filesz_dims[2];
+    space_id = H5Screate_simple(1, dims, NULL);
+    if(space_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_chans_write_index: H5Screate_simple FAILED");
+        return 1;
+    }
+    index_id = H5Dcreate(p_wrh5_ctx->file_id, CHAN_INDEX_NAME, H5T_STD_U32LE, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if(index_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_chans_write_index: H5Dcreate FAILED");
+        H5Sclose(space_id);
+        return 1;
+    }
+    status = H5Dwrite(index_id, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_wrh5_ctx->p_chan_index);
+    if(status < 0)
+        wrh5_error(__FILE__, __LINE__, "wrh5_chans_write_index: H5Dwrite FAILED");
+    wrh5_set_dataset_int_attr(index_id, "nchans", &p_wrh5_ctx->in_nchans, debugging);
+    H5Dclose(index_id);
+    H5Sclose(space_id);
+    return (status < 0) ? 1 : 0;
+}
+
+
+/***
+	Gather the kept channels of nrows rows of in_nchans elements into rows of the stored channels.
+	p_dst may equal p_src (a stored row never starts after its presented row).
+***/
+void wrh5_chans_gather(wrh5_context_t * p_wrh5_ctx, const void * p_src, void * p_dst, size_t nrows) {
+    const uint32_t * p_runs = p_wrh5_ctx->p_chan_runs;
+    size_t      esz = p_wrh5_ctx->elem_size;
+    size_t      in_row = (size_t) p_wrh5_ctx->in_nchans * esz;
+    size_t      out_row = p_wrh5_ctx->filesz_dims[2] * esz;
+    const char * src;
+    char *      dst;
+    size_t      row, ix;
+
+    for(row = 0; row < nrows; row++) {
+        src = (const char *) p_src + row * in_row;
+        dst = (char *) p_dst + row * out_row;
+        for(ix = 0; ix < p_wrh5_ctx->nchan_runs; ix++) {
+            memmove(dst, src + p_runs[2 * ix] * esz, p_runs[2 * ix + 1] * esz);
+            dst += p_runs[2 * ix + 1] * esz;
+        }
+    }
+}
+
+
+/***
+	Free the channel selection (wrh5_close).
+***/
+void wrh5_chans_close(wrh5_context_t * p_wrh5_ctx) {
+    free(p_wrh5_ctx->p_chan_index);
+    free(p_wrh5_ctx->p_chan_runs);
+    p_wrh5_ctx->p_chan_index = NULL;
+    p_wrh5_ctx->p_chan_runs = NULL;
+    p_wrh5_ctx->nchan_runs = 0;
+}
@@ -0,0 +1,172 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_client.c                                                               *
+ * -------------                                                               *
+ * libwrh5c: the producer side of a shared-memory stream (see wrh5_shm.h).     *
+ * No HDF5 here: acquisition processes link this library only.                 *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "wrh5_shm.h"
+
+
+/***
+	Report an error (same format as wrh5_error, without a timestamp).
+***/
+static void client_error(int linenum, const char * msg) {
+    fprintf(stderr, "WRH5C-ERROR %s line %d :: %s\n", __FILE__, linenum, msg);
+}
+
+
+/***
+	Byte size of a segment with nslots slots of slot_bytes bytes.
+***/
+size_t wrh5c_segment_size(size_t slot_bytes, int nslots) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t data_offset = (sizeof(wrh5_shm_stream_t) + nslots * sizeof(uint64_t) + page - 1) / page * page;
+
+    return data_offset + (size_t) nslots * slot_bytes;
+}
+
+
+/***
+	Create and publish a stream: the daemon opens output_path with the header and chunking (NULL: blimpy).
+	Each slot holds up to slot_bytes bytes (a whole number of time integrations per commit).
+***/
+int wrh5c_open(wrh5c_stream_t * p_stream, const char * name, const char * output_path,
+               const wrh5_hdr_t * p_wrh5_hdr, const user_chunking_t * p_user_chunking,
+               size_t slot_bytes, int nslots) {
+    wrh5_shm_stream_t * p_shm;
+    char    msgstr[512];
+    size_t  page = (size_t) sysconf(_SC_PAGESIZE);
+    int     fd;
+
+    memset(p_stream, 0, sizeof(wrh5c_stream_t));
+    if(nslots < 2 || slot_bytes < 1 || strlen(output_path) >= WRH5_SHM_PATHLEN
+       || strlen(name) + strlen(WRH5_SHM_PREFIX) + 2 > sizeof(p_stream->name) || strchr(name, '/') != NULL) {
+        client_error(__LINE__, "wrh5c_open: need nslots >= 2, slot_bytes > 0, a name without '/', and shorter names");
+        return 1;
+    }
+    slot_bytes = (slot_bytes + 63) / 64 * 64;      // Keep every slot cache line aligned
+    sprintf(p_stream->name, "/%s%s", WRH5_SHM_PREFIX, name);
+    p_stream->map_size = wrh5c_segment_size(slot_bytes, nslots);
+
+    // Exclusive creation: a name is one stream at a time.
+    fd = shm_open(p_stream->name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if(fd < 0) {
+        sprintf(msgstr, "wrh5c_open: shm_open of '%s' FAILED (%s)", p_stream->name, strerror(errno));
+        client_error(__LINE__, msgstr);
+        return 1;
+    }
+    if(ftruncate(fd, (off_t) p_stream->map_size) != 0) {
+        sprintf(msgstr, "wrh5c_open: ftruncate of '%s' to %ld bytes FAILED (%s)",
+                p_stream->name, (long) p_stream->map_size, strerror(errno));
+        client_error(__LINE__, msgstr);
+        close(fd);
+        shm_unlink(p_stream->name);
+        return 1;
+    }
+    p_shm = mmap(NULL, p_stream->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if(p_shm == MAP_FAILED) {
+        sprintf(msgstr, "wrh5c_open: mmap of '%s' FAILED (%s)", p_stream->name, strerror(errno));
+        client_error(__LINE__, msgstr);
+        shm_unlink(p_stream->name);
+        return 1;
+    }
+
+    // Describe the stream, then publish it.
+    p_shm->magic = WRH5_SHM_MAGIC;
+    p_shm->version = WRH5_SHM_VERSION;
+    p_shm->pid = (int32_t) getpid();
+    p_shm->nslots = (uint64_t) nslots;
+    p_shm->slot_bytes = slot_bytes;
+    p_shm->data_offset = (sizeof(wrh5_shm_stream_t) + nslots * sizeof(uint64_t) + page - 1) / page * page;
+    memcpy(&p_shm->hdr, p_wrh5_hdr, sizeof(wrh5_hdr_t));
+    if(p_user_chunking != NULL)
+        memcpy(&p_shm->chunking, p_user_chunking, sizeof(user_chunking_t));
+    strcpy(p_shm->output_path, output_path);
+    __atomic_store_n(&p_shm->state, WRH5_SHM_OPEN, __ATOMIC_RELEASE);
+    p_stream->p_shm = p_shm;
+    return 0;
+}
+
+
+/***
+	Claim the next slot: returns its address, to be filled in place and committed, or NULL if the ring is full.
+	Never blocks.  Claiming again before committing returns the same slot.
+***/
+void * wrh5c_claim(wrh5c_stream_t * p_stream) {
+    wrh5_shm_stream_t * p_shm = p_stream->p_shm;
+
+    if(p_stream->head - p_stream->tail >= p_shm->nslots) {
+        p_stream->tail = __atomic_load_n(&p_shm->tail, __ATOMIC_ACQUIRE);
+        if(p_stream->head - p_stream->tail >= p_shm->nslots) {
+            p_shm->stats.full_claims += 1;
+            return NULL;
+        }
+    }
+    return (char *) p_shm + p_shm->data_offset + (p_stream->head % p_shm->nslots) * p_shm->slot_bytes;
+}
+
+
+/***
+	Commit the claimed slot with nbytes of data: the daemon may write it from now on.
+***/
+int wrh5c_commit(wrh5c_stream_t * p_stream, size_t nbytes) {
+    wrh5_shm_stream_t * p_shm = p_stream->p_shm;
+
+    if(nbytes < 1 || nbytes > p_shm->slot_bytes || p_stream->head - p_stream->tail >= p_shm->nslots) {
+        client_error(__LINE__, "wrh5c_commit: no slot is claimed, or nbytes does not fit the slot");
+        return 1;
+    }
+    p_shm->slot_len[p_stream->head % p_shm->nslots] = nbytes;
+    p_stream->head += 1;
+    __atomic_store_n(&p_shm->head, p_stream->head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+/***
+	End the stream.  If wait_seconds > 0, wait up to that long for the daemon to close the file,
+	then copy the final statistics to p_stats (if not NULL).  Returns 1 if the daemon failed or did not finish.
+***/
+int wrh5c_close(wrh5c_stream_t * p_stream, double wait_seconds, wrh5_shm_stats_t * p_stats) {
+    wrh5_shm_stream_t * p_shm = p_stream->p_shm;
+    struct timespec delay = {0, 1000000};     // 1 ms
+    double waited = 0.0;
+    int32_t state;
+    int rc = 0;
+
+    if(p_shm == NULL)
+        return 0;
+    // Only an open stream moves to closing: a daemon that already failed keeps its state.
+    state = WRH5_SHM_OPEN;
+    if(__atomic_compare_exchange_n(&p_shm->state, &state, WRH5_SHM_CLOSING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        state = WRH5_SHM_CLOSING;
+        while(wait_seconds > 0.0 && state < WRH5_SHM_DONE && waited < wait_seconds) {
+            nanosleep(&delay, NULL);
+            waited += 0.001;
+            state = __atomic_load_n(&p_shm->state, __ATOMIC_ACQUIRE);
+        }
+    }
+    if(state == WRH5_SHM_FAILED) {
+        client_error(__LINE__, "wrh5c_close: the daemon FAILED to write the stream");
+        rc = 1;
+    } else if(wait_seconds > 0.0 && state != WRH5_SHM_DONE) {
+        client_error(__LINE__, "wrh5c_close: the daemon did not finish in time");
+        rc = 1;
+    }
+    if(p_stats != NULL)
+        memcpy(p_stats, &p_shm->stats, sizeof(wrh5_shm_stats_t));
+    munmap(p_shm, p_stream->map_size);
+    p_stream->p_shm = NULL;
+    return rc;
+}
@@ -11,21 +11,55 @@
 
 
 /***
-	Main entry point.
+	Finalize the file (wrh5_close).
 ***/
-int wrh5_close(wrh5_context_t * p_wrh5_ctx, 
-               int debugging) {
+static int close_file(wrh5_context_t * p_wrh5_ctx, 
+                      int debugging) {
     herr_t      status;         // Status from HDF5 function call
     hsize_t     sz_store;       // Storage size
     double      MiBstore;       // sz_store converted to MiB
     double      MiBlogical;     // sz_store converted to MiB
+    int         rc = 0;         // 1: the data may not all be on disk
+    uint64_t    trace_t0;       // Trace start (see wrh5_trace.c)
+    double      cpu_0;          // Thread CPU seconds before the chunk cache flush
     
     // Even if this function fails, mark the fbh5 context unusable.
     p_wrh5_ctx->usable = 0;
 
+    // Write the time integrations still held by the detection stage.
+    if(p_wrh5_ctx->detect != WRH5_DETECT_NONE) {
+        if(p_wrh5_ctx->acc_count > 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_close: partially integrated spectra discarded");
+        if(wrh5_detect_flush(p_wrh5_ctx, debugging) != 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_close: wrh5_detect_flush FAILED; last time integrations lost");
+    }
+
+    // Write the time integrations held back for an incomplete bandpass estimate (see wrh5_quant.c).
+    if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE && wrh5_quant_flush(p_wrh5_ctx, debugging) != 0) {
+        wrh5_warning(__FILE__, __LINE__, "wrh5_close: wrh5_quant_flush FAILED; last time integrations lost");
+        rc = 1;
+    }
+
+    // Contiguous layout: sync and unmap the raw data (time integrations never written become missing).
+    if(p_wrh5_ctx->p_map != NULL)
+        rc = wrh5_mmap_close(p_wrh5_ctx, debugging);
+
+    // Leave the live metrics: the last write calls are over.
+    wrh5_metrics_close(p_wrh5_ctx);
+
+    // Compress what the chunk cache still holds, timed for the compression bypass report.
+    if(p_wrh5_ctx->bypass_min_ratio > 0.0 && p_wrh5_ctx->filtered) {
+        cpu_0 = wrh5_thread_cpu_seconds();
+        if(H5Dflush(p_wrh5_ctx->dataset_id) < 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_close: H5Dflush of dataset 'data' FAILED");
+        p_wrh5_ctx->filter_seconds += wrh5_thread_cpu_seconds() - cpu_0;
+    }
+
     // Compute some stats while the dataset is still open.
     sz_store = H5Dget_storage_size(p_wrh5_ctx->dataset_id);
     MiBlogical = (double) p_wrh5_ctx->tint_size * (double) p_wrh5_ctx->offset_dims[0] / MILLION;
+    if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE)
+        MiBlogical /= p_wrh5_ctx->elem_size;
     
     /*
      * Attach "dimension scale" labels.
@@ -35,35 +69,83 @@ int wrh5_close(wrh5_context_t * p_wrh5_ctx,
     wrh5_set_ds_label(p_wrh5_ctx, "frequency", 2, debugging);
 
     /*
-     * Close dataspace.
+     * Write the valid bitmap if any time integration is missing or could have been.
+     */
+    if(p_wrh5_ctx->missing_tints > 0 || p_wrh5_ctx->elide_fill)
+        if(wrh5_write_valid(p_wrh5_ctx, debugging) != 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_close: wrh5_write_valid FAILED; no valid bitmap");
+
+    /*
+     * Write the coarse channel index if chunking is coarse channel aligned.
+     */
+    if(p_wrh5_ctx->cc_aligned)
+        if(wrh5_write_cc_index(p_wrh5_ctx, debugging) != 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_close: wrh5_write_cc_index FAILED; no coarse channel index");
+
+    /*
+     * Judge the last spectral kurtosis block and close the mask datasets.
+     */
+    if(p_wrh5_ctx->sk_m > 0)
+        wrh5_sk_close(p_wrh5_ctx, debugging);
+
+    /*
+     * Close the quantization bandpass datasets.
+     */
+    if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE)
+        wrh5_quant_close(p_wrh5_ctx);
+
+    /*
+     * Close dataspace, dataset and file.
+     * On a failure, carry on: the buffers and the memory budget below are released all the same.
      */
     status = H5Sclose(p_wrh5_ctx->dataspace_id);
     if(status != 0) {
         wrh5_error(__FILE__, __LINE__, "wrh5_close H5Sclose dataspace FAILED\n");
         wrh5_show_context("wrh5_close", p_wrh5_ctx);
-        return 1;
+        rc = 1;
     }
-        
-    /*
-     * Close dataset.
-     */
     status = H5Dclose(p_wrh5_ctx->dataset_id);
     if(status != 0) {
         wrh5_error(__FILE__, __LINE__, "wrh5_close H5Dclose dataset 'data' FAILED\n");
         wrh5_show_context("wrh5_close", p_wrh5_ctx);
-         return 1;
+        rc = 1;
     }
-        
-    /*
-     * Close file.
-     */
+    trace_t0 = WRH5_TRACE_BEGIN();
     status = H5Fclose(p_wrh5_ctx->file_id);
+    WRH5_TRACE_END(trace_t0, "H5Fclose", p_wrh5_ctx->offset_dims[0]);
     if(status != 0) {
         wrh5_error(__FILE__, __LINE__, "wrh5_close H5Fclose FAILED\n");
         wrh5_show_context("wrh5_close", p_wrh5_ctx);
-        return 1;
+        rc = 1;
     }
 
+    /*
+     * Return the staging buffer and release the context's own buffer pool.
+     */
+    if(p_wrh5_ctx->p_staging != NULL) {
+        wrh5_pool_put(p_wrh5_ctx->p_pool, p_wrh5_ctx->p_staging);
+        p_wrh5_ctx->p_staging = NULL;
+    }
+    if(p_wrh5_ctx->pool_owned) {
+        wrh5_pool_destroy(p_wrh5_ctx->p_pool, debugging);
+        free(p_wrh5_ctx->p_pool);
+        p_wrh5_ctx->pool_owned = 0;
+    }
+    p_wrh5_ctx->p_pool = NULL;
+    free(p_wrh5_ctx->p_chunk);
+    p_wrh5_ctx->p_chunk = NULL;
+    free(p_wrh5_ctx->p_valid);
+    p_wrh5_ctx->p_valid = NULL;
+    p_wrh5_ctx->valid_size = 0;
+    wrh5_chans_close(p_wrh5_ctx);
+
+    /*
+     * Give the chunk buffer and chunk cache back to the memory budget.
+     */
+    wrh5_budget_release(p_wrh5_ctx->budget_bytes);
+    p_wrh5_ctx->budget_bytes = 0;
+    p_wrh5_ctx->chunk_cache_bytes = 0;
+
     /*
      * Closing statistics.
      */
@@ -73,10 +155,41 @@ int wrh5_close(wrh5_context_t * p_wrh5_ctx,
         wrh5_info("wrh5_close: %lld time integrations processed.\n", p_wrh5_ctx->offset_dims[0]);
         MiBstore = (double) sz_store / MILLION;
         wrh5_info("wrh5_close: Compressed %.2f MiB --> %.2f MiB\n", MiBlogical, MiBstore);
+        if(p_wrh5_ctx->missing_tints > 0 || p_wrh5_ctx->elide_fill)
+            wrh5_info("wrh5_close: %ld time integrations missing, %ld all-zero chunks not written\n",
+                      p_wrh5_ctx->missing_tints, p_wrh5_ctx->elided_chunks);
+        if(p_wrh5_ctx->sk_m > 0)
+            wrh5_info("wrh5_close: Spectral kurtosis mask: %lld blocks, %ld block-channels flagged\n",
+                      p_wrh5_ctx->sk_nrows, p_wrh5_ctx->sk_flagged);
+        if(p_wrh5_ctx->bypass_min_ratio > 0.0) {
+            wrh5_info("wrh5_close: Compression bypass: %ld chunks (%.2f MiB) stored raw, %ld chunks (%.2f MiB) compressed\n",
+                      p_wrh5_ctx->bypass_chunks, p_wrh5_ctx->bypass_bytes / MILLION,
+                      p_wrh5_ctx->compress_chunks, p_wrh5_ctx->compress_bytes / MILLION);
+            if(p_wrh5_ctx->filtered && p_wrh5_ctx->filter_bytes > 0.0)
+                wrh5_info("wrh5_close: Compression bypass: about %.3f CPU seconds saved "
+                          "(%.3f s for the %.2f MiB written through the filter)\n",
+                          p_wrh5_ctx->bypass_bytes * p_wrh5_ctx->filter_seconds / p_wrh5_ctx->filter_bytes,
+                          p_wrh5_ctx->filter_seconds, p_wrh5_ctx->filter_bytes / MILLION);
+        }
     }
 
     /*
      * Bye-bye.
      */
-    return 0;
+    return rc;
+}
+
+
+/***
+	Main entry point.
+***/
+int wrh5_close(wrh5_context_t * p_wrh5_ctx, 
+               int debugging) {
+    uint64_t    record_t0 = WRH5_RECORD_BEGIN();    // Write-pattern recording (see wrh5_record.c)
+    int         rc;
+
+    rc = close_file(p_wrh5_ctx, debugging);
+    if(record_t0 != 0)
+        wrh5_record_call(p_wrh5_ctx, WRH5_REC_CLOSE, record_t0, 0, NULL, rc);
+    return rc;
 }
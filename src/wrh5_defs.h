@@ -16,6 +16,7 @@
 #include <sys/types.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 
 /*
  * HDF5 library definitions
@@ -27,6 +28,13 @@
 #error The installed HDF5 run-time is not thread-safe!
 #endif
 
+/*
+ * C linkage when included from C++ (see wrh5.hpp).
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /*
  * HDF5 library ID of the Bitshuffle filter.
  */
@@ -45,6 +53,54 @@
 #define FILTERBANK_CLASS    "FILTERBANK"    // File-level attribute "CLASS"
 #define FILTERBANK_VERSION  "2.0"           // File-level attribute "VERSION"
 
+/*
+ * Buffer pool definition - see wrh5_pool.c.
+ * Fixed-size buffers carved out of one mapping, backed by hugepages where available,
+ * and pre-faulted at creation time.  A pool may be owned by one context or shared by many.
+ */
+#define WRH5_HUGEPAGE_SIZE  (2 * 1024 * 1024)   // Buffer sizes are rounded up to a multiple of this
+typedef struct {
+    char * base;                // Start of the mapping that holds all buffers
+    size_t map_size;            // Byte size of the mapping
+    size_t bufsize;             // Byte size of one buffer (hugepage multiple)
+    int nbufs;                  // Number of buffers in the pool
+    int nfree;                  // Number of buffers currently available
+    int * free_stack;           // Indices of the available buffers (nfree entries are valid)
+    int hugepages;              // 2: explicit hugepages (MAP_HUGETLB), 1: transparent hugepages, 0: regular pages
+    pthread_mutex_t lock;       // Protects nfree and free_stack
+    pthread_cond_t released;    // Signalled when a buffer is returned to the pool
+} wrh5_pool_t;
+
+/*
+ * Input layouts of caller buffers presented to wrh5_write (ntints = time integrations in the dump).
+ */
+#define WRH5_LAYOUT_TIF     0       // [time][ifs][chan] : on-disk order (default), written as is
+#define WRH5_LAYOUT_TCI     1       // [time][chan][ifs] : IF-interleaved, IF varies fastest
+#define WRH5_LAYOUT_ICT     2       // [ifs][chan][time] : channel-major, time varies fastest
+
+/*
+ * Detection products of wrh5_write_detect (dual-polarization complex64 X/Y spectra --> float32 power).
+ */
+#define WRH5_DETECT_NONE    0       // No detection stage (default)
+#define WRH5_DETECT_I       1       // Stokes I (nifs = 1)
+#define WRH5_DETECT_IQUV    2       // Stokes I, Q, U, V (nifs = 4)
+
+/*
+ * Quantization of float32 input to 8-bit storage (physical value = offset + scale * stored value).
+ */
+#define WRH5_QUANT_NONE     0       // No quantization (default)
+#define WRH5_QUANT_UINT8    1       // Stored as uint8, mean at 128
+#define WRH5_QUANT_INT8     2       // Stored as int8, mean at 0
+#define WRH5_QUANT_NSIGMA   6.0     // Default quant_nsigma: the 256 levels span mean +/- 3 sigma
+
+/*
+ * Spectral kurtosis RFI mask ("sk_mask" flag values).
+ */
+#define WRH5_SK_CLEAN       0       // SK estimator within the thresholds
+#define WRH5_SK_HIGH        1       // Above the upper threshold (E.g. intermittent RFI)
+#define WRH5_SK_LOW         2       // Below the lower threshold (E.g. persistent narrowband RFI)
+#define WRH5_SK_NSIGMA      3.0     // Default sk_nsigma
+
 /*
  * Context definition
  */
@@ -61,69 +117,83 @@ typedef struct {
     unsigned long byte_count;   // Number of bytes output so far
     unsigned long dump_count;   // Number of dumps processed so far
     int usable;                 // writes permitted: 1 (normal), else: 0 (an error occured or closed)
+    hsize_t cdims[3];           // Chunk dimensions in effect for dataset "data"
+    int nfpc;                   // Fine channels per coarse channel (copied from the header)
+    int cc_aligned;             // 1: chunks are coarse-channel aligned and "cc_index" is written at close
+    wrh5_pool_t * p_pool;       // Buffer pool for wrh5_submit and internal staging (NULL if none)
+    int pool_owned;             // 1: p_pool was created by wrh5_open_ext and is destroyed by wrh5_close
+    int input_layout;           // Caller's buffer layout: WRH5_LAYOUT_TIF, WRH5_LAYOUT_TCI or WRH5_LAYOUT_ICT
+    char * p_staging;           // Staging buffer held from p_pool for the life of the context (NULL if not needed)
+    size_t staging_tints;       // Capacity of p_staging in time integrations
+    int detect;                 // Detection product: WRH5_DETECT_NONE, WRH5_DETECT_I or WRH5_DETECT_IQUV
+    int detect_nint;            // Spectra integrated per time integration by wrh5_write_detect
+    int acc_count;              // Spectra accumulated so far into the current staging slot
+    size_t acc_slot;            // Current staging slot (time integration) being accumulated
+    int keep_mantissa_bits;     // Mantissa bits kept by round-to-nearest bit trimming (0 = no trimming)
+    int quantize;               // Storage quantization: WRH5_QUANT_NONE, WRH5_QUANT_UINT8 or WRH5_QUANT_INT8
+    size_t quant_nint;          // Time integrations used for each bandpass estimate
+    int quant_update;           // 1: re-estimate every quant_nint time integrations; 0: keep the first estimate
+    double quant_nsigma;        // Width of the 256 quantization levels in bandpass standard deviations
+    hsize_t quant_next;         // Time integration at or after which the next estimate is taken
+    hsize_t quant_nrows;        // Rows written so far to "quant_offset", "quant_scale" and "quant_tint"
+    float * quant_offset;       // Current offset per [ifs][chan]
+    float * quant_scale;        // Current scale per [ifs][chan]
+    float * quant_inv;          // 1 / quant_scale per [ifs][chan]
+    double * quant_acc;         // Estimation accumulators: sum and sum of squares per [ifs][chan]
+    float * quant_hold;         // Time integrations held back until the estimate in progress is complete
+    size_t quant_held;          // Time integrations in quant_hold
+    hsize_t quant_hold_start;   // Time integration at which the estimate in progress started
+    hid_t quant_offset_id;      // Dataset "quant_offset" handle
+    hid_t quant_scale_id;       // Dataset "quant_scale" handle
+    hid_t quant_tint_id;        // Dataset "quant_tint" handle
+    int filtered;               // 1: the Bitshuffle (or deflate) filter is set on dataset "data"
+    int deflate_level;          // > 0: the filter is deflate, at this level (deflate_level option)
+    double bypass_min_ratio;    // Whole chunks with a lower estimated compression ratio are stored raw (0 = off)
+    char * p_chunk;             // One zero-padded chunk, gathered for H5Dwrite_chunk (bypass only)
+    size_t chunk_bytes;         // Byte size of p_chunk
+    unsigned long bypass_chunks;    // Chunks stored raw
+    unsigned long compress_chunks;  // Whole chunks written through the filter
+    double bypass_bytes;        // Bytes stored raw
+    double compress_bytes;      // Bytes of whole chunks written through the filter
+    double filter_bytes;        // Bytes written through the filter pipeline by wrh5_write_block (whole and partial chunks)
+    double filter_seconds;      // Thread CPU seconds of those writes and of the final chunk cache flush
+    int elide_fill;             // 1: all-zero time integrations are missing and all-zero whole chunks are not written
+    unsigned char * p_valid;    // Bitmap of real time integrations, bit (t % 8) of byte (t / 8)
+    size_t valid_size;          // Allocated byte size of p_valid
+    unsigned long missing_tints;    // Time integrations recorded as missing
+    unsigned long elided_chunks;    // All-zero whole chunks not written
+    int sk_m;                   // Time integrations per spectral kurtosis block (0 = no SK mask)
+    int sk_n;                   // Power samples summed into each value (N of the SK estimator)
+    double sk_nsigma;           // Flag thresholds in standard deviations of the SK estimator
+    size_t sk_count;            // Time integrations accumulated into the current block
+    hsize_t sk_first;           // First time integration of the current block
+    hsize_t sk_nrows;           // Rows written so far to "sk_mask" and "sk_tint"
+    double * sk_acc;            // S1 and S2 accumulators per fine channel
+    float * sk_power;           // Power of one time integration, summed over the IFs
+    unsigned char * sk_flags;   // One row of "sk_mask"
+    hid_t sk_mask_id;           // Dataset "sk_mask" handle
+    hid_t sk_tint_id;           // Dataset "sk_tint" handle
+    unsigned long sk_flagged;   // Block-channels flagged so far
+    size_t chunk_cache_bytes;   // HDF5 chunk cache size of dataset "data" (granted by the memory budget if one is set)
+    size_t budget_bytes;        // Bytes reserved from the memory budget for p_chunk and the chunk cache
+    char * p_map;               // Contiguous layout: mapping of the raw data of "data" (NULL: chunked)
+    size_t map_size;            // Byte size of p_map
+    size_t map_skip;            // Bytes of p_map before the raw data (page alignment)
+    int map_fd;                 // File descriptor behind p_map
+    struct wrh5_metrics * p_metrics;    // Live metrics of this context (NULL: the exporter was not running at open)
+    unsigned int record_id;     // Context number in the recording (0: not recorded; see wrh5_record.c)
+    unsigned long record_nwrites;   // wrh5_write calls recorded so far (data sampling)
+    size_t in_tint_size;        // Size of a time integration presented to wrh5_write (tint_size unless channels are selected)
+    int in_nchans;              // Fine channels presented (header nchans); filesz_dims[2] are stored
+    uint32_t * p_chan_index;    // Channel selection: presented channel of each stored channel (NULL: all are stored)
+    uint32_t * p_chan_runs;     // Channel selection: (first presented channel, count) of each run of kept channels
+    size_t nchan_runs;          // Number of runs in p_chan_runs
 } wrh5_context_t;
 
 /*
- * Header (metadata) definition
- */
-typedef struct {
-  // 0=fake data; 1=Arecibo; 2=Ooty... others to be added
-  int machine_id;
-  // 0=FAKE; 1=PSPM; 2=WAPP; 3=OOTY... others to be added
-  int telescope_id;
-  // 1=filterbank; 2=time series... others to be added
-  int data_type;
-  // 1 if barycentric or 0 otherwise (only output if non-zero)
-  int barycentric;
-  // 1 if pulsarcentric or 0 otherwise (only output if non-zero)
-  int pulsarcentric;
-  // right ascension (J2000) of source (hours)
-  // will be converted to/from hhmmss.s
-  double src_raj;
-  // declination (J2000) of source (degrees)
-  // will be converted to/from ddmmss.s
-  double src_dej;
-  // telescope azimuth at start of scan (degrees)
-  double az_start;
-  // telescope zenith angle at start of scan (degrees)
-  double za_start;
-  // centre frequency (MHz) of first filterbank channel
-  double fch1;
-  // filterbank channel bandwidth (MHz)
-  double foff;
-  // number of fine filterbank channels (not coarse channels)
-  int nchans;
-  // total number of beams
-  int nbeams;
-  // total number of beams
-  int ibeam;
-  // number of bits per time sample
-  int nbits;
-  // time stamp (MJD) of first sample
-  double tstart;
-  // time interval between samples (s)
-  double tsamp;
-  // number of seperate IF channels
-  int nifs;
-  // the name of the source being observed by the telescope
-  char source_name[81];
-  // the name of the original data file
-  char rawdatafile[81];
-  // Number of fine channels per coarse channel
-  // If unknown, set nfpc=0.  This will cause the output header to omit this field.
-  int nfpc;
-  
-} wrh5_hdr_t;
-
-/*
- * Optional user chunking definition
- * If not supplied (NULL) by caller in wrh5_open, default chunking (blimpy) is used.
- */
-typedef struct {
-    size_t  n_time;       // chunk time dimension
-    size_t  n_nifs;       // chunk nifs dimension
-    size_t  n_fine_chan;  // chunk fine channel dimension
-} user_chunking_t;
+ * Header (metadata) and user chunking definitions - see wrh5_hdr.h.
+ */
+#include "wrh5_hdr.h"
 
 /*
  * Optional user caching definition - see reference for H5Pset_cache().
@@ -135,6 +205,288 @@ typedef struct {
     double  policy;   // Preemptive policy
 } user_caching_t;
 
+/*
+ * Optional user options definition.
+ * If not supplied (NULL) by caller in wrh5_open_ext, every option takes its default (0 = off).
+ */
+typedef struct {
+    int     cc_aligned;   // 1: chunk fine channel dimension divides nfpc; write coarse channel index "cc_index"
+    wrh5_pool_t * p_pool; // Caller-created buffer pool to share with this context, or NULL
+    int     pool_nbufs;   // If p_pool is NULL and pool_nbufs > 0, the context creates its own pool of pool_nbufs buffers
+    size_t  pool_tints;   // Time integrations per buffer of the context's own pool (rounded up to the chunk time dimension)
+    int     input_layout; // Layout of the buffers presented to wrh5_write: WRH5_LAYOUT_TIF (default), _TCI or _ICT
+    int     detect;       // Detection stage for wrh5_write_detect: WRH5_DETECT_NONE (default), _I or _IQUV
+    int     detect_nint;  // Spectra integrated per time integration by wrh5_write_detect (default 1)
+    int     keep_mantissa_bits; // Lossy: round float mantissas to this many bits before the filter (0 = lossless)
+    int     quantize;     // Lossy: store float32 input as WRH5_QUANT_UINT8 or _INT8 with per-channel scale/offset
+    size_t  quant_nint;   // Time integrations per bandpass estimate (default: the chunk time dimension)
+    int     quant_update; // 1: re-estimate the bandpass every quant_nint time integrations; 0: first estimate only
+    double  quant_nsigma; // Width of the 256 levels in standard deviations (default WRH5_QUANT_NSIGMA)
+    double  bypass_min_ratio;   // Store whole chunks raw if their estimated compression ratio is lower (0 = off)
+    int     elide_fill;   // 1: detect all-zero time integrations (missing) and whole chunks (not written)
+    int     resume;       // 1: if output-path exists, append to it instead of replacing it (see wrh5_resume.c)
+    int     sk_m;         // Spectral kurtosis RFI mask: time integrations per block, >= 2 (0 = off)
+    int     sk_n;         // Power samples summed into each value (default: 1, or 2 x detect_nint with detection)
+    double  sk_nsigma;    // Flag thresholds in standard deviations of the SK estimator (default WRH5_SK_NSIGMA)
+    int     io_depth;     // > 0: write through the io_uring driver with up to io_depth writes in flight (0 = sec2)
+    size_t  io_slot_bytes;  // io_uring driver: byte size of each in-flight write buffer (default WRH5_IO_SLOT_BYTES)
+    int     deflate_level;  // 1 to 9: compress "data" with deflate (zlib) at this level instead of Bitshuffle (0 = off)
+    size_t  contiguous_tints;   // > 0: "data" is contiguous, allocated at open for this many time integrations and written through a memory mapping (see wrh5_mmap.c)
+    char    numa_nodes[32]; // NUMA node list (E.g. "1") holding the context's own pool and staging buffer (empty: no binding)
+    char    keep_chans[256];    // Channel selection: presented fine channels to store, E.g. "1024-64511" (empty: all; see wrh5_chans.c)
+    int     guard_chans;  // Channel selection: fine channels dropped at both edges of every coarse channel (0 = none)
+} user_options_t;
+
+/*
+ * Optional parameters of wrh5_rechunk.
+ * If not supplied (NULL), every parameter takes its default (0).
+ */
+#define WRH5_CODEC_KEEP         0   // Same codec as the input (default)
+#define WRH5_CODEC_NONE         1   // Not compressed
+#define WRH5_CODEC_BITSHUFFLE   2   // Bitshuffle/LZ4 (requires the plugin)
+#define WRH5_CODEC_DEFLATE      3   // Deflate (zlib), compressed by the worker threads
+typedef struct {
+    user_chunking_t chunking;   // Output chunk dimensions; 0 = same as the input
+    int     codec;              // WRH5_CODEC_KEEP (default), _NONE, _BITSHUFFLE or _DEFLATE
+    int     deflate_level;      // 1 to 9 (default 4, or the input's level when the codec is kept)
+    int     nthreads;           // Worker threads (default: online CPUs)
+    size_t  mem_budget;         // Bytes of buffers for all threads together (default 256 MiB)
+} user_rechunk_t;
+
+/*
+ * Shared-memory stream daemon parameters - see wrh5_serve.c, wrh5_shm.h and tools/wrh5d.c.
+ */
+typedef struct {
+    char    prefix[64];     // Serve the segments /dev/shm/<prefix>* (default WRH5_SHM_PREFIX, i.e. every stream)
+    int     scan_ms;        // Milliseconds between scans for new streams and dead producers (default 100)
+    int     max_streams;    // Streams served at once (default 64)
+    int     burst;          // Slots written per stream per round (default 4)
+    int     exit_when_idle; // 1: return once every stream served so far is closed
+    volatile int * p_stop;  // If not NULL: when *p_stop becomes non-zero, write what is committed, close and return
+    user_caching_t * p_caching; // HDF5 caching of every output file (NULL: defaults)
+    user_options_t * p_options; // Options of every output file (NULL: defaults)
+} user_serve_t;
+
+/*
+ * Process-wide memory budget - see wrh5_budget.c and wrh5_budget_set.
+ */
+typedef struct {
+    size_t  budget;         // Budget in bytes (0 = unlimited)
+    double  wait_seconds;   // How long a reservation that does not fit waits (< 0: for ever, 0: not at all)
+    size_t  reserved;       // Bytes currently reserved by pools and contexts
+    size_t  peak;           // Highest value of reserved so far
+    int     nreservations;  // Reservations currently held (pools and contexts)
+    int     nwaiting;       // Reservations currently waiting for memory
+    unsigned long nrefused; // Reservations that failed for lack of memory
+} wrh5_budget_t;
+
+/*
+ * Multi-file writer manager - see wrh5_manager.c.
+ * Real-time policies: what a call does when its stream has no free dump buffer within rt_budget_ms.
+ */
+#define WRH5_RT_BLOCK       0       // Wait as long as it takes (default; rt_budget_ms is not used)
+#define WRH5_RT_DROP_NEWEST 1       // Drop the dump presented
+#define WRH5_RT_DROP_OLDEST 2       // Drop the oldest dump waiting to be stored, and reuse its buffer
+#define WRH5_RT_DEGRADE     3       // Once a call waits, skip compression until the queue is empty; drop the dump presented at the budget
+typedef struct {
+    int     nthreads;       // Encoding worker threads (default: online CPUs)
+    int     queue_depth;    // Dumps in flight per stream; wrh5_manager_get_buffer waits beyond that (default 4)
+    int     max_streams;    // Streams open at once (default 64)
+    int     rt_policy;      // WRH5_RT_BLOCK (default), _DROP_NEWEST, _DROP_OLDEST or _DEGRADE
+    double  rt_budget_ms;   // Longest wait of a call for a dump buffer before the policy applies (0: no wait)
+    char    worker_cpus[64];    // CPU list of the encoding workers, E.g. "0-7" (empty: not pinned)
+    char    io_cpus[64];    // CPU list of the I/O thread (empty: not pinned)
+    char    numa_nodes[32]; // NUMA node list of the threads' allocations and of the streams' buffers (empty: no binding)
+} user_manager_t;
+
+typedef struct {
+    unsigned long dumps;        // Dumps stored
+    unsigned long encoded_dumps;    // Dumps whose whole chunks were encoded by the workers (else wrh5_write on the I/O thread)
+    unsigned long chunks;       // Chunks encoded by the workers
+    unsigned long steals;       // Chunks a worker took from another worker's queue
+    double  bytes_in;           // Bytes submitted
+    double  bytes_stored;       // Bytes of the encoded chunks stored
+    double  encode_seconds;     // Worker time spent gathering and compressing chunks
+    double  io_seconds;         // I/O thread time spent storing dumps
+    int     max_queued;         // Most dumps in flight at once in one stream
+    unsigned long dropped_dumps;    // Dumps dropped by the real-time policy (missing time integrations in the file)
+    unsigned long dropped_tints;    // Time integrations of the dropped dumps
+    unsigned long raw_dumps;    // Dumps whose whole chunks were stored uncompressed (WRH5_RT_DEGRADE)
+    double  max_wait_seconds;   // Longest wait of a call for a dump buffer
+    double  worker_cpu_seconds; // CPU time of the workers (stream -1 only; per thread: wrh5_manager_threads)
+    double  io_cpu_seconds;     // CPU time of the I/O thread (stream -1 only)
+} wrh5_manager_stats_t;
+
+struct wrh5_mgr_stream;         // Private to wrh5_manager.c
+struct wrh5_mgr_worker;
+typedef struct {
+    int     nthreads;           // Encoding worker threads
+    int     queue_depth;        // Dumps in flight per stream at most
+    int     max_streams;        // Size of the stream table
+    int     debugging;          // Debug flag given to wrh5_manager_create
+    int     rt_policy;          // WRH5_RT_BLOCK, _DROP_NEWEST, _DROP_OLDEST or _DEGRADE
+    double  rt_budget;          // Real-time budget of a call, seconds
+    char    worker_cpus[64];    // Placement (see user_manager_t)
+    char    io_cpus[64];
+    char    numa_nodes[32];
+    long    io_tid;             // Linux thread ID of the I/O thread
+    int     io_pinned;          // 1: the I/O thread is pinned to io_cpus
+    struct wrh5_mgr_stream * streams;   // Stream table
+    struct wrh5_mgr_worker * workers;   // Worker table
+    pthread_t io_thread;        // The thread that makes every HDF5 call of the dumps
+    pthread_mutex_t lock;       // Protects the stream queues, ntasks, quit and rr
+    pthread_cond_t work;        // Signalled when chunk tasks are queued
+    pthread_cond_t ready;       // Signalled when a dump is ready to be stored
+    pthread_cond_t stored;      // Signalled when a dump was stored
+    long    ntasks;             // Chunk tasks queued and not yet taken by a worker
+    int     quit;               // 1: the threads must exit
+    int     rr;                 // Stream the I/O thread looks at first (round robin)
+    wrh5_manager_stats_t totals;    // Every stream so far, closed ones included (protected by lock)
+} wrh5_manager_t;
+
+/*
+ * Thread placement and statistics - see wrh5_affinity.c and wrh5_manager_threads.
+ */
+#define WRH5_MAX_NODES      64      // NUMA nodes addressed by a node list
+#define WRH5_MAX_CPUS       1024    // CPUs addressed by a CPU list (CPU_SETSIZE)
+typedef struct {
+    char    name[32];       // E.g. "wrh5 worker 3", "wrh5 io"
+    long    tid;            // Linux thread ID
+    double  cpu_seconds;    // CPU time used so far
+    int     cpu;            // CPU it last ran on (-1: unknown)
+    int     node;           // NUMA node of that CPU (-1: unknown)
+    int     pinned;         // 1: pinned to its CPU list
+} wrh5_thread_stats_t;
+
+/*
+ * Log levels and sink - see wrh5_log_set.
+ * A sink receives each message that passes min_level, without the timestamp (E.g. "WRH5-ERROR ... :: ...\n").
+ */
+#define WRH5_LOG_INFO       0       // wrh5_info (debugging output)
+#define WRH5_LOG_WARNING    1       // wrh5_warning
+#define WRH5_LOG_ERROR      2       // wrh5_error
+#define WRH5_LOG_NONE       3       // Nothing
+typedef void (* wrh5_log_sink_t)(int level, const char * msg, void * p_arg);
+
+/*
+ * Live metrics exporter - see wrh5_metrics.c.
+ */
+typedef struct {
+    char    textfile[256];  // If not empty: rewritten every interval_ms (E.g. for the node_exporter textfile collector)
+    char    socket_path[108];   // If not empty: Unix socket answering each connection with the metrics (HTTP if asked "GET")
+    int     interval_ms;    // Milliseconds between textfile rewrites and throughput samples (default 5000)
+} user_metrics_t;
+
+/*
+ * Write-pattern recording and replay - see wrh5_record.c.
+ * A recorded call of the library:
+ *     uint64_t record_t0 = WRH5_RECORD_BEGIN();
+ *     ...
+ *     if(record_t0 != 0)
+ *         wrh5_record_call(p_wrh5_ctx, WRH5_REC_WRITE, record_t0, bufsize, p_buffer, rc);
+ */
+#define WRH5_REC_OPEN       1       // wrh5_open_ext
+#define WRH5_REC_WRITE      2       // wrh5_write, wrh5_submit
+#define WRH5_REC_WRITEV     3       // wrh5_writev (replayed as wrh5_write of the same size)
+#define WRH5_REC_DETECT     4       // wrh5_write_detect
+#define WRH5_REC_MISSING    5       // wrh5_write_missing
+#define WRH5_REC_CLOSE      6       // wrh5_close
+extern volatile int wrh5_recording;
+#define WRH5_RECORD_BEGIN() (wrh5_recording ? wrh5_trace_now() : 0)
+
+typedef struct {
+    char    out_dir[256];   // Directory of the replayed files, written under their recorded base names (default ".")
+    int     paced;          // 1: start each call at its recorded time; 0 (default): as fast as possible
+    user_chunking_t chunking;   // Chunk dimensions that replace the recorded ones; 0 = as recorded
+    int     deflate_level;  // > 0: replaces the recorded deflate_level option
+    int     io_depth;       // > 0: replaces the recorded io_depth option
+} user_replay_t;
+
+typedef struct {
+    unsigned long opens;    // Files opened
+    unsigned long closes;   // Files closed
+    unsigned long writes;   // Write calls (wrh5_write, wrh5_writev and wrh5_write_detect recorded)
+    unsigned long errors;   // Calls that failed in the replay but not in the recording
+    double  bytes;          // Bytes presented by the write calls
+    double  seconds;        // Duration of the replay
+    double  recorded_seconds;   // Duration of the recording
+    double  lat_p50;        // Write call latency in the replay, seconds: median, 90th and 99th percentiles, maximum
+    double  lat_p90;
+    double  lat_p99;
+    double  lat_max;
+    double  rec_p50;        // Write call latency in the recording: median, 99th percentile, maximum
+    double  rec_p99;
+    double  rec_max;
+} wrh5_replay_stats_t;
+
+/*
+ * Tracing - see wrh5_trace.c.  A traced section of the library:
+ *     uint64_t trace_t0 = WRH5_TRACE_BEGIN();
+ *     ...
+ *     WRH5_TRACE_END(trace_t0, "H5Dwrite", nbytes);
+ * The name must be a string literal.  When tracing is off, this is one load and a branch.
+ */
+#define WRH5_TRACE_NEVENTS  65536   // Default events kept per thread
+extern volatile int wrh5_tracing;
+#define WRH5_TRACE_BEGIN()  (wrh5_tracing ? wrh5_trace_now() : 0)
+#define WRH5_TRACE_END(t0, name, arg) \
+    do { if((t0) != 0) wrh5_trace_record((name), (t0), (int64_t) (arg)); } while(0)
+
+/*
+ * Memory held by one context - see wrh5_memory_usage.
+ */
+typedef struct {
+    size_t  pool;           // Context-owned pool mapping, or the staging buffer held from a shared pool
+    size_t  chunk_buffer;   // Chunk buffer of the compression bypass and fill elision
+    size_t  chunk_cache;    // HDF5 chunk cache limit of dataset "data"
+    size_t  io_queue;       // Slots of the io_uring driver
+    size_t  other;          // Per-channel vectors and the valid bitmap (not budgeted), the quantization hold buffer
+    size_t  total;          // Sum of the above
+} wrh5_mem_usage_t;
+
+/*
+ * io_uring file driver - see wrh5_uring.c and wrh5_io_stats.
+ */
+#define WRH5_IO_SLOT_BYTES  (4 * 1024 * 1024)   // Default byte size of each in-flight write buffer
+typedef struct {
+    int     uring;          // 1: writes go through io_uring; 0: io_uring is not available, every write is a pwrite
+    int     fixed;          // 1: the slots are registered buffers (IORING_OP_WRITE_FIXED)
+    int     depth;          // Writes kept in flight at most
+    size_t  slot_bytes;     // Byte size of each slot (hugepage multiple)
+    size_t  queue_bytes;    // Byte size of all slots
+    unsigned long async_writes; // Writes submitted to the ring
+    unsigned long sync_writes;  // Writes done with pwrite (small writes, or no io_uring)
+    unsigned long short_writes; // Ring writes that were completed with pwrite
+    int     max_inflight;   // Most writes in flight at once
+    double  async_bytes;    // Bytes submitted to the ring
+} wrh5_io_stats_t;
+
+/*
+ * Scatter/gather segment definition - see wrh5_writev.
+ * role = WRH5_ROLE_TINTS : whole time integrations in on-disk order [time][ifs][chan]
+ * role = k (0 <= k < nifs) : time integrations of IF k only, in order [time][chan]
+ */
+#define WRH5_ROLE_TINTS     -1
+typedef struct {
+    const void * base;      // Segment address
+    size_t  len;            // Segment byte length
+    int     role;           // WRH5_ROLE_TINTS or an IF index
+} wrh5_iovec_t;
+
+/*
+ * Coarse channel index definition - one row of dataset "cc_index" per allocated chunk of dataset "data".
+ * Rows are sorted by coarse channel, then time, then IF.
+ */
+typedef struct {
+    uint32_t coarse_chan;   // Coarse channel number (chan_offset / nfpc)
+    uint32_t filter_mask;   // HDF5 filter mask of the stored chunk (0 = all filters applied)
+    uint64_t time_offset;   // Chunk coordinate: first time integration
+    uint64_t ifs_offset;    // Chunk coordinate: first IF
+    uint64_t chan_offset;   // Chunk coordinate: first fine channel
+    uint64_t file_addr;     // Byte address of the stored chunk in the file
+    uint64_t nbytes;        // Stored (compressed) byte size of the chunk
+} wrh5_cc_index_t;
+
 /*
  * libwrh5 caller API functions
  */
@@ -144,6 +496,13 @@ int     wrh5_open(wrh5_context_t * p_wrh5_ctx,
                   user_chunking_t * p_user_chunking, 
                   user_caching_t * p_user_caching, 
                   int flag_debug);
+int     wrh5_open_ext(wrh5_context_t * p_wrh5_ctx,
+                      wrh5_hdr_t * p_wrh5_hdr, 
+                      char * output_path, 
+                      user_chunking_t * p_user_chunking, 
+                      user_caching_t * p_user_caching, 
+                      user_options_t * p_user_options, 
+                      int flag_debug);
 int     wrh5_write(wrh5_context_t * p_wrh5_ctx,
                    wrh5_hdr_t * p_wrh5_hdr, 
                    void * buffer, 
@@ -151,25 +510,261 @@ int     wrh5_write(wrh5_context_t * p_wrh5_ctx,
                    int flag_debug);
 int     wrh5_close(wrh5_context_t * p_wrh5_ctx, 
                    int flag_debug);
+int     wrh5_writev(wrh5_context_t * p_wrh5_ctx,
+                    wrh5_hdr_t * p_wrh5_hdr, 
+                    const wrh5_iovec_t * p_iov, 
+                    int iovcnt, 
+                    int flag_debug);
+int     wrh5_write_detect(wrh5_context_t * p_wrh5_ctx,
+                          wrh5_hdr_t * p_wrh5_hdr, 
+                          const float * p_x, 
+                          const float * p_y, 
+                          size_t nspectra, 
+                          int flag_debug);
+int     wrh5_write_missing(wrh5_context_t * p_wrh5_ctx,
+                           wrh5_hdr_t * p_wrh5_hdr, 
+                           size_t ntints, 
+                           int flag_debug);
+int     wrh5_rechunk(char * in_path, 
+                     char * out_path, 
+                     user_rechunk_t * p_params, 
+                     int flag_debug);
+int     wrh5_submit(wrh5_context_t * p_wrh5_ctx,
+                    wrh5_hdr_t * p_wrh5_hdr, 
+                    void * pool_buffer, 
+                    size_t bufsize, 
+                    int flag_debug);
+int     wrh5_budget_set(size_t nbytes, 
+                        double wait_seconds, 
+                        int flag_debug);
+void    wrh5_budget_get(wrh5_budget_t * p_budget);
+int     wrh5_memory_usage(wrh5_context_t * p_wrh5_ctx, 
+                          wrh5_mem_usage_t * p_usage);
+int     wrh5_set_fapl_uring(hid_t fapl, 
+                            int depth, 
+                            size_t slot_bytes, 
+                            int flag_debug);
+int     wrh5_manager_create(wrh5_manager_t * p_mgr,
+                            user_manager_t * p_params,
+                            int flag_debug);
+int     wrh5_manager_open(wrh5_manager_t * p_mgr,
+                          int * p_stream,
+                          wrh5_hdr_t * p_wrh5_hdr,
+                          char * output_path,
+                          user_chunking_t * p_user_chunking,
+                          user_caching_t * p_user_caching,
+                          user_options_t * p_user_options,
+                          size_t max_dump_bytes);
+void *  wrh5_manager_get_buffer(wrh5_manager_t * p_mgr,
+                                int stream);
+int     wrh5_manager_submit(wrh5_manager_t * p_mgr,
+                            int stream,
+                            void * buffer,
+                            size_t bufsize);
+int     wrh5_manager_write(wrh5_manager_t * p_mgr,
+                           int stream,
+                           const void * buffer,
+                           size_t bufsize);
+int     wrh5_manager_drop(wrh5_manager_t * p_mgr,
+                          int stream,
+                          size_t bufsize);
+int     wrh5_manager_drain(wrh5_manager_t * p_mgr,
+                           int stream);
+int     wrh5_manager_close(wrh5_manager_t * p_mgr,
+                           int stream);
+int     wrh5_manager_stats(wrh5_manager_t * p_mgr,
+                           int stream,
+                           wrh5_manager_stats_t * p_stats);
+int     wrh5_manager_threads(wrh5_manager_t * p_mgr,
+                             wrh5_thread_stats_t * p_stats,
+                             int max_threads);
+int     wrh5_manager_destroy(wrh5_manager_t * p_mgr);
+int     wrh5_serve(user_serve_t * p_params,
+                   int flag_debug);
+void *  wrh5_mmap_next(wrh5_context_t * p_wrh5_ctx,
+                       size_t ntints,
+                       int flag_debug);
+void    wrh5_log_set(wrh5_log_sink_t sink,
+                     void * p_arg,
+                     int min_level);
+int     wrh5_trace_start(size_t nevents,
+                         int flag_debug);
+void    wrh5_trace_stop(void);
+int     wrh5_trace_dump(const char * path,
+                        int flag_debug);
+void    wrh5_trace_thread_name(const char * name);
+int     wrh5_metrics_start(user_metrics_t * p_params,
+                           int flag_debug);
+int     wrh5_metrics_stop(int flag_debug);
+size_t  wrh5_metrics_format(char * buffer,
+                            size_t size);
+int     wrh5_record_start(const char * path,
+                          unsigned int sample_every,
+                          int flag_debug);
+int     wrh5_record_stop(int flag_debug);
+int     wrh5_replay(const char * in_path,
+                    user_replay_t * p_params,
+                    wrh5_replay_stats_t * p_stats,
+                    int flag_debug);
+int     wrh5_vds_create(char * master_path,
+                        char ** part_paths,
+                        int nparts,
+                        int flag_debug);
+int     wrh5_io_stats(wrh5_context_t * p_wrh5_ctx, 
+                      wrh5_io_stats_t * p_stats);
+
+/*
+ * wrh5_budget.c functions
+ */
+int     wrh5_budget_acquire(size_t nbytes, size_t extra_min, size_t extra_max, size_t * p_extra,
+                            const char * caller, int flag_debug);
+void    wrh5_budget_release(size_t nbytes);
+
+/*
+ * wrh5_resume.c functions
+ */
+int     wrh5_resume(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, char * path,
+                    user_chunking_t * p_user_chunking, user_caching_t * p_user_caching,
+                    user_options_t * p_options, int flag_debug);
+
+/*
+ * wrh5_write.c functions
+ */
+int     wrh5_extend(wrh5_context_t * p_wrh5_ctx, size_t ntints);
+int     wrh5_write_hyperslab(wrh5_context_t * p_wrh5_ctx, hsize_t * p_start, hsize_t * p_count, const void * p_buffer);
+
+/*
+ * wrh5_bypass.c functions
+ */
+int     wrh5_write_block(wrh5_context_t * p_wrh5_ctx, hsize_t tint_start, size_t ntints, const void * p_block, int flag_debug);
+
+/*
+ * wrh5_valid.c functions
+ */
+int     wrh5_is_fill(const void * p, size_t nbytes);
+int     wrh5_valid_mark(wrh5_context_t * p_wrh5_ctx, hsize_t tint_start, size_t ntints, const void * p_block, int real);
+int     wrh5_write_valid(wrh5_context_t * p_wrh5_ctx, int flag_debug);
+
+/*
+ * wrh5_stage.c functions
+ */
+void    wrh5_stage(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, const void * p_src,
+                   size_t ntints, size_t tint_first, size_t tint_count, void * p_dst);
+void    wrh5_trim_mantissa(const void * p_src, void * p_dst, size_t nelems, unsigned int elem_size, int keep_bits);
+
+/*
+ * wrh5_quant.c functions
+ */
+int     wrh5_quant_init(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, int flag_debug);
+size_t  wrh5_quant_span(wrh5_context_t * p_wrh5_ctx, hsize_t tint_offset, size_t ntints);
+int     wrh5_quantize(wrh5_context_t * p_wrh5_ctx, void * p_staged, hsize_t tint_offset, size_t ntints, int flag_debug);
+int     wrh5_quant_flush(wrh5_context_t * p_wrh5_ctx, int flag_debug);
+void    wrh5_quant_close(wrh5_context_t * p_wrh5_ctx);
+int     wrh5_quant_resume(wrh5_context_t * p_wrh5_ctx, int flag_debug);
+
+/*
+ * wrh5_sk.c functions
+ */
+int     wrh5_sk_init(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, user_options_t * p_options, int resuming, int flag_debug);
+int     wrh5_sk_update(wrh5_context_t * p_wrh5_ctx, const void * p_block, hsize_t tint_start, size_t ntints, int flag_debug);
+void    wrh5_sk_close(wrh5_context_t * p_wrh5_ctx, int flag_debug);
+
+/*
+ * wrh5_detect.c functions
+ */
+int     wrh5_detect_flush(wrh5_context_t * p_wrh5_ctx, int flag_debug);
+
+/*
+ * wrh5_trace.c functions
+ */
+uint64_t wrh5_trace_now(void);
+void    wrh5_trace_record(const char * name, uint64_t t0, int64_t arg);
+
+/*
+ * wrh5_record.c functions
+ */
+void    wrh5_record_open(wrh5_context_t * p_wrh5_ctx, uint64_t t0, wrh5_hdr_t * p_wrh5_hdr, char * output_path,
+                         user_chunking_t * p_user_chunking, user_caching_t * p_user_caching, user_options_t * p_user_options);
+void    wrh5_record_call(wrh5_context_t * p_wrh5_ctx, int type, uint64_t t0, uint64_t n, const void * p_data, int rc);
+
+/*
+ * wrh5_metrics.c functions
+ */
+extern unsigned long wrh5_metrics_messages[WRH5_LOG_NONE];
+void    wrh5_metrics_open(wrh5_context_t * p_wrh5_ctx, const char * output_path);
+void    wrh5_metrics_close(wrh5_context_t * p_wrh5_ctx);
+uint64_t wrh5_metrics_begin(wrh5_context_t * p_wrh5_ctx);
+void    wrh5_metrics_end(wrh5_context_t * p_wrh5_ctx, uint64_t t0, size_t ntints, size_t nbytes, int rc);
+void    wrh5_metrics_missing(wrh5_context_t * p_wrh5_ctx, size_t ntints);
+void    wrh5_metrics_queue(wrh5_context_t * p_wrh5_ctx, int depth);
+
+/*
+ * wrh5_affinity.c functions
+ */
+int     wrh5_parse_list(const char * list, uint64_t * p_mask, int nbits);
+int     wrh5_pin_self(const char * list, const char * who, int flag_debug);
+void    wrh5_numa_self(const char * list, const char * who, int flag_debug);
+void    wrh5_numa_bind(void * p_addr, size_t nbytes, const char * list, const char * who, int flag_debug);
+void    wrh5_thread_stats(pthread_t thread, long tid, const char * name, int pinned, wrh5_thread_stats_t * p_stats);
+
+/*
+ * wrh5_chans.c functions
+ */
+int     wrh5_chans_init(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, user_options_t * p_options,
+                        wrh5_hdr_t * p_file_hdr, int flag_debug);
+int     wrh5_chans_write_index(wrh5_context_t * p_wrh5_ctx, int flag_debug);
+void    wrh5_chans_gather(wrh5_context_t * p_wrh5_ctx, const void * p_src, void * p_dst, size_t nrows);
+void    wrh5_chans_close(wrh5_context_t * p_wrh5_ctx);
+
+/*
+ * wrh5_mmap.c functions
+ */
+int     wrh5_mmap_init(wrh5_context_t * p_wrh5_ctx, char * output_path, int flag_debug);
+int     wrh5_mmap_copy(wrh5_context_t * p_wrh5_ctx, hsize_t * p_start, hsize_t * p_count, const void * p_buffer);
+int     wrh5_mmap_close(wrh5_context_t * p_wrh5_ctx, int flag_debug);
+
+/*
+ * wrh5_pool.c functions
+ */
+int     wrh5_pool_create(wrh5_pool_t * p_pool, size_t bufsize, int nbufs, int flag_debug);
+void *  wrh5_pool_get(wrh5_pool_t * p_pool, int flag_wait);
+int     wrh5_pool_put(wrh5_pool_t * p_pool, void * buffer);
+int     wrh5_pool_owns(wrh5_pool_t * p_pool, void * buffer);
+int     wrh5_pool_destroy(wrh5_pool_t * p_pool, int flag_debug);
 
 /*
  * wrh5_util.c functions
  */
+double  wrh5_thread_cpu_seconds(void);
 void    wrh5_info(const char * format, ...);
 void    wrh5_warning(char * srcfile, int linenum, char * msg);
 void    wrh5_error(char * srcfile, int linenum, char * msg);
 void    wrh5_set_str_attr(hid_t file_or_dataset_id, char * tag, char * value, int flag_debug);
 void    wrh5_set_dataset_double_attr(hid_t dataset_id, char * tag, double * p_value, int flag_debug);
 void    wrh5_set_dataset_int_attr(hid_t dataset_id, char * tag, int * p_value, int flag_debug);
+int     wrh5_get_attr(hid_t file_or_dataset_id, char * tag, hid_t mem_type, void * p_value);
+int     wrh5_get_str_attr(hid_t file_or_dataset_id, char * tag, char * p_value, size_t bufsize);
+hid_t   wrh5_create_rows(hid_t file_id, char * name, hid_t type_id, int rank, hsize_t * row_dims, hsize_t * row_cdims);
+int     wrh5_append_row(hid_t dataset_id, hid_t type_id, int rank, hsize_t * row_dims, hsize_t irow, const void * p_row);
 void    wrh5_write_metadata(hid_t dataset_id, wrh5_hdr_t * p_metadata, int flag_debug);
 void    wrh5_set_ds_label(wrh5_context_t * p_wrh5_ctx, char * label, int dims_index, int flag_debug);
 void    wrh5_show_context(char * caller, wrh5_context_t * p_wrh5_ctx);
 void    wrh5_blimpy_chunking(wrh5_hdr_t * p_wrh5_hdr, hsize_t * p_cdims);
+void    wrh5_cc_align_chunking(wrh5_hdr_t * p_wrh5_hdr, hsize_t * p_cdims);
+
+/*
+ * wrh5_cc_index.c functions
+ */
+int     wrh5_write_cc_index(wrh5_context_t * p_wrh5_ctx, int flag_debug);
 
 // This stringification trick is from "info cpp"
 // See https://gcc.gnu.org/onlinedocs/gcc-4.8.5/cpp/Stringification.html
 #define STRINGIFY1(s) #s
 #define STRINGIFY(s) STRINGIFY1(s)
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
@@ -0,0 +1,224 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_detect.c                                                               *
+ * -------------                                                               *
+ * Fused power detection of dual-polarization complex spectra.                 *
+ *                                                                             *
+ * The caller presents complex64 X and Y spectra (interleaved re, im).  Each   *
+ * spectrum is detected and summed straight into the current staging slot;     *
+ * after detect_nint spectra, the slot is one float32 time integration.        *
+ * A full staging buffer is written in one go, as is a partial one at close.   *
+ *                                                                             *
+ * With XY* = (xr + i.xi)(yr - i.yi):                                          *
+ *     I = |X|^2 + |Y|^2        Q = |X|^2 - |Y|^2                              *
+ *     U = 2 Re(XY*)            V = -2 Im(XY*)                                 *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+#ifdef __SSE2__
+/***
+	Load 4 complex values and split them into 4 real parts and 4 imaginary parts.
+***/
+static inline void load_complex4(const float * p, __m128 * p_re, __m128 * p_im) {
+    __m128 lo = _mm_loadu_ps(p);        // re0 im0 re1 im1
+    __m128 hi = _mm_loadu_ps(p + 4);    // re2 im2 re3 im3
+    *p_re = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    *p_im = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+/***
+	Store or accumulate 4 floats.
+***/
+static inline void put4(float * p, __m128 value, int first) {
+    if(first)
+        _mm_storeu_ps(p, value);
+    else
+        _mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p), value));
+}
+#endif
+
+
+/***
+	Stokes I of one spectrum: out[c] (+)= |X[c]|^2 + |Y[c]|^2
+***/
+static void detect_i(const float * x, const float * y, float * out, size_t nchans, int first) {
+    size_t c = 0;
+    float power;
+
+#ifdef __SSE2__
+    __m128 xr, xi, yr, yi, p;
+    for(; c + 4 <= nchans; c += 4) {
+        load_complex4(x + 2 * c, &xr, &xi);
+        load_complex4(y + 2 * c, &yr, &yi);
+        p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xr, xr), _mm_mul_ps(xi, xi)),
+                       _mm_add_ps(_mm_mul_ps(yr, yr), _mm_mul_ps(yi, yi)));
+        put4(out + c, p, first);
+    }
+#endif
+    for(; c < nchans; c++) {
+        power = x[2 * c] * x[2 * c] + x[2 * c + 1] * x[2 * c + 1]
+              + y[2 * c] * y[2 * c] + y[2 * c + 1] * y[2 * c + 1];
+        out[c] = first ? power : out[c] + power;
+    }
+}
+
+
+/***
+	Stokes I, Q, U, V of one spectrum into 4 IF rows of nchans each.
+***/
+static void detect_iquv(const float * x, const float * y, float * out, size_t nchans, int first) {
+    float * out_i = out;
+    float * out_q = out + nchans;
+    float * out_u = out + 2 * nchans;
+    float * out_v = out + 3 * nchans;
+    size_t c = 0;
+    float xx, yy, re, im;
+
+#ifdef __SSE2__
+    __m128 xr, xi, yr, yi, pxx, pyy, two = _mm_set1_ps(2.0f);
+    for(; c + 4 <= nchans; c += 4) {
+        load_complex4(x + 2 * c, &xr, &xi);
+        load_complex4(y + 2 * c, &yr, &yi);
+        pxx = _mm_add_ps(_mm_mul_ps(xr, xr), _mm_mul_ps(xi, xi));
+        pyy = _mm_add_ps(_mm_mul_ps(yr, yr), _mm_mul_ps(yi, yi));
+        put4(out_i + c, _mm_add_ps(pxx, pyy), first);
+        put4(out_q + c, _mm_sub_ps(pxx, pyy), first);
+        put4(out_u + c, _mm_mul_ps(two, _mm_add_ps(_mm_mul_ps(xr, yr), _mm_mul_ps(xi, yi))), first);
+        put4(out_v + c, _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(xr, yi), _mm_mul_ps(xi, yr))), first);
+    }
+#endif
+    for(; c < nchans; c++) {
+        xx = x[2 * c] * x[2 * c] + x[2 * c + 1] * x[2 * c + 1];
+        yy = y[2 * c] * y[2 * c] + y[2 * c + 1] * y[2 * c + 1];
+        re = 2.0f * (x[2 * c] * y[2 * c] + x[2 * c + 1] * y[2 * c + 1]);
+        im = 2.0f * (x[2 * c] * y[2 * c + 1] - x[2 * c + 1] * y[2 * c]);
+        out_i[c] = first ? xx + yy : out_i[c] + xx + yy;
+        out_q[c] = first ? xx - yy : out_q[c] + xx - yy;
+        out_u[c] = first ? re : out_u[c] + re;
+        out_v[c] = first ? im : out_v[c] + im;
+    }
+}
+
+
+/***
+	Write the completed staging slots (wrh5_detect_flush).
+***/
+static int flush_slots(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    hsize_t selection[NDIMS];
+
+    if(p_wrh5_ctx->keep_mantissa_bits > 0)
+        wrh5_trim_mantissa(p_wrh5_ctx->p_staging, p_wrh5_ctx->p_staging, 
+                           p_wrh5_ctx->acc_slot * p_wrh5_ctx->tint_size / sizeof(float), 
+                           sizeof(float), p_wrh5_ctx->keep_mantissa_bits);
+    p_wrh5_ctx->dump_count += 1;
+    if(wrh5_extend(p_wrh5_ctx, p_wrh5_ctx->acc_slot) != 0)
+        return 1;
+    if(p_wrh5_ctx->sk_m > 0)
+        if(wrh5_sk_update(p_wrh5_ctx, p_wrh5_ctx->p_staging, p_wrh5_ctx->offset_dims[0], p_wrh5_ctx->acc_slot, debugging) != 0)
+            return 1;
+    selection[0] = p_wrh5_ctx->acc_slot;
+    selection[1] = p_wrh5_ctx->filesz_dims[1];
+    selection[2] = p_wrh5_ctx->filesz_dims[2];
+    if(debugging)
+        wrh5_info("wrh5_detect_flush: dump %ld, %lld time integrations at offset %lld\n",
+                  p_wrh5_ctx->dump_count, selection[0], p_wrh5_ctx->offset_dims[0]);
+    if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE) {
+        if(wrh5_quantize(p_wrh5_ctx, p_wrh5_ctx->p_staging, p_wrh5_ctx->offset_dims[0], p_wrh5_ctx->acc_slot, debugging) != 0)
+            return 1;
+    } else if(wrh5_write_block(p_wrh5_ctx, p_wrh5_ctx->offset_dims[0], selection[0], p_wrh5_ctx->p_staging, debugging) != 0)
+        return 1;
+    p_wrh5_ctx->offset_dims[0] += p_wrh5_ctx->acc_slot;
+    p_wrh5_ctx->byte_count += p_wrh5_ctx->acc_slot * p_wrh5_ctx->tint_size;
+    p_wrh5_ctx->acc_slot = 0;
+    return 0;
+}
+
+
+/***
+	Write the completed staging slots, if any.
+	Called when the staging buffer is full and by wrh5_close.
+***/
+int wrh5_detect_flush(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    size_t      ntints = p_wrh5_ctx->acc_slot;
+    uint64_t    metrics_t0;         // Live metrics (see wrh5_metrics.c)
+    int         rc;
+
+    if(ntints == 0)
+        return 0;
+    metrics_t0 = wrh5_metrics_begin(p_wrh5_ctx);
+    rc = flush_slots(p_wrh5_ctx, debugging);
+    wrh5_metrics_end(p_wrh5_ctx, metrics_t0, ntints, ntints * p_wrh5_ctx->tint_size, rc);
+    return rc;
+}
+
+
+/***
+	Detect and integrate spectra (wrh5_write_detect).
+***/
+static int detect_spectra(wrh5_context_t * p_wrh5_ctx,
+                          wrh5_hdr_t * p_wrh5_hdr,
+                          const float * p_x,
+                          const float * p_y,
+                          size_t nspectra,
+                          int debugging) {
+    size_t  nchans = (size_t) p_wrh5_hdr->nchans;
+    size_t  ispec;
+    float * p_slot;
+
+    if(p_wrh5_ctx->detect == WRH5_DETECT_NONE) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_detect: the context was not opened with a detection stage");
+        return 1;
+    }
+    if(!p_wrh5_ctx->usable) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_detect: the context is not usable");
+        return 1;
+    }
+
+    for(ispec = 0; ispec < nspectra; ispec++) {
+        p_slot = (float *) (p_wrh5_ctx->p_staging + p_wrh5_ctx->acc_slot * p_wrh5_ctx->tint_size);
+        if(p_wrh5_ctx->detect == WRH5_DETECT_I)
+            detect_i(p_x + 2 * ispec * nchans, p_y + 2 * ispec * nchans, p_slot, nchans, p_wrh5_ctx->acc_count == 0);
+        else
+            detect_iquv(p_x + 2 * ispec * nchans, p_y + 2 * ispec * nchans, p_slot, nchans, p_wrh5_ctx->acc_count == 0);
+
+        // Time integration complete?  Move on to the next slot; write a full staging buffer.
+        p_wrh5_ctx->acc_count += 1;
+        if(p_wrh5_ctx->acc_count >= p_wrh5_ctx->detect_nint) {
+            p_wrh5_ctx->acc_count = 0;
+            p_wrh5_ctx->acc_slot += 1;
+            if(p_wrh5_ctx->acc_slot >= p_wrh5_ctx->staging_tints)
+                if(wrh5_detect_flush(p_wrh5_ctx, debugging) != 0)
+                    return 1;
+        }
+    }
+
+    /*
+     * Bye-bye.
+     */
+    return 0;
+}
+
+
+/***
+	Main entry point.
+	p_x, p_y : nspectra consecutive spectra of nchans complex64 values each (re, im interleaved)
+***/
+int wrh5_write_detect(wrh5_context_t * p_wrh5_ctx,
+                      wrh5_hdr_t * p_wrh5_hdr,
+                      const float * p_x,
+                      const float * p_y,
+                      size_t nspectra,
+                      int debugging) {
+    uint64_t    record_t0 = WRH5_RECORD_BEGIN();    // Write-pattern recording (see wrh5_record.c)
+    int         rc;
+
+    rc = detect_spectra(p_wrh5_ctx, p_wrh5_hdr, p_x, p_y, nspectra, debugging);
+    if(record_t0 != 0)
+        wrh5_record_call(p_wrh5_ctx, WRH5_REC_DETECT, record_t0, nspectra, NULL, rc);
+    return rc;
+}
@@ -0,0 +1,83 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_hdr.h                                                                  *
+ * ----------                                                                  *
+ * Header (metadata) and chunking definitions, without HDF5, so that the       *
+ * shared-memory client (wrh5_shm.h) does not need HDF5 either.                *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef wrh5_HDR_H
+#define wrh5_HDR_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Header (metadata) definition
+ */
+typedef struct {
+  // 0=fake data; 1=Arecibo; 2=Ooty... others to be added
+  int machine_id;
+  // 0=FAKE; 1=PSPM; 2=WAPP; 3=OOTY... others to be added
+  int telescope_id;
+  // 1=filterbank; 2=time series... others to be added
+  int data_type;
+  // 1 if barycentric or 0 otherwise (only output if non-zero)
+  int barycentric;
+  // 1 if pulsarcentric or 0 otherwise (only output if non-zero)
+  int pulsarcentric;
+  // right ascension (J2000) of source (hours)
+  // will be converted to/from hhmmss.s
+  double src_raj;
+  // declination (J2000) of source (degrees)
+  // will be converted to/from ddmmss.s
+  double src_dej;
+  // telescope azimuth at start of scan (degrees)
+  double az_start;
+  // telescope zenith angle at start of scan (degrees)
+  double za_start;
+  // centre frequency (MHz) of first filterbank channel
+  double fch1;
+  // filterbank channel bandwidth (MHz)
+  double foff;
+  // number of fine filterbank channels (not coarse channels)
+  int nchans;
+  // total number of beams
+  int nbeams;
+  // total number of beams
+  int ibeam;
+  // number of bits per time sample
+  int nbits;
+  // time stamp (MJD) of first sample
+  double tstart;
+  // time interval between samples (s)
+  double tsamp;
+  // number of seperate IF channels
+  int nifs;
+  // the name of the source being observed by the telescope
+  char source_name[81];
+  // the name of the original data file
+  char rawdatafile[81];
+  // Number of fine channels per coarse channel
+  // If unknown, set nfpc=0.  This will cause the output header to omit this field.
+  int nfpc;
+  
+} wrh5_hdr_t;
+
+/*
+ * Optional user chunking definition
+ * If not supplied (NULL) by caller in wrh5_open, default chunking (blimpy) is used.
+ */
+typedef struct {
+    size_t  n_time;       // chunk time dimension
+    size_t  n_nifs;       // chunk nifs dimension
+    size_t  n_fine_chan;  // chunk fine channel dimension
+} user_chunking_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1068 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_manager.c                                                              *
+ * --------------                                                              *
+ * Multi-file writer manager: many contexts (streams), one pool of encoding    *
+ * worker threads, one HDF5 I/O thread.                                        *
+ *                                                                             *
+ * A dump is submitted in a buffer of its stream's pool, whose queue_depth     *
+ * buffers bound the dumps in flight per stream (wrh5_manager_get_buffer waits *
+ * for one).  Each whole chunk of the dump is one task for the workers:        *
+ * gather it from the dump (zero-padded), then deflate it if the stream's      *
+ * filter is deflate.  Tasks are spread over the workers' queues; a worker     *
+ * takes its newest task first and, when its queue is empty, steals the        *
+ * oldest task of another worker.                                              *
+ * The I/O thread alone stores the dumps: it extends "data", writes the time   *
+ * integrations outside whole chunk rows through the filter pipeline and the   *
+ * encoded chunks with H5Dwrite_chunk.  It takes at most one ready dump per    *
+ * stream in turn (round robin), and the dumps of a stream in order.           *
+ * A stream whose options need wrh5_write (staging, detection, SK, bypass,     *
+ * fill elision) or whose filter is Bitshuffle (only HDF5 can run it) still    *
+ * gets the queue and the I/O thread, with wrh5_write there.                   *
+ * Streams are opened and closed by the calling thread.                        *
+ *                                                                             *
+ * Real-time mode (rt_policy): a call that finds no free dump buffer waits at  *
+ * most rt_budget_ms, then drops a dump instead of stalling its producer.      *
+ * A dropped dump keeps its place in the file: its time integrations are       *
+ * recorded as missing (wrh5_write_missing, by the I/O thread, just before the *
+ * next dump stored), and counted in the statistics.                           *
+ *                                                                             *
+ * Placement (worker_cpus, io_cpus, numa_nodes): each thread pins itself and   *
+ * sets its memory policy as it starts, so that its own allocations (worker    *
+ * scratch, the HDF5 chunk caches filled by the I/O thread) are node-local;    *
+ * the dump buffers and encoding area of each stream are bound at open.        *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+
+typedef struct mgr_dump mgr_dump_t;
+
+/*
+ * One chunk to encode.
+ */
+typedef struct mgr_task {
+    mgr_dump_t * p_dump;        // Dump that holds the chunk
+    int     ichunk;             // Whole chunk number in the dump
+    struct mgr_task * prev;     // Worker queue links
+    struct mgr_task * next;
+} mgr_task_t;
+
+/*
+ * One dump in flight (one per pool buffer of the stream).
+ */
+struct mgr_dump {
+    struct wrh5_mgr_stream * p_stream;
+    char *  buffer;             // Pool buffer holding the dump
+    size_t  bufsize;            // Byte size of the dump
+    size_t  ntints;             // Time integrations in the dump
+    hsize_t tint_start;         // First time integration of the dump in the file
+    hsize_t row_first;          // Whole chunk rows, dump-relative: [row_first, row_end)
+    hsize_t row_end;
+    int     nchunks;            // Whole chunks, encoded by the workers
+    int     nleft;              // Chunks not encoded yet (atomic)
+    int     failed;             // 1: a worker could not encode a chunk
+    char *  p_enc;              // Encoded chunks, enc_stride bytes apart
+    size_t * enc_len;           // Encoded byte size of each chunk
+    mgr_task_t * tasks;         // One per chunk
+    size_t  gap_tints;          // Dropped time integrations just before this dump (recorded as missing first)
+    int     raw;                // 1: the whole chunks are stored uncompressed (WRH5_RT_DEGRADE)
+    mgr_dump_t * next;          // Stream FIFO link
+};
+
+struct wrh5_mgr_stream {
+    int     state;              // 0: free, 1: being opened, 2: open
+    int     failed;             // 1: a dump could not be stored; later dumps are dropped
+    wrh5_context_t ctx;         // Output file context
+    wrh5_hdr_t hdr;             // Private copy of the header
+    wrh5_pool_t pool;           // Dump buffers: queue_depth of them
+    size_t  max_dump_bytes;     // Largest dump accepted
+    mgr_dump_t * dumps;         // One per pool buffer
+    mgr_task_t * tasks;         // max_chunks per dump
+    size_t * enc_len;           // max_chunks per dump
+    char *  p_enc;              // max_chunks encoded chunks per dump
+    size_t  chunk_bytes;        // Byte size of one chunk
+    size_t  enc_stride;         // Room for one encoded chunk
+    size_t  enc_bytes;          // Byte size of p_enc (reserved from the memory budget)
+    int     row_chunks;         // Chunks in a chunk row (all IFs and fine channels)
+    int     max_chunks;         // Whole chunks in a dump at most
+    int     direct;             // 1: the workers encode whole chunks; 0: wrh5_write on the I/O thread
+    hsize_t next_tint;          // First time integration of the next dump submitted
+    mgr_dump_t * head;          // FIFO of the dumps submitted and not stored yet
+    mgr_dump_t * tail;
+    int     nqueued;            // Dumps in the FIFO
+    size_t  gap_tints;          // Dropped time integrations not attached to a dump yet
+    int     degraded;           // 1: dumps submitted now skip compression (WRH5_RT_DEGRADE)
+    wrh5_manager_stats_t stats; // This stream's statistics
+};
+
+struct wrh5_mgr_worker {
+    wrh5_manager_t * p_mgr;
+    int     index;              // Worker number
+    pthread_t thread;
+    long    tid;                // Linux thread ID
+    int     pinned;             // 1: pinned to worker_cpus
+    pthread_mutex_t lock;       // Protects head and tail
+    mgr_task_t * head;          // Oldest task (stolen first)
+    mgr_task_t * tail;          // Newest task (taken first by the owner)
+    char *  p_scratch;          // One gathered chunk, to be deflated
+    size_t  scratch_size;
+    unsigned long chunks;       // Chunks encoded
+    unsigned long steals;       // Chunks stolen
+    double  encode_seconds;     // Time spent encoding
+};
+
+
+/***
+	Monotonic clock in seconds.
+***/
+static double now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+
+/***
+	Chunk coordinates of whole chunk ichunk of a dump (dump-relative time offset).
+***/
+static void chunk_coords(struct wrh5_mgr_stream * p_stream, mgr_dump_t * p_dump, int ichunk, hsize_t * p_start, hsize_t * p_count) {
+    hsize_t * cdims = p_stream->ctx.cdims;
+    hsize_t * dims = p_stream->ctx.filesz_dims;
+    hsize_t   nci = (dims[1] + cdims[1] - 1) / cdims[1];
+    hsize_t   ncc = (dims[2] + cdims[2] - 1) / cdims[2];
+    hsize_t   rem = (hsize_t) ichunk % (nci * ncc);
+
+    p_start[0] = p_dump->row_first + ((hsize_t) ichunk / (nci * ncc)) * cdims[0];
+    p_start[1] = (rem / ncc) * cdims[1];
+    p_start[2] = (rem % ncc) * cdims[2];
+    p_count[0] = cdims[0];
+    p_count[1] = (p_start[1] + cdims[1] <= dims[1]) ? cdims[1] : dims[1] - p_start[1];
+    p_count[2] = (p_start[2] + cdims[2] <= dims[2]) ? cdims[2] : dims[2] - p_start[2];
+}
+
+
+/***
+	Worker: gather one whole chunk, zero-padded, and deflate it if the filter is deflate.
+	Stored raw (filter skipped) if deflate does not make it smaller.
+***/
+static void encode_chunk(struct wrh5_mgr_worker * p_worker, mgr_task_t * p_task) {
+    mgr_dump_t * p_dump = p_task->p_dump;
+    struct wrh5_mgr_stream * p_stream = p_dump->p_stream;
+    hsize_t * cdims = p_stream->ctx.cdims;
+    hsize_t * dims = p_stream->ctx.filesz_dims;
+    size_t    esz = p_stream->ctx.elem_size;
+    size_t    chunk_bytes = p_stream->chunk_bytes;
+    char *    p_enc = p_dump->p_enc + p_task->ichunk * p_stream->enc_stride;
+    char *    p_dst = p_enc;
+    hsize_t   start[NDIMS], count[NDIMS];
+    uLongf    enc_len;
+    size_t    t, i;
+    int       deflate = (p_stream->ctx.deflate_level > 0 && !p_dump->raw);
+    uint64_t  trace_t0 = WRH5_TRACE_BEGIN();
+
+    if(deflate) {
+        if(p_worker->scratch_size < chunk_bytes) {
+            free(p_worker->p_scratch);
+            p_worker->p_scratch = malloc(chunk_bytes);
+            p_worker->scratch_size = (p_worker->p_scratch != NULL) ? chunk_bytes : 0;
+            if(p_worker->p_scratch == NULL) {
+                wrh5_error(__FILE__, __LINE__, "wrh5_manager: malloc of a worker chunk buffer FAILED");
+                p_dump->failed = 1;
+                return;
+            }
+        }
+        p_dst = p_worker->p_scratch;
+    }
+
+    chunk_coords(p_stream, p_dump, p_task->ichunk, start, count);
+    if(count[1] < cdims[1] || count[2] < cdims[2])
+        memset(p_dst, 0, chunk_bytes);
+    for(t = 0; t < count[0]; t++)
+        for(i = 0; i < count[1]; i++)
+            memcpy(p_dst + ((t * cdims[1] + i) * cdims[2]) * esz,
+                   p_dump->buffer + (((start[0] + t) * dims[1] + start[1] + i) * dims[2] + start[2]) * esz,
+                   count[2] * esz);
+
+    p_dump->enc_len[p_task->ichunk] = chunk_bytes;
+    if(deflate) {
+        enc_len = (uLongf) p_stream->enc_stride;
+        if(compress2((Bytef *) p_enc, &enc_len, (const Bytef *) p_dst, (uLong) chunk_bytes,
+                     p_stream->ctx.deflate_level) == Z_OK && enc_len < chunk_bytes)
+            p_dump->enc_len[p_task->ichunk] = enc_len;
+        else
+            memcpy(p_enc, p_dst, chunk_bytes);
+    }
+    WRH5_TRACE_END(trace_t0, "encode_chunk", p_dump->enc_len[p_task->ichunk]);
+}
+
+
+/***
+	Worker queue: take the newest task (owner) or the oldest (thief).
+***/
+static mgr_task_t * take_task(struct wrh5_mgr_worker * p_worker, int newest) {
+    mgr_task_t * p_task;
+
+    pthread_mutex_lock(&p_worker->lock);
+    p_task = newest ? p_worker->tail : p_worker->head;
+    if(p_task != NULL) {
+        if(p_task->prev != NULL)
+            p_task->prev->next = p_task->next;
+        else
+            p_worker->head = p_task->next;
+        if(p_task->next != NULL)
+            p_task->next->prev = p_task->prev;
+        else
+            p_worker->tail = p_task->prev;
+    }
+    pthread_mutex_unlock(&p_worker->lock);
+    return p_task;
+}
+
+
+/***
+	Worker thread.
+***/
+static void * worker_main(void * p_arg) {
+    struct wrh5_mgr_worker * p_worker = (struct wrh5_mgr_worker *) p_arg;
+    wrh5_manager_t * p_mgr = p_worker->p_mgr;
+    mgr_task_t * p_task;
+    double t0;
+    int    k;
+    char   name[32];
+
+    sprintf(name, "wrh5 worker %d", p_worker->index);
+    wrh5_trace_thread_name(name);
+    p_worker->tid = (long) syscall(SYS_gettid);
+    p_worker->pinned = wrh5_pin_self(p_mgr->worker_cpus, name, p_mgr->debugging);
+    wrh5_numa_self(p_mgr->numa_nodes, name, p_mgr->debugging);
+    for(;;) {
+        // Reserve one of the queued tasks, then find it: in this worker's queue, else in another's.
+        pthread_mutex_lock(&p_mgr->lock);
+        while(p_mgr->ntasks == 0 && !p_mgr->quit)
+            pthread_cond_wait(&p_mgr->work, &p_mgr->lock);
+        if(p_mgr->ntasks == 0) {
+            pthread_mutex_unlock(&p_mgr->lock);
+            break;
+        }
+        p_mgr->ntasks -= 1;
+        pthread_mutex_unlock(&p_mgr->lock);
+        for(p_task = NULL; p_task == NULL; ) {
+            p_task = take_task(p_worker, 1);
+            for(k = 1; k < p_mgr->nthreads && p_task == NULL; k++)
+                if((p_task = take_task(&p_mgr->workers[(p_worker->index + k) % p_mgr->nthreads], 0)) != NULL)
+                    p_worker->steals += 1;
+        }
+
+        t0 = now_seconds();
+        encode_chunk(p_worker, p_task);
+        p_worker->encode_seconds += now_seconds() - t0;
+        p_worker->chunks += 1;
+        if(__atomic_sub_fetch(&p_task->p_dump->nleft, 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&p_mgr->lock);
+            pthread_cond_broadcast(&p_mgr->ready);     // The I/O thread, and a producer in drop_oldest
+            pthread_mutex_unlock(&p_mgr->lock);
+        }
+    }
+    return NULL;
+}
+
+
+/***
+	I/O thread: store one dump whose chunks are encoded.
+***/
+static int store_dump(struct wrh5_mgr_stream * p_stream, mgr_dump_t * p_dump, double * p_stored, int debugging) {
+    wrh5_context_t * p_wrh5_ctx = &p_stream->ctx;
+    hsize_t start[NDIMS], count[NDIMS], offset[NDIMS];
+    int     ichunk;
+    uint64_t trace_t0;
+
+    if(p_dump->gap_tints > 0 && wrh5_write_missing(p_wrh5_ctx, &p_stream->hdr, p_dump->gap_tints, debugging) != 0)
+        return 1;
+    if(!p_stream->direct)
+        return wrh5_write(p_wrh5_ctx, &p_stream->hdr, p_dump->buffer, p_dump->bufsize, debugging);
+    if(p_dump->failed)
+        return 1;
+
+    p_wrh5_ctx->dump_count += 1;
+    if(wrh5_extend(p_wrh5_ctx, p_dump->ntints) != 0)
+        return 1;
+    if(wrh5_valid_mark(p_wrh5_ctx, p_dump->tint_start, p_dump->ntints, p_dump->buffer, 1) != 0)
+        return 1;
+
+    // Time integrations outside whole chunk rows go through the filter pipeline.
+    start[1] = start[2] = 0;
+    count[1] = p_wrh5_ctx->filesz_dims[1];
+    count[2] = p_wrh5_ctx->filesz_dims[2];
+    if(p_dump->row_first > 0) {
+        start[0] = p_dump->tint_start;
+        count[0] = p_dump->row_first;
+        if(wrh5_write_hyperslab(p_wrh5_ctx, start, count, p_dump->buffer) != 0)
+            return 1;
+    }
+    if(p_dump->row_end < p_dump->ntints) {
+        start[0] = p_dump->tint_start + p_dump->row_end;
+        count[0] = p_dump->ntints - p_dump->row_end;
+        if(wrh5_write_hyperslab(p_wrh5_ctx, start, count, p_dump->buffer + p_dump->row_end * p_wrh5_ctx->tint_size) != 0)
+            return 1;
+    }
+
+    // Whole chunks as encoded: filter mask 1 (skip filter 0) for a deflate chunk stored raw.
+    for(ichunk = 0; ichunk < p_dump->nchunks; ichunk++) {
+        size_t enc_len = p_dump->enc_len[ichunk];
+
+        chunk_coords(p_stream, p_dump, ichunk, offset, count);
+        offset[0] += p_dump->tint_start;
+        trace_t0 = WRH5_TRACE_BEGIN();
+        if(H5Dwrite_chunk(p_wrh5_ctx->dataset_id, H5P_DEFAULT,
+                          (p_wrh5_ctx->filtered && enc_len == p_stream->chunk_bytes) ? 1 : 0,
+                          offset, enc_len, p_dump->p_enc + ichunk * p_stream->enc_stride) < 0) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_manager: H5Dwrite_chunk FAILED");
+            p_wrh5_ctx->usable = 0;
+            return 1;
+        }
+        WRH5_TRACE_END(trace_t0, "H5Dwrite_chunk", enc_len);
+        *p_stored += enc_len;
+    }
+    if(p_wrh5_ctx->filtered) {
+        p_wrh5_ctx->compress_chunks += p_dump->nchunks;
+        p_wrh5_ctx->compress_bytes += (double) (p_dump->row_end - p_dump->row_first) * p_wrh5_ctx->tint_size;
+    }
+    p_wrh5_ctx->offset_dims[0] += p_dump->ntints;
+    p_wrh5_ctx->byte_count += p_dump->bufsize;
+    p_wrh5_ctx->usable = 1;
+    return 0;
+}
+
+
+/***
+	I/O thread: store ready dumps, one per stream in turn.
+***/
+static void * io_main(void * p_arg) {
+    wrh5_manager_t * p_mgr = (wrh5_manager_t *) p_arg;
+    struct wrh5_mgr_stream * p_stream = NULL;
+    mgr_dump_t * p_dump;
+    char    msgstr[256];
+    double  t0, elapsed, stored;
+    int     k, rc;
+    uint64_t trace_t0, metrics_t0;
+
+    wrh5_trace_thread_name("wrh5 io");
+    p_mgr->io_tid = (long) syscall(SYS_gettid);
+    p_mgr->io_pinned = wrh5_pin_self(p_mgr->io_cpus, "wrh5 io", p_mgr->debugging);
+    wrh5_numa_self(p_mgr->numa_nodes, "wrh5 io", p_mgr->debugging);
+    pthread_mutex_lock(&p_mgr->lock);
+    for(;;) {
+        p_dump = NULL;
+        for(k = 0; k < p_mgr->max_streams && p_dump == NULL; k++) {
+            p_stream = &p_mgr->streams[(p_mgr->rr + k) % p_mgr->max_streams];
+            if(p_stream->head != NULL && __atomic_load_n(&p_stream->head->nleft, __ATOMIC_ACQUIRE) == 0) {
+                p_dump = p_stream->head;
+                p_stream->head = p_dump->next;
+                if(p_stream->head == NULL)
+                    p_stream->tail = NULL;
+                p_mgr->rr = (p_mgr->rr + k + 1) % p_mgr->max_streams;
+            }
+        }
+        if(p_dump == NULL) {
+            if(p_mgr->quit)
+                break;
+            pthread_cond_wait(&p_mgr->ready, &p_mgr->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&p_mgr->lock);
+
+        // A stream that failed drops its later dumps.
+        t0 = now_seconds();
+        trace_t0 = WRH5_TRACE_BEGIN();
+        stored = 0.0;
+        metrics_t0 = (p_stream->direct || p_stream->failed) ? wrh5_metrics_begin(&p_stream->ctx) : 0;   // Else wrh5_write's
+        rc = p_stream->failed ? 1 : store_dump(p_stream, p_dump, &stored, p_mgr->debugging);
+        wrh5_metrics_end(&p_stream->ctx, metrics_t0, p_dump->ntints, p_dump->bufsize, rc);
+        WRH5_TRACE_END(trace_t0, "store_dump", p_dump->ntints);
+        elapsed = now_seconds() - t0;
+        if(rc != 0 && !p_stream->failed) {
+            sprintf(msgstr, "wrh5_manager: stream %d FAILED to store a dump; its later dumps are dropped",
+                    (int) (p_stream - p_mgr->streams));
+            wrh5_error(__FILE__, __LINE__, msgstr);
+        }
+
+        pthread_mutex_lock(&p_mgr->lock);
+        if(rc != 0)
+            p_stream->failed = 1;
+        else {
+            p_stream->stats.dumps += 1;
+            p_stream->stats.encoded_dumps += p_stream->direct;
+            p_stream->stats.raw_dumps += p_dump->raw;
+            p_stream->stats.chunks += p_dump->nchunks;
+            p_stream->stats.bytes_stored += stored;
+            p_mgr->totals.dumps += 1;
+            p_mgr->totals.encoded_dumps += p_stream->direct;
+            p_mgr->totals.raw_dumps += p_dump->raw;
+        }
+        p_stream->stats.io_seconds += elapsed;
+        p_mgr->totals.io_seconds += elapsed;
+        p_stream->nqueued -= 1;
+        wrh5_metrics_queue(&p_stream->ctx, p_stream->nqueued);
+        wrh5_pool_put(&p_stream->pool, p_dump->buffer);     // Under the lock: in step with nqueued
+        pthread_cond_broadcast(&p_mgr->stored);
+    }
+    pthread_mutex_unlock(&p_mgr->lock);
+    return NULL;
+}
+
+
+/***
+	Create a manager: start the workers and the I/O thread.
+***/
+int wrh5_manager_create(wrh5_manager_t * p_mgr, user_manager_t * p_params, int debugging) {
+    user_manager_t params;
+    int    ii;
+
+    if(p_params == NULL)
+        memset(&params, 0, sizeof(params));
+    else
+        memcpy(&params, p_params, sizeof(params));
+    if(params.nthreads < 0 || params.queue_depth < 0 || params.max_streams < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_create: nthreads, queue_depth and max_streams must be >= 0");
+        return 1;
+    }
+    if(params.rt_policy < WRH5_RT_BLOCK || params.rt_policy > WRH5_RT_DEGRADE || params.rt_budget_ms < 0.0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_create: rt_policy must be a WRH5_RT_ value and rt_budget_ms >= 0");
+        return 1;
+    }
+    params.worker_cpus[sizeof(params.worker_cpus) - 1] = '\0';
+    params.io_cpus[sizeof(params.io_cpus) - 1] = '\0';
+    params.numa_nodes[sizeof(params.numa_nodes) - 1] = '\0';
+    if(wrh5_parse_list(params.worker_cpus, NULL, WRH5_MAX_CPUS) != 0 || wrh5_parse_list(params.io_cpus, NULL, WRH5_MAX_CPUS) != 0
+       || wrh5_parse_list(params.numa_nodes, NULL, WRH5_MAX_NODES) != 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_create: worker_cpus, io_cpus and numa_nodes must be lists like \"0-3,8\"");
+        return 1;
+    }
+#ifndef __linux__
+    if(params.worker_cpus[0] != '\0' || params.io_cpus[0] != '\0' || params.numa_nodes[0] != '\0') {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_create: worker_cpus, io_cpus and numa_nodes are only available on Linux");
+        return 1;
+    }
+#endif
+    memset(p_mgr, 0, sizeof(wrh5_manager_t));
+    p_mgr->nthreads = (params.nthreads > 0) ? params.nthreads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(p_mgr->nthreads < 1)
+        p_mgr->nthreads = 1;
+    p_mgr->queue_depth = (params.queue_depth > 0) ? params.queue_depth : 4;
+    p_mgr->max_streams = (params.max_streams > 0) ? params.max_streams : 64;
+    p_mgr->debugging = debugging;
+    p_mgr->rt_policy = params.rt_policy;
+    p_mgr->rt_budget = params.rt_budget_ms / 1000.0;
+    strcpy(p_mgr->worker_cpus, params.worker_cpus);
+    strcpy(p_mgr->io_cpus, params.io_cpus);
+    strcpy(p_mgr->numa_nodes, params.numa_nodes);
+    p_mgr->streams = calloc(p_mgr->max_streams, sizeof(struct wrh5_mgr_stream));
+    p_mgr->workers = calloc(p_mgr->nthreads, sizeof(struct wrh5_mgr_worker));
+    if(p_mgr->streams == NULL || p_mgr->workers == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_create: calloc FAILED");
+        free(p_mgr->streams);
+        free(p_mgr->workers);
+        return 1;
+    }
+    pthread_mutex_init(&p_mgr->lock, NULL);
+    pthread_cond_init(&p_mgr->work, NULL);
+    pthread_cond_init(&p_mgr->ready, NULL);
+    pthread_cond_init(&p_mgr->stored, NULL);
+
+    for(ii = 0; ii < p_mgr->nthreads; ii++) {
+        p_mgr->workers[ii].p_mgr = p_mgr;
+        p_mgr->workers[ii].index = ii;
+        pthread_mutex_init(&p_mgr->workers[ii].lock, NULL);
+    }
+    for(ii = 0; ii < p_mgr->nthreads; ii++)
+        if(pthread_create(&p_mgr->workers[ii].thread, NULL, worker_main, &p_mgr->workers[ii]) != 0)
+            break;
+    if(ii < p_mgr->nthreads || pthread_create(&p_mgr->io_thread, NULL, io_main, p_mgr) != 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_create: pthread_create FAILED");
+        pthread_mutex_lock(&p_mgr->lock);
+        p_mgr->quit = 1;
+        pthread_cond_broadcast(&p_mgr->work);
+        pthread_mutex_unlock(&p_mgr->lock);
+        while(--ii >= 0)
+            pthread_join(p_mgr->workers[ii].thread, NULL);
+        free(p_mgr->streams);
+        free(p_mgr->workers);
+        memset(p_mgr, 0, sizeof(wrh5_manager_t));
+        return 1;
+    }
+    if(debugging)
+        wrh5_info("wrh5_manager_create: %d workers, queue depth %d, up to %d streams, real-time policy %d (%.1f ms)\n",
+                  p_mgr->nthreads, p_mgr->queue_depth, p_mgr->max_streams, p_mgr->rt_policy, params.rt_budget_ms);
+    return 0;
+}
+
+
+/***
+	Free the dump buffers and encoding areas of a stream.
+***/
+static void stream_free(struct wrh5_mgr_stream * p_stream, int debugging) {
+    if(p_stream->pool.base != NULL)
+        wrh5_pool_destroy(&p_stream->pool, debugging);
+    free(p_stream->dumps);
+    free(p_stream->tasks);
+    free(p_stream->enc_len);
+    free(p_stream->p_enc);
+    if(p_stream->enc_bytes > 0)
+        wrh5_budget_release(p_stream->enc_bytes);
+}
+
+
+/***
+	Open a stream (wrh5_open_ext in the calling thread); *p_stream receives its number.
+	Dumps must be whole time integrations of at most max_dump_bytes.
+***/
+int wrh5_manager_open(wrh5_manager_t * p_mgr, int * p_stream_no, wrh5_hdr_t * p_wrh5_hdr, char * output_path,
+                      user_chunking_t * p_user_chunking, user_caching_t * p_user_caching,
+                      user_options_t * p_user_options, size_t max_dump_bytes) {
+    struct wrh5_mgr_stream * p_stream;
+    wrh5_context_t * p_wrh5_ctx;
+    hid_t   dcpl;
+    size_t  max_tints, nci, ncc;
+    const char * numa_nodes = (p_user_options != NULL && p_user_options->numa_nodes[0] != '\0')
+                              ? p_user_options->numa_nodes : p_mgr->numa_nodes;
+    char    msgstr[256];
+    int     ii, jj, debugging = p_mgr->debugging;
+
+    // Reserve a table entry.
+    pthread_mutex_lock(&p_mgr->lock);
+    for(ii = 0; ii < p_mgr->max_streams && p_mgr->streams[ii].state != 0; ii++)
+        ;
+    if(ii < p_mgr->max_streams)
+        p_mgr->streams[ii].state = 1;
+    pthread_mutex_unlock(&p_mgr->lock);
+    if(ii >= p_mgr->max_streams) {
+        sprintf(msgstr, "wrh5_manager_open: all %d streams are open", p_mgr->max_streams);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    p_stream = &p_mgr->streams[ii];
+    memset(p_stream, 0, sizeof(struct wrh5_mgr_stream));
+    p_stream->state = 1;
+    p_wrh5_ctx = &p_stream->ctx;
+
+    if(wrh5_open_ext(p_wrh5_ctx, p_wrh5_hdr, output_path, p_user_chunking, p_user_caching, p_user_options, debugging) != 0) {
+        p_stream->state = 0;
+        return 1;
+    }
+    memcpy(&p_stream->hdr, p_wrh5_hdr, sizeof(wrh5_hdr_t));
+    max_tints = max_dump_bytes / p_wrh5_ctx->in_tint_size;
+    if(max_tints < 1) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_open: max_dump_bytes is less than one time integration");
+        wrh5_close(p_wrh5_ctx, debugging);
+        p_stream->state = 0;
+        return 1;
+    }
+    p_stream->max_dump_bytes = max_tints * p_wrh5_ctx->in_tint_size;
+
+    // Whole chunks are encoded by the workers unless wrh5_write has more to do, or only HDF5 can compress.
+    // A contiguous (memory mapped) "data" has no chunks: wrh5_write copies into the mapping.
+    p_stream->direct = (p_wrh5_ctx->p_map == NULL && p_wrh5_ctx->p_staging == NULL && p_wrh5_ctx->detect == WRH5_DETECT_NONE && p_wrh5_ctx->sk_m == 0
+                        && p_wrh5_ctx->bypass_min_ratio <= 0.0 && !p_wrh5_ctx->elide_fill
+                        && (!p_wrh5_ctx->filtered || p_wrh5_ctx->deflate_level > 0));
+    if(p_stream->direct && p_wrh5_ctx->deflate_level > 0) {
+        dcpl = H5Dget_create_plist(p_wrh5_ctx->dataset_id);
+        p_stream->direct = (dcpl >= 0 && H5Pget_nfilters(dcpl) == 1);
+        if(dcpl >= 0)
+            H5Pclose(dcpl);
+    }
+    if(p_stream->direct) {
+        nci = (p_wrh5_ctx->filesz_dims[1] + p_wrh5_ctx->cdims[1] - 1) / p_wrh5_ctx->cdims[1];
+        ncc = (p_wrh5_ctx->filesz_dims[2] + p_wrh5_ctx->cdims[2] - 1) / p_wrh5_ctx->cdims[2];
+        p_stream->row_chunks = (int) (nci * ncc);
+        p_stream->max_chunks = (int) (max_tints / p_wrh5_ctx->cdims[0]) * p_stream->row_chunks;
+        p_stream->chunk_bytes = p_wrh5_ctx->cdims[0] * p_wrh5_ctx->cdims[1] * p_wrh5_ctx->cdims[2] * p_wrh5_ctx->elem_size;
+        p_stream->enc_stride = (p_wrh5_ctx->deflate_level > 0) ? (size_t) compressBound((uLong) p_stream->chunk_bytes)
+                                                               : p_stream->chunk_bytes;
+        p_stream->enc_stride = (p_stream->enc_stride + 63) / 64 * 64;
+    }
+
+    // Dump buffers (the queue) and encoding areas.
+    if(wrh5_pool_create(&p_stream->pool, p_stream->max_dump_bytes, p_mgr->queue_depth, debugging) != 0)
+        goto failed;
+    p_stream->dumps = calloc(p_mgr->queue_depth, sizeof(mgr_dump_t));
+    p_stream->tasks = calloc((size_t) p_mgr->queue_depth * p_stream->max_chunks + 1, sizeof(mgr_task_t));
+    p_stream->enc_len = calloc((size_t) p_mgr->queue_depth * p_stream->max_chunks + 1, sizeof(size_t));
+    if(p_stream->dumps == NULL || p_stream->tasks == NULL || p_stream->enc_len == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_open: calloc FAILED");
+        goto failed;
+    }
+    if(p_stream->max_chunks > 0) {
+        if(wrh5_budget_acquire((size_t) p_mgr->queue_depth * p_stream->max_chunks * p_stream->enc_stride, 0, 0, NULL,
+                               "wrh5_manager_open", debugging) != 0)
+            goto failed;
+        p_stream->enc_bytes = (size_t) p_mgr->queue_depth * p_stream->max_chunks * p_stream->enc_stride;
+        if(posix_memalign((void **) &p_stream->p_enc, (size_t) sysconf(_SC_PAGESIZE), p_stream->enc_bytes) != 0) {
+            p_stream->p_enc = NULL;
+            wrh5_error(__FILE__, __LINE__, "wrh5_manager_open: allocation of the encoding area FAILED");
+            goto failed;
+        }
+        wrh5_numa_bind(p_stream->p_enc, p_stream->enc_bytes, numa_nodes, "wrh5_manager_open", debugging);
+    }
+    wrh5_numa_bind(p_stream->pool.base, p_stream->pool.map_size, numa_nodes, "wrh5_manager_open", debugging);
+    for(jj = 0; jj < p_mgr->queue_depth; jj++) {
+        p_stream->dumps[jj].p_stream = p_stream;
+        p_stream->dumps[jj].buffer = p_stream->pool.base + jj * p_stream->pool.bufsize;
+        p_stream->dumps[jj].tasks = p_stream->tasks + jj * p_stream->max_chunks;
+        p_stream->dumps[jj].enc_len = p_stream->enc_len + jj * p_stream->max_chunks;
+        if(p_stream->p_enc != NULL)
+            p_stream->dumps[jj].p_enc = p_stream->p_enc + jj * p_stream->max_chunks * p_stream->enc_stride;
+    }
+    p_stream->next_tint = p_wrh5_ctx->offset_dims[0];   // 0, or the end of a resumed file
+
+    pthread_mutex_lock(&p_mgr->lock);
+    p_stream->state = 2;
+    pthread_mutex_unlock(&p_mgr->lock);
+    *p_stream_no = ii;
+    if(debugging)
+        wrh5_info("wrh5_manager_open: stream %d -> %s, %s, up to %d chunks per dump\n", ii, output_path,
+                  p_stream->direct ? "chunks encoded by the workers" : "wrh5_write on the I/O thread", p_stream->max_chunks);
+    return 0;
+
+failed:
+    stream_free(p_stream, debugging);
+    wrh5_close(p_wrh5_ctx, debugging);
+    p_stream->state = 0;
+    return 1;
+}
+
+
+/***
+	Validate a stream number.
+***/
+static struct wrh5_mgr_stream * get_stream(wrh5_manager_t * p_mgr, int stream, const char * caller) {
+    char msgstr[256];
+
+    if(stream < 0 || stream >= p_mgr->max_streams || p_mgr->streams[stream].state != 2) {
+        sprintf(msgstr, "%s: stream %d is not open", caller, stream);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return NULL;
+    }
+    return &p_mgr->streams[stream];
+}
+
+
+/***
+	Count a dropped dump.  Called with the manager lock held; returns 1 for the stream's first drop.
+***/
+static int count_drop(wrh5_manager_t * p_mgr, struct wrh5_mgr_stream * p_stream, size_t ntints) {
+    p_stream->stats.dropped_dumps += 1;
+    p_stream->stats.dropped_tints += ntints;
+    p_mgr->totals.dropped_dumps += 1;
+    p_mgr->totals.dropped_tints += ntints;
+    return p_stream->stats.dropped_dumps == 1;
+}
+
+
+/***
+	Warn once per stream that the real-time policy drops dumps (wrh5_manager_close reports the total).
+***/
+static void warn_drop(wrh5_manager_t * p_mgr, struct wrh5_mgr_stream * p_stream) {
+    char msgstr[256];
+
+    sprintf(msgstr, "wrh5_manager: stream %d has no free dump buffer within %.1f ms; dumps are being dropped",
+            (int) (p_stream - p_mgr->streams), p_mgr->rt_budget * 1000.0);
+    wrh5_warning(__FILE__, __LINE__, msgstr);
+}
+
+
+/***
+	WRH5_RT_DROP_OLDEST: take back the buffer of the oldest dump waiting to be stored, once the workers are done with it.
+	Its time integrations (and the gap before it) become a gap before the next dump.
+	Called with the manager lock held.  NULL if no dump is waiting.
+***/
+static void * drop_oldest(wrh5_manager_t * p_mgr, struct wrh5_mgr_stream * p_stream, int * p_first) {
+    mgr_dump_t * p_dump;
+
+    while((p_dump = p_stream->head) != NULL && __atomic_load_n(&p_dump->nleft, __ATOMIC_ACQUIRE) > 0)
+        pthread_cond_wait(&p_mgr->ready, &p_mgr->lock);
+    if(p_dump == NULL)
+        return NULL;
+    p_stream->head = p_dump->next;
+    if(p_stream->head != NULL)
+        p_stream->head->gap_tints += p_dump->gap_tints + p_dump->ntints;
+    else {
+        p_stream->tail = NULL;
+        p_stream->gap_tints += p_dump->gap_tints + p_dump->ntints;
+    }
+    p_stream->nqueued -= 1;
+    wrh5_metrics_queue(&p_stream->ctx, p_stream->nqueued);
+    *p_first = count_drop(p_mgr, p_stream, p_dump->ntints);
+    return p_dump->buffer;
+}
+
+
+/***
+	Get a dump buffer of the stream.
+	WRH5_RT_BLOCK: wait while queue_depth dumps are in flight.  Else wait at most the budget, then apply the policy:
+	NULL means that the caller's dump is to be dropped (wrh5_manager_drop).
+***/
+static void * get_dump_buffer(wrh5_manager_t * p_mgr, struct wrh5_mgr_stream * p_stream) {
+    struct timespec deadline;
+    void *  p_buf;
+    double  t0 = now_seconds(), wait;
+    int     timed_out = 0, first = 0;
+
+    if(p_mgr->rt_policy == WRH5_RT_BLOCK) {
+        p_buf = wrh5_pool_get(&p_stream->pool, 1);
+        pthread_mutex_lock(&p_mgr->lock);
+    } else {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t) p_mgr->rt_budget;
+        deadline.tv_nsec += (long) ((p_mgr->rt_budget - (double) (time_t) p_mgr->rt_budget) * 1e9);
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        // The I/O thread returns buffers to the pool under the lock, then signals "stored".
+        pthread_mutex_lock(&p_mgr->lock);
+        if(p_stream->nqueued == 0)
+            p_stream->degraded = 0;
+        while((p_buf = wrh5_pool_get(&p_stream->pool, 0)) == NULL && !timed_out) {
+            if(p_mgr->rt_policy == WRH5_RT_DEGRADE)
+                p_stream->degraded = 1;
+            timed_out = (pthread_cond_timedwait(&p_mgr->stored, &p_mgr->lock, &deadline) == ETIMEDOUT);
+        }
+        if(p_buf == NULL && p_mgr->rt_policy == WRH5_RT_DROP_OLDEST)
+            p_buf = drop_oldest(p_mgr, p_stream, &first);
+    }
+    wait = now_seconds() - t0;
+    if(wait > p_stream->stats.max_wait_seconds)
+        p_stream->stats.max_wait_seconds = wait;
+    if(wait > p_mgr->totals.max_wait_seconds)
+        p_mgr->totals.max_wait_seconds = wait;
+    pthread_mutex_unlock(&p_mgr->lock);
+    if(first)
+        warn_drop(p_mgr, p_stream);
+    return p_buf;
+}
+
+
+/***
+	Get a dump buffer of the stream (see get_dump_buffer).
+***/
+void * wrh5_manager_get_buffer(wrh5_manager_t * p_mgr, int stream) {
+    struct wrh5_mgr_stream * p_stream = get_stream(p_mgr, stream, "wrh5_manager_get_buffer");
+
+    if(p_stream == NULL)
+        return NULL;
+    return get_dump_buffer(p_mgr, p_stream);
+}
+
+
+/***
+	Drop a dump of bufsize bytes (real-time mode, when wrh5_manager_get_buffer returned NULL).
+	Its time integrations are recorded as missing.  Returns 1 if the stream failed earlier.
+***/
+int wrh5_manager_drop(wrh5_manager_t * p_mgr, int stream, size_t bufsize) {
+    struct wrh5_mgr_stream * p_stream = get_stream(p_mgr, stream, "wrh5_manager_drop");
+    size_t  ntints;
+    int     failed, first = 0;
+
+    if(p_stream == NULL)
+        return 1;
+    if(bufsize < p_stream->ctx.in_tint_size || bufsize % p_stream->ctx.in_tint_size != 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_drop: bufsize must be whole time integrations");
+        return 1;
+    }
+    ntints = bufsize / p_stream->ctx.in_tint_size;
+    pthread_mutex_lock(&p_mgr->lock);
+    failed = p_stream->failed;
+    if(!failed) {
+        p_stream->gap_tints += ntints;
+        p_stream->next_tint += ntints;
+        first = count_drop(p_mgr, p_stream, ntints);
+    }
+    pthread_mutex_unlock(&p_mgr->lock);
+    if(first)
+        warn_drop(p_mgr, p_stream);
+    return failed;
+}
+
+
+/***
+	Submit a dump held in a buffer of wrh5_manager_get_buffer; the buffer goes back to the stream once stored.
+	Returns 1 (and takes the buffer back) if the stream failed earlier.
+***/
+int wrh5_manager_submit(wrh5_manager_t * p_mgr, int stream, void * buffer, size_t bufsize) {
+    struct wrh5_mgr_stream * p_stream = get_stream(p_mgr, stream, "wrh5_manager_submit");
+    struct wrh5_mgr_worker * p_worker;
+    wrh5_context_t * p_wrh5_ctx;
+    mgr_dump_t * p_dump;
+    hsize_t * cdims;
+    int     ichunk, failed;
+
+    if(p_stream == NULL)
+        return 1;
+    p_wrh5_ctx = &p_stream->ctx;
+    cdims = p_wrh5_ctx->cdims;
+    if(!wrh5_pool_owns(&p_stream->pool, buffer)) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_submit: buffer was not obtained from wrh5_manager_get_buffer");
+        return 1;
+    }
+    pthread_mutex_lock(&p_mgr->lock);
+    failed = p_stream->failed;
+    pthread_mutex_unlock(&p_mgr->lock);
+    if(failed || bufsize < p_wrh5_ctx->in_tint_size || bufsize > p_stream->max_dump_bytes || bufsize % p_wrh5_ctx->in_tint_size != 0) {
+        if(!failed)
+            wrh5_error(__FILE__, __LINE__, "wrh5_manager_submit: bufsize must be whole time integrations, up to max_dump_bytes");
+        wrh5_pool_put(&p_stream->pool, buffer);
+        return 1;
+    }
+
+    // Describe the dump and its whole chunk rows.
+    p_dump = &p_stream->dumps[((char *) buffer - p_stream->pool.base) / p_stream->pool.bufsize];
+    p_dump->bufsize = bufsize;
+    p_dump->ntints = bufsize / p_wrh5_ctx->in_tint_size;
+    p_dump->tint_start = p_stream->next_tint;
+    p_dump->gap_tints = p_stream->gap_tints;    // The producer's own fields: drops happen in its calls
+    p_dump->raw = (p_stream->direct && p_wrh5_ctx->deflate_level > 0 && p_stream->degraded);
+    p_stream->gap_tints = 0;
+    p_dump->failed = 0;
+    p_dump->nchunks = 0;
+    p_dump->next = NULL;
+    p_stream->next_tint += p_dump->ntints;
+    if(p_stream->direct) {
+        p_dump->row_first = (p_dump->tint_start + cdims[0] - 1) / cdims[0] * cdims[0] - p_dump->tint_start;
+        p_dump->row_end = (p_dump->tint_start + p_dump->ntints) / cdims[0] * cdims[0];
+        p_dump->row_end = (p_dump->row_end > p_dump->tint_start) ? p_dump->row_end - p_dump->tint_start : 0;
+        if(p_dump->row_first >= p_dump->row_end)
+            p_dump->row_first = p_dump->row_end = p_dump->ntints;
+        p_dump->nchunks = (int) ((p_dump->row_end - p_dump->row_first) / cdims[0]) * p_stream->row_chunks;
+    }
+    p_dump->nleft = p_dump->nchunks;
+
+    // Queue the dump, then its chunks: spread over the workers, starting with a different one each time.
+    pthread_mutex_lock(&p_mgr->lock);
+    if(p_stream->tail != NULL)
+        p_stream->tail->next = p_dump;
+    else
+        p_stream->head = p_dump;
+    p_stream->tail = p_dump;
+    p_stream->nqueued += 1;
+    wrh5_metrics_queue(&p_stream->ctx, p_stream->nqueued);
+    if(p_stream->nqueued > p_stream->stats.max_queued)
+        p_stream->stats.max_queued = p_stream->nqueued;
+    if(p_stream->nqueued > p_mgr->totals.max_queued)
+        p_mgr->totals.max_queued = p_stream->nqueued;
+    p_stream->stats.bytes_in += bufsize;
+    p_mgr->totals.bytes_in += bufsize;
+    if(p_dump->nchunks == 0)
+        pthread_cond_broadcast(&p_mgr->ready);
+    pthread_mutex_unlock(&p_mgr->lock);
+    if(p_dump->nchunks == 0)
+        return 0;
+
+    for(ichunk = 0; ichunk < p_dump->nchunks; ichunk++) {
+        mgr_task_t * p_task = &p_dump->tasks[ichunk];
+
+        p_task->p_dump = p_dump;
+        p_task->ichunk = ichunk;
+        p_task->next = NULL;
+        p_worker = &p_mgr->workers[(ichunk + p_dump->tint_start) % p_mgr->nthreads];
+        pthread_mutex_lock(&p_worker->lock);
+        p_task->prev = p_worker->tail;
+        if(p_worker->tail != NULL)
+            p_worker->tail->next = p_task;
+        else
+            p_worker->head = p_task;
+        p_worker->tail = p_task;
+        pthread_mutex_unlock(&p_worker->lock);
+    }
+    pthread_mutex_lock(&p_mgr->lock);
+    p_mgr->ntasks += p_dump->nchunks;
+    pthread_cond_broadcast(&p_mgr->work);
+    pthread_mutex_unlock(&p_mgr->lock);
+    return 0;
+}
+
+
+/***
+	Copy a dump into a buffer of the stream and submit it.
+	In real-time mode, a dump that gets no buffer within the budget is dropped, and the call succeeds.
+***/
+int wrh5_manager_write(wrh5_manager_t * p_mgr, int stream, const void * buffer, size_t bufsize) {
+    struct wrh5_mgr_stream * p_stream = get_stream(p_mgr, stream, "wrh5_manager_write");
+    void * p_buf;
+
+    if(p_stream == NULL)
+        return 1;
+    if(bufsize > p_stream->max_dump_bytes) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_manager_write: bufsize exceeds max_dump_bytes");
+        return 1;
+    }
+    p_buf = get_dump_buffer(p_mgr, p_stream);
+    if(p_buf == NULL)
+        return (p_mgr->rt_policy == WRH5_RT_BLOCK) ? 1 : wrh5_manager_drop(p_mgr, stream, bufsize);
+    memcpy(p_buf, buffer, bufsize);
+    return wrh5_manager_submit(p_mgr, stream, p_buf, bufsize);
+}
+
+
+/***
+	Wait until every dump submitted to the stream is stored, then record the dumps dropped since as missing.
+	Returns 1 if a dump could not be stored.
+***/
+int wrh5_manager_drain(wrh5_manager_t * p_mgr, int stream) {
+    struct wrh5_mgr_stream * p_stream = get_stream(p_mgr, stream, "wrh5_manager_drain");
+    size_t gap;
+    int rc;
+
+    if(p_stream == NULL)
+        return 1;
+    pthread_mutex_lock(&p_mgr->lock);
+    while(p_stream->nqueued > 0)
+        pthread_cond_wait(&p_mgr->stored, &p_mgr->lock);
+    rc = p_stream->failed;
+    gap = rc ? 0 : p_stream->gap_tints;
+    p_stream->gap_tints = 0;
+    pthread_mutex_unlock(&p_mgr->lock);
+
+    // Nothing in flight: the I/O thread does not use the context now.
+    if(gap > 0 && wrh5_write_missing(&p_stream->ctx, &p_stream->hdr, gap, p_mgr->debugging) != 0) {
+        pthread_mutex_lock(&p_mgr->lock);
+        p_stream->failed = 1;
+        pthread_mutex_unlock(&p_mgr->lock);
+        rc = 1;
+    }
+    return rc;
+}
+
+
+/***
+	Wait until every dump of the stream is stored, then close it (wrh5_close in the calling thread).
+	Returns 1 if a dump could not be stored or the close failed.
+***/
+int wrh5_manager_close(wrh5_manager_t * p_mgr, int stream) {
+    struct wrh5_mgr_stream * p_stream = get_stream(p_mgr, stream, "wrh5_manager_close");
+    char msgstr[256];
+    int rc;
+
+    if(p_stream == NULL)
+        return 1;
+    wrh5_manager_drain(p_mgr, stream);
+    pthread_mutex_lock(&p_mgr->lock);
+    p_stream->state = 1;
+    pthread_mutex_unlock(&p_mgr->lock);
+
+    if(p_stream->stats.dropped_dumps > 0) {
+        sprintf(msgstr, "wrh5_manager_close: stream %d: %lu dumps (%lu time integrations) were dropped and are missing",
+                stream, p_stream->stats.dropped_dumps, p_stream->stats.dropped_tints);
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+    }
+    rc = wrh5_close(&p_stream->ctx, p_mgr->debugging);
+    if(p_mgr->debugging)
+        wrh5_info("wrh5_manager_close: stream %d: %ld dumps (%ld with %ld chunks encoded by the workers), I/O %.3f s\n",
+                  stream, p_stream->stats.dumps, p_stream->stats.encoded_dumps, p_stream->stats.chunks,
+                  p_stream->stats.io_seconds);
+    stream_free(p_stream, p_mgr->debugging);
+    pthread_mutex_lock(&p_mgr->lock);
+    rc |= p_stream->failed;
+    p_mgr->totals.chunks += p_stream->stats.chunks;
+    p_mgr->totals.bytes_stored += p_stream->stats.bytes_stored;
+    p_stream->state = 0;
+    pthread_mutex_unlock(&p_mgr->lock);
+    return rc;
+}
+
+
+/***
+	Statistics of one stream, or of the manager (stream = -1: every stream so far, closed ones included).
+***/
+int wrh5_manager_stats(wrh5_manager_t * p_mgr, int stream, wrh5_manager_stats_t * p_stats) {
+    wrh5_thread_stats_t thread;
+    int ii;
+
+    if(stream >= 0) {
+        if(get_stream(p_mgr, stream, "wrh5_manager_stats") == NULL)
+            return 1;
+        pthread_mutex_lock(&p_mgr->lock);
+        memcpy(p_stats, &p_mgr->streams[stream].stats, sizeof(wrh5_manager_stats_t));
+        pthread_mutex_unlock(&p_mgr->lock);
+        return 0;
+    }
+    pthread_mutex_lock(&p_mgr->lock);
+    memcpy(p_stats, &p_mgr->totals, sizeof(wrh5_manager_stats_t));
+    for(ii = 0; ii < p_mgr->max_streams; ii++)
+        if(p_mgr->streams[ii].state == 2) {
+            p_stats->chunks += p_mgr->streams[ii].stats.chunks;
+            p_stats->bytes_stored += p_mgr->streams[ii].stats.bytes_stored;
+        }
+    pthread_mutex_unlock(&p_mgr->lock);
+    // Worker counters are kept by each worker without a lock: approximate while dumps are in flight.
+    for(ii = 0; ii < p_mgr->nthreads; ii++) {
+        p_stats->steals += p_mgr->workers[ii].steals;
+        p_stats->encode_seconds += p_mgr->workers[ii].encode_seconds;
+    }
+    wrh5_thread_stats(p_mgr->io_thread, p_mgr->io_tid, "wrh5 io", p_mgr->io_pinned, &thread);
+    p_stats->io_cpu_seconds = thread.cpu_seconds;
+    for(ii = 0; ii < p_mgr->nthreads; ii++) {
+        wrh5_thread_stats(p_mgr->workers[ii].thread, p_mgr->workers[ii].tid, "", p_mgr->workers[ii].pinned, &thread);
+        p_stats->worker_cpu_seconds += thread.cpu_seconds;
+    }
+    return 0;
+}
+
+
+/***
+	Statistics of the manager's threads: the workers, then the I/O thread.
+	Returns the number of entries filled in p_stats (at most max_threads).
+***/
+int wrh5_manager_threads(wrh5_manager_t * p_mgr, wrh5_thread_stats_t * p_stats, int max_threads) {
+    char name[32];
+    int  ii;
+
+    for(ii = 0; ii < p_mgr->nthreads && ii < max_threads; ii++) {
+        sprintf(name, "wrh5 worker %d", ii);
+        wrh5_thread_stats(p_mgr->workers[ii].thread, p_mgr->workers[ii].tid, name, p_mgr->workers[ii].pinned, &p_stats[ii]);
+    }
+    if(ii < max_threads)
+        wrh5_thread_stats(p_mgr->io_thread, p_mgr->io_tid, "wrh5 io", p_mgr->io_pinned, &p_stats[ii++]);
+    return ii;
+}
+
+
+/***
+	Close every open stream, stop the threads and free the manager.
+***/
+int wrh5_manager_destroy(wrh5_manager_t * p_mgr) {
+    int ii, rc = 0;
+
+    if(p_mgr->streams == NULL)
+        return 0;
+    for(ii = 0; ii < p_mgr->max_streams; ii++)
+        if(p_mgr->streams[ii].state == 2)
+            rc |= wrh5_manager_close(p_mgr, ii);
+
+    pthread_mutex_lock(&p_mgr->lock);
+    p_mgr->quit = 1;
+    pthread_cond_broadcast(&p_mgr->work);
+    pthread_cond_broadcast(&p_mgr->ready);
+    pthread_mutex_unlock(&p_mgr->lock);
+    for(ii = 0; ii < p_mgr->nthreads; ii++) {
+        pthread_join(p_mgr->workers[ii].thread, NULL);
+        pthread_mutex_destroy(&p_mgr->workers[ii].lock);
+        free(p_mgr->workers[ii].p_scratch);
+    }
+    pthread_join(p_mgr->io_thread, NULL);
+    pthread_mutex_destroy(&p_mgr->lock);
+    pthread_cond_destroy(&p_mgr->work);
+    pthread_cond_destroy(&p_mgr->ready);
+    pthread_cond_destroy(&p_mgr->stored);
+    free(p_mgr->streams);
+    free(p_mgr->workers);
+    p_mgr->streams = NULL;
+    p_mgr->workers = NULL;
+    return rc;
+}
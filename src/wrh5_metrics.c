@@ -0,0 +1,569 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_metrics.c                                                              *
+ * --------------                                                              *
+ * Live metrics of every open context in Prometheus text format, for           *
+ * recorders that run for hours.                                               *
+ *                                                                             *
+ * While the exporter runs (wrh5_metrics_start), each context opened gets a    *
+ * metrics block of its own.  A context has one writing thread, which updates  *
+ * the block with relaxed atomic stores: no lock, no read-modify-write, and    *
+ * no cache line shared with another context.  A write in progress is visible  *
+ * as such (wrh5_write_in_progress_seconds), so a disk stall shows while it    *
+ * lasts, not only in the latency histogram once it is over.                   *
+ *                                                                             *
+ * One exporter thread rewrites the textfile (new file renamed into place)     *
+ * every interval_ms and answers the Unix socket.  wrh5_metrics_format gives   *
+ * the same text to a caller that serves it by its own means.                  *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define NBUCKETS 14
+static const double bucket_le[NBUCKETS] = {             // Write latency histogram upper bounds, seconds
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+
+struct wrh5_metrics {
+    struct wrh5_metrics * next; // Registry link
+    char    path[256];          // Output file (label)
+    int     contiguous;         // 1: the file is allocated at open; stored bytes are the bytes written
+    unsigned long dumps;        // Write calls that succeeded
+    unsigned long tints;        // Time integrations written
+    unsigned long bytes;        // Bytes presented
+    unsigned long errors;       // Write calls that failed
+    unsigned long missing;      // Time integrations recorded as missing
+    unsigned long buckets[NBUCKETS + 1];    // Write calls per latency bucket (last: above bucket_le[NBUCKETS - 1])
+    uint64_t latency_ns;        // Sum of the write call durations
+    uint64_t busy_since;        // Start of the write call in progress (wrh5_trace_now), 0 if none
+    uint64_t last_write;        // End of the last write call (wrh5_trace_now), 0 if none
+    int     queue_depth;        // Dumps in flight (writer manager)
+    unsigned long rate_bytes;   // Exporter only: bytes at the previous sample
+    uint64_t rate_time;         // Exporter only: time of the previous sample
+    double  rate;               // Exporter only: bytes per second over the last interval
+    char    label[520];         // Formatting only: path escaped as a label value
+    unsigned long snap_bytes;   // Formatting only: bytes at the snapshot
+    double  snap_stored;        // Formatting only: bytes on disk at the snapshot
+};
+
+unsigned long wrh5_metrics_messages[WRH5_LOG_NONE]; // Messages reported per level, filtered or not (wrh5_util.c)
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;  // Protects the registry and the closed totals
+static struct wrh5_metrics * metrics_list = NULL;   // Open contexts
+static unsigned long closed_files = 0;  // Contexts closed since wrh5_metrics_start
+static volatile int metrics_running = 0;
+static volatile int metrics_quit = 0;
+static pthread_t metrics_thread;
+static user_metrics_t metrics_params;
+static int listen_fd = -1;
+
+typedef struct {
+    char *  buffer;
+    size_t  size;
+    size_t  len;                // Length of the whole text, even beyond size
+} text_t;
+
+
+/***
+	Append to the text (snprintf semantics: counted even when it does not fit).
+***/
+static void put(text_t * p_text, const char * format, ...) {
+    va_list va_array;
+    size_t  room = (p_text->len < p_text->size) ? p_text->size - p_text->len : 0;
+    int     n;
+
+    va_start(va_array, format);
+    n = vsnprintf((room > 0) ? p_text->buffer + p_text->len : NULL, room, format, va_array);
+    va_end(va_array);
+    if(n > 0)
+        p_text->len += (size_t) n;
+}
+
+
+/***
+	Copy a path into a label value, escaped.
+***/
+static void escape_label(char * dst, size_t size, const char * src) {
+    size_t jj = 0;
+
+    for(; *src != '\0' && jj + 3 < size; src++) {
+        if(*src == '\\' || *src == '"')
+            dst[jj++] = '\\';
+        if(*src == '\n') {
+            dst[jj++] = '\\';
+            dst[jj++] = 'n';
+            continue;
+        }
+        dst[jj++] = *src;
+    }
+    dst[jj] = '\0';
+}
+
+
+/***
+	Add n to a counter of a metrics block (its context's writing thread only).
+***/
+static inline void bump(unsigned long * p_counter, unsigned long n) {
+    __atomic_store_n(p_counter, *p_counter + n, __ATOMIC_RELAXED);
+}
+
+
+/***
+	Register a context just opened (wrh5_open_ext), if the exporter runs.
+***/
+void wrh5_metrics_open(wrh5_context_t * p_wrh5_ctx, const char * output_path) {
+    struct wrh5_metrics * p_metrics;
+
+    p_wrh5_ctx->p_metrics = NULL;
+    if(!metrics_running)
+        return;
+    p_metrics = calloc(1, sizeof(struct wrh5_metrics));
+    if(p_metrics == NULL) {
+        wrh5_warning(__FILE__, __LINE__, "wrh5_metrics_open: calloc FAILED; the file has no metrics");
+        return;
+    }
+    snprintf(p_metrics->path, sizeof(p_metrics->path), "%s", output_path);
+    p_metrics->contiguous = (p_wrh5_ctx->p_map != NULL);
+    p_metrics->rate_time = wrh5_trace_now();
+    pthread_mutex_lock(&metrics_lock);
+    p_metrics->next = metrics_list;
+    metrics_list = p_metrics;
+    pthread_mutex_unlock(&metrics_lock);
+    p_wrh5_ctx->p_metrics = p_metrics;
+}
+
+
+/***
+	Unregister a context being closed (wrh5_close).
+***/
+void wrh5_metrics_close(wrh5_context_t * p_wrh5_ctx) {
+    struct wrh5_metrics ** pp_metrics;
+
+    if(p_wrh5_ctx->p_metrics == NULL)
+        return;
+    pthread_mutex_lock(&metrics_lock);
+    for(pp_metrics = &metrics_list; *pp_metrics != NULL; pp_metrics = &(*pp_metrics)->next)
+        if(*pp_metrics == p_wrh5_ctx->p_metrics) {
+            *pp_metrics = p_wrh5_ctx->p_metrics->next;
+            break;
+        }
+    closed_files += 1;
+    pthread_mutex_unlock(&metrics_lock);
+    free(p_wrh5_ctx->p_metrics);
+    p_wrh5_ctx->p_metrics = NULL;
+}
+
+
+/***
+	A write call starts: return its start time (0 if the context has no metrics).
+***/
+uint64_t wrh5_metrics_begin(wrh5_context_t * p_wrh5_ctx) {
+    uint64_t t0;
+
+    if(p_wrh5_ctx->p_metrics == NULL)
+        return 0;
+    t0 = wrh5_trace_now();
+    __atomic_store_n(&p_wrh5_ctx->p_metrics->busy_since, t0, __ATOMIC_RELAXED);
+    return t0;
+}
+
+
+/***
+	A write call that started at t0 (wrh5_metrics_begin) is over: rc = 0 if it stored ntints time integrations of nbytes.
+***/
+void wrh5_metrics_end(wrh5_context_t * p_wrh5_ctx, uint64_t t0, size_t ntints, size_t nbytes, int rc) {
+    struct wrh5_metrics * p_metrics = p_wrh5_ctx->p_metrics;
+    uint64_t t1;
+    double   seconds;
+    int      ix;
+
+    if(p_metrics == NULL || t0 == 0)
+        return;
+    t1 = wrh5_trace_now();
+    if(rc != 0)
+        bump(&p_metrics->errors, 1);
+    else {
+        bump(&p_metrics->dumps, 1);
+        bump(&p_metrics->tints, ntints);
+        bump(&p_metrics->bytes, nbytes);
+    }
+    seconds = (double) (t1 - t0) * 1e-9;
+    for(ix = 0; ix < NBUCKETS && seconds > bucket_le[ix]; ix++)
+        ;
+    bump(&p_metrics->buckets[ix], 1);
+    __atomic_store_n(&p_metrics->latency_ns, p_metrics->latency_ns + (t1 - t0), __ATOMIC_RELAXED);
+    __atomic_store_n(&p_metrics->last_write, t1, __ATOMIC_RELAXED);
+    __atomic_store_n(&p_metrics->busy_since, 0, __ATOMIC_RELAXED);
+}
+
+
+/***
+	Count time integrations recorded as missing (wrh5_valid_mark).
+***/
+void wrh5_metrics_missing(wrh5_context_t * p_wrh5_ctx, size_t ntints) {
+    if(p_wrh5_ctx->p_metrics != NULL)
+        bump(&p_wrh5_ctx->p_metrics->missing, ntints);
+}
+
+
+/***
+	Publish the number of dumps in flight (writer manager).
+***/
+void wrh5_metrics_queue(wrh5_context_t * p_wrh5_ctx, int depth) {
+    if(p_wrh5_ctx->p_metrics != NULL)
+        __atomic_store_n(&p_wrh5_ctx->p_metrics->queue_depth, depth, __ATOMIC_RELAXED);
+}
+
+
+/***
+	Append the HELP and TYPE lines of a metric family.
+***/
+static void family(text_t * p_text, const char * name, const char * type, const char * help) {
+    put(p_text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+
+/***
+	Main entry point.
+	Format the metrics of every registered context into buffer (size bytes, NUL-terminated).
+	Return the length of the whole text: if it is size or more, the text was truncated.
+***/
+size_t wrh5_metrics_format(char * buffer, size_t size) {
+    text_t  text = {buffer, size, 0};
+    struct wrh5_metrics * p_m;
+    struct stat st;
+    uint64_t now = wrh5_trace_now();
+    uint64_t busy, last;
+    double  now_real;
+    unsigned long cumulative;
+    struct timespec ts;
+    int     ix, nopen = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    now_real = (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+    if(size > 0)
+        buffer[0] = '\0';
+    pthread_mutex_lock(&metrics_lock);
+
+    /*
+     * Snapshot what the families below share: label, bytes presented, bytes on disk.
+     */
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next) {
+        escape_label(p_m->label, sizeof(p_m->label), p_m->path);
+        p_m->snap_bytes = __atomic_load_n(&p_m->bytes, __ATOMIC_RELAXED);
+        if(p_m->contiguous || stat(p_m->path, &st) != 0)
+            p_m->snap_stored = (double) p_m->snap_bytes;
+        else
+            p_m->snap_stored = (double) st.st_size;
+        nopen += 1;
+    }
+
+    /*
+     * Process-wide.
+     */
+    family(&text, "wrh5_files_open", "gauge", "Files being written.");
+    put(&text, "wrh5_files_open %d\n", nopen);
+    family(&text, "wrh5_files_closed_total", "counter", "Files closed since the exporter started.");
+    put(&text, "wrh5_files_closed_total %lu\n", closed_files);
+    family(&text, "wrh5_log_messages_total", "counter", "Warnings and errors reported by the library.");
+    put(&text, "wrh5_log_messages_total{level=\"warning\"} %lu\n",
+        __atomic_load_n(&wrh5_metrics_messages[WRH5_LOG_WARNING], __ATOMIC_RELAXED));
+    put(&text, "wrh5_log_messages_total{level=\"error\"} %lu\n",
+        __atomic_load_n(&wrh5_metrics_messages[WRH5_LOG_ERROR], __ATOMIC_RELAXED));
+
+    /*
+     * Per file.
+     */
+    family(&text, "wrh5_dumps_total", "counter", "Write calls that succeeded.");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_dumps_total{file=\"%s\"} %lu\n", p_m->label, __atomic_load_n(&p_m->dumps, __ATOMIC_RELAXED));
+    family(&text, "wrh5_time_integrations_total", "counter", "Time integrations written.");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_time_integrations_total{file=\"%s\"} %lu\n", p_m->label,
+            __atomic_load_n(&p_m->tints, __ATOMIC_RELAXED));
+    family(&text, "wrh5_bytes_written_total", "counter", "Bytes presented to the write calls.");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_bytes_written_total{file=\"%s\"} %lu\n", p_m->label, p_m->snap_bytes);
+    family(&text, "wrh5_write_bytes_per_second", "gauge", "Bytes presented per second over the last exporter interval.");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_write_bytes_per_second{file=\"%s\"} %.0f\n", p_m->label, p_m->rate);
+    family(&text, "wrh5_bytes_stored", "gauge", "Size of the file on disk.");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_bytes_stored{file=\"%s\"} %.0f\n", p_m->label, p_m->snap_stored);
+    family(&text, "wrh5_compression_ratio", "gauge", "Bytes presented per byte on disk (metadata included).");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_compression_ratio{file=\"%s\"} %.3f\n", p_m->label,
+            (p_m->snap_stored > 0.0) ? (double) p_m->snap_bytes / p_m->snap_stored : 1.0);
+    family(&text, "wrh5_write_errors_total", "counter", "Write calls that failed.");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_write_errors_total{file=\"%s\"} %lu\n", p_m->label, __atomic_load_n(&p_m->errors, __ATOMIC_RELAXED));
+    family(&text, "wrh5_missing_time_integrations_total", "counter", "Time integrations recorded as missing.");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_missing_time_integrations_total{file=\"%s\"} %lu\n", p_m->label,
+            __atomic_load_n(&p_m->missing, __ATOMIC_RELAXED));
+    family(&text, "wrh5_queue_depth", "gauge", "Dumps in flight (writer manager).");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next)
+        put(&text, "wrh5_queue_depth{file=\"%s\"} %d\n", p_m->label, __atomic_load_n(&p_m->queue_depth, __ATOMIC_RELAXED));
+    family(&text, "wrh5_write_in_progress_seconds", "gauge", "Age of the write call in progress (0: none).");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next) {
+        busy = __atomic_load_n(&p_m->busy_since, __ATOMIC_RELAXED);
+        put(&text, "wrh5_write_in_progress_seconds{file=\"%s\"} %.6f\n", p_m->label,
+            (busy != 0 && now > busy) ? (double) (now - busy) * 1e-9 : 0.0);
+    }
+    family(&text, "wrh5_last_write_timestamp_seconds", "gauge", "End of the last write call (Unix time, 0: none).");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next) {
+        last = __atomic_load_n(&p_m->last_write, __ATOMIC_RELAXED);
+        put(&text, "wrh5_last_write_timestamp_seconds{file=\"%s\"} %.3f\n", p_m->label,
+            (last != 0) ? now_real - (double) (now - last) * 1e-9 : 0.0);
+    }
+    family(&text, "wrh5_write_duration_seconds", "histogram", "Duration of the write calls.");
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next) {
+        cumulative = 0;
+        for(ix = 0; ix < NBUCKETS; ix++) {
+            cumulative += __atomic_load_n(&p_m->buckets[ix], __ATOMIC_RELAXED);
+            put(&text, "wrh5_write_duration_seconds_bucket{file=\"%s\",le=\"%g\"} %lu\n", p_m->label, bucket_le[ix], cumulative);
+        }
+        cumulative += __atomic_load_n(&p_m->buckets[NBUCKETS], __ATOMIC_RELAXED);
+        put(&text, "wrh5_write_duration_seconds_bucket{file=\"%s\",le=\"+Inf\"} %lu\n", p_m->label, cumulative);
+        put(&text, "wrh5_write_duration_seconds_sum{file=\"%s\"} %.6f\n", p_m->label,
+            (double) __atomic_load_n(&p_m->latency_ns, __ATOMIC_RELAXED) * 1e-9);
+        put(&text, "wrh5_write_duration_seconds_count{file=\"%s\"} %lu\n", p_m->label, cumulative);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+    if(size > 0 && text.len >= size)
+        buffer[size - 1] = '\0';
+    return text.len;
+}
+
+
+/***
+	Format the metrics into a buffer grown as needed (*p_buffer, *p_size).  Return the length, 0 on failure.
+***/
+static size_t format_all(char ** p_buffer, size_t * p_size) {
+    size_t len;
+    char * p_new;
+
+    for(;;) {
+        len = wrh5_metrics_format(*p_buffer, *p_size);
+        if(len < *p_size)
+            return len;
+        p_new = realloc(*p_buffer, len + 4096);
+        if(p_new == NULL)
+            return 0;
+        *p_buffer = p_new;
+        *p_size = len + 4096;
+    }
+}
+
+
+/***
+	Sample the throughput of every registered context.
+***/
+static void sample_rates(void) {
+    struct wrh5_metrics * p_m;
+    uint64_t now = wrh5_trace_now();
+    unsigned long bytes;
+
+    pthread_mutex_lock(&metrics_lock);
+    for(p_m = metrics_list; p_m != NULL; p_m = p_m->next) {
+        bytes = __atomic_load_n(&p_m->bytes, __ATOMIC_RELAXED);
+        if(now > p_m->rate_time)
+            p_m->rate = (double) (bytes - p_m->rate_bytes) * 1e9 / (double) (now - p_m->rate_time);
+        p_m->rate_bytes = bytes;
+        p_m->rate_time = now;
+    }
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+
+/***
+	Rewrite the textfile: a new file renamed into place, so that readers never see a partial one.
+***/
+static int write_textfile(const char * text, size_t len) {
+    char    tmp_path[300];
+    FILE *  p_file;
+    char    msgstr[256];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", metrics_params.textfile, (int) getpid());
+    p_file = fopen(tmp_path, "w");
+    if(p_file == NULL) {
+        sprintf(msgstr, "wrh5_metrics: cannot create '%.200s' (%s)", tmp_path, strerror(errno));
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(fwrite(text, 1, len, p_file) != len || fclose(p_file) != 0 || rename(tmp_path, metrics_params.textfile) != 0) {
+        sprintf(msgstr, "wrh5_metrics: cannot write '%.200s' (%s)", metrics_params.textfile, strerror(errno));
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Answer one socket connection: an HTTP response if the client sent "GET", else the bare text.
+***/
+static void answer(int fd, char ** p_buffer, size_t * p_size) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    char    request[512];
+    char    header[160];
+    ssize_t n = 0, sent;
+    size_t  len, done;
+
+    if(poll(&pfd, 1, 100) == 1)
+        n = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT);
+    len = format_all(p_buffer, p_size);
+    if(n >= 4 && memcmp(request, "GET ", 4) == 0) {
+        snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %lu\r\n\r\n", (unsigned long) len);
+        if(send(fd, header, strlen(header), MSG_NOSIGNAL) < 0)
+            return;
+    }
+    for(done = 0; done < len; done += (size_t) sent) {
+        sent = send(fd, *p_buffer + done, len - done, MSG_NOSIGNAL);
+        if(sent <= 0)
+            return;
+    }
+}
+
+
+/***
+	Exporter thread: sample, rewrite the textfile every interval and answer the socket in between.
+***/
+static void * exporter_main(void * p_arg) {
+    struct pollfd pfd;
+    char *  buffer = NULL;
+    size_t  size = 0, len;
+    uint64_t next = wrh5_trace_now();
+    int64_t wait_ms;
+    int     fd;
+
+    (void) p_arg;
+    wrh5_trace_thread_name("wrh5 metrics");
+    while(!metrics_quit) {
+        if(wrh5_trace_now() >= next) {
+            sample_rates();
+            if(metrics_params.textfile[0] != '\0') {
+                len = format_all(&buffer, &size);
+                if(len > 0)
+                    write_textfile(buffer, len);
+            }
+            next += (uint64_t) metrics_params.interval_ms * 1000000ULL;
+        }
+        wait_ms = ((int64_t) next - (int64_t) wrh5_trace_now()) / 1000000 + 1;
+        if(wait_ms > 100)
+            wait_ms = 100;          // metrics_quit is looked at 10 times per second
+        if(listen_fd < 0) {
+            usleep((useconds_t) wait_ms * 1000);
+            continue;
+        }
+        pfd.fd = listen_fd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, (int) wait_ms) == 1) {
+            fd = accept(listen_fd, NULL, NULL);
+            if(fd >= 0) {
+                answer(fd, &buffer, &size);
+                close(fd);
+            }
+        }
+    }
+    if(metrics_params.textfile[0] != '\0') {
+        sample_rates();
+        len = format_all(&buffer, &size);
+        if(len > 0)
+            write_textfile(buffer, len);
+    }
+    free(buffer);
+    return NULL;
+}
+
+
+/***
+	Main entry point.
+	Start the exporter.  Only the contexts opened from now on have metrics.
+***/
+int wrh5_metrics_start(user_metrics_t * p_params, int debugging) {
+    struct sockaddr_un addr;
+    char    msgstr[256];
+
+    if(metrics_running) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_metrics_start: the exporter already runs");
+        return 1;
+    }
+    memcpy(&metrics_params, p_params, sizeof(metrics_params));
+    metrics_params.textfile[sizeof(metrics_params.textfile) - 1] = '\0';
+    metrics_params.socket_path[sizeof(metrics_params.socket_path) - 1] = '\0';
+    if(metrics_params.interval_ms <= 0)
+        metrics_params.interval_ms = 5000;
+
+    /*
+     * Listen on the Unix socket (a stale one left by a dead process is replaced).
+     */
+    listen_fd = -1;
+    if(metrics_params.socket_path[0] != '\0') {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, metrics_params.socket_path);
+        unlink(metrics_params.socket_path);
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listen_fd, 8) != 0) {
+            sprintf(msgstr, "wrh5_metrics_start: cannot listen on '%.100s' (%s)", metrics_params.socket_path, strerror(errno));
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            if(listen_fd >= 0)
+                close(listen_fd);
+            listen_fd = -1;
+            return 1;
+        }
+    }
+
+    pthread_mutex_lock(&metrics_lock);
+    closed_files = 0;
+    pthread_mutex_unlock(&metrics_lock);
+    metrics_quit = 0;
+    metrics_running = 1;
+    if(pthread_create(&metrics_thread, NULL, exporter_main, NULL) != 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_metrics_start: pthread_create FAILED");
+        metrics_running = 0;
+        if(listen_fd >= 0) {
+            close(listen_fd);
+            unlink(metrics_params.socket_path);
+            listen_fd = -1;
+        }
+        return 1;
+    }
+    if(debugging)
+        wrh5_info("wrh5_metrics_start: textfile '%s', socket '%s', every %d ms\n",
+                  metrics_params.textfile, metrics_params.socket_path, metrics_params.interval_ms);
+    return 0;
+}
+
+
+/***
+	Stop the exporter: the textfile is rewritten one last time and the socket removed.
+	Contexts still open keep updating their metrics, which are freed when they close.
+***/
+int wrh5_metrics_stop(int debugging) {
+    if(!metrics_running) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_metrics_stop: the exporter does not run");
+        return 1;
+    }
+    metrics_running = 0;
+    metrics_quit = 1;
+    pthread_join(metrics_thread, NULL);
+    if(listen_fd >= 0) {
+        close(listen_fd);
+        unlink(metrics_params.socket_path);
+        listen_fd = -1;
+    }
+    if(debugging)
+        wrh5_info("wrh5_metrics_stop: exporter stopped\n");
+    return 0;
+}
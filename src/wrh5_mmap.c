@@ -0,0 +1,181 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_mmap.c                                                                 *
+ * -----------                                                                 *
+ * Contiguous layout (contiguous_tints option): for uncompressed recording of  *
+ * a known number of time integrations.                                        *
+ *                                                                             *
+ * wrh5_open_ext creates dataset "data" contiguous, with its whole extent      *
+ * allocated at creation (page aligned, never filled).  wrh5_mmap_init then    *
+ * asks HDF5 for the file offset of the raw data, reserves the region on disk  *
+ * (posix_fallocate) and maps it.  Writes never go through HDF5:               *
+ * - wrh5_mmap_next hands out the address of the next time integrations in     *
+ *   the file; the caller fills them in place (no copy at all).                *
+ * - wrh5_write, wrh5_writev, ... copy their hyperslabs into the mapping.      *
+ * wrh5_close syncs the mapping, records the time integrations never written   *
+ * as missing (they read back as 0) and finalizes the metadata.                *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+/***
+	Map the raw data of dataset "data" (contiguous, allocated) into p_wrh5_ctx->p_map.
+***/
+int wrh5_mmap_init(wrh5_context_t * p_wrh5_ctx, char * output_path, int debugging) {
+    haddr_t     addr;               // File offset of the raw data
+    size_t      page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t      nbytes;             // Byte size of the raw data
+    off_t       map_start;          // addr rounded down to a page
+    int         rc;
+    char        msgstr[256];
+
+    nbytes = (size_t) p_wrh5_ctx->filesz_dims[0] * p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2]
+             * H5Tget_size(p_wrh5_ctx->elem_type);
+    addr = H5Dget_offset(p_wrh5_ctx->dataset_id);
+    if(addr == HADDR_UNDEF) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_mmap_init: H5Dget_offset FAILED (the raw data is not allocated)");
+        return 1;
+    }
+    if(H5Fflush(p_wrh5_ctx->file_id, H5F_SCOPE_LOCAL) < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_mmap_init: H5Fflush FAILED");
+        return 1;
+    }
+
+    /*
+     * Reserve the region on disk: no ENOSPC (SIGBUS) while writing through the mapping.
+     */
+    p_wrh5_ctx->map_fd = open(output_path, O_RDWR);
+    if(p_wrh5_ctx->map_fd < 0) {
+        sprintf(msgstr, "wrh5_mmap_init: open of '%s' FAILED (%s)", output_path, strerror(errno));
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    rc = posix_fallocate(p_wrh5_ctx->map_fd, (off_t) addr, (off_t) nbytes);
+    if(rc != 0) {
+        sprintf(msgstr, "wrh5_mmap_init: posix_fallocate of %ld bytes FAILED (%s)", (long) nbytes, strerror(rc));
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        close(p_wrh5_ctx->map_fd);
+        return 1;
+    }
+
+    /*
+     * Map it.  The mapping starts on a page: map_skip bytes of it precede the raw data.
+     */
+    map_start = (off_t) (addr / page * page);
+    p_wrh5_ctx->map_skip = (size_t) (addr - (haddr_t) map_start);
+    p_wrh5_ctx->map_size = p_wrh5_ctx->map_skip + nbytes;
+    p_wrh5_ctx->p_map = mmap(NULL, p_wrh5_ctx->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, p_wrh5_ctx->map_fd, map_start);
+    if(p_wrh5_ctx->p_map == MAP_FAILED) {
+        sprintf(msgstr, "wrh5_mmap_init: mmap of %ld bytes FAILED (%s)", (long) p_wrh5_ctx->map_size, strerror(errno));
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        p_wrh5_ctx->p_map = NULL;
+        close(p_wrh5_ctx->map_fd);
+        return 1;
+    }
+    madvise(p_wrh5_ctx->p_map, p_wrh5_ctx->map_size, MADV_SEQUENTIAL);
+    if(debugging)
+        wrh5_info("wrh5_mmap_init: %lld time integrations (%ld bytes) at file offset %lld mapped\n",
+                  p_wrh5_ctx->filesz_dims[0], (long) nbytes, (long long) addr);
+    return 0;
+}
+
+
+/***
+	Copy a hyperslab of dataset "data" from a contiguous memory buffer into the mapping (wrh5_write_hyperslab).
+***/
+int wrh5_mmap_copy(wrh5_context_t * p_wrh5_ctx, hsize_t * p_start, hsize_t * p_count, const void * p_buffer) {
+    size_t      esz = H5Tget_size(p_wrh5_ctx->elem_type);
+    size_t      row_bytes = p_count[2] * esz;
+    const char * p_src = (const char *) p_buffer;
+    char *      p_dst;
+    hsize_t     t, i;
+
+    if(p_start[0] + p_count[0] > p_wrh5_ctx->filesz_dims[0]) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_mmap_copy: the hyperslab goes past contiguous_tints");
+        p_wrh5_ctx->usable = 0;
+        return 1;
+    }
+    p_dst = p_wrh5_ctx->p_map + p_wrh5_ctx->map_skip;
+    if(p_start[1] == 0 && p_start[2] == 0 && p_count[1] == p_wrh5_ctx->filesz_dims[1]
+       && p_count[2] == p_wrh5_ctx->filesz_dims[2]) {
+        memcpy(p_dst + p_start[0] * p_wrh5_ctx->tint_size, p_src, p_count[0] * p_wrh5_ctx->tint_size);
+        return 0;
+    }
+    for(t = 0; t < p_count[0]; t++)
+        for(i = 0; i < p_count[1]; i++) {
+            memcpy(p_dst + (((p_start[0] + t) * p_wrh5_ctx->filesz_dims[1] + p_start[1] + i) * p_wrh5_ctx->filesz_dims[2]
+                            + p_start[2]) * esz, p_src, row_bytes);
+            p_src += row_bytes;
+        }
+    return 0;
+}
+
+
+/***
+	Main entry point.
+	Return the address, in the file, of the next ntints time integrations, and count them as written.
+	The caller fills them in place (on-disk order [time][ifs][chan]).  NULL if they go past contiguous_tints.
+***/
+void * wrh5_mmap_next(wrh5_context_t * p_wrh5_ctx, size_t ntints, int debugging) {
+    char *      p_tints;
+    uint64_t    metrics_t0;         // Live metrics (see wrh5_metrics.c)
+
+    if(p_wrh5_ctx->p_map == NULL || p_wrh5_ctx->p_staging != NULL || p_wrh5_ctx->sk_m > 0) {
+        wrh5_error(__FILE__, __LINE__,
+                   "wrh5_mmap_next: needs the contiguous_tints option, without staging (input_layout, detect, "
+                   "keep_mantissa_bits, quantize) or sk_m");
+        return NULL;
+    }
+    if(ntints < 1 || p_wrh5_ctx->offset_dims[0] + ntints > p_wrh5_ctx->filesz_dims[0]) {
+        if(debugging)
+            wrh5_info("wrh5_mmap_next: %ld time integrations at offset %lld do not fit in %lld\n",
+                      (long) ntints, p_wrh5_ctx->offset_dims[0], p_wrh5_ctx->filesz_dims[0]);
+        return NULL;
+    }
+    metrics_t0 = wrh5_metrics_begin(p_wrh5_ctx);
+    if(wrh5_valid_mark(p_wrh5_ctx, p_wrh5_ctx->offset_dims[0], ntints, NULL, 1) != 0) {
+        wrh5_metrics_end(p_wrh5_ctx, metrics_t0, 0, 0, 1);
+        return NULL;
+    }
+    p_tints = p_wrh5_ctx->p_map + p_wrh5_ctx->map_skip + p_wrh5_ctx->offset_dims[0] * p_wrh5_ctx->tint_size;
+    p_wrh5_ctx->offset_dims[0] += ntints;
+    p_wrh5_ctx->dump_count += 1;
+    p_wrh5_ctx->byte_count += ntints * p_wrh5_ctx->tint_size;
+    wrh5_metrics_end(p_wrh5_ctx, metrics_t0, ntints, ntints * p_wrh5_ctx->tint_size, 0);
+    return p_tints;
+}
+
+
+/***
+	Sync and unmap (wrh5_close).  Time integrations never written are recorded as missing.
+***/
+int wrh5_mmap_close(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    size_t  unwritten = p_wrh5_ctx->filesz_dims[0] - p_wrh5_ctx->offset_dims[0];
+    uint64_t trace_t0;
+    int     rc = 0;
+    char    msgstr[256];
+
+    if(unwritten > 0) {
+        if(debugging)
+            wrh5_info("wrh5_mmap_close: %ld of %lld time integrations were not written\n",
+                      (long) unwritten, p_wrh5_ctx->filesz_dims[0]);
+        if(wrh5_valid_mark(p_wrh5_ctx, p_wrh5_ctx->offset_dims[0], unwritten, NULL, 0) == 0)
+            p_wrh5_ctx->offset_dims[0] += unwritten;
+    }
+    trace_t0 = WRH5_TRACE_BEGIN();
+    if(msync(p_wrh5_ctx->p_map, p_wrh5_ctx->map_size, MS_SYNC) != 0) {
+        sprintf(msgstr, "wrh5_mmap_close: msync FAILED (%s)", strerror(errno));
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        rc = 1;
+    }
+    WRH5_TRACE_END(trace_t0, "msync", p_wrh5_ctx->map_size);
+    munmap(p_wrh5_ctx->p_map, p_wrh5_ctx->map_size);
+    close(p_wrh5_ctx->map_fd);
+    p_wrh5_ctx->p_map = NULL;
+    return rc;
+}
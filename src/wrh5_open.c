@@ -6,6 +6,204 @@
 
 
 #include "wrh5_defs.h"
+#include <unistd.h>
+
+/***
+	Close everything that a failed open left open, so that the same path may be opened again (E.g. after backpressure).
+***/
+static void abandon_file(wrh5_context_t * p_wrh5_ctx) {
+    if(p_wrh5_ctx->p_map != NULL)
+        wrh5_mmap_close(p_wrh5_ctx, 0);
+    if(p_wrh5_ctx->sk_m > 0)
+        wrh5_sk_close(p_wrh5_ctx, 0);
+    if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE)
+        wrh5_quant_close(p_wrh5_ctx);
+    H5E_BEGIN_TRY {
+        H5Dclose(p_wrh5_ctx->dataset_id);
+        H5Sclose(p_wrh5_ctx->dataspace_id);
+        H5Fclose(p_wrh5_ctx->file_id);
+    } H5E_END_TRY;
+    p_wrh5_ctx->dataset_id = p_wrh5_ctx->dataspace_id = p_wrh5_ctx->file_id = 0;
+
+    // The buffers and the memory budget, as wrh5_close gives them back.
+    if(p_wrh5_ctx->p_staging != NULL) {
+        wrh5_pool_put(p_wrh5_ctx->p_pool, p_wrh5_ctx->p_staging);
+        p_wrh5_ctx->p_staging = NULL;
+    }
+    if(p_wrh5_ctx->pool_owned) {
+        wrh5_pool_destroy(p_wrh5_ctx->p_pool, 0);
+        free(p_wrh5_ctx->p_pool);
+        p_wrh5_ctx->pool_owned = 0;
+    }
+    p_wrh5_ctx->p_pool = NULL;
+    free(p_wrh5_ctx->p_chunk);
+    p_wrh5_ctx->p_chunk = NULL;
+    free(p_wrh5_ctx->p_valid);
+    p_wrh5_ctx->p_valid = NULL;
+    p_wrh5_ctx->valid_size = 0;
+    wrh5_chans_close(p_wrh5_ctx);
+    if(p_wrh5_ctx->budget_bytes > 0)
+        wrh5_budget_release(p_wrh5_ctx->budget_bytes);
+    p_wrh5_ctx->budget_bytes = 0;
+    p_wrh5_ctx->chunk_cache_bytes = 0;
+}
+
+
+/***
+	Reserve the chunk buffer and the chunk cache of dataset "data" from the memory budget (wrh5_budget.c).
+	With a budget set, "data" is reopened with the granted chunk cache: between one chunk and the size in effect.
+***/
+static int reserve_memory(wrh5_context_t * p_wrh5_ctx, size_t chunk_buffer_bytes, int debugging) {
+    wrh5_budget_t budget;           // Process-wide budget
+    hid_t       dapl;               // Dataset access property list of "data"
+    size_t      nslots, nbytes;     // Chunk cache in effect
+    double      w0;                 // Chunk cache preemption policy in effect
+    size_t      one_chunk;          // Byte size of one uncompressed chunk
+    size_t      granted;            // Chunk cache granted by the budget
+
+    dapl = H5Dget_access_plist(p_wrh5_ctx->dataset_id);
+    if(dapl < 0 || H5Pget_chunk_cache(dapl, &nslots, &nbytes, &w0) < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: H5Pget_chunk_cache of dataset 'data' FAILED");
+        return 1;
+    }
+    H5Pclose(dapl);
+    one_chunk = p_wrh5_ctx->cdims[0] * p_wrh5_ctx->cdims[1] * p_wrh5_ctx->cdims[2] * H5Tget_size(p_wrh5_ctx->elem_type);
+    if(wrh5_budget_acquire(chunk_buffer_bytes, (one_chunk < nbytes) ? one_chunk : nbytes, nbytes, &granted,
+                           "wrh5_open", debugging) != 0)
+        return 1;
+    p_wrh5_ctx->budget_bytes = chunk_buffer_bytes + granted;
+    p_wrh5_ctx->chunk_cache_bytes = granted;
+    wrh5_budget_get(&budget);
+    if(budget.budget == 0 || granted == nbytes)
+        return 0;
+
+    // Nothing has been cached yet: reopen "data" with the smaller cache.
+    dapl = H5Pcreate(H5P_DATASET_ACCESS);
+    if(dapl < 0 || H5Pset_chunk_cache(dapl, nslots, granted, w0) < 0 || H5Dclose(p_wrh5_ctx->dataset_id) < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: H5Pset_chunk_cache of dataset 'data' FAILED");
+        return 1;
+    }
+    p_wrh5_ctx->dataset_id = H5Dopen(p_wrh5_ctx->file_id, DATASETNAME, dapl);
+    H5Pclose(dapl);
+    if(p_wrh5_ctx->dataset_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: H5Dopen of dataset 'data' with the budgeted chunk cache FAILED");
+        return 1;
+    }
+    if(debugging)
+        wrh5_info("wrh5_open: chunk cache of %ld bytes granted by the memory budget (%ld requested)\n",
+                  (long) granted, (long) nbytes);
+    return 0;
+}
+
+
+/***
+	Allocate the buffers of a context: chunk buffer, buffer pool, staging buffer.
+***/
+static int alloc_buffers(wrh5_context_t * p_wrh5_ctx, user_options_t * p_options, int need_staging, int debugging) {
+    char        msgstr[256];        // sprintf target
+
+    /*
+     * Chunk buffer for the compression bypass and fill elision.
+     */
+    if(p_wrh5_ctx->chunk_bytes > 0) {
+        p_wrh5_ctx->bypass_min_ratio = p_options->bypass_min_ratio;
+        p_wrh5_ctx->p_chunk = malloc(p_wrh5_ctx->chunk_bytes);
+        if(p_wrh5_ctx->p_chunk == NULL) {
+            sprintf(msgstr, "wrh5_open: malloc of a %ld byte chunk buffer FAILED", (long) p_wrh5_ctx->chunk_bytes);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+        if(!p_wrh5_ctx->filtered && debugging)
+            wrh5_info("wrh5_open: no filter; whole chunks are written directly\n");
+    }
+
+    /*
+     * Attach the caller's buffer pool or create the context's own.
+     * Own pool buffers hold a whole number of chunk time dimensions.
+     */
+    if(p_options->p_pool != NULL) {
+        if(p_options->p_pool->bufsize < p_wrh5_ctx->in_tint_size) {
+            sprintf(msgstr, "wrh5_open: pool buffer size %ld is smaller than one time integration (%ld)",
+                    (long) p_options->p_pool->bufsize, (long) p_wrh5_ctx->in_tint_size);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+        p_wrh5_ctx->p_pool = p_options->p_pool;
+    } else if(p_options->pool_nbufs > 0 || need_staging) {
+        // One extra buffer is held as the staging buffer.
+        size_t pool_tints = p_options->pool_tints;
+        if(pool_tints < 1)
+            pool_tints = p_wrh5_ctx->cdims[0];
+        if(p_options->quantize != WRH5_QUANT_NONE && p_options->pool_tints < 1 && pool_tints < p_wrh5_ctx->quant_nint)
+            pool_tints = p_wrh5_ctx->quant_nint;    // A bandpass estimate fits in one staging load
+        pool_tints = (pool_tints + p_wrh5_ctx->cdims[0] - 1) / p_wrh5_ctx->cdims[0] * p_wrh5_ctx->cdims[0];
+        p_wrh5_ctx->p_pool = malloc(sizeof(wrh5_pool_t));
+        if(p_wrh5_ctx->p_pool == NULL) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_open: malloc of the buffer pool FAILED");
+            return 1;
+        }
+        if(wrh5_pool_create(p_wrh5_ctx->p_pool, pool_tints * p_wrh5_ctx->in_tint_size, 
+                            p_options->pool_nbufs + need_staging, debugging) != 0) {
+            free(p_wrh5_ctx->p_pool);
+            p_wrh5_ctx->p_pool = NULL;
+            return 1;
+        }
+        p_wrh5_ctx->pool_owned = 1;
+        wrh5_numa_bind(p_wrh5_ctx->p_pool->base, p_wrh5_ctx->p_pool->map_size, p_options->numa_nodes, "wrh5_open", debugging);
+    }
+
+    /*
+     * Hold a staging buffer from the pool for the life of the context.
+     */
+    if(need_staging) {
+        p_wrh5_ctx->p_staging = wrh5_pool_get(p_wrh5_ctx->p_pool, 0);
+        if(p_wrh5_ctx->p_staging == NULL) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_open: no pool buffer is free for staging");
+            return 1;
+        }
+        p_wrh5_ctx->staging_tints = p_wrh5_ctx->p_pool->bufsize / p_wrh5_ctx->in_tint_size;
+        if(debugging)
+            wrh5_info("wrh5_open: staging buffer holds %ld time integrations\n", (long) p_wrh5_ctx->staging_tints);
+    }
+
+    return 0;
+}
+
+
+/***
+	Set up the buffers of a context whose file and dataset are open, within the memory budget.
+	Shared by new and resumed files.
+***/
+static int open_buffers(wrh5_context_t * p_wrh5_ctx, char * output_path, user_options_t * p_options, int need_staging,
+                        int debugging) {
+
+    /*
+     * Reserve the chunk buffer and the chunk cache from the memory budget.
+     */
+    p_wrh5_ctx->elide_fill = p_options->elide_fill;
+    if(p_options->bypass_min_ratio > 0.0 || p_options->elide_fill)
+        p_wrh5_ctx->chunk_bytes = p_wrh5_ctx->cdims[0] * p_wrh5_ctx->cdims[1] * p_wrh5_ctx->cdims[2]
+                                  * H5Tget_size(p_wrh5_ctx->elem_type);
+    if(p_wrh5_ctx->p_map == NULL && reserve_memory(p_wrh5_ctx, p_wrh5_ctx->chunk_bytes, debugging) != 0) {
+        abandon_file(p_wrh5_ctx);
+        return 1;
+    }
+    if(alloc_buffers(p_wrh5_ctx, p_options, need_staging, debugging) != 0) {
+        abandon_file(p_wrh5_ctx);
+        return 1;
+    }
+
+    /*
+     * Bye-bye.
+     */
+    p_wrh5_ctx->usable = 1;
+    wrh5_metrics_open(p_wrh5_ctx, output_path);
+    if(debugging)
+        wrh5_show_context("wrh5_open", p_wrh5_ctx);
+    return 0;
+
+}
+
 
 /***
 	Open-file entry point.
@@ -16,11 +214,28 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
               user_chunking_t * p_user_chunking,
               user_caching_t * p_user_caching,
               int debugging) {
+    return wrh5_open_ext(p_wrh5_ctx, p_wrh5_hdr, output_path, p_user_chunking, p_user_caching, NULL, debugging);
+}
+
+
+/***
+	Open a file (wrh5_open_ext).
+***/
+static int open_file(wrh5_context_t * p_wrh5_ctx,
+                     wrh5_hdr_t * p_wrh5_hdr,
+                     char * output_path,
+                     user_chunking_t * p_user_chunking,
+                     user_caching_t * p_user_caching,
+                     user_options_t * p_user_options,
+                     int debugging) {
     hid_t       dcpl;               // Chunking handle - needed until dataset handle is produced
     hsize_t     max_dims[NDIMS];    // Maximum dataset allocation dimensions
     herr_t      status;             // Status from HDF5 function call
     char        msgstr[256];        // sprintf target
     unsigned    hdf5_majnum, hdf5_minnum, hdf5_relnum;  // Version/release info for the HDF5 library
+    user_options_t options;         // User options (all zero if not supplied)
+    int         need_staging;       // 1: the write path stages data in a pool buffer
+    wrh5_hdr_t  file_hdr;           // Header of the stored channels (see wrh5_chans.c)
 
     // Chunking parameters
     hsize_t     cdims[NDIMS];       // Chunking dimensions array
@@ -40,10 +255,18 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
     // Clear context.
     memset(p_wrh5_ctx, 0, (size_t) sizeof(wrh5_context_t));
 
+    // Collect user options.
+    if(p_user_options == NULL)
+        memset(&options, 0, sizeof(options));
+    else
+        memcpy(&options, p_user_options, sizeof(options));
+
     /*
      * Check whether or not the Bitshuffle filter is available.
      */
-    if (H5Zfilter_avail(FILTER_ID_BITSHUFFLE) <= 0)
+    if(options.deflate_level > 0 || options.contiguous_tints > 0)
+        bitshuffle_available = 0;
+    else if (H5Zfilter_avail(FILTER_ID_BITSHUFFLE) <= 0)
         wrh5_warning(__FILE__, __LINE__, "fbhf_open: Plugin bitshuffle is NOT available; data will not be compressed");
     else {
         bitshuffle_available = 1;
@@ -74,24 +297,198 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
             return 1;
         }
     }
+    if(options.input_layout < WRH5_LAYOUT_TIF || options.input_layout > WRH5_LAYOUT_ICT) {
+        sprintf(msgstr, "wrh5_open: input_layout must be in [%d, %d] but I saw %d", 
+                WRH5_LAYOUT_TIF, WRH5_LAYOUT_ICT, options.input_layout);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(options.detect < WRH5_DETECT_NONE || options.detect > WRH5_DETECT_IQUV) {
+        sprintf(msgstr, "wrh5_open: detect must be in [%d, %d] but I saw %d", 
+                WRH5_DETECT_NONE, WRH5_DETECT_IQUV, options.detect);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(options.detect != WRH5_DETECT_NONE) {
+        if(p_wrh5_hdr->nbits != 32) {
+            sprintf(msgstr, "wrh5_open: detection requires nbits = 32 but I saw %d", p_wrh5_hdr->nbits);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+        if(p_wrh5_hdr->nifs != (options.detect == WRH5_DETECT_I ? 1 : 4)) {
+            sprintf(msgstr, "wrh5_open: detection product requires nifs = %d but I saw %d", 
+                    (options.detect == WRH5_DETECT_I ? 1 : 4), p_wrh5_hdr->nifs);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+        if(options.detect_nint < 0) {
+            sprintf(msgstr, "wrh5_open: detect_nint must be > -1 but I saw %d", options.detect_nint);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+    }
+    if(options.keep_mantissa_bits != 0) {
+        int max_bits = (p_wrh5_hdr->nbits == 64) ? 51 : 22;
+        if(p_wrh5_hdr->nbits < 32 || options.keep_mantissa_bits < 1 || options.keep_mantissa_bits > max_bits) {
+            sprintf(msgstr, "wrh5_open: keep_mantissa_bits must be in [1, %d] with nbits = 32 or 64 but I saw %d with nbits = %d", 
+                    max_bits, options.keep_mantissa_bits, p_wrh5_hdr->nbits);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+    }
+    if(options.quantize != WRH5_QUANT_NONE) {
+        if(options.quantize < WRH5_QUANT_NONE || options.quantize > WRH5_QUANT_INT8) {
+            sprintf(msgstr, "wrh5_open: quantize must be in [%d, %d] but I saw %d", 
+                    WRH5_QUANT_NONE, WRH5_QUANT_INT8, options.quantize);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+        if(p_wrh5_hdr->nbits != 32) {
+            sprintf(msgstr, "wrh5_open: quantization requires float32 input (nbits = 32) but I saw %d", p_wrh5_hdr->nbits);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+        if(options.keep_mantissa_bits != 0) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_open: quantization and keep_mantissa_bits are mutually exclusive");
+            return 1;
+        }
+        if(options.quant_nsigma < 0.0) {
+            sprintf(msgstr, "wrh5_open: quant_nsigma must be >= 0 but I saw %f", options.quant_nsigma);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+    }
+    if(options.bypass_min_ratio < 0.0) {
+        sprintf(msgstr, "wrh5_open: bypass_min_ratio must be >= 0 but I saw %f", options.bypass_min_ratio);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(options.sk_m != 0) {
+        if(options.sk_m < 2 || p_wrh5_hdr->nbits != 32) {
+            sprintf(msgstr, "wrh5_open: sk_m must be >= 2 with nbits = 32 but I saw %d with nbits = %d", 
+                    options.sk_m, p_wrh5_hdr->nbits);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+        if(options.sk_n < 0 || options.sk_nsigma < 0.0) {
+            sprintf(msgstr, "wrh5_open: sk_n and sk_nsigma must be >= 0 but I saw %d and %f", 
+                    options.sk_n, options.sk_nsigma);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+    }
+    if(options.deflate_level < 0 || options.deflate_level > 9) {
+        sprintf(msgstr, "wrh5_open: deflate_level must be in [0, 9] but I saw %d", options.deflate_level);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(options.io_depth < 0) {
+        sprintf(msgstr, "wrh5_open: io_depth must be >= 0 but I saw %d", options.io_depth);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    options.numa_nodes[sizeof(options.numa_nodes) - 1] = '\0';
+    if(wrh5_parse_list(options.numa_nodes, NULL, WRH5_MAX_NODES) != 0) {
+        sprintf(msgstr, "wrh5_open: numa_nodes must be a node list like \"0-1\" but I saw '%s'", options.numa_nodes);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+#ifndef __linux__
+    if(options.numa_nodes[0] != '\0') {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: numa_nodes is only available on Linux");
+        return 1;
+    }
+#endif
+    if(options.cc_aligned && p_wrh5_hdr->nfpc < 1) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: coarse channel aligned chunking requires nfpc > 0");
+        return 1;
+    }
+    if(options.contiguous_tints > 0 && (options.deflate_level > 0 || options.bypass_min_ratio > 0.0 || options.elide_fill
+                                        || options.cc_aligned || options.resume || options.io_depth > 0)) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: contiguous_tints excludes deflate_level, bypass_min_ratio, elide_fill, "
+                                       "cc_aligned, resume and io_depth");
+        return 1;
+    }
         
     /*
      * Initialize FBH5 context.
      */
     memset(p_wrh5_ctx, 0, sizeof(wrh5_context_t));
+    if(wrh5_chans_init(p_wrh5_ctx, p_wrh5_hdr, &options, &file_hdr, debugging) != 0)
+        return 1;
+    if(options.cc_aligned && file_hdr.nfpc < 1) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_open: coarse channel aligned chunking requires the kept channels to keep nfpc > 0");
+        wrh5_chans_close(p_wrh5_ctx);
+        return 1;
+    }
     p_wrh5_ctx->elem_size = p_wrh5_hdr->nbits / 8;
-    p_wrh5_ctx->tint_size = p_wrh5_hdr->nifs * p_wrh5_hdr->nchans * p_wrh5_ctx->elem_size;
+    p_wrh5_ctx->tint_size = file_hdr.nifs * file_hdr.nchans * p_wrh5_ctx->elem_size;
+    p_wrh5_ctx->in_tint_size = p_wrh5_hdr->nifs * p_wrh5_hdr->nchans * p_wrh5_ctx->elem_size;
     p_wrh5_ctx->offset_dims[0] = 0;
     p_wrh5_ctx->offset_dims[1] = 0;
     p_wrh5_ctx->offset_dims[2] = 0;
+    p_wrh5_ctx->nfpc = file_hdr.nfpc;
+    p_wrh5_ctx->cc_aligned = options.cc_aligned;
+    p_wrh5_ctx->input_layout = options.input_layout;
+    p_wrh5_ctx->detect = options.detect;
+    p_wrh5_ctx->detect_nint = (options.detect_nint > 0) ? options.detect_nint : 1;
+    p_wrh5_ctx->keep_mantissa_bits = options.keep_mantissa_bits;
+    p_wrh5_ctx->quantize = options.quantize;
+    p_wrh5_ctx->quant_update = options.quant_update;
+    p_wrh5_ctx->quant_nsigma = (options.quant_nsigma > 0.0) ? options.quant_nsigma : WRH5_QUANT_NSIGMA;
+    need_staging = (options.input_layout != WRH5_LAYOUT_TIF) || (options.detect != WRH5_DETECT_NONE)
+                   || (options.keep_mantissa_bits > 0) || (options.quantize != WRH5_QUANT_NONE)
+                   || (p_wrh5_ctx->p_chan_index != NULL);
+
+    /*
+     * Resume an existing file if so requested.
+     */
+    if(options.resume && access(output_path, F_OK) == 0) {
+        if(debugging)
+            wrh5_info("wrh5_open: resuming '%s'\n", output_path);
+        if(wrh5_resume(p_wrh5_ctx, p_wrh5_hdr, output_path, p_user_chunking, p_user_caching, &options, debugging) != 0)
+            return 1;
+        if(options.sk_m > 0)
+            if(wrh5_sk_init(p_wrh5_ctx, p_wrh5_hdr, &options, 1, debugging) != 0) {
+                abandon_file(p_wrh5_ctx);
+                return 1;
+            }
+        return open_buffers(p_wrh5_ctx, output_path, &options, need_staging, debugging);
+    }
     
+    /*
+     * Select the io_uring file driver if so requested.
+     */
+    if(options.io_depth > 0) {
+        fapl = H5Pcreate(H5P_FILE_ACCESS);
+        if(fapl < 0 || wrh5_set_fapl_uring(fapl, options.io_depth, options.io_slot_bytes, debugging) != 0) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_open: the io_uring file driver could not be selected");
+            if(!(fapl < 0))
+                H5Pclose(fapl);
+            return 1;
+        }
+    }
+
+    /*
+     * Contiguous layout: page-align the raw data so that it can be mapped from its first byte.
+     */
+    if(options.contiguous_tints > 0) {
+        fapl = H5Pcreate(H5P_FILE_ACCESS);
+        if(fapl < 0 || H5Pset_alignment(fapl, (hsize_t) sysconf(_SC_PAGESIZE), (hsize_t) sysconf(_SC_PAGESIZE)) < 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_open: H5Pset_alignment FAILED; the raw data may not be page aligned");
+    }
+
     /*
      * Open HDF5 file.  Overwrite it if preexisting.
      */
     p_wrh5_ctx->file_id = H5Fcreate(output_path,    // Full path of output file
                                     H5F_ACC_TRUNC,  // Overwrite if preexisting.
                                     H5P_DEFAULT,    // Default creation property list 
-                                    H5P_DEFAULT);   // Default access property list
+                                    (fapl < 0) ? H5P_DEFAULT : fapl);   // Access property list (file driver)
+    if(!(fapl < 0)) {
+        H5Pclose(fapl);
+        fapl = -1;
+    }
     if(p_wrh5_ctx->file_id < 0) {
         sprintf(msgstr, "wrh5_open: H5Fcreate of '%s' FAILED", output_path);
         wrh5_error(__FILE__, __LINE__, msgstr);
@@ -139,16 +536,16 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
     /*
      * Initialise the total file size in terms of its shape.
      */
-    p_wrh5_ctx->filesz_dims[0] = 1;
-    p_wrh5_ctx->filesz_dims[1] = p_wrh5_hdr->nifs;
-    p_wrh5_ctx->filesz_dims[2] = p_wrh5_hdr->nchans;
+    p_wrh5_ctx->filesz_dims[0] = (options.contiguous_tints > 0) ? options.contiguous_tints : 1;
+    p_wrh5_ctx->filesz_dims[1] = file_hdr.nifs;
+    p_wrh5_ctx->filesz_dims[2] = file_hdr.nchans;
     
     /*
-     * Set the maximum file size in terms of its shape.
+     * Set the maximum file size in terms of its shape (fixed with the contiguous layout).
      */
-    max_dims[0] = H5S_UNLIMITED;
-    max_dims[1] = p_wrh5_hdr->nifs;
-    max_dims[2] = p_wrh5_hdr->nchans;
+    max_dims[0] = (options.contiguous_tints > 0) ? options.contiguous_tints : H5S_UNLIMITED;
+    max_dims[1] = file_hdr.nifs;
+    max_dims[2] = file_hdr.nchans;
 
     /*
      * Create a dataspace which is extensible in the time dimension.
@@ -158,6 +555,7 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
                                                 max_dims);               // maximum dimensions
     if(p_wrh5_ctx->dataspace_id < 0) {
         wrh5_error(__FILE__, __LINE__, "wrh5_open: H5Screate_simple FAILED");
+        abandon_file(p_wrh5_ctx);
         return 1;
     }
     
@@ -167,6 +565,7 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
     dcpl = H5Pcreate(H5P_DATASET_CREATE);
     if(dcpl < 0) {
         wrh5_error(__FILE__, __LINE__, "wrh5_open: H5Pcreate/dcpl FAILED");
+        abandon_file(p_wrh5_ctx);
         return 1;
     }
          
@@ -176,20 +575,43 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
     if(p_user_chunking == NULL) {
         if(debugging)
             wrh5_info("Default chunking requested (blimpy)\n");
-        wrh5_blimpy_chunking(p_wrh5_hdr, &cdims[0]);
+        wrh5_blimpy_chunking(&file_hdr, &cdims[0]);
     } else {
         // User supplied chunk dimensions
         cdims[0] = p_user_chunking->n_time;
         cdims[1] = p_user_chunking->n_nifs;
         cdims[2] = p_user_chunking->n_fine_chan;
     }
-    status = H5Pset_chunk(dcpl, NDIMS, cdims);
-    if(status != 0) {
-        wrh5_error(__FILE__, __LINE__, "wrh5_open: H5Pset_chunk FAILED");
-        return 1;
+    if(options.cc_aligned) {
+        wrh5_cc_align_chunking(&file_hdr, &cdims[0]);
+        if(debugging)
+            wrh5_info("Coarse channel aligned chunking requested (nfpc = %d)\n", file_hdr.nfpc);
+    }
+    memcpy(p_wrh5_ctx->cdims, cdims, sizeof(cdims));
+    p_wrh5_ctx->quant_nint = (options.quant_nint > 0) ? options.quant_nint : cdims[0];
+    if(options.contiguous_tints > 0) {
+        // No chunks: cdims only sets the default staging and bandpass granularity.
+        // The raw data is allocated now and never filled; wrh5_mmap_init maps it.
+        if(H5Pset_layout(dcpl, H5D_CONTIGUOUS) < 0 || H5Pset_alloc_time(dcpl, H5D_ALLOC_TIME_EARLY) < 0
+           || H5Pset_fill_time(dcpl, H5D_FILL_TIME_NEVER) < 0) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_open: contiguous layout properties FAILED");
+            H5Pclose(dcpl);
+            abandon_file(p_wrh5_ctx);
+            return 1;
+        }
+        if(debugging)
+            wrh5_info("Contiguous layout, %lld time integrations\n", p_wrh5_ctx->filesz_dims[0]);
+    } else {
+        status = H5Pset_chunk(dcpl, NDIMS, cdims);
+        if(status != 0) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_open: H5Pset_chunk FAILED");
+            H5Pclose(dcpl);
+            abandon_file(p_wrh5_ctx);
+            return 1;
+        }
+        if(debugging)
+            wrh5_info("Chunk dimensions = (%lld, %lld, %lld)\n", cdims[0], cdims[1], cdims[2]);
     }
-    if(debugging)
-        wrh5_info("Chunk dimensions = (%lld, %lld, %lld)\n", cdims[0], cdims[1], cdims[2]);
 
     /*
      * Add the Bitshuffle and LZ4 filters to the dataset creation property list.
@@ -198,13 +620,27 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
         status = H5Pset_filter(dcpl, FILTER_ID_BITSHUFFLE, H5Z_FLAG_MANDATORY, 2, bitshuffle_opts); // Bitshuffle Filter
         if(status < 0)
             wrh5_warning(__FILE__, __LINE__, "wrh5_open: H5Pset_filter FAILED; data will not be compressed");
+        else
+            p_wrh5_ctx->filtered = 1;
+    } else if(options.deflate_level > 0) {
+        // Deflate (zlib) instead: readable everywhere, and libwrh5 can compress chunks itself (see wrh5_manager.c).
+        if(H5Pset_deflate(dcpl, options.deflate_level) < 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_open: H5Pset_deflate FAILED; data will not be compressed");
+        else {
+            p_wrh5_ctx->filtered = 1;
+            p_wrh5_ctx->deflate_level = options.deflate_level;
+        }
     }
     
     /* 
      * Define datatype for the data in the file.
      * We will store little endian values.
      */
-    switch(p_wrh5_hdr->nbits) {
+    if(options.quantize == WRH5_QUANT_UINT8)
+        p_wrh5_ctx->elem_type = H5T_STD_U8LE;
+    else if(options.quantize == WRH5_QUANT_INT8)
+        p_wrh5_ctx->elem_type = H5T_STD_I8LE;
+    else switch(p_wrh5_hdr->nbits) {
         case 8:
             p_wrh5_ctx->elem_type = H5T_NATIVE_B8;
             break;
@@ -230,6 +666,8 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
                                        H5P_DEFAULT);              // Default access properties
     if(p_wrh5_ctx->dataset_id < 0) {
         wrh5_error(__FILE__, __LINE__, "wrh5_open: H5Dcreate FAILED");
+        H5Pclose(dcpl);
+        abandon_file(p_wrh5_ctx);
         return 1;
     }
 
@@ -278,16 +716,69 @@ int wrh5_open(wrh5_context_t * p_wrh5_ctx,
     /*
      * Write dataset metadata attributes.
      */
-    wrh5_write_metadata(p_wrh5_ctx->dataset_id, // Dataset handle
-                        p_wrh5_hdr,               // Metadata (SIGPROC header)
-                        debugging);        // Tracing flag
+    if(options.quantize != WRH5_QUANT_NONE) {
+        // The stored data has 8 bits per sample.
+        wrh5_hdr_t quant_hdr;
+        memcpy(&quant_hdr, &file_hdr, sizeof(wrh5_hdr_t));
+        quant_hdr.nbits = 8;
+        wrh5_write_metadata(p_wrh5_ctx->dataset_id, &quant_hdr, debugging);
+        wrh5_set_str_attr(p_wrh5_ctx->dataset_id, "quantize", 
+                          (options.quantize == WRH5_QUANT_UINT8) ? "uint8" : "int8", debugging);
+        wrh5_set_dataset_double_attr(p_wrh5_ctx->dataset_id, "quant_nsigma", &p_wrh5_ctx->quant_nsigma, debugging);
+        if(wrh5_quant_init(p_wrh5_ctx, &file_hdr, debugging) != 0) {
+            abandon_file(p_wrh5_ctx);
+            return 1;
+        }
+    } else
+        wrh5_write_metadata(p_wrh5_ctx->dataset_id, // Dataset handle
+                            &file_hdr,                // Metadata (SIGPROC header)
+                            debugging);        // Tracing flag
+    if(options.keep_mantissa_bits > 0)
+        wrh5_set_dataset_int_attr(p_wrh5_ctx->dataset_id, "keep_mantissa_bits", &p_wrh5_ctx->keep_mantissa_bits, debugging);
+    if(options.cc_aligned)
+        wrh5_set_dataset_int_attr(p_wrh5_ctx->dataset_id, "cc_aligned", &p_wrh5_ctx->cc_aligned, debugging);
+    if(options.detect != WRH5_DETECT_NONE) {
+        wrh5_set_str_attr(p_wrh5_ctx->dataset_id, "detection", 
+                          (options.detect == WRH5_DETECT_I) ? "I" : "IQUV", debugging);
+        wrh5_set_dataset_int_attr(p_wrh5_ctx->dataset_id, "detect_nint", &p_wrh5_ctx->detect_nint, debugging);
+    }
+    if(p_wrh5_ctx->p_chan_index != NULL)
+        if(wrh5_chans_write_index(p_wrh5_ctx, debugging) != 0) {
+            abandon_file(p_wrh5_ctx);
+            return 1;
+        }
+    if(options.sk_m > 0)
+        if(wrh5_sk_init(p_wrh5_ctx, &file_hdr, &options, 0, debugging) != 0) {
+            abandon_file(p_wrh5_ctx);
+            return 1;
+        }
+    if(options.contiguous_tints > 0)
+        if(wrh5_mmap_init(p_wrh5_ctx, output_path, debugging) != 0) {
+            abandon_file(p_wrh5_ctx);
+            return 1;
+        }
 
-    /*
-     * Bye-bye.
-     */
-    p_wrh5_ctx->usable = 1;
-    if(debugging)
-        wrh5_show_context("wrh5_open", p_wrh5_ctx);
-    return 0;
+    return open_buffers(p_wrh5_ctx, output_path, &options, need_staging, debugging);
+}
+
+
+/***
+	Open-file entry point with user options.
+***/
+int wrh5_open_ext(wrh5_context_t * p_wrh5_ctx,
+                  wrh5_hdr_t * p_wrh5_hdr,
+                  char * output_path,
+                  user_chunking_t * p_user_chunking,
+                  user_caching_t * p_user_caching,
+                  user_options_t * p_user_options,
+                  int debugging) {
+    uint64_t    record_t0 = wrh5_trace_now();   // Write-pattern recording (see wrh5_record.c)
+    int         rc;
 
+    rc = open_file(p_wrh5_ctx, p_wrh5_hdr, output_path, p_user_chunking, p_user_caching, p_user_options, debugging);
+    if(rc != 0)
+        wrh5_chans_close(p_wrh5_ctx);
+    if(rc == 0)
+        wrh5_record_open(p_wrh5_ctx, record_t0, p_wrh5_hdr, output_path, p_user_chunking, p_user_caching, p_user_options);
+    return rc;
 }
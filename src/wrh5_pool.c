@@ -0,0 +1,188 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_pool.c                                                                 *
+ * -----------                                                                 *
+ * Reusable buffer pool for staging and compression scratch space.             *
+ *                                                                             *
+ * All buffers are carved out of a single anonymous mapping which is made      *
+ * once, at creation time:                                                     *
+ * - explicit hugepages (MAP_HUGETLB) if the system has some reserved,         *
+ * - else transparent hugepages (MADV_HUGEPAGE) on a 2 MiB aligned region,     *
+ * - else regular pages.                                                       *
+ * Every page is pre-faulted so that the first dump does not pay for it.       *
+ * After creation, get/put only move an index on a stack: no malloc/free.     *
+ * The mapping is reserved from the process-wide memory budget (wrh5_budget.c).*
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <sys/mman.h>
+
+
+/***
+	Map size bytes, trying explicit hugepages first, then transparent hugepages.
+	Returns the mapping or NULL; *p_hugepages is set to 2, 1 or 0.
+***/
+static char * map_hugepages(size_t size, int * p_hugepages) {
+    char * p_map;
+    char * p_aligned;
+    size_t head, tail;
+
+#ifdef MAP_HUGETLB
+    p_map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if(p_map != MAP_FAILED) {
+        *p_hugepages = 2;
+        return p_map;
+    }
+#endif
+
+    // Over-map by one hugepage so that the region can be hugepage aligned, then trim.
+    p_map = mmap(NULL, size + WRH5_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p_map == MAP_FAILED)
+        return NULL;
+    p_aligned = (char *) (((uintptr_t) p_map + WRH5_HUGEPAGE_SIZE - 1) & ~((uintptr_t) WRH5_HUGEPAGE_SIZE - 1));
+    head = p_aligned - p_map;
+    tail = WRH5_HUGEPAGE_SIZE - head;
+    if(head > 0)
+        munmap(p_map, head);
+    if(tail > 0)
+        munmap(p_aligned + size, tail);
+    *p_hugepages = 0;
+#ifdef MADV_HUGEPAGE
+    if(madvise(p_aligned, size, MADV_HUGEPAGE) == 0)
+        *p_hugepages = 1;
+#endif
+
+    // Pre-fault every page.
+    memset(p_aligned, 0, size);
+    return p_aligned;
+}
+
+
+/***
+	Create a pool of nbufs buffers of at least bufsize bytes each.
+***/
+int wrh5_pool_create(wrh5_pool_t * p_pool, size_t bufsize, int nbufs, int debugging) {
+    char msgstr[256];
+    int ix;
+
+    memset(p_pool, 0, sizeof(wrh5_pool_t));
+    if(nbufs < 1 || bufsize < 1) {
+        sprintf(msgstr, "wrh5_pool_create: nbufs (%d) and bufsize (%ld) must be > 0", nbufs, (long) bufsize);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    p_pool->bufsize = (bufsize + WRH5_HUGEPAGE_SIZE - 1) / WRH5_HUGEPAGE_SIZE * WRH5_HUGEPAGE_SIZE;
+    p_pool->nbufs = nbufs;
+    p_pool->map_size = p_pool->bufsize * nbufs;
+    if(wrh5_budget_acquire(p_pool->map_size, 0, 0, NULL, "wrh5_pool_create", debugging) != 0)
+        return 1;
+    p_pool->free_stack = malloc(nbufs * sizeof(int));
+    if(p_pool->free_stack == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_pool_create: malloc of the free stack FAILED");
+        wrh5_budget_release(p_pool->map_size);
+        return 1;
+    }
+    p_pool->base = map_hugepages(p_pool->map_size, &p_pool->hugepages);
+    if(p_pool->base == NULL) {
+        sprintf(msgstr, "wrh5_pool_create: mmap of %ld bytes FAILED", (long) p_pool->map_size);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        free(p_pool->free_stack);
+        p_pool->free_stack = NULL;
+        wrh5_budget_release(p_pool->map_size);
+        return 1;
+    }
+
+    // Hand out the lowest addresses first.
+    for(ix = 0; ix < nbufs; ix++)
+        p_pool->free_stack[ix] = nbufs - 1 - ix;
+    p_pool->nfree = nbufs;
+    pthread_mutex_init(&p_pool->lock, NULL);
+    pthread_cond_init(&p_pool->released, NULL);
+
+    if(debugging)
+        wrh5_info("wrh5_pool_create: %d buffers of %ld bytes, hugepages = %d\n",
+                  nbufs, (long) p_pool->bufsize, p_pool->hugepages);
+    return 0;
+}
+
+
+/***
+	Get a buffer from the pool.
+	If none is available: wait for one if flag_wait is nonzero, else return NULL.
+***/
+void * wrh5_pool_get(wrh5_pool_t * p_pool, int flag_wait) {
+    char * p_buffer = NULL;
+
+    pthread_mutex_lock(&p_pool->lock);
+    while(p_pool->nfree == 0 && flag_wait)
+        pthread_cond_wait(&p_pool->released, &p_pool->lock);
+    if(p_pool->nfree > 0) {
+        p_pool->nfree -= 1;
+        p_buffer = p_pool->base + (size_t) p_pool->free_stack[p_pool->nfree] * p_pool->bufsize;
+    }
+    pthread_mutex_unlock(&p_pool->lock);
+    return p_buffer;
+}
+
+
+/***
+	Is buffer the start of one of the pool's buffers? 1=yes, 0=no.
+***/
+int wrh5_pool_owns(wrh5_pool_t * p_pool, void * buffer) {
+    char * p_buffer = (char *) buffer;
+
+    if(p_pool == NULL || p_pool->base == NULL)
+        return 0;
+    if(p_buffer < p_pool->base || p_buffer >= p_pool->base + p_pool->map_size)
+        return 0;
+    return ((size_t) (p_buffer - p_pool->base) % p_pool->bufsize) == 0;
+}
+
+
+/***
+	Return a buffer to the pool.
+***/
+int wrh5_pool_put(wrh5_pool_t * p_pool, void * buffer) {
+    if(!wrh5_pool_owns(p_pool, buffer)) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_pool_put: buffer does not belong to this pool");
+        return 1;
+    }
+    pthread_mutex_lock(&p_pool->lock);
+    if(p_pool->nfree >= p_pool->nbufs) {
+        pthread_mutex_unlock(&p_pool->lock);
+        wrh5_error(__FILE__, __LINE__, "wrh5_pool_put: more buffers returned than were taken");
+        return 1;
+    }
+    p_pool->free_stack[p_pool->nfree] = (int) (((char *) buffer - p_pool->base) / p_pool->bufsize);
+    p_pool->nfree += 1;
+    pthread_cond_signal(&p_pool->released);
+    pthread_mutex_unlock(&p_pool->lock);
+    return 0;
+}
+
+
+/***
+	Release the pool's memory.
+***/
+int wrh5_pool_destroy(wrh5_pool_t * p_pool, int debugging) {
+    int rc = 0;
+
+    if(p_pool->base == NULL)
+        return 0;
+    if(p_pool->nfree != p_pool->nbufs)
+        wrh5_warning(__FILE__, __LINE__, "wrh5_pool_destroy: some buffers were never returned to the pool");
+    if(munmap(p_pool->base, p_pool->map_size) != 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_pool_destroy: munmap FAILED");
+        rc = 1;
+    }
+    pthread_cond_destroy(&p_pool->released);
+    pthread_mutex_destroy(&p_pool->lock);
+    free(p_pool->free_stack);
+    wrh5_budget_release(p_pool->map_size);
+    if(debugging)
+        wrh5_info("wrh5_pool_destroy: %d buffers of %ld bytes released\n", p_pool->nbufs, (long) p_pool->bufsize);
+    memset(p_pool, 0, sizeof(wrh5_pool_t));
+    return rc;
+}
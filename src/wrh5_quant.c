@@ -0,0 +1,384 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_quant.c                                                                *
+ * ------------                                                                *
+ * Bandpass normalisation and 8-bit quantization of float32 time integrations. *
+ *                                                                             *
+ * The bandpass (mean and standard deviation of every [ifs][chan] element) is  *
+ * estimated from the first quant_nint time integrations written, and again at *
+ * every multiple of quant_nint if quant_update is set (wrh5_write splits its  *
+ * staging loads there; the detection stage estimates at the first flush at or *
+ * after the boundary).  The sums are accumulated over as many staging loads   *
+ * as it takes, and those loads are held back (copied to quant_hold) until the *
+ * estimate is complete.  Each estimate appends a row to the auxiliary datasets:*
+ * - quant_offset [row][ifs][chan] float32                                     *
+ * - quant_scale  [row][ifs][chan] float32                                     *
+ * - quant_tint   [row]            uint64 : first time integration of the row  *
+ * so that a reader reconstructs data = quant_offset + quant_scale * stored.   *
+ *                                                                             *
+ * The staged float32 block is converted in place (SSE2 pack with saturation  *
+ * when available): the 8-bit output never overtakes the float32 input.       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/***
+	Add ntints float32 time integrations to the sums of the bandpass estimate in progress.
+***/
+static void accumulate(wrh5_context_t * p_wrh5_ctx, const float * p_data, size_t ntints) {
+    size_t   nelems = (size_t) (p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2]);
+    double * p_sum = p_wrh5_ctx->quant_acc;
+    double * p_sumsq = p_wrh5_ctx->quant_acc + nelems;
+    double   value;
+    size_t   ix, itint;
+
+    for(itint = 0; itint < ntints; itint++)
+        for(ix = 0; ix < nelems; ix++) {
+            value = (double) p_data[itint * nelems + ix];
+            p_sum[ix] += value;
+            p_sumsq[ix] += value * value;
+        }
+}
+
+
+/***
+	Complete the bandpass estimate from the sums of ntints time integrations starting at tint_offset,
+	append it to the auxiliary datasets and set the time integration of the next one.
+***/
+static int estimate(wrh5_context_t * p_wrh5_ctx, hsize_t tint_offset, size_t ntints, int debugging) {
+    size_t   nelems = (size_t) (p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2]);
+    double * p_sum = p_wrh5_ctx->quant_acc;
+    double * p_sumsq = p_wrh5_ctx->quant_acc + nelems;
+    double   mean, var, scale;
+    uint64_t first_tint = (uint64_t) tint_offset;
+    size_t   ix;
+
+    for(ix = 0; ix < nelems; ix++) {
+        mean = p_sum[ix] / ntints;
+        var = p_sumsq[ix] / ntints - mean * mean;
+        scale = p_wrh5_ctx->quant_nsigma * sqrt(var > 0.0 ? var : 0.0) / 256.0;
+        if(!(scale > 0.0))
+            scale = 1.0;    // Flat (or empty) channel : stored exactly at the mean
+        p_wrh5_ctx->quant_scale[ix] = (float) scale;
+        p_wrh5_ctx->quant_inv[ix] = (float) (1.0 / scale);
+        p_wrh5_ctx->quant_offset[ix] = (float) ((p_wrh5_ctx->quantize == WRH5_QUANT_UINT8) ? mean - 128.0 * scale : mean);
+    }
+
+    if(wrh5_append_row(p_wrh5_ctx->quant_offset_id, H5T_NATIVE_FLOAT, NDIMS, &p_wrh5_ctx->filesz_dims[1],
+                  p_wrh5_ctx->quant_nrows, p_wrh5_ctx->quant_offset) != 0
+       || wrh5_append_row(p_wrh5_ctx->quant_scale_id, H5T_NATIVE_FLOAT, NDIMS, &p_wrh5_ctx->filesz_dims[1],
+                     p_wrh5_ctx->quant_nrows, p_wrh5_ctx->quant_scale) != 0
+       || wrh5_append_row(p_wrh5_ctx->quant_tint_id, H5T_NATIVE_UINT64, 1, NULL,
+                     p_wrh5_ctx->quant_nrows, &first_tint) != 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_quantize: writing the bandpass estimate FAILED");
+        return 1;
+    }
+    if(debugging)
+        wrh5_info("wrh5_quantize: bandpass estimate %lld from %ld time integrations at offset %lld\n",
+                  p_wrh5_ctx->quant_nrows, (long) ntints, tint_offset);
+    p_wrh5_ctx->quant_nrows += 1;
+
+    // Next estimate: the first multiple of quant_nint past this one, if updating.
+    if(p_wrh5_ctx->quant_update)
+        p_wrh5_ctx->quant_next = ((tint_offset + ntints - 1) / p_wrh5_ctx->quant_nint + 1) * p_wrh5_ctx->quant_nint;
+    else
+        p_wrh5_ctx->quant_next = (hsize_t) -1;
+    return 0;
+}
+
+
+/***
+	Quantize nelems float32 values in place: dst[i] = saturate(round((src[i] - offset[i]) * inv[i])).
+	Rounding is to nearest even, as in _mm_cvtps_epi32 and lrintf.
+***/
+static void quantize_row(const float * src, void * dst, const float * offset, const float * inv,
+                         size_t nelems, int to_unsigned) {
+    uint8_t * p_u8 = (uint8_t *) dst;
+    int8_t *  p_i8 = (int8_t *) dst;
+    long      q;
+    size_t    ix = 0;
+
+#ifdef __SSE2__
+    __m128i q0, q1, q2, q3, q01, q23;
+    for(; ix + 16 <= nelems; ix += 16) {
+        q0 = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + ix), _mm_loadu_ps(offset + ix)), _mm_loadu_ps(inv + ix)));
+        q1 = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + ix + 4), _mm_loadu_ps(offset + ix + 4)), _mm_loadu_ps(inv + ix + 4)));
+        q2 = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + ix + 8), _mm_loadu_ps(offset + ix + 8)), _mm_loadu_ps(inv + ix + 8)));
+        q3 = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + ix + 12), _mm_loadu_ps(offset + ix + 12)), _mm_loadu_ps(inv + ix + 12)));
+        q01 = _mm_packs_epi32(q0, q1);
+        q23 = _mm_packs_epi32(q2, q3);
+        if(to_unsigned)
+            _mm_storeu_si128((__m128i *) (p_u8 + ix), _mm_packus_epi16(q01, q23));
+        else
+            _mm_storeu_si128((__m128i *) (p_i8 + ix), _mm_packs_epi16(q01, q23));
+    }
+#endif
+    for(; ix < nelems; ix++) {
+        q = lrintf((src[ix] - offset[ix]) * inv[ix]);
+        if(to_unsigned)
+            p_u8[ix] = (uint8_t) (q < 0 ? 0 : (q > 255 ? 255 : q));
+        else
+            p_i8[ix] = (int8_t) (q < -128 ? -128 : (q > 127 ? 127 : q));
+    }
+}
+
+
+/***
+	Allocate the bandpass vectors for nelems [ifs][chan] elements.
+***/
+static int alloc_vectors(wrh5_context_t * p_wrh5_ctx, size_t nelems) {
+    p_wrh5_ctx->quant_offset = malloc(nelems * sizeof(float));
+    p_wrh5_ctx->quant_scale = malloc(nelems * sizeof(float));
+    p_wrh5_ctx->quant_inv = malloc(nelems * sizeof(float));
+    p_wrh5_ctx->quant_acc = malloc(2 * nelems * sizeof(double));
+    if(p_wrh5_ctx->quant_offset == NULL || p_wrh5_ctx->quant_scale == NULL
+       || p_wrh5_ctx->quant_inv == NULL || p_wrh5_ctx->quant_acc == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_quant: malloc of the bandpass vectors FAILED");
+        wrh5_quant_close(p_wrh5_ctx);
+        return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Set up quantization: allocate the bandpass vectors and create the auxiliary datasets.
+	Called by wrh5_open_ext after dataset "data" exists.
+***/
+int wrh5_quant_init(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, int debugging) {
+    if(alloc_vectors(p_wrh5_ctx, (size_t) p_wrh5_hdr->nifs * p_wrh5_hdr->nchans) != 0)
+        return 1;
+    p_wrh5_ctx->quant_offset_id = wrh5_create_rows(p_wrh5_ctx->file_id, "quant_offset", H5T_IEEE_F32LE, NDIMS, &p_wrh5_ctx->filesz_dims[1], NULL);
+    p_wrh5_ctx->quant_scale_id = wrh5_create_rows(p_wrh5_ctx->file_id, "quant_scale", H5T_IEEE_F32LE, NDIMS, &p_wrh5_ctx->filesz_dims[1], NULL);
+    p_wrh5_ctx->quant_tint_id = wrh5_create_rows(p_wrh5_ctx->file_id, "quant_tint", H5T_STD_U64LE, 1, NULL, NULL);
+    if(p_wrh5_ctx->quant_offset_id < 0 || p_wrh5_ctx->quant_scale_id < 0 || p_wrh5_ctx->quant_tint_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_quant_init: H5Dcreate of the bandpass datasets FAILED");
+        wrh5_quant_close(p_wrh5_ctx);
+        return 1;
+    }
+    p_wrh5_ctx->quant_next = 0;
+    p_wrh5_ctx->quant_nrows = 0;
+    if(debugging)
+        wrh5_info("wrh5_quant_init: %s, quant_nint = %ld, quant_update = %d, quant_nsigma = %.2f\n",
+                  (p_wrh5_ctx->quantize == WRH5_QUANT_UINT8) ? "uint8" : "int8",
+                  (long) p_wrh5_ctx->quant_nint, p_wrh5_ctx->quant_update, p_wrh5_ctx->quant_nsigma);
+    return 0;
+}
+
+
+/***
+	Resume quantization of an existing file: reopen the auxiliary datasets and reload the last bandpass row.
+	Called by wrh5_resume once the context describes dataset "data".
+***/
+int wrh5_quant_resume(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    size_t  nelems = (size_t) (p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2]);
+    hsize_t dims[NDIMS], start[NDIMS], count[NDIMS];
+    hid_t   filespace_id, memspace_id;
+    herr_t  status = 0;
+    size_t  ix;
+    int     jx;
+
+    if(alloc_vectors(p_wrh5_ctx, nelems) != 0)
+        return 1;
+    p_wrh5_ctx->quant_offset_id = H5Dopen(p_wrh5_ctx->file_id, "quant_offset", H5P_DEFAULT);
+    p_wrh5_ctx->quant_scale_id = H5Dopen(p_wrh5_ctx->file_id, "quant_scale", H5P_DEFAULT);
+    p_wrh5_ctx->quant_tint_id = H5Dopen(p_wrh5_ctx->file_id, "quant_tint", H5P_DEFAULT);
+    if(p_wrh5_ctx->quant_offset_id < 0 || p_wrh5_ctx->quant_scale_id < 0 || p_wrh5_ctx->quant_tint_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_quant_resume: H5Dopen of the bandpass datasets FAILED");
+        wrh5_quant_close(p_wrh5_ctx);
+        return 1;
+    }
+    filespace_id = H5Dget_space(p_wrh5_ctx->quant_tint_id);
+    H5Sget_simple_extent_dims(filespace_id, dims, NULL);
+    H5Sclose(filespace_id);
+    p_wrh5_ctx->quant_nrows = dims[0];
+
+    /*
+     * Reload the last row: the bandpass in effect at the end of the file.
+     */
+    if(p_wrh5_ctx->quant_nrows > 0) {
+        start[0] = p_wrh5_ctx->quant_nrows - 1;
+        count[0] = 1;
+        for(jx = 1; jx < NDIMS; jx++) {
+            start[jx] = 0;
+            count[jx] = p_wrh5_ctx->filesz_dims[jx];
+        }
+        memspace_id = H5Screate_simple(NDIMS, count, NULL);
+        filespace_id = H5Dget_space(p_wrh5_ctx->quant_offset_id);
+        status = H5Sselect_hyperslab(filespace_id, H5S_SELECT_SET, start, NULL, count, NULL);
+        if(status >= 0)
+            status = H5Dread(p_wrh5_ctx->quant_offset_id, H5T_NATIVE_FLOAT, memspace_id, filespace_id, H5P_DEFAULT, p_wrh5_ctx->quant_offset);
+        if(status >= 0)
+            status = H5Dread(p_wrh5_ctx->quant_scale_id, H5T_NATIVE_FLOAT, memspace_id, filespace_id, H5P_DEFAULT, p_wrh5_ctx->quant_scale);
+        H5Sclose(filespace_id);
+        H5Sclose(memspace_id);
+        if(status < 0) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_quant_resume: H5Dread of the last bandpass row FAILED");
+            wrh5_quant_close(p_wrh5_ctx);
+            return 1;
+        }
+        for(ix = 0; ix < nelems; ix++)
+            p_wrh5_ctx->quant_inv[ix] = 1.0f / p_wrh5_ctx->quant_scale[ix];
+    }
+
+    /*
+     * Next estimate: the next quant_nint boundary if updating, else never (unless there is no row yet).
+     */
+    if(p_wrh5_ctx->quant_nrows == 0)
+        p_wrh5_ctx->quant_next = 0;
+    else if(p_wrh5_ctx->quant_update)
+        p_wrh5_ctx->quant_next = (p_wrh5_ctx->offset_dims[0] + p_wrh5_ctx->quant_nint - 1) / p_wrh5_ctx->quant_nint * p_wrh5_ctx->quant_nint;
+    else
+        p_wrh5_ctx->quant_next = (hsize_t) -1;
+    if(debugging)
+        wrh5_info("wrh5_quant_resume: %lld bandpass rows, next estimate at %lld\n",
+                  p_wrh5_ctx->quant_nrows, p_wrh5_ctx->quant_next);
+    return 0;
+}
+
+
+/***
+	Number of time integrations, at most ntints, that one staging load starting at tint_offset
+	may hold without crossing the boundary at which the next bandpass estimate is due,
+	or the end of the estimate in progress.
+***/
+size_t wrh5_quant_span(wrh5_context_t * p_wrh5_ctx, hsize_t tint_offset, size_t ntints) {
+    hsize_t boundary = p_wrh5_ctx->quant_next;
+
+    if(p_wrh5_ctx->quant_held > 0)
+        boundary = p_wrh5_ctx->quant_hold_start + p_wrh5_ctx->quant_nint;
+    else if(tint_offset >= boundary)
+        boundary = tint_offset + p_wrh5_ctx->quant_nint;
+    if(boundary - tint_offset < ntints)
+        return (size_t) (boundary - tint_offset);
+    return ntints;
+}
+
+
+/***
+	Quantize ntints staged time integrations in place and write them (wrh5_write_block).
+***/
+static int quantize_block(wrh5_context_t * p_wrh5_ctx, void * p_staged, hsize_t tint_offset, size_t ntints, int debugging) {
+    size_t nelems = (size_t) (p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2]);
+    size_t itint;
+
+    for(itint = 0; itint < ntints; itint++)
+        quantize_row((const float *) p_staged + itint * nelems, (uint8_t *) p_staged + itint * nelems,
+                     p_wrh5_ctx->quant_offset, p_wrh5_ctx->quant_inv, nelems,
+                     p_wrh5_ctx->quantize == WRH5_QUANT_UINT8);
+    return wrh5_write_block(p_wrh5_ctx, tint_offset, ntints, p_staged, debugging);
+}
+
+
+/***
+	Hold back ntints time integrations of an incomplete estimate.
+	The hold buffer (quant_nint time integrations) is reserved from the memory budget on first use.
+***/
+static int hold(wrh5_context_t * p_wrh5_ctx, const void * p_staged, size_t ntints, int debugging) {
+    size_t nelems = (size_t) (p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2]);
+    size_t nbytes = p_wrh5_ctx->quant_nint * nelems * sizeof(float);
+
+    if(p_wrh5_ctx->quant_hold == NULL) {
+        if(wrh5_budget_acquire(nbytes, 0, 0, NULL, "wrh5_quantize", debugging) != 0)
+            return 1;
+        p_wrh5_ctx->quant_hold = malloc(nbytes);
+        if(p_wrh5_ctx->quant_hold == NULL) {
+            wrh5_budget_release(nbytes);
+            wrh5_error(__FILE__, __LINE__, "wrh5_quantize: malloc of the hold buffer FAILED");
+            return 1;
+        }
+        if(debugging)
+            wrh5_info("wrh5_quantize: holding back time integrations until the bandpass estimate is complete\n");
+    }
+    memcpy(p_wrh5_ctx->quant_hold + p_wrh5_ctx->quant_held * nelems, p_staged, ntints * nelems * sizeof(float));
+    p_wrh5_ctx->quant_held += ntints;
+    return 0;
+}
+
+
+/***
+	Main entry point.
+	p_staged    : ntints float32 time integrations in on-disk order, converted in place to 8 bits
+	tint_offset : time integration number of the first one in the file
+	The time integrations are written (wrh5_write_block) once the bandpass they need is known;
+	until then they are held back.
+***/
+int wrh5_quantize(wrh5_context_t * p_wrh5_ctx, void * p_staged, hsize_t tint_offset, size_t ntints, int debugging) {
+    size_t nelems = (size_t) (p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2]);
+    size_t nacc, nheld;
+
+    /*
+     * Add to the bandpass estimate if one is due or in progress.
+     */
+    if(p_wrh5_ctx->quant_held > 0 || tint_offset >= p_wrh5_ctx->quant_next) {
+        if(p_wrh5_ctx->quant_held == 0) {
+            memset(p_wrh5_ctx->quant_acc, 0, 2 * nelems * sizeof(double));
+            p_wrh5_ctx->quant_hold_start = tint_offset;
+        }
+        nacc = p_wrh5_ctx->quant_nint - p_wrh5_ctx->quant_held;
+        if(nacc > ntints)
+            nacc = ntints;
+        accumulate(p_wrh5_ctx, (const float *) p_staged, nacc);
+        if(p_wrh5_ctx->quant_held + nacc < p_wrh5_ctx->quant_nint)
+            return hold(p_wrh5_ctx, p_staged, ntints, debugging);
+
+        // Complete: estimate, then write what was held back.
+        if(estimate(p_wrh5_ctx, p_wrh5_ctx->quant_hold_start, p_wrh5_ctx->quant_held + nacc, debugging) != 0)
+            return 1;
+        nheld = p_wrh5_ctx->quant_held;
+        p_wrh5_ctx->quant_held = 0;
+        if(nheld > 0)
+            if(quantize_block(p_wrh5_ctx, p_wrh5_ctx->quant_hold, p_wrh5_ctx->quant_hold_start, nheld, debugging) != 0)
+                return 1;
+    }
+
+    return quantize_block(p_wrh5_ctx, p_staged, tint_offset, ntints, debugging);
+}
+
+
+/***
+	Complete the estimate in progress from the time integrations held back so far, and write them.
+	Called by wrh5_write_missing (before a gap) and wrh5_close.
+***/
+int wrh5_quant_flush(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    size_t ntints = p_wrh5_ctx->quant_held;
+
+    if(ntints == 0)
+        return 0;
+    p_wrh5_ctx->quant_held = 0;
+    if(estimate(p_wrh5_ctx, p_wrh5_ctx->quant_hold_start, ntints, debugging) != 0)
+        return 1;
+    return quantize_block(p_wrh5_ctx, p_wrh5_ctx->quant_hold, p_wrh5_ctx->quant_hold_start, ntints, debugging);
+}
+
+
+/***
+	Close the auxiliary datasets and free the bandpass vectors and the hold buffer
+	(time integrations still held back are dropped: wrh5_close flushes them first).
+***/
+void wrh5_quant_close(wrh5_context_t * p_wrh5_ctx) {
+    if(p_wrh5_ctx->quant_offset_id > 0)
+        H5Dclose(p_wrh5_ctx->quant_offset_id);
+    if(p_wrh5_ctx->quant_scale_id > 0)
+        H5Dclose(p_wrh5_ctx->quant_scale_id);
+    if(p_wrh5_ctx->quant_tint_id > 0)
+        H5Dclose(p_wrh5_ctx->quant_tint_id);
+    p_wrh5_ctx->quant_offset_id = p_wrh5_ctx->quant_scale_id = p_wrh5_ctx->quant_tint_id = 0;
+    free(p_wrh5_ctx->quant_offset);
+    free(p_wrh5_ctx->quant_scale);
+    free(p_wrh5_ctx->quant_inv);
+    free(p_wrh5_ctx->quant_acc);
+    p_wrh5_ctx->quant_offset = p_wrh5_ctx->quant_scale = p_wrh5_ctx->quant_inv = NULL;
+    p_wrh5_ctx->quant_acc = NULL;
+    if(p_wrh5_ctx->quant_hold != NULL) {
+        free(p_wrh5_ctx->quant_hold);
+        wrh5_budget_release(p_wrh5_ctx->quant_nint * p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2] * sizeof(float));
+    }
+    p_wrh5_ctx->quant_hold = NULL;
+    p_wrh5_ctx->quant_held = 0;
+}
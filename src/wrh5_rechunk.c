@@ -0,0 +1,684 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_rechunk.c                                                              *
+ * --------------                                                              *
+ * Copy an existing FBH5 file into a new chunk shape and/or codec.             *
+ *                                                                             *
+ * Dataset "data" is cut into tiles of [H][nifs][W] elements: H is a multiple  *
+ * of the output chunk time dimension (of both chunk time dimensions when it   *
+ * fits) and W a multiple of the output chunk fine channel dimension, so that  *
+ * every output chunk belongs to one tile.  Worker threads take tiles in turn: *
+ * - Read: input chunks that are not filtered or only deflated are read raw    *
+ *   with H5Dread_chunk and inflated by the worker; others go through H5Dread  *
+ *   (the HDF5 filter pipeline).                                               *
+ * - Write: for no codec or deflate, each output chunk is gathered, deflated   *
+ *   by the worker and stored with H5Dwrite_chunk; for Bitshuffle, the tile is *
+ *   written through the HDF5 filter pipeline with H5Dwrite.                   *
+ * Memory is bounded by mem_budget: each thread holds one tile plus an input   *
+ * and an output chunk, and the number of threads is reduced if need be.       *
+ *                                                                             *
+ * File attributes, dataset attributes, dimension labels and the other         *
+ * datasets ("valid", "quant_*") are copied.  "cc_index" is not: it describes  *
+ * the input chunks.                                                           *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <unistd.h>
+#include <zlib.h>
+
+#define CC_INDEX_NAME       "cc_index"
+#define RECHUNK_BUDGET      (256 * 1024 * 1024)     // Default mem_budget
+#define RECHUNK_LEVEL       4                       // Default deflate level
+
+
+/*
+ * Shared by the worker threads.
+ */
+typedef struct {
+    hid_t   in_id;              // Input dataset "data"
+    hid_t   out_id;             // Output dataset "data"
+    hid_t   type_id;            // Element type (of both)
+    size_t  esz;                // Element byte size
+    hsize_t dims[NDIMS];        // Shape of "data"
+    hsize_t ci[NDIMS];          // Input chunk dimensions
+    hsize_t co[NDIMS];          // Output chunk dimensions
+    hsize_t tile[NDIMS];        // Tile shape
+    hsize_t ntiles_c;           // Tiles across the fine channels
+    hsize_t ntiles;             // Tiles in all
+    int     in_direct;          // 1: read input chunks with H5Dread_chunk
+    int     in_deflate;         // 1: direct input chunks are deflated (unless their filter mask says otherwise)
+    int     codec;              // Output codec: WRH5_CODEC_NONE, _BITSHUFFLE or _DEFLATE
+    int     level;              // Deflate level
+    hsize_t next_tile;          // Next tile to take
+    int     failed;             // 1: a worker failed; the others stop
+    pthread_mutex_t lock;       // Protects next_tile and failed
+} rechunk_job_t;
+
+
+/*
+ * Per-thread buffers.
+ */
+typedef struct {
+    rechunk_job_t * p_job;
+    char *  p_tile;             // [H][nifs][W]
+    char *  p_raw;              // One stored input chunk
+    size_t  raw_size;           // Allocated byte size of p_raw
+    char *  p_in;               // One inflated input chunk
+    char *  p_out;              // One output chunk
+    char *  p_zip;              // One deflated output chunk
+    uLong   zip_size;           // Byte size of p_zip
+} rechunk_worker_t;
+
+
+/***
+	Copy one attribute to the object dest_id (H5Aiterate2 callback).
+	Dimension scale bookkeeping attributes are left out: labels are set again by the caller.
+	So is "cc_aligned": the output chunks are not those of the input, and "cc_index" is not copied.
+***/
+static herr_t copy_attr(hid_t loc_id, const char * name, const H5A_info_t * p_info, void * p_dest) {
+    hid_t   dest_id = *(hid_t *) p_dest;
+    hid_t   attr_id, type_id, space_id, new_id;
+    size_t  nbytes;
+    void *  p_buf;
+    char    msgstr[256];
+
+    (void) p_info;
+    if(strcmp(name, "DIMENSION_LABELS") == 0 || strcmp(name, "DIMENSION_LIST") == 0 || strcmp(name, "REFERENCE_LIST") == 0
+       || strcmp(name, "cc_aligned") == 0)
+        return 0;
+    attr_id = H5Aopen(loc_id, name, H5P_DEFAULT);
+    type_id = H5Aget_type(attr_id);
+    space_id = H5Aget_space(attr_id);
+    nbytes = H5Tget_size(type_id) * (size_t) H5Sget_simple_extent_npoints(space_id);
+    p_buf = calloc(nbytes > 0 ? nbytes : 1, 1);
+    new_id = -1;
+    if(p_buf != NULL && H5Aread(attr_id, type_id, p_buf) >= 0) {
+        new_id = H5Acreate2(dest_id, name, type_id, space_id, H5P_DEFAULT, H5P_DEFAULT);
+        if(new_id >= 0 && H5Awrite(new_id, type_id, p_buf) < 0) {
+            H5Aclose(new_id);
+            new_id = -1;
+        }
+        if(H5Tis_variable_str(type_id) > 0 || H5Tdetect_class(type_id, H5T_VLEN) > 0)
+            H5Dvlen_reclaim(type_id, space_id, H5P_DEFAULT, p_buf);
+    }
+    if(new_id < 0) {
+        sprintf(msgstr, "wrh5_rechunk: attribute %s not copied", name);
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+    } else
+        H5Aclose(new_id);
+    free(p_buf);
+    H5Sclose(space_id);
+    H5Tclose(type_id);
+    H5Aclose(attr_id);
+    return 0;
+}
+
+
+/***
+	Copy one object of the input root group, except "data" and "cc_index" (H5Literate callback).
+***/
+static herr_t copy_object(hid_t group_id, const char * name, const H5L_info_t * p_info, void * p_dest) {
+    char msgstr[256];
+
+    (void) p_info;
+    if(strcmp(name, DATASETNAME) == 0 || strcmp(name, CC_INDEX_NAME) == 0)
+        return 0;
+    if(H5Ocopy(group_id, name, *(hid_t *) p_dest, name, H5P_DEFAULT, H5P_DEFAULT) < 0) {
+        sprintf(msgstr, "wrh5_rechunk: object %s not copied", name);
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+    }
+    return 0;
+}
+
+
+/***
+	Copy the overlap of a [ccount] region at chunk origin corg, held in p_src with shape [cdims],
+	into the tile at origin torg with shape [tcount].
+***/
+static void put_region(char * p_tile, hsize_t * torg, hsize_t * tcount,
+                       const char * p_src, hsize_t * corg, hsize_t * cdims, size_t esz) {
+    hsize_t lo[NDIMS], hi[NDIMS];
+    hsize_t t, i;
+    int     k;
+
+    for(k = 0; k < NDIMS; k++) {
+        lo[k] = (corg[k] > torg[k]) ? corg[k] : torg[k];
+        hi[k] = (corg[k] + cdims[k] < torg[k] + tcount[k]) ? corg[k] + cdims[k] : torg[k] + tcount[k];
+        if(lo[k] >= hi[k])
+            return;
+    }
+    for(t = lo[0]; t < hi[0]; t++)
+        for(i = lo[1]; i < hi[1]; i++)
+            memcpy(p_tile + (((t - torg[0]) * tcount[1] + i - torg[1]) * tcount[2] + lo[2] - torg[2]) * esz,
+                   p_src + (((t - corg[0]) * cdims[1] + i - corg[1]) * cdims[2] + lo[2] - corg[2]) * esz,
+                   (hi[2] - lo[2]) * esz);
+}
+
+
+/***
+	Fill the tile [tcount] at torg from the input dataset.
+***/
+static int read_tile(rechunk_worker_t * p_worker, hsize_t * torg, hsize_t * tcount) {
+    rechunk_job_t * p_job = p_worker->p_job;
+    size_t   in_bytes = p_job->ci[0] * p_job->ci[1] * p_job->ci[2] * p_job->esz;
+    hsize_t  corg[NDIMS], nbytes;
+    hid_t    memspace_id, filespace_id;
+    herr_t   status;
+    uint32_t filter_mask;
+    uLongf   in_len;
+    char *   p_new;
+    char     msgstr[256];
+
+    if(!p_job->in_direct) {
+        memspace_id = H5Screate_simple(NDIMS, tcount, NULL);
+        filespace_id = H5Dget_space(p_job->in_id);
+        status = H5Sselect_hyperslab(filespace_id, H5S_SELECT_SET, torg, NULL, tcount, NULL);
+        if(status >= 0)
+            status = H5Dread(p_job->in_id, p_job->type_id, memspace_id, filespace_id, H5P_DEFAULT, p_worker->p_tile);
+        H5Sclose(filespace_id);
+        H5Sclose(memspace_id);
+        return (status < 0) ? 1 : 0;
+    }
+
+    memset(p_worker->p_tile, 0, tcount[0] * tcount[1] * tcount[2] * p_job->esz);
+    for(corg[0] = torg[0] / p_job->ci[0] * p_job->ci[0]; corg[0] < torg[0] + tcount[0]; corg[0] += p_job->ci[0])
+        for(corg[1] = 0; corg[1] < tcount[1]; corg[1] += p_job->ci[1])
+            for(corg[2] = torg[2] / p_job->ci[2] * p_job->ci[2]; corg[2] < torg[2] + tcount[2]; corg[2] += p_job->ci[2]) {
+                H5E_BEGIN_TRY {     // An unallocated chunk is an error to HDF5, not to us
+                    status = H5Dget_chunk_storage_size(p_job->in_id, corg, &nbytes);
+                } H5E_END_TRY;
+                if(status < 0 || nbytes == 0)
+                    continue;   // Not allocated: fill value 0
+                if(nbytes > p_worker->raw_size) {
+                    p_new = realloc(p_worker->p_raw, nbytes);
+                    if(p_new == NULL) {
+                        sprintf(msgstr, "wrh5_rechunk: realloc of %lld bytes for a stored chunk FAILED", nbytes);
+                        wrh5_error(__FILE__, __LINE__, msgstr);
+                        return 1;
+                    }
+                    p_worker->p_raw = p_new;
+                    p_worker->raw_size = nbytes;
+                }
+                if(H5Dread_chunk(p_job->in_id, H5P_DEFAULT, corg, &filter_mask, p_worker->p_raw) < 0) {
+                    sprintf(msgstr, "wrh5_rechunk: H5Dread_chunk at (%lld, %lld, %lld) FAILED", corg[0], corg[1], corg[2]);
+                    wrh5_error(__FILE__, __LINE__, msgstr);
+                    return 1;
+                }
+                if(p_job->in_deflate && (filter_mask & 1) == 0) {
+                    in_len = in_bytes;
+                    if(uncompress((Bytef *) p_worker->p_in, &in_len, (Bytef *) p_worker->p_raw, nbytes) != Z_OK
+                       || in_len != in_bytes) {
+                        sprintf(msgstr, "wrh5_rechunk: chunk at (%lld, %lld, %lld) does not inflate to %ld bytes (%lld stored)",
+                                corg[0], corg[1], corg[2], (long) in_bytes, nbytes);
+                        wrh5_error(__FILE__, __LINE__, msgstr);
+                        return 1;
+                    }
+                    put_region(p_worker->p_tile, torg, tcount, p_worker->p_in, corg, p_job->ci, p_job->esz);
+                } else {
+                    if(nbytes != in_bytes) {
+                        sprintf(msgstr, "wrh5_rechunk: raw chunk at (%lld, %lld, %lld) has %lld bytes but I expected %ld",
+                                corg[0], corg[1], corg[2], nbytes, (long) in_bytes);
+                        wrh5_error(__FILE__, __LINE__, msgstr);
+                        return 1;
+                    }
+                    put_region(p_worker->p_tile, torg, tcount, p_worker->p_raw, corg, p_job->ci, p_job->esz);
+                }
+            }
+    return 0;
+}
+
+
+/***
+	Write the tile [tcount] at torg to the output dataset.
+***/
+static int write_tile(rechunk_worker_t * p_worker, hsize_t * torg, hsize_t * tcount) {
+    rechunk_job_t * p_job = p_worker->p_job;
+    hsize_t *  co = p_job->co;
+    size_t     esz = p_job->esz;
+    size_t     out_bytes = co[0] * co[1] * co[2] * esz;
+    hsize_t    offset[NDIMS], lo[NDIMS], n[NDIMS];
+    hsize_t    t, i;
+    hid_t      memspace_id, filespace_id;
+    herr_t     status;
+    uLongf     zip_len;
+    int        k, zrc;
+    char       msgstr[256];
+
+    if(p_job->codec == WRH5_CODEC_BITSHUFFLE) {
+        memspace_id = H5Screate_simple(NDIMS, tcount, NULL);
+        filespace_id = H5Dget_space(p_job->out_id);
+        status = H5Sselect_hyperslab(filespace_id, H5S_SELECT_SET, torg, NULL, tcount, NULL);
+        if(status >= 0)
+            status = H5Dwrite(p_job->out_id, p_job->type_id, memspace_id, filespace_id, H5P_DEFAULT, p_worker->p_tile);
+        H5Sclose(filespace_id);
+        H5Sclose(memspace_id);
+        if(status < 0) {
+            sprintf(msgstr, "wrh5_rechunk: H5Dwrite of the tile at (%lld, %lld, %lld) FAILED", torg[0], torg[1], torg[2]);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            return 1;
+        }
+        return 0;
+    }
+
+    for(offset[0] = torg[0]; offset[0] < torg[0] + tcount[0]; offset[0] += co[0])
+        for(offset[1] = 0; offset[1] < tcount[1]; offset[1] += co[1])
+            for(offset[2] = torg[2]; offset[2] < torg[2] + tcount[2]; offset[2] += co[2]) {
+                // Gather the chunk, zero-padded at the dataset edges.
+                for(k = 0; k < NDIMS; k++) {
+                    lo[k] = offset[k] - torg[k];
+                    n[k] = (lo[k] + co[k] <= tcount[k]) ? co[k] : tcount[k] - lo[k];
+                }
+                if(n[0] < co[0] || n[1] < co[1] || n[2] < co[2])
+                    memset(p_worker->p_out, 0, out_bytes);
+                for(t = 0; t < n[0]; t++)
+                    for(i = 0; i < n[1]; i++)
+                        memcpy(p_worker->p_out + ((t * co[1] + i) * co[2]) * esz,
+                               p_worker->p_tile + (((lo[0] + t) * tcount[1] + lo[1] + i) * tcount[2] + lo[2]) * esz,
+                               n[2] * esz);
+                if(p_job->codec == WRH5_CODEC_DEFLATE) {
+                    zip_len = p_worker->zip_size;
+                    zrc = compress2((Bytef *) p_worker->p_zip, &zip_len, (Bytef *) p_worker->p_out, out_bytes, p_job->level);
+                    if(zrc != Z_OK) {
+                        sprintf(msgstr, "wrh5_rechunk: compress2 of the chunk at (%lld, %lld, %lld) FAILED, zlib code %d",
+                                offset[0], offset[1], offset[2], zrc);
+                        wrh5_error(__FILE__, __LINE__, msgstr);
+                        return 1;
+                    }
+                    status = H5Dwrite_chunk(p_job->out_id, H5P_DEFAULT, 0, offset, zip_len, p_worker->p_zip);
+                } else
+                    status = H5Dwrite_chunk(p_job->out_id, H5P_DEFAULT, 0, offset, out_bytes, p_worker->p_out);
+                if(status < 0) {
+                    sprintf(msgstr, "wrh5_rechunk: H5Dwrite_chunk of the chunk at (%lld, %lld, %lld) FAILED",
+                            offset[0], offset[1], offset[2]);
+                    wrh5_error(__FILE__, __LINE__, msgstr);
+                    return 1;
+                }
+            }
+    return 0;
+}
+
+
+/***
+	Worker thread: take tiles until there are none left.
+***/
+static void * rechunk_worker(void * p_arg) {
+    rechunk_worker_t * p_worker = (rechunk_worker_t *) p_arg;
+    rechunk_job_t *    p_job = p_worker->p_job;
+    hsize_t            itile, torg[NDIMS], tcount[NDIMS];
+    char               msgstr[256];
+
+    for(;;) {
+        pthread_mutex_lock(&p_job->lock);
+        itile = p_job->next_tile++;
+        if(p_job->failed)
+            itile = p_job->ntiles;
+        pthread_mutex_unlock(&p_job->lock);
+        if(itile >= p_job->ntiles)
+            break;
+        torg[0] = (itile / p_job->ntiles_c) * p_job->tile[0];
+        torg[1] = 0;
+        torg[2] = (itile % p_job->ntiles_c) * p_job->tile[2];
+        tcount[0] = (torg[0] + p_job->tile[0] <= p_job->dims[0]) ? p_job->tile[0] : p_job->dims[0] - torg[0];
+        tcount[1] = p_job->dims[1];
+        tcount[2] = (torg[2] + p_job->tile[2] <= p_job->dims[2]) ? p_job->tile[2] : p_job->dims[2] - torg[2];
+        if(read_tile(p_worker, torg, tcount) != 0 || write_tile(p_worker, torg, tcount) != 0) {
+            sprintf(msgstr, "wrh5_rechunk: tile at (%lld, 0, %lld) FAILED", torg[0], torg[2]);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            pthread_mutex_lock(&p_job->lock);
+            p_job->failed = 1;
+            pthread_mutex_unlock(&p_job->lock);
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+/***
+	Greatest common divisor.
+***/
+static hsize_t gcd(hsize_t a, hsize_t b) {
+    hsize_t r;
+
+    while(b != 0) {
+        r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+
+/***
+	Choose the tile shape and the number of threads within the memory budget.
+***/
+static void plan_tiles(rechunk_job_t * p_job, size_t budget, int * p_nthreads) {
+    hsize_t * ci = p_job->ci;
+    hsize_t * co = p_job->co;
+    size_t    fixed, per_thread, row;
+    hsize_t   lcm_t, lcm_c, width, full;
+
+    // Besides its tile, a thread holds an input chunk twice and an output chunk twice.
+    fixed = 2 * (ci[0] * ci[1] * ci[2] + co[0] * co[1] * co[2]) * p_job->esz + 1024;
+    per_thread = budget / *p_nthreads;
+    row = p_job->dims[1] * p_job->esz;  // Bytes per time integration and fine channel
+    if(per_thread < fixed + co[0] * co[2] * row) {
+        *p_nthreads = budget / (fixed + co[0] * co[2] * row);
+        if(*p_nthreads < 1) {
+            *p_nthreads = 1;
+            wrh5_warning(__FILE__, __LINE__, "wrh5_rechunk: mem_budget is too small for one output chunk row; exceeding it");
+        }
+        per_thread = budget / *p_nthreads;
+    }
+
+    // Time: both chunk time dimensions if they fit, else the output one.
+    lcm_t = ci[0] / gcd(ci[0], co[0]) * co[0];
+    p_job->tile[0] = (fixed + lcm_t * co[2] * row <= per_thread) ? lcm_t : co[0];
+
+    // Fine channels: as many output chunks as fit, in whole input chunks where possible.
+    full = (p_job->dims[2] + co[2] - 1) / co[2] * co[2];
+    width = (per_thread > fixed) ? (per_thread - fixed) / (p_job->tile[0] * row) / co[2] * co[2] : co[2];
+    if(width < co[2])
+        width = co[2];
+    if(width > full)
+        width = full;
+    lcm_c = ci[2] / gcd(ci[2], co[2]) * co[2];
+    if(width < full && width > lcm_c)
+        width = width / lcm_c * lcm_c;
+    p_job->tile[1] = p_job->dims[1];
+    p_job->tile[2] = width;
+    p_job->ntiles_c = (p_job->dims[2] + width - 1) / width;
+    p_job->ntiles = (p_job->dims[0] + p_job->tile[0] - 1) / p_job->tile[0] * p_job->ntiles_c;
+    if((hsize_t) *p_nthreads > p_job->ntiles)
+        *p_nthreads = (int) p_job->ntiles;
+}
+
+
+/***
+	Inspect the input dataset "data" and settle the output chunk dimensions and codec.
+***/
+static int setup_input(rechunk_job_t * p_job, user_rechunk_t * p_params) {
+    hid_t        space_id, dcpl;
+    H5Z_filter_t filter = H5Z_FILTER_NONE;
+    unsigned     flags, cd_values[8], filter_config;
+    size_t       nelmts = 0;
+    char         msgstr[256];
+    int          nfilters = 0, ix;
+
+    p_job->type_id = H5Dget_type(p_job->in_id);
+    p_job->esz = H5Tget_size(p_job->type_id);
+    space_id = H5Dget_space(p_job->in_id);
+    if(H5Sget_simple_extent_ndims(space_id) != NDIMS) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: dataset 'data' is not 3-dimensional");
+        H5Sclose(space_id);
+        return 1;
+    }
+    H5Sget_simple_extent_dims(space_id, p_job->dims, NULL);
+    H5Sclose(space_id);
+
+    /*
+     * Input chunking and filters: direct chunk reads when the pipeline is empty or deflate only.
+     */
+    dcpl = H5Dget_create_plist(p_job->in_id);
+    if(H5Pget_layout(dcpl) == H5D_CHUNKED) {
+        H5Pget_chunk(dcpl, NDIMS, p_job->ci);
+        nfilters = H5Pget_nfilters(dcpl);
+        p_job->in_direct = 1;
+    } else {
+        p_job->ci[0] = 1;
+        p_job->ci[1] = p_job->dims[1];
+        p_job->ci[2] = p_job->dims[2];
+    }
+    if(nfilters > 0) {
+        nelmts = sizeof(cd_values) / sizeof(cd_values[0]);
+        filter = H5Pget_filter2(dcpl, 0, &flags, &nelmts, cd_values, 0, NULL, &filter_config);
+        p_job->in_deflate = (nfilters == 1 && filter == H5Z_FILTER_DEFLATE);
+        p_job->in_direct = p_job->in_deflate;
+    }
+    H5Pclose(dcpl);
+    if(filter == FILTER_ID_BITSHUFFLE && H5Zfilter_avail(FILTER_ID_BITSHUFFLE) <= 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: the input is compressed but the Bitshuffle plugin is NOT available");
+        return 1;
+    }
+
+    /*
+     * Output chunk dimensions (0 = as the input) and codec.
+     */
+    p_job->co[0] = (p_params->chunking.n_time > 0) ? p_params->chunking.n_time : p_job->ci[0];
+    p_job->co[1] = (p_params->chunking.n_nifs > 0) ? p_params->chunking.n_nifs : p_job->ci[1];
+    p_job->co[2] = (p_params->chunking.n_fine_chan > 0) ? p_params->chunking.n_fine_chan : p_job->ci[2];
+    for(ix = 1; ix < NDIMS; ix++)
+        if(p_job->co[ix] > p_job->dims[ix])
+            p_job->co[ix] = p_job->dims[ix];
+    p_job->codec = p_params->codec;
+    p_job->level = (p_params->deflate_level > 0) ? p_params->deflate_level : RECHUNK_LEVEL;
+    if(p_job->codec == WRH5_CODEC_KEEP) {
+        if(nfilters == 0)
+            p_job->codec = WRH5_CODEC_NONE;
+        else if(filter == FILTER_ID_BITSHUFFLE && nfilters == 1)
+            p_job->codec = WRH5_CODEC_BITSHUFFLE;
+        else if(p_job->in_deflate) {
+            p_job->codec = WRH5_CODEC_DEFLATE;
+            if(p_params->deflate_level < 1 && nelmts > 0)
+                p_job->level = (int) cd_values[0];
+        } else {
+            wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: the input filter pipeline cannot be kept; choose a codec");
+            return 1;
+        }
+    }
+    if(p_job->codec < WRH5_CODEC_NONE || p_job->codec > WRH5_CODEC_DEFLATE || p_job->level < 1 || p_job->level > 9) {
+        sprintf(msgstr, "wrh5_rechunk: codec must be in [%d, %d] and deflate_level in [1, 9] but I saw %d and %d",
+                WRH5_CODEC_KEEP, WRH5_CODEC_DEFLATE, p_job->codec, p_job->level);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(p_job->codec == WRH5_CODEC_BITSHUFFLE && H5Zfilter_avail(FILTER_ID_BITSHUFFLE) <= 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: Bitshuffle requested but the plugin is NOT available");
+        return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Create the output dataset "data" and copy the attributes, labels and other objects.
+***/
+static int setup_output(rechunk_job_t * p_job, hid_t in_file, hid_t out_file) {
+    hid_t    dcpl, space_id;
+    hsize_t  max_dims[NDIMS];
+    unsigned bitshuffle_opts[] = {0, 2};    // As wrh5_open: nelems = 0, LZ4
+    char     label[256];
+    char     msgstr[256];
+    herr_t   status;
+    int      ix;
+
+    H5Aiterate2(in_file, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, copy_attr, &out_file);
+    dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    if(dcpl < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: H5Pcreate of the output dataset creation properties FAILED");
+        return 1;
+    }
+    if(H5Pset_chunk(dcpl, NDIMS, p_job->co) < 0) {
+        sprintf(msgstr, "wrh5_rechunk: H5Pset_chunk (%lld, %lld, %lld) FAILED", p_job->co[0], p_job->co[1], p_job->co[2]);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        H5Pclose(dcpl);
+        return 1;
+    }
+    status = 0;
+    if(p_job->codec == WRH5_CODEC_BITSHUFFLE)
+        status = H5Pset_filter(dcpl, FILTER_ID_BITSHUFFLE, H5Z_FLAG_MANDATORY, 2, bitshuffle_opts);
+    else if(p_job->codec == WRH5_CODEC_DEFLATE)
+        status = H5Pset_deflate(dcpl, p_job->level);
+    if(status < 0) {
+        sprintf(msgstr, "wrh5_rechunk: setting filter %d on the output dataset FAILED",
+                (p_job->codec == WRH5_CODEC_BITSHUFFLE) ? FILTER_ID_BITSHUFFLE : H5Z_FILTER_DEFLATE);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        H5Pclose(dcpl);
+        return 1;
+    }
+    max_dims[0] = H5S_UNLIMITED;    // Extensible like a libwrh5 file, so that it may be resumed
+    max_dims[1] = p_job->dims[1];
+    max_dims[2] = p_job->dims[2];
+    space_id = H5Screate_simple(NDIMS, p_job->dims, max_dims);
+    p_job->out_id = H5Dcreate(out_file, DATASETNAME, p_job->type_id, space_id, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    H5Sclose(space_id);
+    H5Pclose(dcpl);
+    if(p_job->out_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: H5Dcreate of dataset 'data' FAILED");
+        return 1;
+    }
+    H5Aiterate2(p_job->in_id, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, copy_attr, &p_job->out_id);
+    for(ix = 0; ix < NDIMS; ix++)
+        if(H5DSget_label(p_job->in_id, ix, label, sizeof(label)) > 0)
+            H5DSset_label(p_job->out_id, ix, label);
+    H5Literate(in_file, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, copy_object, &out_file);
+    return 0;
+}
+
+
+/***
+	Plan the tiles, then run the worker threads until every tile is copied.
+***/
+static int run_workers(rechunk_job_t * p_job, user_rechunk_t * p_params, int debugging) {
+    rechunk_worker_t * p_workers;
+    pthread_t *        p_threads;
+    size_t             chunk_in, chunk_out;
+    int                nthreads, nstarted, ix, rc = 0;
+
+    nthreads = (p_params->nthreads > 0) ? p_params->nthreads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads < 1)
+        nthreads = 1;
+    plan_tiles(p_job, (p_params->mem_budget > 0) ? p_params->mem_budget : RECHUNK_BUDGET, &nthreads);
+    if(debugging)
+        wrh5_info("wrh5_rechunk: (%lld, %lld, %lld) chunks (%lld, %lld, %lld) --> (%lld, %lld, %lld), codec %d, "
+                  "%lld tiles of (%lld, %lld, %lld), %d threads, input read %s\n",
+                  p_job->dims[0], p_job->dims[1], p_job->dims[2], p_job->ci[0], p_job->ci[1], p_job->ci[2],
+                  p_job->co[0], p_job->co[1], p_job->co[2], p_job->codec, p_job->ntiles,
+                  p_job->tile[0], p_job->tile[1], p_job->tile[2], nthreads,
+                  p_job->in_direct ? "direct" : "through the filters");
+
+    /*
+     * Per-thread buffers.
+     */
+    p_workers = calloc(nthreads, sizeof(rechunk_worker_t));
+    p_threads = calloc(nthreads, sizeof(pthread_t));
+    if(p_workers == NULL || p_threads == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: calloc of the workers FAILED");
+        free(p_workers);
+        free(p_threads);
+        return 1;
+    }
+    chunk_in = p_job->ci[0] * p_job->ci[1] * p_job->ci[2] * p_job->esz;
+    chunk_out = p_job->co[0] * p_job->co[1] * p_job->co[2] * p_job->esz;
+    for(ix = 0; ix < nthreads; ix++) {
+        p_workers[ix].p_job = p_job;
+        p_workers[ix].raw_size = chunk_in;
+        p_workers[ix].zip_size = compressBound(chunk_out);
+        p_workers[ix].p_tile = malloc(p_job->tile[0] * p_job->tile[1] * p_job->tile[2] * p_job->esz);
+        p_workers[ix].p_raw = malloc(chunk_in);
+        p_workers[ix].p_in = malloc(chunk_in);
+        p_workers[ix].p_out = malloc(chunk_out);
+        p_workers[ix].p_zip = malloc(p_workers[ix].zip_size);
+        if(p_workers[ix].p_tile == NULL || p_workers[ix].p_raw == NULL || p_workers[ix].p_in == NULL
+           || p_workers[ix].p_out == NULL || p_workers[ix].p_zip == NULL) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: malloc of the worker buffers FAILED");
+            rc = 1;
+        }
+    }
+
+    /*
+     * Run.
+     */
+    if(rc == 0) {
+        pthread_mutex_init(&p_job->lock, NULL);
+        for(nstarted = 0; nstarted < nthreads; nstarted++)
+            if(pthread_create(&p_threads[nstarted], NULL, rechunk_worker, &p_workers[nstarted]) != 0) {
+                wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: pthread_create FAILED");
+                pthread_mutex_lock(&p_job->lock);
+                p_job->failed = 1;
+                pthread_mutex_unlock(&p_job->lock);
+                break;
+            }
+        for(ix = 0; ix < nstarted; ix++)
+            pthread_join(p_threads[ix], NULL);
+        pthread_mutex_destroy(&p_job->lock);
+        rc = p_job->failed;
+    }
+    for(ix = 0; ix < nthreads; ix++) {
+        free(p_workers[ix].p_tile);
+        free(p_workers[ix].p_raw);
+        free(p_workers[ix].p_in);
+        free(p_workers[ix].p_out);
+        free(p_workers[ix].p_zip);
+    }
+    free(p_workers);
+    free(p_threads);
+    return rc;
+}
+
+
+/***
+	Main entry point.
+	p_params : output chunking, codec, threads and memory budget; NULL = all defaults (see user_rechunk_t).
+***/
+int wrh5_rechunk(char * in_path, char * out_path, user_rechunk_t * p_params, int debugging) {
+    user_rechunk_t  params;
+    rechunk_job_t   job;
+    hid_t           in_file, out_file = -1;
+    char            msgstr[256];
+    int             rc;
+    struct timespec ts1, ts2;
+
+    if(p_params == NULL)
+        memset(&params, 0, sizeof(params));
+    else
+        memcpy(&params, p_params, sizeof(params));
+    memset(&job, 0, sizeof(job));
+    job.in_id = job.out_id = job.type_id = -1;
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+    in_file = H5Fopen(in_path, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if(in_file < 0) {
+        sprintf(msgstr, "wrh5_rechunk: H5Fopen of '%s' FAILED", in_path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    job.in_id = H5Dopen(in_file, DATASETNAME, H5P_DEFAULT);
+    if(job.in_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_rechunk: H5Dopen of dataset 'data' FAILED");
+        rc = 1;
+    } else
+        rc = setup_input(&job, &params);
+    if(rc == 0) {
+        out_file = H5Fcreate(out_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if(out_file < 0) {
+            sprintf(msgstr, "wrh5_rechunk: H5Fcreate of '%s' FAILED", out_path);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            rc = 1;
+        }
+    }
+    if(rc == 0)
+        rc = setup_output(&job, in_file, out_file);
+    if(rc == 0)
+        rc = run_workers(&job, &params, debugging);
+    if(debugging && rc == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &ts2);
+        wrh5_info("wrh5_rechunk: %.2f MB in %.3f seconds\n",
+                  job.dims[0] * job.dims[1] * job.dims[2] * job.esz / 1.0e6,
+                  (ts2.tv_sec - ts1.tv_sec) + 1.0e-9 * (ts2.tv_nsec - ts1.tv_nsec));
+    }
+
+    /*
+     * Bye-bye.
+     */
+    if(job.out_id >= 0)
+        H5Dclose(job.out_id);
+    if(job.in_id >= 0)
+        H5Dclose(job.in_id);
+    if(job.type_id >= 0)
+        H5Tclose(job.type_id);
+    if(out_file >= 0)
+        H5Fclose(out_file);
+    H5Fclose(in_file);
+    return rc;
+}
@@ -0,0 +1,573 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_record.c                                                               *
+ * -------------                                                               *
+ * Record the write pattern of an application and replay it, so that a         *
+ * production performance problem can be reproduced against any build or      *
+ * configuration of the library.                                               *
+ *                                                                             *
+ * While recording (wrh5_record_start, or the WRH5_RECORD environment          *
+ * variable at the first open), every wrh5_open_ext, wrh5_write (and           *
+ * wrh5_submit), wrh5_writev, wrh5_write_detect, wrh5_write_missing and        *
+ * wrh5_close call is appended to the recording: start time, duration,         *
+ * result, size; the header, path, chunking, caching and options at open;      *
+ * and the data of one wrh5_write in sample_every per context.                 *
+ * When not recording, a call costs one load and a branch.                     *
+ *                                                                             *
+ * wrh5_replay re-drives the calls, in recorded order, from one thread, at     *
+ * the recorded pace or as fast as possible.  A write without recorded data    *
+ * replays the context's last sample (or noise).  The recording is in the      *
+ * host's byte order and struct layouts: replay it on the same architecture.   *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <errno.h>
+#include <unistd.h>
+
+#define REC_MAGIC       "WRH5REC"
+#define REC_VERSION     1
+
+typedef struct {
+    char        magic[8];           // REC_MAGIC
+    uint32_t    version;            // REC_VERSION
+    uint32_t    hdr_size;           // sizeof(wrh5_hdr_t)
+    uint32_t    chunking_size;      // sizeof(user_chunking_t)
+    uint32_t    caching_size;       // sizeof(user_caching_t)
+    uint32_t    options_size;       // sizeof(user_options_t)
+    uint32_t    reserved;
+} rec_file_t;
+
+typedef struct {
+    uint32_t    type;               // WRH5_REC_OPEN, ...
+    uint32_t    ctx_id;             // Context number (1, 2, ... in order of opening)
+    uint64_t    t_ns;               // Call start, nanoseconds since the recording started
+    uint64_t    dur_ns;             // Call duration
+    uint64_t    n;                  // Bytes (write), time integrations (missing), spectra (detect)
+    int32_t     rc;                 // Call result
+    uint32_t    extra;              // Bytes that follow the record
+} rec_t;
+
+#define REC_HAS_CHUNKING    1       // Open flags
+#define REC_HAS_CACHING     2
+#define REC_HAS_OPTIONS     4
+
+volatile int wrh5_recording = 0;    // 1: record the calls (see WRH5_RECORD_BEGIN)
+
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;   // Protects everything below
+static FILE *   record_file = NULL;
+static uint64_t record_t0;          // wrh5_record_start time
+static unsigned int record_sample_every;    // Record the data of one wrh5_write in this many per context (0: none)
+static unsigned int record_next_id = 0;     // Last context number given
+static pthread_once_t record_env_once = PTHREAD_ONCE_INIT;
+
+
+/***
+	Append one record and its extra bytes (record_lock held).
+***/
+static void put_record(rec_t * p_rec, const void * p_extra1, size_t len1, const void * p_extra2, size_t len2) {
+    p_rec->extra = (uint32_t) (len1 + len2);
+    if(fwrite(p_rec, sizeof(rec_t), 1, record_file) != 1
+       || (len1 > 0 && fwrite(p_extra1, 1, len1, record_file) != len1)
+       || (len2 > 0 && fwrite(p_extra2, 1, len2, record_file) != len2)) {
+        wrh5_warning(__FILE__, __LINE__, "wrh5_record: write of the recording FAILED; recording stopped");
+        fclose(record_file);
+        record_file = NULL;
+        wrh5_recording = 0;
+    }
+}
+
+
+/***
+	Main entry point.
+	Start recording to path (replaced).  sample_every = N: record the data of one wrh5_write in N per context (0: none).
+***/
+int wrh5_record_start(const char * path, unsigned int sample_every, int debugging) {
+    rec_file_t  head;
+    char        msgstr[256];
+
+    pthread_mutex_lock(&record_lock);
+    if(record_file != NULL) {
+        pthread_mutex_unlock(&record_lock);
+        wrh5_error(__FILE__, __LINE__, "wrh5_record_start: already recording");
+        return 1;
+    }
+    record_file = fopen(path, "w");
+    if(record_file == NULL) {
+        pthread_mutex_unlock(&record_lock);
+        sprintf(msgstr, "wrh5_record_start: cannot create '%.200s' (%s)", path, strerror(errno));
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    memset(&head, 0, sizeof(head));
+    strcpy(head.magic, REC_MAGIC);
+    head.version = REC_VERSION;
+    head.hdr_size = sizeof(wrh5_hdr_t);
+    head.chunking_size = sizeof(user_chunking_t);
+    head.caching_size = sizeof(user_caching_t);
+    head.options_size = sizeof(user_options_t);
+    if(fwrite(&head, sizeof(head), 1, record_file) != 1) {
+        fclose(record_file);
+        record_file = NULL;
+        pthread_mutex_unlock(&record_lock);
+        sprintf(msgstr, "wrh5_record_start: write of '%.200s' FAILED", path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    record_t0 = wrh5_trace_now();
+    record_sample_every = sample_every;
+    wrh5_recording = 1;
+    pthread_mutex_unlock(&record_lock);
+    if(debugging)
+        wrh5_info("wrh5_record_start: recording to '%s', data of 1 write in %u\n", path, sample_every);
+    return 0;
+}
+
+
+/***
+	Stop recording and close the recording.  Contexts still open are no longer recorded.
+***/
+int wrh5_record_stop(int debugging) {
+    int rc = 0;
+
+    pthread_mutex_lock(&record_lock);
+    wrh5_recording = 0;
+    if(record_file != NULL && fclose(record_file) != 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_record_stop: write of the recording FAILED");
+        rc = 1;
+    }
+    record_file = NULL;
+    pthread_mutex_unlock(&record_lock);
+    if(debugging)
+        wrh5_info("wrh5_record_stop: recording closed\n");
+    return rc;
+}
+
+
+/***
+	WRH5_RECORD=path (and WRH5_RECORD_SAMPLE=N) in the environment: record from the first open on.
+***/
+static void record_from_env(void) {
+    const char * path = getenv("WRH5_RECORD");
+    const char * sample = getenv("WRH5_RECORD_SAMPLE");
+
+    if(path != NULL && path[0] != '\0')
+        wrh5_record_start(path, (sample != NULL) ? (unsigned int) atoi(sample) : 0, 0);
+}
+
+
+/***
+	Record a successful open (wrh5_open_ext), which gives the context its number.
+***/
+void wrh5_record_open(wrh5_context_t * p_wrh5_ctx, uint64_t t0, wrh5_hdr_t * p_wrh5_hdr, char * output_path,
+                      user_chunking_t * p_user_chunking, user_caching_t * p_user_caching, user_options_t * p_user_options) {
+    rec_t       rec;
+    char        blob[sizeof(uint32_t) + sizeof(wrh5_hdr_t) + sizeof(user_chunking_t) + sizeof(user_caching_t)
+                     + sizeof(user_options_t)];
+    uint32_t    flags = 0;
+    size_t      off;
+    uint64_t    t1;
+
+    pthread_once(&record_env_once, record_from_env);
+    p_wrh5_ctx->record_id = 0;
+    if(!wrh5_recording)
+        return;
+    t1 = wrh5_trace_now();
+    memset(blob, 0, sizeof(blob));
+    off = sizeof(uint32_t);
+    memcpy(blob + off, p_wrh5_hdr, sizeof(wrh5_hdr_t));
+    off += sizeof(wrh5_hdr_t);
+    if(p_user_chunking != NULL) {
+        flags |= REC_HAS_CHUNKING;
+        memcpy(blob + off, p_user_chunking, sizeof(user_chunking_t));
+    }
+    off += sizeof(user_chunking_t);
+    if(p_user_caching != NULL) {
+        flags |= REC_HAS_CACHING;
+        memcpy(blob + off, p_user_caching, sizeof(user_caching_t));
+    }
+    off += sizeof(user_caching_t);
+    if(p_user_options != NULL) {
+        flags |= REC_HAS_OPTIONS;
+        memcpy(blob + off, p_user_options, sizeof(user_options_t));
+        ((user_options_t *) (blob + off))->p_pool = NULL;       // An address means nothing in the replay
+    }
+    memcpy(blob, &flags, sizeof(flags));
+
+    pthread_mutex_lock(&record_lock);
+    if(record_file != NULL) {
+        p_wrh5_ctx->record_id = ++record_next_id;
+        memset(&rec, 0, sizeof(rec));
+        rec.type = WRH5_REC_OPEN;
+        rec.ctx_id = p_wrh5_ctx->record_id;
+        rec.t_ns = (t0 > record_t0) ? t0 - record_t0 : 0;
+        rec.dur_ns = t1 - t0;
+        put_record(&rec, blob, sizeof(blob), output_path, strlen(output_path) + 1);
+    }
+    pthread_mutex_unlock(&record_lock);
+}
+
+
+/***
+	Record a call on a recorded context that started at t0 (WRH5_RECORD_BEGIN).
+	p_data : the dump of a wrh5_write (n bytes), recorded if it is this context's turn; else NULL.
+***/
+void wrh5_record_call(wrh5_context_t * p_wrh5_ctx, int type, uint64_t t0, uint64_t n, const void * p_data, int rc) {
+    rec_t       rec;
+    uint64_t    t1 = wrh5_trace_now();
+    int         sample;
+
+    if(p_wrh5_ctx->record_id == 0)
+        return;
+    sample = (p_data != NULL && rc == 0 && record_sample_every > 0 && p_wrh5_ctx->record_nwrites % record_sample_every == 0
+              && n <= UINT32_MAX);     // rec.extra is 32 bits: larger dumps are not sampled
+    if(type == WRH5_REC_WRITE)
+        p_wrh5_ctx->record_nwrites += 1;
+    memset(&rec, 0, sizeof(rec));
+    rec.type = (uint32_t) type;
+    rec.ctx_id = p_wrh5_ctx->record_id;
+    rec.dur_ns = t1 - t0;
+    rec.n = n;
+    rec.rc = rc;
+    pthread_mutex_lock(&record_lock);
+    if(record_file != NULL) {
+        rec.t_ns = (t0 > record_t0) ? t0 - record_t0 : 0;
+        put_record(&rec, p_data, sample ? n : 0, NULL, 0);
+    }
+    pthread_mutex_unlock(&record_lock);
+    if(type == WRH5_REC_CLOSE)
+        p_wrh5_ctx->record_id = 0;
+}
+
+
+/*
+ * Replay.
+ */
+typedef struct {
+    wrh5_context_t ctx;
+    wrh5_hdr_t  hdr;
+    char *      p_data;             // Last sampled dump (or noise)
+    size_t      data_size;
+    int         known;              // 1: its open is in the recording
+    int         open;               // 1: opened by the replay
+} replay_ctx_t;
+
+typedef struct {
+    double *    values;
+    size_t      count;
+    size_t      size;
+} samples_t;
+
+
+/***
+	Keep one latency sample.
+***/
+static int add_sample(samples_t * p_samples, double value) {
+    double * p_new;
+
+    if(p_samples->count == p_samples->size) {
+        p_samples->size = (p_samples->size > 0) ? 2 * p_samples->size : 4096;
+        p_new = realloc(p_samples->values, p_samples->size * sizeof(double));
+        if(p_new == NULL)
+            return 1;
+        p_samples->values = p_new;
+    }
+    p_samples->values[p_samples->count++] = value;
+    return 0;
+}
+
+
+/***
+	qsort comparator of doubles.
+***/
+static int cmp_double(const void * p_a, const void * p_b) {
+    double a = *(const double *) p_a, b = *(const double *) p_b;
+
+    return (a > b) - (a < b);
+}
+
+
+/***
+	Sort the samples and return the quantile q (0 to 1).
+***/
+static double quantile(samples_t * p_samples, double q) {
+    size_t ix;
+
+    if(p_samples->count == 0)
+        return 0.0;
+    qsort(p_samples->values, p_samples->count, sizeof(double), cmp_double);
+    ix = (size_t) (q * (double) (p_samples->count - 1) + 0.5);
+    return p_samples->values[ix];
+}
+
+
+/***
+	Make the replay buffer of a context hold at least nbytes: the last sample repeated, else noise.
+***/
+static int replay_buffer(replay_ctx_t * p_rc, size_t nbytes) {
+    char *  p_new;
+    size_t  ix;
+    float * p_float;
+
+    if(nbytes <= p_rc->data_size)
+        return 0;
+    p_new = realloc(p_rc->p_data, nbytes);
+    if(p_new == NULL)
+        return 1;
+    if(p_rc->data_size > 0)
+        for(ix = p_rc->data_size; ix < nbytes; ix++)
+            p_new[ix] = p_new[ix % p_rc->data_size];
+    else {
+        p_float = (float *) p_new;
+        for(ix = 0; ix < nbytes / sizeof(float); ix++)
+            p_float[ix] = 1.0f + (float) (rand() % 1024) / 1024.0f;     // Noise around 1.5
+    }
+    p_rc->p_data = p_new;
+    p_rc->data_size = nbytes;
+    return 0;
+}
+
+
+/***
+	Main entry point.
+	Replay the recording at in_path: the files are written into p_params->out_dir under their recorded base names.
+***/
+int wrh5_replay(const char * in_path, user_replay_t * p_params, wrh5_replay_stats_t * p_stats, int debugging) {
+    FILE *          p_file;
+    rec_file_t      head;
+    rec_t           rec;
+    replay_ctx_t ** table = NULL;   // By context number
+    unsigned int    table_size = 0;
+    replay_ctx_t *  p_rc;
+    char *          p_extra = NULL;
+    size_t          extra_size = 0;
+    char            out_path[768];
+    const char *    base;
+    uint32_t        flags;
+    user_chunking_t chunking;
+    hsize_t         cdims[NDIMS];   // Default (blimpy) chunking
+    user_caching_t  caching;
+    user_options_t  options;
+    samples_t       lat_replay = {NULL, 0, 0}, lat_record = {NULL, 0, 0};
+    uint64_t        start, t0, t1, due;
+    float *         p_x = NULL;
+    size_t          xy_size = 0, off;
+    unsigned int    ix;
+    int             rc, status = 0;
+    char            msgstr[256];
+
+    memset(p_stats, 0, sizeof(wrh5_replay_stats_t));
+    p_file = fopen(in_path, "r");
+    if(p_file == NULL) {
+        sprintf(msgstr, "wrh5_replay: cannot open '%.200s' (%s)", in_path, strerror(errno));
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(fread(&head, sizeof(head), 1, p_file) != 1 || strcmp(head.magic, REC_MAGIC) != 0 || head.version != REC_VERSION
+       || head.hdr_size != sizeof(wrh5_hdr_t) || head.chunking_size != sizeof(user_chunking_t)
+       || head.caching_size != sizeof(user_caching_t) || head.options_size != sizeof(user_options_t)) {
+        sprintf(msgstr, "wrh5_replay: '%.180s' is not a recording of this version and architecture", in_path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        fclose(p_file);
+        return 1;
+    }
+
+    start = wrh5_trace_now();
+    while(fread(&rec, sizeof(rec), 1, p_file) == 1) {
+
+        /*
+         * Read the extra bytes, find the context, wait for the recorded start time.
+         */
+        if(rec.extra > extra_size) {
+            char * p_new = realloc(p_extra, rec.extra);
+            if(p_new == NULL) {
+                wrh5_error(__FILE__, __LINE__, "wrh5_replay: realloc FAILED");
+                status = 1;
+                break;
+            }
+            p_extra = p_new;
+            extra_size = rec.extra;
+        }
+        if(rec.extra > 0 && fread(p_extra, 1, rec.extra, p_file) != rec.extra) {
+            wrh5_warning(__FILE__, __LINE__, "wrh5_replay: the recording is truncated");
+            break;
+        }
+        if(rec.ctx_id >= table_size) {
+            replay_ctx_t ** p_new = realloc(table, (rec.ctx_id + 64) * sizeof(replay_ctx_t *));
+            if(p_new == NULL) {
+                wrh5_error(__FILE__, __LINE__, "wrh5_replay: realloc FAILED");
+                status = 1;
+                break;
+            }
+            memset(p_new + table_size, 0, (rec.ctx_id + 64 - table_size) * sizeof(replay_ctx_t *));
+            table = p_new;
+            table_size = rec.ctx_id + 64;
+        }
+        if(table[rec.ctx_id] == NULL)
+            table[rec.ctx_id] = calloc(1, sizeof(replay_ctx_t));
+        p_rc = table[rec.ctx_id];
+        if(p_rc == NULL) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_replay: calloc FAILED");
+            status = 1;
+            break;
+        }
+        if(rec.type == WRH5_REC_OPEN)
+            p_rc->known = 1;
+        else if(!p_rc->known)
+            continue;           // Opened in an earlier recording
+        if(p_params->paced) {
+            due = start + rec.t_ns;
+            while((t0 = wrh5_trace_now()) < due)
+                usleep((useconds_t) ((due - t0) / 1000 > 100000 ? 100000 : (due - t0) / 1000 + 1));
+        }
+
+        /*
+         * Re-drive the call.  A call on a context whose open failed fails.
+         */
+        rc = 1;
+        switch(rec.type) {
+            case WRH5_REC_OPEN:
+                memcpy(&flags, p_extra, sizeof(flags));
+                off = sizeof(flags);
+                memcpy(&p_rc->hdr, p_extra + off, sizeof(wrh5_hdr_t));
+                off += sizeof(wrh5_hdr_t);
+                memcpy(&chunking, p_extra + off, sizeof(chunking));
+                off += sizeof(chunking);
+                memcpy(&caching, p_extra + off, sizeof(caching));
+                off += sizeof(caching);
+                memcpy(&options, p_extra + off, sizeof(options));
+                off += sizeof(options);
+                if(p_params->chunking.n_time > 0 || p_params->chunking.n_nifs > 0 || p_params->chunking.n_fine_chan > 0) {
+                    if(!(flags & REC_HAS_CHUNKING)) {
+                        wrh5_blimpy_chunking(&p_rc->hdr, cdims);
+                        chunking.n_time = cdims[0];
+                        chunking.n_nifs = cdims[1];
+                        chunking.n_fine_chan = cdims[2];
+                    }
+                    if(p_params->chunking.n_time > 0)
+                        chunking.n_time = p_params->chunking.n_time;
+                    if(p_params->chunking.n_nifs > 0)
+                        chunking.n_nifs = p_params->chunking.n_nifs;
+                    if(p_params->chunking.n_fine_chan > 0)
+                        chunking.n_fine_chan = p_params->chunking.n_fine_chan;
+                    flags |= REC_HAS_CHUNKING;
+                }
+                if(!(flags & REC_HAS_OPTIONS))
+                    memset(&options, 0, sizeof(options));
+                if(p_params->deflate_level > 0)
+                    options.deflate_level = p_params->deflate_level;
+                if(p_params->io_depth > 0)
+                    options.io_depth = p_params->io_depth;
+                base = strrchr(p_extra + off, '/');
+                base = (base != NULL) ? base + 1 : p_extra + off;
+                snprintf(out_path, sizeof(out_path), "%s/%s", (p_params->out_dir[0] != '\0') ? p_params->out_dir : ".", base);
+                rc = wrh5_open_ext(&p_rc->ctx, &p_rc->hdr, out_path, (flags & REC_HAS_CHUNKING) ? &chunking : NULL,
+                                   (flags & REC_HAS_CACHING) ? &caching : NULL, &options, debugging);
+                p_rc->open = (rc == 0);
+                p_stats->opens += 1;
+                break;
+
+            case WRH5_REC_WRITE:
+            case WRH5_REC_WRITEV:
+                if(!p_rc->open)
+                    break;
+                if(rec.extra > 0) {
+                    if(replay_buffer(p_rc, rec.extra) != 0) {
+                        status = 1;
+                        break;
+                    }
+                    memcpy(p_rc->p_data, p_extra, rec.extra);
+                    p_rc->data_size = rec.extra;
+                } else if(replay_buffer(p_rc, rec.n) != 0) {
+                    status = 1;
+                    break;
+                }
+                t0 = wrh5_trace_now();
+                rc = wrh5_write(&p_rc->ctx, &p_rc->hdr, p_rc->p_data, rec.n, debugging);
+                t1 = wrh5_trace_now();
+                p_stats->writes += 1;
+                p_stats->bytes += (double) rec.n;
+                if(add_sample(&lat_replay, (double) (t1 - t0) * 1e-9) != 0 || add_sample(&lat_record, (double) rec.dur_ns * 1e-9) != 0)
+                    status = 1;
+                break;
+
+            case WRH5_REC_DETECT:
+                if(!p_rc->open)
+                    break;
+                if(rec.n * p_rc->hdr.nchans * 2 > xy_size) {
+                    free(p_x);
+                    xy_size = rec.n * p_rc->hdr.nchans * 2;
+                    p_x = malloc(xy_size * sizeof(float));
+                    if(p_x == NULL) {
+                        wrh5_error(__FILE__, __LINE__, "wrh5_replay: malloc FAILED");
+                        status = 1;
+                        break;
+                    }
+                    for(off = 0; off < xy_size; off++)
+                        p_x[off] = (float) (rand() % 1024) / 1024.0f - 0.5f;
+                }
+                t0 = wrh5_trace_now();
+                rc = wrh5_write_detect(&p_rc->ctx, &p_rc->hdr, p_x, p_x, rec.n, debugging);
+                t1 = wrh5_trace_now();
+                p_stats->writes += 1;
+                p_stats->bytes += (double) rec.n * p_rc->hdr.nchans * 16.0;
+                if(add_sample(&lat_replay, (double) (t1 - t0) * 1e-9) != 0 || add_sample(&lat_record, (double) rec.dur_ns * 1e-9) != 0)
+                    status = 1;
+                break;
+
+            case WRH5_REC_MISSING:
+                if(p_rc->open)
+                    rc = wrh5_write_missing(&p_rc->ctx, &p_rc->hdr, rec.n, debugging);
+                break;
+
+            case WRH5_REC_CLOSE:
+                if(p_rc->open)
+                    rc = wrh5_close(&p_rc->ctx, debugging);
+                p_rc->open = 0;
+                p_stats->closes += 1;
+                break;
+
+            default:
+                sprintf(msgstr, "wrh5_replay: unknown record type %u; replay stopped", rec.type);
+                wrh5_error(__FILE__, __LINE__, msgstr);
+                rc = 0;
+                status = 1;
+        }
+        if(status != 0)
+            break;
+        if(rc != 0 && rec.rc == 0)
+            p_stats->errors += 1;
+        p_stats->recorded_seconds = (double) (rec.t_ns + rec.dur_ns) * 1e-9;
+    }
+    p_stats->seconds = (double) (wrh5_trace_now() - start) * 1e-9;
+    fclose(p_file);
+
+    /*
+     * Close what the recording left open; summarize.
+     */
+    for(ix = 0; ix < table_size; ix++)
+        if(table[ix] != NULL) {
+            if(table[ix]->open) {
+                if(wrh5_close(&table[ix]->ctx, debugging) != 0)
+                    p_stats->errors += 1;
+                p_stats->closes += 1;
+            }
+            free(table[ix]->p_data);
+            free(table[ix]);
+        }
+    free(table);
+    free(p_extra);
+    free(p_x);
+    p_stats->lat_p50 = quantile(&lat_replay, 0.50);
+    p_stats->lat_p90 = quantile(&lat_replay, 0.90);
+    p_stats->lat_p99 = quantile(&lat_replay, 0.99);
+    p_stats->lat_max = quantile(&lat_replay, 1.0);
+    p_stats->rec_p50 = quantile(&lat_record, 0.50);
+    p_stats->rec_p99 = quantile(&lat_record, 0.99);
+    p_stats->rec_max = quantile(&lat_record, 1.0);
+    free(lat_replay.values);
+    free(lat_record.values);
+    if(debugging)
+        wrh5_info("wrh5_replay: %lu writes, %.2f MiB in %.3f s (recorded: %.3f s), %lu errors\n",
+                  p_stats->writes, p_stats->bytes / 1048576.0, p_stats->seconds, p_stats->recorded_seconds, p_stats->errors);
+    return (status != 0 || p_stats->errors > 0) ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_resume.c                                                               *
+ * -------------                                                               *
+ * Resume writing an existing libwrh5 file in place (user option resume).      *
+ *                                                                             *
+ * The file is opened read-write and the caller's header is checked against    *
+ * the attributes of dataset "data".  The context is then rebuilt from the     *
+ * dataset: time integration count (its extent), chunk dimensions and filter   *
+ * (its creation properties), valid bitmap and quantization bandpass.          *
+ * Datasets written at close time ("valid", "cc_index") are removed here, to   *
+ * be written again by wrh5_close.                                             *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+
+#define VALID_NAME      "valid"
+#define CC_INDEX_NAME   "cc_index"
+
+
+/***
+	Report msg, close what was opened, and return 1.
+***/
+static int give_up(wrh5_context_t * p_wrh5_ctx, char * msg) {
+    wrh5_error(__FILE__, __LINE__, msg);
+    if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE)
+        wrh5_quant_close(p_wrh5_ctx);
+    if(p_wrh5_ctx->dataspace_id > 0)
+        H5Sclose(p_wrh5_ctx->dataspace_id);
+    if(p_wrh5_ctx->dataset_id > 0)
+        H5Dclose(p_wrh5_ctx->dataset_id);
+    if(p_wrh5_ctx->file_id > 0)
+        H5Fclose(p_wrh5_ctx->file_id);
+    p_wrh5_ctx->dataspace_id = p_wrh5_ctx->dataset_id = p_wrh5_ctx->file_id = 0;
+    free(p_wrh5_ctx->p_valid);
+    p_wrh5_ctx->p_valid = NULL;
+    return 1;
+}
+
+
+/***
+	Check the header against the attributes of dataset "data".  0 = same, 1 = not.
+***/
+static int check_header(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, user_options_t * p_options, char * msgstr) {
+    hid_t   id = p_wrh5_ctx->dataset_id;
+    int     ivalue, nbits;
+    double  dvalue;
+    char    svalue[81];
+
+    nbits = (p_options->quantize != WRH5_QUANT_NONE) ? 8 : p_wrh5_hdr->nbits;
+    if(wrh5_get_attr(id, "nchans", H5T_NATIVE_INT, &ivalue) != 0 || ivalue != p_wrh5_hdr->nchans) {
+        sprintf(msgstr, "wrh5_resume: header nchans = %d does not match the file", p_wrh5_hdr->nchans);
+        return 1;
+    }
+    if(wrh5_get_attr(id, "nifs", H5T_NATIVE_INT, &ivalue) != 0 || ivalue != p_wrh5_hdr->nifs) {
+        sprintf(msgstr, "wrh5_resume: header nifs = %d does not match the file", p_wrh5_hdr->nifs);
+        return 1;
+    }
+    if(wrh5_get_attr(id, "nbits", H5T_NATIVE_INT, &ivalue) != 0 || ivalue != nbits) {
+        sprintf(msgstr, "wrh5_resume: stored nbits = %d does not match the file", nbits);
+        return 1;
+    }
+    if(wrh5_get_attr(id, "nfpc", H5T_NATIVE_INT, &ivalue) != 0)
+        ivalue = 0;
+    if(ivalue != ((p_wrh5_hdr->nfpc > 0) ? p_wrh5_hdr->nfpc : 0)) {
+        sprintf(msgstr, "wrh5_resume: header nfpc = %d does not match the file (%d)", p_wrh5_hdr->nfpc, ivalue);
+        return 1;
+    }
+    if(wrh5_get_attr(id, "fch1", H5T_NATIVE_DOUBLE, &dvalue) != 0 || dvalue != p_wrh5_hdr->fch1) {
+        sprintf(msgstr, "wrh5_resume: header fch1 = %f does not match the file", p_wrh5_hdr->fch1);
+        return 1;
+    }
+    if(wrh5_get_attr(id, "foff", H5T_NATIVE_DOUBLE, &dvalue) != 0 || dvalue != p_wrh5_hdr->foff) {
+        sprintf(msgstr, "wrh5_resume: header foff = %e does not match the file", p_wrh5_hdr->foff);
+        return 1;
+    }
+    if(wrh5_get_attr(id, "tsamp", H5T_NATIVE_DOUBLE, &dvalue) != 0 || dvalue != p_wrh5_hdr->tsamp) {
+        sprintf(msgstr, "wrh5_resume: header tsamp = %f does not match the file", p_wrh5_hdr->tsamp);
+        return 1;
+    }
+
+    /*
+     * Options that change what is stored must be the same as when the file was created.
+     */
+    if(wrh5_get_str_attr(id, "quantize", svalue, sizeof(svalue)) != 0)
+        strcpy(svalue, "none");
+    if(strcmp(svalue, (p_options->quantize == WRH5_QUANT_UINT8) ? "uint8"
+                      : (p_options->quantize == WRH5_QUANT_INT8) ? "int8" : "none") != 0) {
+        sprintf(msgstr, "wrh5_resume: quantize = %d does not match the file (%s)", p_options->quantize, svalue);
+        return 1;
+    }
+    if(wrh5_get_str_attr(id, "detection", svalue, sizeof(svalue)) != 0)
+        strcpy(svalue, "none");
+    if(strcmp(svalue, (p_options->detect == WRH5_DETECT_I) ? "I"
+                      : (p_options->detect == WRH5_DETECT_IQUV) ? "IQUV" : "none") != 0) {
+        sprintf(msgstr, "wrh5_resume: detect = %d does not match the file (%s)", p_options->detect, svalue);
+        return 1;
+    }
+    if(wrh5_get_attr(id, "keep_mantissa_bits", H5T_NATIVE_INT, &ivalue) != 0)
+        ivalue = 0;
+    if(ivalue != p_options->keep_mantissa_bits) {
+        sprintf(msgstr, "wrh5_resume: keep_mantissa_bits = %d does not match the file (%d)",
+                p_options->keep_mantissa_bits, ivalue);
+        return 1;
+    }
+    if(wrh5_get_attr(id, "cc_aligned", H5T_NATIVE_INT, &ivalue) != 0)
+        ivalue = 0;
+    if((ivalue != 0) != (p_options->cc_aligned != 0)) {
+        sprintf(msgstr, "wrh5_resume: cc_aligned = %d does not match the file (%d)", p_options->cc_aligned, ivalue);
+        return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Reload the valid bitmap, if any, and remove it: wrh5_close writes it again.
+	Without one, every time integration already in the file is real.
+***/
+static int reload_valid(wrh5_context_t * p_wrh5_ctx) {
+    hid_t   valid_id, space_id;
+    hsize_t dims[1], itint;
+    herr_t  status;
+
+    if(wrh5_valid_mark(p_wrh5_ctx, 0, p_wrh5_ctx->offset_dims[0], NULL, 1) != 0)
+        return 1;
+    if(H5Lexists(p_wrh5_ctx->file_id, VALID_NAME, H5P_DEFAULT) <= 0)
+        return 0;
+    valid_id = H5Dopen(p_wrh5_ctx->file_id, VALID_NAME, H5P_DEFAULT);
+    if(valid_id < 0)
+        return 1;
+    space_id = H5Dget_space(valid_id);
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    status = 0;
+    if(dims[0] > 0 && dims[0] <= p_wrh5_ctx->valid_size)
+        status = H5Dread(valid_id, H5T_NATIVE_UINT8, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_wrh5_ctx->p_valid);
+    H5Dclose(valid_id);
+    if(status < 0 || dims[0] > p_wrh5_ctx->valid_size)
+        return 1;
+    for(itint = 0; itint < p_wrh5_ctx->offset_dims[0]; itint++)
+        if((p_wrh5_ctx->p_valid[itint / 8] & (1 << (itint % 8))) == 0)
+            p_wrh5_ctx->missing_tints += 1;
+    return (H5Ldelete(p_wrh5_ctx->file_id, VALID_NAME, H5P_DEFAULT) < 0) ? 1 : 0;
+}
+
+
+/***
+	Main entry point - called by wrh5_open_ext when the resume option is set and path exists.
+	The context fields derived from the header and options alone are already set.
+***/
+int wrh5_resume(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, char * path,
+                user_chunking_t * p_user_chunking, user_caching_t * p_user_caching,
+                user_options_t * p_options, int debugging) {
+    hid_t       fapl, dcpl, type_id;
+    hsize_t     dims[NDIMS], nchunks;
+    unsigned    flags;
+    size_t      nelmts;
+    unsigned    cd_values[8];
+    unsigned    filter_config;
+    int         ix;
+    char        msgstr[256];
+    char        svalue[81];
+
+    /*
+     * Open the file read-write, with the user's caching and file driver if any.
+     */
+    fapl = H5Pcreate(H5P_FILE_ACCESS);
+    if(fapl >= 0 && p_user_caching != NULL)
+        if(H5Pset_cache(fapl, 0, p_user_caching->nslots, p_user_caching->nbytes, p_user_caching->policy) < 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_resume: H5Pset_cache FAILED; using default caching");
+    if(fapl >= 0 && p_options->io_depth > 0)
+        if(wrh5_set_fapl_uring(fapl, p_options->io_depth, p_options->io_slot_bytes, debugging) != 0) {
+            H5Pclose(fapl);
+            return 1;
+        }
+    p_wrh5_ctx->file_id = H5Fopen(path, H5F_ACC_RDWR, (fapl >= 0) ? fapl : H5P_DEFAULT);
+    if(fapl >= 0)
+        H5Pclose(fapl);
+    if(p_wrh5_ctx->file_id < 0) {
+        sprintf(msgstr, "wrh5_resume: H5Fopen of '%s' FAILED", path);
+        p_wrh5_ctx->file_id = 0;
+        return give_up(p_wrh5_ctx, msgstr);
+    }
+    if(wrh5_get_str_attr(p_wrh5_ctx->file_id, "CLASS", svalue, sizeof(svalue)) != 0
+       || strcmp(svalue, FILTERBANK_CLASS) != 0
+       || H5Aexists(p_wrh5_ctx->file_id, "LIBWRH5") <= 0) {
+        sprintf(msgstr, "wrh5_resume: '%s' was not written by libwrh5", path);
+        return give_up(p_wrh5_ctx, msgstr);
+    }
+    p_wrh5_ctx->dataset_id = H5Dopen(p_wrh5_ctx->file_id, DATASETNAME, H5P_DEFAULT);
+    if(p_wrh5_ctx->dataset_id < 0) {
+        p_wrh5_ctx->dataset_id = 0;
+        return give_up(p_wrh5_ctx, "wrh5_resume: H5Dopen of dataset 'data' FAILED");
+    }
+    if(check_header(p_wrh5_ctx, p_wrh5_hdr, p_options, msgstr) != 0)
+        return give_up(p_wrh5_ctx, msgstr);
+
+    /*
+     * Element type: the size stored must be the size this context writes.
+     */
+    if(p_options->quantize == WRH5_QUANT_UINT8)
+        p_wrh5_ctx->elem_type = H5T_STD_U8LE;
+    else if(p_options->quantize == WRH5_QUANT_INT8)
+        p_wrh5_ctx->elem_type = H5T_STD_I8LE;
+    else switch(p_wrh5_hdr->nbits) {
+        case 8:
+            p_wrh5_ctx->elem_type = H5T_NATIVE_B8;
+            break;
+        case 16:
+            p_wrh5_ctx->elem_type = H5T_NATIVE_B16;
+            break;
+        case 32:
+            p_wrh5_ctx->elem_type = H5T_IEEE_F32LE;
+            break;
+        default: // 64
+            p_wrh5_ctx->elem_type = H5T_IEEE_F64LE;
+    }
+    type_id = H5Dget_type(p_wrh5_ctx->dataset_id);
+    if(type_id < 0 || H5Tget_size(type_id) != H5Tget_size(p_wrh5_ctx->elem_type)) {
+        if(type_id >= 0)
+            H5Tclose(type_id);
+        return give_up(p_wrh5_ctx, "wrh5_resume: the element size of dataset 'data' does not match the header");
+    }
+    H5Tclose(type_id);
+
+    /*
+     * Extent: nifs and nchans must match; the time dimension is the count so far.
+     */
+    p_wrh5_ctx->dataspace_id = H5Dget_space(p_wrh5_ctx->dataset_id);
+    if(p_wrh5_ctx->dataspace_id < 0 || H5Sget_simple_extent_ndims(p_wrh5_ctx->dataspace_id) != NDIMS) {
+        p_wrh5_ctx->dataspace_id = 0;
+        return give_up(p_wrh5_ctx, "wrh5_resume: dataset 'data' is not 3-dimensional");
+    }
+    H5Sget_simple_extent_dims(p_wrh5_ctx->dataspace_id, dims, NULL);
+    if(dims[1] != (hsize_t) p_wrh5_hdr->nifs || dims[2] != (hsize_t) p_wrh5_hdr->nchans) {
+        sprintf(msgstr, "wrh5_resume: dataset 'data' shape (%lld, %lld, %lld) does not match nifs and nchans",
+                dims[0], dims[1], dims[2]);
+        return give_up(p_wrh5_ctx, msgstr);
+    }
+    memcpy(p_wrh5_ctx->filesz_dims, dims, sizeof(dims));
+    p_wrh5_ctx->offset_dims[0] = dims[0];
+    if(dims[0] == 1 && H5Lexists(p_wrh5_ctx->file_id, VALID_NAME, H5P_DEFAULT) <= 0
+       && H5Dget_num_chunks(p_wrh5_ctx->dataset_id, p_wrh5_ctx->dataspace_id, &nchunks) >= 0 && nchunks == 0)
+        p_wrh5_ctx->offset_dims[0] = 0;     // Created but never written: the one time integration of wrh5_open
+    p_wrh5_ctx->byte_count = p_wrh5_ctx->offset_dims[0] * p_wrh5_ctx->tint_size;
+
+    /*
+     * Chunking and filter are those of the file.
+     */
+    dcpl = H5Dget_create_plist(p_wrh5_ctx->dataset_id);
+    if(dcpl < 0 || H5Pget_chunk(dcpl, NDIMS, p_wrh5_ctx->cdims) != NDIMS) {
+        if(dcpl >= 0)
+            H5Pclose(dcpl);
+        return give_up(p_wrh5_ctx, "wrh5_resume: dataset 'data' is not chunked");
+    }
+    for(ix = 0; ix < H5Pget_nfilters(dcpl); ix++) {
+        nelmts = sizeof(cd_values) / sizeof(cd_values[0]);
+        switch(H5Pget_filter2(dcpl, ix, &flags, &nelmts, cd_values, 0, NULL, &filter_config)) {
+            case FILTER_ID_BITSHUFFLE:
+                p_wrh5_ctx->filtered = 1;
+                break;
+            case H5Z_FILTER_DEFLATE:
+                p_wrh5_ctx->filtered = 1;
+                p_wrh5_ctx->deflate_level = (nelmts > 0) ? (int) cd_values[0] : 6;
+                break;
+        }
+    }
+    if(p_wrh5_ctx->filtered && p_wrh5_ctx->deflate_level == 0 && H5Zfilter_avail(FILTER_ID_BITSHUFFLE) <= 0) {
+        H5Pclose(dcpl);
+        return give_up(p_wrh5_ctx, "wrh5_resume: the file is compressed but the Bitshuffle plugin is NOT available");
+    }
+    H5Pclose(dcpl);
+    if(p_user_chunking != NULL && (p_user_chunking->n_time != p_wrh5_ctx->cdims[0]
+       || p_user_chunking->n_nifs != p_wrh5_ctx->cdims[1] || p_user_chunking->n_fine_chan != p_wrh5_ctx->cdims[2]))
+        wrh5_warning(__FILE__, __LINE__, "wrh5_resume: user chunking ignored; the chunking of the file is kept");
+    p_wrh5_ctx->quant_nint = (p_options->quant_nint > 0) ? p_options->quant_nint : p_wrh5_ctx->cdims[0];
+
+    /*
+     * State kept in other datasets.
+     */
+    if(reload_valid(p_wrh5_ctx) != 0)
+        return give_up(p_wrh5_ctx, "wrh5_resume: reloading the valid bitmap FAILED");
+    if(p_options->cc_aligned && H5Lexists(p_wrh5_ctx->file_id, CC_INDEX_NAME, H5P_DEFAULT) > 0)
+        if(H5Ldelete(p_wrh5_ctx->file_id, CC_INDEX_NAME, H5P_DEFAULT) < 0)
+            return give_up(p_wrh5_ctx, "wrh5_resume: removing the old coarse channel index FAILED");
+    if(p_options->quantize != WRH5_QUANT_NONE) {
+        wrh5_get_attr(p_wrh5_ctx->dataset_id, "quant_nsigma", H5T_NATIVE_DOUBLE, &p_wrh5_ctx->quant_nsigma);
+        if(wrh5_quant_resume(p_wrh5_ctx, debugging) != 0)
+            return give_up(p_wrh5_ctx, "wrh5_resume: wrh5_quant_resume FAILED");
+    }
+
+    /*
+     * Bye-bye.
+     */
+    if(debugging)
+        wrh5_info("wrh5_resume: '%s' has %lld time integrations (%ld missing), chunk dimensions = (%lld, %lld, %lld)\n",
+                  path, p_wrh5_ctx->offset_dims[0], p_wrh5_ctx->missing_tints,
+                  p_wrh5_ctx->cdims[0], p_wrh5_ctx->cdims[1], p_wrh5_ctx->cdims[2]);
+    return 0;
+}
@@ -0,0 +1,303 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_serve.c                                                                *
+ * ------------                                                                *
+ * The daemon side of the shared-memory streams (see wrh5_shm.h and wrh5d).    *
+ *                                                                             *
+ * wrh5_serve scans /dev/shm for segments named <prefix>*, claims each new     *
+ * published stream and opens its output file with wrh5_open_ext.  Then, in    *
+ * turn, it writes up to burst committed slots of every stream straight from   *
+ * the shared memory with wrh5_write and hands them back to the producer by    *
+ * advancing the tail.  A stream is closed (wrh5_close), marked done and       *
+ * unlinked once its producer has closed it, or has died, and every committed  *
+ * slot is written.  A stream whose file cannot be opened or written is        *
+ * marked failed and unlinked; the other streams carry on.                     *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include "wrh5_shm.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * One served stream.
+ */
+typedef struct {
+    wrh5_shm_stream_t * p_shm;  // Mapped segment (NULL: entry free)
+    size_t  map_size;           // Byte size of the mapping
+    char    name[256];          // Segment name, E.g. "/wrh5.beam07"
+    wrh5_hdr_t hdr;             // Private copy of the header
+    wrh5_context_t ctx;         // Output file context
+    uint64_t tail;              // Slots written
+    int     producer_gone;      // 1: the producer closed the stream or died
+} serve_stream_t;
+
+
+/***
+	Monotonic clock in nanoseconds.
+***/
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+
+/***
+	Unmap and unlink a stream after setting its final state; free its entry.
+***/
+static void stream_finish(serve_stream_t * p_stream, int32_t state, int debugging) {
+    // Unlink first so that the producer may reuse the name as soon as it sees the final state.
+    shm_unlink(p_stream->name);
+    __atomic_store_n(&p_stream->p_shm->state, state, __ATOMIC_RELEASE);
+    if(debugging)
+        wrh5_info("wrh5_serve: stream %s %s after %ld dumps\n", p_stream->name,
+                  (state == WRH5_SHM_DONE) ? "done" : "FAILED", (long) p_stream->p_shm->stats.dumps);
+    munmap(p_stream->p_shm, p_stream->map_size);
+    p_stream->p_shm = NULL;
+}
+
+
+/***
+	Map segment name (without the leading '/') and claim it if it is a published stream nobody serves.
+	Returns 1 if the stream was attached (its output file is open), else 0.
+***/
+static int stream_attach(serve_stream_t * p_stream, const char * name, user_serve_t * p_params, int debugging) {
+    wrh5_shm_stream_t * p_shm;
+    user_chunking_t * p_chunking;
+    struct stat st;
+    char    msgstr[256];
+    int32_t expected = 0;
+    int     fd;
+
+    if(strlen(name) + 2 > sizeof(p_stream->name))
+        return 0;
+    sprintf(p_stream->name, "/%s", name);
+    fd = shm_open(p_stream->name, O_RDWR, 0);
+    if(fd < 0)
+        return 0;
+    if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(wrh5_shm_stream_t)) {
+        close(fd);
+        return 0;   // Not sized yet
+    }
+    p_shm = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p_shm == MAP_FAILED)
+        return 0;
+
+    // Only published streams of this version that no daemon has claimed yet.
+    if(p_shm->magic != WRH5_SHM_MAGIC || p_shm->version != WRH5_SHM_VERSION
+       || __atomic_load_n(&p_shm->state, __ATOMIC_ACQUIRE) == WRH5_SHM_SETUP
+       || __atomic_load_n(&p_shm->state, __ATOMIC_ACQUIRE) >= WRH5_SHM_DONE
+       || !__atomic_compare_exchange_n(&p_shm->server_pid, &expected, (int32_t) getpid(), 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        munmap(p_shm, (size_t) st.st_size);
+        return 0;
+    }
+    p_stream->p_shm = p_shm;
+    p_stream->map_size = (size_t) st.st_size;
+    p_stream->tail = p_shm->tail;
+    p_stream->producer_gone = 0;
+    memcpy(&p_stream->hdr, &p_shm->hdr, sizeof(wrh5_hdr_t));
+    p_shm->output_path[WRH5_SHM_PATHLEN - 1] = '\0';
+
+    if(p_shm->nslots < 1 || p_shm->slot_bytes < 1
+       || p_shm->data_offset + p_shm->nslots * p_shm->slot_bytes > p_stream->map_size) {
+        sprintf(msgstr, "wrh5_serve: stream %.200s has an inconsistent layout", p_stream->name);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        stream_finish(p_stream, WRH5_SHM_FAILED, debugging);
+        return 0;
+    }
+    p_chunking = (p_shm->chunking.n_time > 0) ? &p_shm->chunking : NULL;
+    memset(&p_stream->ctx, 0, sizeof(wrh5_context_t));
+    if(wrh5_open_ext(&p_stream->ctx, &p_stream->hdr, p_shm->output_path, p_chunking,
+                     p_params->p_caching, p_params->p_options, debugging) != 0) {
+        sprintf(msgstr, "wrh5_serve: stream %.80s: wrh5_open_ext of %.120s FAILED", p_stream->name, p_shm->output_path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        stream_finish(p_stream, WRH5_SHM_FAILED, debugging);
+        return 0;
+    }
+    if(debugging)
+        wrh5_info("wrh5_serve: stream %s (pid %d, %ld slots of %ld bytes) -> %s\n", p_stream->name,
+                  (int) p_shm->pid, (long) p_shm->nslots, (long) p_shm->slot_bytes, p_shm->output_path);
+    return 1;
+}
+
+
+/***
+	Write up to burst committed slots of a stream; close it when it is over.
+	Returns the number of slots written; *p_failed is set to 1 if the stream failed.
+***/
+static int stream_pump(serve_stream_t * p_stream, int burst, int stopping, int * p_failed, int debugging) {
+    wrh5_shm_stream_t * p_shm = p_stream->p_shm;
+    uint64_t head, backlog, t0, elapsed;
+    char    msgstr[256];
+    int     nwritten = 0;
+
+    // Seeing the state as closing first guarantees that the head loaded next is final.
+    if(__atomic_load_n(&p_shm->state, __ATOMIC_ACQUIRE) == WRH5_SHM_CLOSING)
+        p_stream->producer_gone = 1;
+    head = __atomic_load_n(&p_shm->head, __ATOMIC_ACQUIRE);
+    backlog = head - p_stream->tail;
+    if(backlog > p_shm->nslots) {
+        sprintf(msgstr, "wrh5_serve: stream %.160s: head %ld is out of range", p_stream->name, (long) head);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        backlog = 0;
+        p_stream->producer_gone = 1;
+        *p_failed = 1;
+    }
+    if(backlog > p_shm->stats.max_backlog)
+        p_shm->stats.max_backlog = backlog;
+
+    while(backlog > 0 && (nwritten < burst || stopping) && !*p_failed) {
+        uint64_t islot = p_stream->tail % p_shm->nslots;
+        size_t   nbytes = p_shm->slot_len[islot];
+        void *   p_slot = (char *) p_shm + p_shm->data_offset + islot * p_shm->slot_bytes;
+
+        if(nbytes > p_shm->slot_bytes) {
+            sprintf(msgstr, "wrh5_serve: stream %.160s: slot length %ld is out of range", p_stream->name, (long) nbytes);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            *p_failed = 1;
+            break;
+        }
+        t0 = now_ns();
+        if(wrh5_write(&p_stream->ctx, &p_stream->hdr, p_slot, nbytes, debugging) != 0) {
+            sprintf(msgstr, "wrh5_serve: stream %.200s: wrh5_write FAILED", p_stream->name);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            *p_failed = 1;
+            break;
+        }
+        elapsed = now_ns() - t0;
+        p_shm->stats.dumps += 1;
+        p_shm->stats.bytes += nbytes;
+        p_shm->stats.write_ns += elapsed;
+        if(elapsed > p_shm->stats.max_write_ns)
+            p_shm->stats.max_write_ns = elapsed;
+
+        // Hand the slot back to the producer.
+        p_stream->tail += 1;
+        __atomic_store_n(&p_shm->tail, p_stream->tail, __ATOMIC_RELEASE);
+        backlog -= 1;
+        nwritten += 1;
+    }
+
+    if(*p_failed) {
+        wrh5_close(&p_stream->ctx, debugging);
+        stream_finish(p_stream, WRH5_SHM_FAILED, debugging);
+    } else if(backlog == 0 && (p_stream->producer_gone || stopping)) {
+        if(wrh5_close(&p_stream->ctx, debugging) != 0) {
+            *p_failed = 1;
+            stream_finish(p_stream, WRH5_SHM_FAILED, debugging);
+        } else
+            stream_finish(p_stream, WRH5_SHM_DONE, debugging);
+    }
+    return nwritten;
+}
+
+
+/***
+	Serve shared-memory streams until *p_params->p_stop becomes non-zero
+	(or, with exit_when_idle, until every stream served so far is closed).
+	Returns 0 if every stream was written and closed, else 1.
+***/
+int wrh5_serve(user_serve_t * p_params, int debugging) {
+    serve_stream_t * streams;
+    struct dirent * p_entry;
+    struct timespec idle = {0, 1000000};    // 1 ms
+    DIR *   p_dir;
+    const char * prefix = (p_params->prefix[0] != '\0') ? p_params->prefix : WRH5_SHM_PREFIX;
+    int     max_streams = (p_params->max_streams > 0) ? p_params->max_streams : 64;
+    int     burst = (p_params->burst > 0) ? p_params->burst : 4;
+    uint64_t scan_ns = (uint64_t) ((p_params->scan_ms > 0) ? p_params->scan_ms : 100) * 1000000ULL;
+    uint64_t last_scan = 0;
+    int     ii, jj, nactive = 0, nserved = 0, nwritten, failed, stopping, rc = 0;
+    char    msgstr[256];
+
+    if(strchr(prefix, '/') != NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_serve: the prefix must not contain '/'");
+        return 1;
+    }
+    streams = calloc(max_streams, sizeof(serve_stream_t));
+    if(streams == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_serve: calloc of the stream table FAILED");
+        return 1;
+    }
+    if(debugging)
+        wrh5_info("wrh5_serve: serving /dev/shm/%s* (up to %d streams, burst %d)\n", prefix, max_streams, burst);
+
+    for(;;) {
+        stopping = (p_params->p_stop != NULL && *p_params->p_stop != 0);
+
+        // Look for new streams, and for producers that died.
+        if(!stopping && now_ns() - last_scan >= scan_ns) {
+            last_scan = now_ns();
+            p_dir = opendir("/dev/shm");
+            if(p_dir == NULL) {
+                sprintf(msgstr, "wrh5_serve: opendir of /dev/shm FAILED (%s)", strerror(errno));
+                wrh5_error(__FILE__, __LINE__, msgstr);
+                rc = 1;
+                break;
+            }
+            while((p_entry = readdir(p_dir)) != NULL && nactive < max_streams) {
+                if(strncmp(p_entry->d_name, prefix, strlen(prefix)) != 0)
+                    continue;
+                for(jj = 0; jj < max_streams; jj++)
+                    if(streams[jj].p_shm != NULL && strcmp(streams[jj].name + 1, p_entry->d_name) == 0)
+                        break;
+                if(jj < max_streams)
+                    continue;       // Already served
+                for(jj = 0; streams[jj].p_shm != NULL; jj++)
+                    ;
+                if(stream_attach(&streams[jj], p_entry->d_name, p_params, debugging)) {
+                    nactive += 1;
+                    nserved += 1;
+                }
+            }
+            closedir(p_dir);
+            for(ii = 0; ii < max_streams; ii++)
+                if(streams[ii].p_shm != NULL && kill(streams[ii].p_shm->pid, 0) != 0 && errno == ESRCH) {
+                    if(!streams[ii].producer_gone) {
+                        sprintf(msgstr, "wrh5_serve: the producer of stream %.180s died; closing it", streams[ii].name);
+                        wrh5_warning(__FILE__, __LINE__, msgstr);
+                    }
+                    streams[ii].producer_gone = 1;
+                }
+        }
+
+        // One round: each stream in turn.
+        nwritten = 0;
+        for(ii = 0; ii < max_streams; ii++) {
+            if(streams[ii].p_shm == NULL)
+                continue;
+            failed = 0;
+            nwritten += stream_pump(&streams[ii], burst, stopping, &failed, debugging);
+            if(streams[ii].p_shm == NULL)
+                nactive -= 1;
+            if(failed)
+                rc = 1;
+        }
+
+        if(nactive == 0 && (stopping || (p_params->exit_when_idle && nserved > 0)))
+            break;
+        if(nwritten == 0)
+            nanosleep(&idle, NULL);
+    }
+
+    // Streams are left only after an error above: drop them.
+    for(ii = 0; ii < max_streams; ii++)
+        if(streams[ii].p_shm != NULL) {
+            wrh5_close(&streams[ii].ctx, debugging);
+            stream_finish(&streams[ii], WRH5_SHM_FAILED, debugging);
+        }
+    free(streams);
+    if(debugging)
+        wrh5_info("wrh5_serve: served %d streams, rc = %d\n", nserved, rc);
+    return rc;
+}
@@ -0,0 +1,107 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_shm.h                                                                  *
+ * ----------                                                                  *
+ * Shared-memory streams between acquisition processes and the wrh5d daemon.   *
+ *                                                                             *
+ * A producer links only libwrh5c (wrh5_client.c), never HDF5.  It creates     *
+ * one POSIX shared memory segment per stream, /dev/shm/<prefix><name>, which  *
+ * holds the header, the output path and a single-producer/single-consumer     *
+ * ring of fixed-size slots.  The producer fills a slot in place and commits   *
+ * it; the daemon (wrh5_serve) writes it with wrh5_write and frees it.         *
+ * Neither side ever takes a lock or copies a slot.                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef wrh5_SHM_H
+#define wrh5_SHM_H
+
+#include <stdint.h>
+#include "wrh5_hdr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WRH5_SHM_MAGIC      0x35485257      // "WRH5"
+#define WRH5_SHM_VERSION    1
+#define WRH5_SHM_PREFIX     "wrh5."         // Default segment name prefix in /dev/shm
+#define WRH5_SHM_PATHLEN    512             // Room for the output path
+
+/*
+ * Stream states, in order.
+ */
+#define WRH5_SHM_SETUP      0       // Being created by the producer
+#define WRH5_SHM_OPEN       1       // Published: the daemon opens the output file and writes committed slots
+#define WRH5_SHM_CLOSING    2       // The producer is done: the daemon writes what is left, then closes the file
+#define WRH5_SHM_DONE       3       // The daemon closed the file and unlinked the segment
+#define WRH5_SHM_FAILED     4       // The daemon could not open or write the file; the segment is unlinked
+
+/*
+ * Per-stream statistics, kept by the daemon (except full_claims) in the segment.
+ */
+typedef struct {
+    uint64_t dumps;             // Slots written
+    uint64_t bytes;             // Bytes written
+    uint64_t write_ns;          // Nanoseconds spent in wrh5_write
+    uint64_t max_write_ns;      // Longest wrh5_write
+    uint64_t max_backlog;       // Most committed slots waiting to be written
+    uint64_t full_claims;       // Producer: claims that found the ring full
+} wrh5_shm_stats_t;
+
+/*
+ * Segment layout.  The slots start at data_offset (a page multiple); slot k is at data_offset + k * slot_bytes.
+ * head and tail are on cache lines of their own and only ever grow: head - tail slots are committed.
+ */
+typedef struct {
+    uint32_t magic;             // WRH5_SHM_MAGIC
+    uint32_t version;           // WRH5_SHM_VERSION
+    int32_t  state;             // WRH5_SHM_SETUP, _OPEN, _CLOSING, _DONE or _FAILED
+    int32_t  pid;               // Producer process ID (the daemon closes the stream if it dies)
+    int32_t  server_pid;        // Daemon process ID, claimed with compare-and-swap (0: not served yet)
+    int32_t  reserved;          // Padding
+    uint64_t nslots;            // Slots in the ring
+    uint64_t slot_bytes;        // Byte size of one slot (a whole number of time integrations)
+    uint64_t data_offset;       // Byte offset of slot 0 in the segment
+    wrh5_hdr_t hdr;             // Header of the output file
+    user_chunking_t chunking;   // Chunk dimensions of the output file (all 0: blimpy chunking)
+    char     output_path[WRH5_SHM_PATHLEN];    // Output file, as seen by the daemon
+    wrh5_shm_stats_t stats;     // See above
+    uint64_t head __attribute__((aligned(64)));     // Slots committed (written by the producer)
+    uint64_t tail __attribute__((aligned(64)));     // Slots written (written by the daemon)
+    uint64_t slot_len[] __attribute__((aligned(64)));   // Committed byte length of each slot
+} wrh5_shm_stream_t;
+
+/*
+ * Producer handle.
+ */
+typedef struct {
+    wrh5_shm_stream_t * p_shm;  // Mapped segment
+    size_t  map_size;           // Byte size of the mapping
+    char    name[256];          // Segment name, E.g. "/wrh5.beam07"
+    uint64_t head;              // Next slot to claim
+    uint64_t tail;              // Last tail seen (refreshed only when the ring looks full)
+} wrh5c_stream_t;
+
+/*
+ * libwrh5c producer API (wrh5_client.c).  Functions return 0 (success) or 1 (failure), as libwrh5.
+ */
+int     wrh5c_open(wrh5c_stream_t * p_stream,
+                   const char * name,
+                   const char * output_path,
+                   const wrh5_hdr_t * p_wrh5_hdr,
+                   const user_chunking_t * p_user_chunking,
+                   size_t slot_bytes,
+                   int nslots);
+void *  wrh5c_claim(wrh5c_stream_t * p_stream);
+int     wrh5c_commit(wrh5c_stream_t * p_stream,
+                     size_t nbytes);
+int     wrh5c_close(wrh5c_stream_t * p_stream,
+                    double wait_seconds,
+                    wrh5_shm_stats_t * p_stats);
+size_t  wrh5c_segment_size(size_t slot_bytes,
+                           int nslots);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
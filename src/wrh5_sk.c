@@ -0,0 +1,261 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_sk.c                                                                   *
+ * ---------                                                                   *
+ * In-stream spectral kurtosis (SK) RFI mask of float32 power spectra.         *
+ *                                                                             *
+ * With the sk_m user option, every time integration written is added to the  *
+ * per-channel accumulators S1 = sum(P) and S2 = sum(P^2) before it is         *
+ * quantized and stored, P being the power of the fine channel: IF 0 with the  *
+ * IQUV detection stage (Stokes I), else the sum over the IFs.  Every sk_m    *
+ * real time integrations (wrh5_write_missing and, with elide_fill, all-zero  *
+ * ones do not count) complete a block, and the generalized SK estimator       *
+ *     SK = (M N + 1) / (M - 1) * (M S2 / S1^2 - 1)                            *
+ * (Nita & Gary 2010, d = 1) of each channel is compared with                  *
+ * 1 +/- sk_nsigma x sqrt(2 N (N + 1) M^2 / ((M - 1) (M N + 2) (M N + 3))).    *
+ * Each block appends a row to the auxiliary datasets:                         *
+ * - sk_mask [row][chan] uint8  : WRH5_SK_CLEAN, WRH5_SK_HIGH or WRH5_SK_LOW   *
+ * - sk_tint [row]       uint64 : first time integration of the block          *
+ * sk_mask is chunked like the fine channel dimension of "data", so its rows  *
+ * go out with the data that they describe, and no second pass is needed.     *
+ * wrh5_close judges the last, partial block; a block of one time integration  *
+ * cannot be judged and its row is all WRH5_SK_CLEAN.                          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SK_MASK_NAME "sk_mask"
+#define SK_TINT_NAME "sk_tint"
+
+
+/***
+	Add one power spectrum of nchans values to the S1 and S2 accumulators (in double precision).
+***/
+static void accumulate(const float * p_power, double * p_s1, double * p_s2, size_t nchans) {
+    double value;
+    size_t c = 0;
+
+#ifdef __SSE2__
+    __m128  x;
+    __m128d lo, hi;
+    for(; c + 4 <= nchans; c += 4) {
+        x = _mm_loadu_ps(p_power + c);
+        lo = _mm_cvtps_pd(x);
+        hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+        _mm_storeu_pd(p_s1 + c, _mm_add_pd(_mm_loadu_pd(p_s1 + c), lo));
+        _mm_storeu_pd(p_s1 + c + 2, _mm_add_pd(_mm_loadu_pd(p_s1 + c + 2), hi));
+        _mm_storeu_pd(p_s2 + c, _mm_add_pd(_mm_loadu_pd(p_s2 + c), _mm_mul_pd(lo, lo)));
+        _mm_storeu_pd(p_s2 + c + 2, _mm_add_pd(_mm_loadu_pd(p_s2 + c + 2), _mm_mul_pd(hi, hi)));
+    }
+#endif
+    for(; c < nchans; c++) {
+        value = (double) p_power[c];
+        p_s1[c] += value;
+        p_s2[c] += value * value;
+    }
+}
+
+
+/***
+	Sum the nifs IF rows of one time integration into p_power.
+***/
+static void sum_ifs(const float * p_tint, float * p_power, int nifs, size_t nchans) {
+    size_t c;
+    int    ix;
+
+    memcpy(p_power, p_tint, nchans * sizeof(float));
+    for(ix = 1; ix < nifs; ix++) {
+        c = 0;
+#ifdef __SSE2__
+        for(; c + 4 <= nchans; c += 4)
+            _mm_storeu_ps(p_power + c, _mm_add_ps(_mm_loadu_ps(p_power + c), _mm_loadu_ps(p_tint + ix * nchans + c)));
+#endif
+        for(; c < nchans; c++)
+            p_power[c] += p_tint[ix * nchans + c];
+    }
+}
+
+
+/***
+	Judge the current block, append its row to "sk_mask" and "sk_tint", and reset the accumulators.
+***/
+static int finish_block(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    size_t   nchans = (size_t) p_wrh5_ctx->filesz_dims[2];
+    double * p_s1 = p_wrh5_ctx->sk_acc;
+    double * p_s2 = p_wrh5_ctx->sk_acc + nchans;
+    double   m = (double) p_wrh5_ctx->sk_count;
+    double   n = (double) p_wrh5_ctx->sk_n;
+    double   coef, sigma, lower, upper, sk;
+    uint64_t first_tint = (uint64_t) p_wrh5_ctx->sk_first;
+    size_t   c;
+
+    memset(p_wrh5_ctx->sk_flags, WRH5_SK_CLEAN, nchans);
+    if(p_wrh5_ctx->sk_count >= 2) {
+        coef = (m * n + 1.0) / (m - 1.0);
+        sigma = sqrt(2.0 * n * (n + 1.0) * m * m / ((m - 1.0) * (m * n + 2.0) * (m * n + 3.0)));
+        lower = 1.0 - p_wrh5_ctx->sk_nsigma * sigma;
+        upper = 1.0 + p_wrh5_ctx->sk_nsigma * sigma;
+        for(c = 0; c < nchans; c++) {
+            if(!(p_s1[c] > 0.0))
+                continue;   // No power: nothing to judge
+            sk = coef * (m * p_s2[c] / (p_s1[c] * p_s1[c]) - 1.0);
+            if(sk > upper)
+                p_wrh5_ctx->sk_flags[c] = WRH5_SK_HIGH;
+            else if(sk < lower)
+                p_wrh5_ctx->sk_flags[c] = WRH5_SK_LOW;
+            else
+                continue;
+            p_wrh5_ctx->sk_flagged += 1;
+        }
+        if(debugging)
+            wrh5_info("wrh5_sk: block %lld at %lld, M = %ld, thresholds [%.4f, %.4f], %ld flagged so far\n",
+                      p_wrh5_ctx->sk_nrows, p_wrh5_ctx->sk_first, (long) p_wrh5_ctx->sk_count,
+                      lower, upper, p_wrh5_ctx->sk_flagged);
+    }
+
+    if(wrh5_append_row(p_wrh5_ctx->sk_mask_id, H5T_NATIVE_UINT8, 2, &p_wrh5_ctx->filesz_dims[2],
+                       p_wrh5_ctx->sk_nrows, p_wrh5_ctx->sk_flags) != 0
+       || wrh5_append_row(p_wrh5_ctx->sk_tint_id, H5T_NATIVE_UINT64, 1, NULL,
+                          p_wrh5_ctx->sk_nrows, &first_tint) != 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_sk: writing a spectral kurtosis mask row FAILED");
+        return 1;
+    }
+    p_wrh5_ctx->sk_nrows += 1;
+    p_wrh5_ctx->sk_count = 0;
+    memset(p_wrh5_ctx->sk_acc, 0, 2 * nchans * sizeof(double));
+    return 0;
+}
+
+
+/***
+	Set up the spectral kurtosis mask: allocate the accumulators and create (or, resuming, reopen)
+	the auxiliary datasets.  Called by wrh5_open_ext after dataset "data" exists.
+***/
+int wrh5_sk_init(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, user_options_t * p_options, int resuming, int debugging) {
+    size_t  nchans = (size_t) p_wrh5_hdr->nchans;
+    hsize_t dims[1];
+    hid_t   space_id;
+    int     attr_m = 0, attr_n = 0;
+    double  attr_nsigma = 0.0;
+    char    msgstr[256];
+
+    p_wrh5_ctx->sk_m = p_options->sk_m;
+    if(p_options->sk_n > 0)
+        p_wrh5_ctx->sk_n = p_options->sk_n;
+    else if(p_wrh5_ctx->detect != WRH5_DETECT_NONE)
+        p_wrh5_ctx->sk_n = 2 * p_wrh5_ctx->detect_nint;    // |X|^2 + |Y|^2 of detect_nint spectra
+    else
+        p_wrh5_ctx->sk_n = 1;
+    p_wrh5_ctx->sk_nsigma = (p_options->sk_nsigma > 0.0) ? p_options->sk_nsigma : WRH5_SK_NSIGMA;
+    p_wrh5_ctx->sk_acc = calloc(2 * nchans, sizeof(double));
+    p_wrh5_ctx->sk_power = malloc(nchans * sizeof(float));
+    p_wrh5_ctx->sk_flags = malloc(nchans);
+    if(p_wrh5_ctx->sk_acc == NULL || p_wrh5_ctx->sk_power == NULL || p_wrh5_ctx->sk_flags == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_sk_init: malloc of the accumulators FAILED");
+        wrh5_sk_close(p_wrh5_ctx, 0);
+        return 1;
+    }
+
+    if(resuming) {
+        p_wrh5_ctx->sk_mask_id = H5Dopen(p_wrh5_ctx->file_id, SK_MASK_NAME, H5P_DEFAULT);
+        p_wrh5_ctx->sk_tint_id = H5Dopen(p_wrh5_ctx->file_id, SK_TINT_NAME, H5P_DEFAULT);
+        if(p_wrh5_ctx->sk_mask_id < 0 || p_wrh5_ctx->sk_tint_id < 0) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_sk_init: the file to resume has no spectral kurtosis mask");
+            wrh5_sk_close(p_wrh5_ctx, 0);
+            return 1;
+        }
+        wrh5_get_attr(p_wrh5_ctx->sk_mask_id, "sk_m", H5T_NATIVE_INT, &attr_m);
+        wrh5_get_attr(p_wrh5_ctx->sk_mask_id, "sk_n", H5T_NATIVE_INT, &attr_n);
+        wrh5_get_attr(p_wrh5_ctx->sk_mask_id, "sk_nsigma", H5T_NATIVE_DOUBLE, &attr_nsigma);
+        if(attr_m != p_wrh5_ctx->sk_m || attr_n != p_wrh5_ctx->sk_n || attr_nsigma != p_wrh5_ctx->sk_nsigma) {
+            sprintf(msgstr, "wrh5_sk_init: the file to resume has sk_m = %d, sk_n = %d and sk_nsigma = %.3f but I saw %d, %d and %.3f",
+                    attr_m, attr_n, attr_nsigma, p_wrh5_ctx->sk_m, p_wrh5_ctx->sk_n, p_wrh5_ctx->sk_nsigma);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            wrh5_sk_close(p_wrh5_ctx, 0);
+            return 1;
+        }
+        space_id = H5Dget_space(p_wrh5_ctx->sk_tint_id);
+        H5Sget_simple_extent_dims(space_id, dims, NULL);
+        H5Sclose(space_id);
+        p_wrh5_ctx->sk_nrows = dims[0];
+    } else {
+        p_wrh5_ctx->sk_mask_id = wrh5_create_rows(p_wrh5_ctx->file_id, SK_MASK_NAME, H5T_STD_U8LE, 2,
+                                                  &p_wrh5_ctx->filesz_dims[2], &p_wrh5_ctx->cdims[2]);
+        p_wrh5_ctx->sk_tint_id = wrh5_create_rows(p_wrh5_ctx->file_id, SK_TINT_NAME, H5T_STD_U64LE, 1, NULL, NULL);
+        if(p_wrh5_ctx->sk_mask_id < 0 || p_wrh5_ctx->sk_tint_id < 0) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_sk_init: H5Dcreate of the spectral kurtosis datasets FAILED");
+            wrh5_sk_close(p_wrh5_ctx, 0);
+            return 1;
+        }
+        wrh5_set_dataset_int_attr(p_wrh5_ctx->sk_mask_id, "sk_m", &p_wrh5_ctx->sk_m, debugging);
+        wrh5_set_dataset_int_attr(p_wrh5_ctx->sk_mask_id, "sk_n", &p_wrh5_ctx->sk_n, debugging);
+        wrh5_set_dataset_double_attr(p_wrh5_ctx->sk_mask_id, "sk_nsigma", &p_wrh5_ctx->sk_nsigma, debugging);
+        p_wrh5_ctx->sk_nrows = 0;
+    }
+    p_wrh5_ctx->sk_count = 0;
+    if(debugging)
+        wrh5_info("wrh5_sk_init: sk_m = %d, sk_n = %d, sk_nsigma = %.2f, %lld rows already\n",
+                  p_wrh5_ctx->sk_m, p_wrh5_ctx->sk_n, p_wrh5_ctx->sk_nsigma, p_wrh5_ctx->sk_nrows);
+    return 0;
+}
+
+
+/***
+	Main entry point.
+	p_block    : ntints float32 time integrations in on-disk order, not yet quantized
+	tint_start : time integration number of the first one in the file
+***/
+int wrh5_sk_update(wrh5_context_t * p_wrh5_ctx, const void * p_block, hsize_t tint_start, size_t ntints, int debugging) {
+    size_t        nchans = (size_t) p_wrh5_ctx->filesz_dims[2];
+    int           nifs = (int) p_wrh5_ctx->filesz_dims[1];
+    size_t        tint_elems = nifs * nchans;
+    const float * p_tint;
+    const float * p_power;
+    size_t        itint;
+
+    for(itint = 0; itint < ntints; itint++) {
+        p_tint = (const float *) p_block + itint * tint_elems;
+        if(p_wrh5_ctx->elide_fill && wrh5_is_fill(p_tint, tint_elems * sizeof(float)))
+            continue;   // Missing: see wrh5_valid.c
+        if(nifs == 1 || p_wrh5_ctx->detect == WRH5_DETECT_IQUV)
+            p_power = p_tint;
+        else {
+            sum_ifs(p_tint, p_wrh5_ctx->sk_power, nifs, nchans);
+            p_power = p_wrh5_ctx->sk_power;
+        }
+        if(p_wrh5_ctx->sk_count == 0)
+            p_wrh5_ctx->sk_first = tint_start + itint;
+        accumulate(p_power, p_wrh5_ctx->sk_acc, p_wrh5_ctx->sk_acc + nchans, nchans);
+        p_wrh5_ctx->sk_count += 1;
+        if(p_wrh5_ctx->sk_count == (size_t) p_wrh5_ctx->sk_m)
+            if(finish_block(p_wrh5_ctx, debugging) != 0)
+                return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Judge the last, partial block, close the auxiliary datasets and free the accumulators.
+***/
+void wrh5_sk_close(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    if(p_wrh5_ctx->sk_count > 0 && p_wrh5_ctx->sk_mask_id > 0)
+        if(finish_block(p_wrh5_ctx, debugging) != 0)
+            wrh5_warning(__FILE__, __LINE__, "wrh5_sk_close: last spectral kurtosis block lost");
+    if(p_wrh5_ctx->sk_mask_id > 0)
+        H5Dclose(p_wrh5_ctx->sk_mask_id);
+    if(p_wrh5_ctx->sk_tint_id > 0)
+        H5Dclose(p_wrh5_ctx->sk_tint_id);
+    p_wrh5_ctx->sk_mask_id = p_wrh5_ctx->sk_tint_id = 0;
+    free(p_wrh5_ctx->sk_acc);
+    free(p_wrh5_ctx->sk_power);
+    free(p_wrh5_ctx->sk_flags);
+    p_wrh5_ctx->sk_acc = NULL;
+    p_wrh5_ctx->sk_power = NULL;
+    p_wrh5_ctx->sk_flags = NULL;
+    p_wrh5_ctx->sk_count = 0;
+}
@@ -0,0 +1,240 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_stage.c                                                                *
+ * ------------                                                                *
+ * Copy time integrations of a caller buffer into the staging buffer,          *
+ * converting them to on-disk order [time][ifs][chan] on the way.              *
+ *                                                                             *
+ * Both non-default layouts are 2-D transposes:                                *
+ * - WRH5_LAYOUT_TCI : per time integration, [chan][ifs] --> [ifs][chan]       *
+ * - WRH5_LAYOUT_ICT : per IF, [chan][time] --> [time][chan]                   *
+ * The transpose is cache-blocked in TILE x TILE tiles; 32-bit elements use    *
+ * a 4x4 SSE micro-kernel when available.  The reorder is fused with the copy  *
+ * into staging, so the data crosses memory only once.                         *
+ *                                                                             *
+ * Optional lossy mantissa trimming (keep_mantissa_bits) rounds each float to  *
+ * the nearest value with N mantissa bits (ties to even), zeroing the random   *
+ * low bits so that Bitshuffle+LZ4 finds constant bit planes.  It is fused     *
+ * with the copy for on-disk order input, else applied to the staged block.    *
+ *                                                                             *
+ * With a channel selection (see wrh5_chans.c), on-disk order input is         *
+ * gathered straight into staging; the other layouts are reordered first,      *
+ * then gathered in place.  Staging is sized in presented time integrations.   *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TILE 32
+
+
+/***
+	Cache-blocked transpose: dst[c * dst_stride + r] = src[r * src_stride + c]
+	for r in [0, nrows), c in [0, ncols).
+***/
+#define DEFINE_TRANSPOSE(NAME, TYPE) \
+static void NAME(const TYPE * src, size_t src_stride, TYPE * dst, size_t dst_stride, size_t nrows, size_t ncols) { \
+    size_t rb, cb, r, c, rmax, cmax; \
+    for(rb = 0; rb < nrows; rb += TILE) { \
+        rmax = (rb + TILE < nrows) ? rb + TILE : nrows; \
+        for(cb = 0; cb < ncols; cb += TILE) { \
+            cmax = (cb + TILE < ncols) ? cb + TILE : ncols; \
+            for(r = rb; r < rmax; r++) \
+                for(c = cb; c < cmax; c++) \
+                    dst[c * dst_stride + r] = src[r * src_stride + c]; \
+        } \
+    } \
+}
+
+DEFINE_TRANSPOSE(transpose_8, uint8_t)
+DEFINE_TRANSPOSE(transpose_16, uint16_t)
+DEFINE_TRANSPOSE(transpose_64, uint64_t)
+
+
+/***
+	32-bit transpose: same tiling, 4x4 register transposes inside each tile.
+***/
+static void transpose_32(const uint32_t * src, size_t src_stride, uint32_t * dst, size_t dst_stride, size_t nrows, size_t ncols) {
+    size_t rb, cb, r, c, rmax, cmax;
+
+    for(rb = 0; rb < nrows; rb += TILE) {
+        rmax = (rb + TILE < nrows) ? rb + TILE : nrows;
+        for(cb = 0; cb < ncols; cb += TILE) {
+            cmax = (cb + TILE < ncols) ? cb + TILE : ncols;
+            r = rb;
+#ifdef __SSE2__
+            for(; r + 4 <= rmax; r += 4) {
+                for(c = cb; c + 4 <= cmax; c += 4) {
+                    __m128 row0 = _mm_loadu_ps((const float *) &src[(r + 0) * src_stride + c]);
+                    __m128 row1 = _mm_loadu_ps((const float *) &src[(r + 1) * src_stride + c]);
+                    __m128 row2 = _mm_loadu_ps((const float *) &src[(r + 2) * src_stride + c]);
+                    __m128 row3 = _mm_loadu_ps((const float *) &src[(r + 3) * src_stride + c]);
+                    _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+                    _mm_storeu_ps((float *) &dst[(c + 0) * dst_stride + r], row0);
+                    _mm_storeu_ps((float *) &dst[(c + 1) * dst_stride + r], row1);
+                    _mm_storeu_ps((float *) &dst[(c + 2) * dst_stride + r], row2);
+                    _mm_storeu_ps((float *) &dst[(c + 3) * dst_stride + r], row3);
+                }
+                for(; c < cmax; c++) {
+                    dst[c * dst_stride + r + 0] = src[(r + 0) * src_stride + c];
+                    dst[c * dst_stride + r + 1] = src[(r + 1) * src_stride + c];
+                    dst[c * dst_stride + r + 2] = src[(r + 2) * src_stride + c];
+                    dst[c * dst_stride + r + 3] = src[(r + 3) * src_stride + c];
+                }
+            }
+#endif
+            for(; r < rmax; r++)
+                for(c = cb; c < cmax; c++)
+                    dst[c * dst_stride + r] = src[r * src_stride + c];
+        }
+    }
+}
+
+
+/***
+	Dispatch a transpose on the element size.  Strides are in elements.
+***/
+static void transpose(unsigned int elem_size, const char * src, size_t src_stride,
+                      char * dst, size_t dst_stride, size_t nrows, size_t ncols) {
+    switch(elem_size) {
+        case 1:
+            transpose_8((const uint8_t *) src, src_stride, (uint8_t *) dst, dst_stride, nrows, ncols);
+            break;
+        case 2:
+            transpose_16((const uint16_t *) src, src_stride, (uint16_t *) dst, dst_stride, nrows, ncols);
+            break;
+        case 4:
+            transpose_32((const uint32_t *) src, src_stride, (uint32_t *) dst, dst_stride, nrows, ncols);
+            break;
+        default: // 8
+            transpose_64((const uint64_t *) src, src_stride, (uint64_t *) dst, dst_stride, nrows, ncols);
+    }
+}
+
+
+/***
+	Round float32 mantissas (23 bits) to keep_bits bits, ties to even.
+	Infinities and NaNs are left untouched.  p_src may equal p_dst.
+***/
+static void trim_32(const uint32_t * src, uint32_t * dst, size_t nelems, int keep_bits) {
+    int      drop = 23 - keep_bits;
+    uint32_t half_m1 = (1u << (drop - 1)) - 1;
+    uint32_t mask = ~((1u << drop) - 1);
+    uint32_t u;
+    size_t   ix = 0;
+
+#ifdef __SSE2__
+    __m128i v_exp = _mm_set1_epi32(0x7f800000);
+    __m128i v_half_m1 = _mm_set1_epi32((int) half_m1);
+    __m128i v_mask = _mm_set1_epi32((int) mask);
+    __m128i v_one = _mm_set1_epi32(1);
+    __m128i v_drop = _mm_cvtsi32_si128(drop);
+    __m128i v, odd, rounded, special;
+    for(; ix + 4 <= nelems; ix += 4) {
+        v = _mm_loadu_si128((const __m128i *) (src + ix));
+        odd = _mm_and_si128(_mm_srl_epi32(v, v_drop), v_one);
+        rounded = _mm_and_si128(_mm_add_epi32(v, _mm_add_epi32(v_half_m1, odd)), v_mask);
+        special = _mm_cmpeq_epi32(_mm_and_si128(v, v_exp), v_exp);
+        v = _mm_or_si128(_mm_and_si128(special, v), _mm_andnot_si128(special, rounded));
+        _mm_storeu_si128((__m128i *) (dst + ix), v);
+    }
+#endif
+    for(; ix < nelems; ix++) {
+        u = src[ix];
+        if((u & 0x7f800000u) != 0x7f800000u)
+            u = (u + half_m1 + ((u >> drop) & 1u)) & mask;
+        dst[ix] = u;
+    }
+}
+
+
+/***
+	Round float64 mantissas (52 bits) to keep_bits bits, ties to even.
+***/
+static void trim_64(const uint64_t * src, uint64_t * dst, size_t nelems, int keep_bits) {
+    int      drop = 52 - keep_bits;
+    uint64_t half_m1 = (1ull << (drop - 1)) - 1;
+    uint64_t mask = ~((1ull << drop) - 1);
+    uint64_t exp = 0x7ff0000000000000ull;
+    uint64_t u;
+    size_t   ix;
+
+    for(ix = 0; ix < nelems; ix++) {
+        u = src[ix];
+        if((u & exp) != exp)
+            u = (u + half_m1 + ((u >> drop) & 1ull)) & mask;
+        dst[ix] = u;
+    }
+}
+
+
+/***
+	Mantissa trimming of nelems float32 or float64 elements (elem_size 4 or 8).
+	keep_bits outside (0, full mantissa) means a plain copy.
+***/
+void wrh5_trim_mantissa(const void * p_src, void * p_dst, size_t nelems, unsigned int elem_size, int keep_bits) {
+    if(elem_size == 4 && keep_bits > 0 && keep_bits < 23)
+        trim_32((const uint32_t *) p_src, (uint32_t *) p_dst, nelems, keep_bits);
+    else if(elem_size == 8 && keep_bits > 0 && keep_bits < 52)
+        trim_64((const uint64_t *) p_src, (uint64_t *) p_dst, nelems, keep_bits);
+    else if(p_src != p_dst)
+        memcpy(p_dst, p_src, nelems * elem_size);
+}
+
+
+/***
+	Main entry point.
+	p_src      : caller buffer holding ntints time integrations in the context's input layout
+	tint_first : first time integration of p_src to stage
+	tint_count : number of time integrations to stage
+	p_dst      : staging buffer, filled in on-disk order [time][ifs][chan] (stored channels only)
+***/
+void wrh5_stage(wrh5_context_t * p_wrh5_ctx, wrh5_hdr_t * p_wrh5_hdr, const void * p_src,
+                size_t ntints, size_t tint_first, size_t tint_count, void * p_dst) {
+    const char * src = (const char *) p_src;
+    char *      dst = (char *) p_dst;
+    size_t      esz = p_wrh5_ctx->elem_size;
+    size_t      nchans = (size_t) p_wrh5_hdr->nchans;
+    size_t      nifs = (size_t) p_wrh5_hdr->nifs;
+    size_t      tint_size = p_wrh5_ctx->in_tint_size;
+    size_t      itint, iif;
+
+    switch(p_wrh5_ctx->input_layout) {
+        case WRH5_LAYOUT_TCI:
+            if(nifs == 1) {
+                memcpy(dst, src + tint_first * tint_size, tint_count * tint_size);
+                break;
+            }
+            for(itint = 0; itint < tint_count; itint++)
+                transpose(esz, src + (tint_first + itint) * tint_size, nifs,
+                          dst + itint * tint_size, nchans, nchans, nifs);
+            break;
+        case WRH5_LAYOUT_ICT:
+            for(iif = 0; iif < nifs; iif++)
+                transpose(esz, src + (iif * nchans * ntints + tint_first) * esz, ntints,
+                          dst + iif * nchans * esz, nifs * nchans, nchans, tint_count);
+            break;
+        default: // WRH5_LAYOUT_TIF : copy, fused with trimming if requested, or gather
+            if(p_wrh5_ctx->p_chan_index != NULL) {
+                wrh5_chans_gather(p_wrh5_ctx, src + tint_first * tint_size, dst, tint_count * nifs);
+                break;
+            }
+            wrh5_trim_mantissa(src + tint_first * tint_size, dst, tint_count * tint_size / esz, 
+                               esz, p_wrh5_ctx->keep_mantissa_bits);
+            return;
+    }
+
+    /*
+     * Gather the stored channels of a reordered block in place.
+     */
+    if(p_wrh5_ctx->p_chan_index != NULL && p_wrh5_ctx->input_layout != WRH5_LAYOUT_TIF)
+        wrh5_chans_gather(p_wrh5_ctx, dst, dst, tint_count * nifs);
+
+    /*
+     * Trim the staged block in place.
+     */
+    if(p_wrh5_ctx->keep_mantissa_bits > 0)
+        wrh5_trim_mantissa(dst, dst, tint_count * p_wrh5_ctx->tint_size / esz, esz, p_wrh5_ctx->keep_mantissa_bits);
+}
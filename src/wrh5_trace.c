@@ -0,0 +1,228 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_trace.c                                                                *
+ * ------------                                                                *
+ * Low-overhead tracing of the write paths, exported as Chrome trace JSON      *
+ * (chrome://tracing, https://ui.perfetto.dev).                                *
+ *                                                                             *
+ * Each thread records its events in a ring of its own, allocated on its first *
+ * event: only that thread writes the ring, so recording takes no lock and no  *
+ * atomic read-modify-write (two clock reads and one 32-byte store).  A full   *
+ * ring overwrites its oldest events: the most recent window is kept.          *
+ * When tracing is off, an instrumented section costs one load and a branch    *
+ * (WRH5_TRACE_BEGIN and WRH5_TRACE_END in wrh5_defs.h).                       *
+ *                                                                             *
+ * wrh5_trace_dump writes the rings as complete ("X") events: name, start and  *
+ * duration in microseconds, and one integer argument (bytes, time             *
+ * integrations, ...).  Call wrh5_trace_start and wrh5_trace_dump while no     *
+ * traced call is in progress (before and after the run).                      *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef struct {
+    uint64_t    ts;                 // Start, nanoseconds (CLOCK_MONOTONIC)
+    uint64_t    dur;                // Duration, nanoseconds
+    const char * name;              // String literal
+    int64_t     arg;                // One integer argument
+} trace_event_t;
+
+typedef struct trace_ring {
+    struct trace_ring * next;       // Every ring ever allocated, newest first
+    trace_event_t * events;         // nevents slots
+    uint64_t    head;               // Events recorded since wrh5_trace_start (written by the owner only)
+    long        tid;                // Owner thread ID
+    char        name[48];           // Owner thread name
+} trace_ring_t;
+
+volatile int wrh5_tracing = 0;      // 1: record events (see WRH5_TRACE_BEGIN)
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;     // Protects the ring list
+static trace_ring_t * trace_rings = NULL;
+static size_t trace_nevents = WRH5_TRACE_NEVENTS;  // Events per thread (32 bytes each)
+static uint64_t trace_t0 = 0;       // wrh5_trace_start time
+static __thread trace_ring_t * my_ring = NULL;
+
+
+/***
+	Monotonic clock in nanoseconds (never 0).
+***/
+uint64_t wrh5_trace_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec + 1;
+}
+
+
+/***
+	The calling thread's ring, allocated on its first event.
+***/
+static trace_ring_t * get_ring(void) {
+    trace_ring_t * p_ring = my_ring;
+
+    if(p_ring != NULL)
+        return p_ring;
+    p_ring = calloc(1, sizeof(trace_ring_t));
+    if(p_ring == NULL)
+        return NULL;
+    pthread_mutex_lock(&trace_lock);
+    p_ring->events = calloc(trace_nevents, sizeof(trace_event_t));
+    if(p_ring->events == NULL) {
+        pthread_mutex_unlock(&trace_lock);
+        free(p_ring);
+        return NULL;
+    }
+    p_ring->tid = (long) syscall(SYS_gettid);
+    sprintf(p_ring->name, "thread %ld", p_ring->tid);
+    p_ring->next = trace_rings;
+    trace_rings = p_ring;
+    pthread_mutex_unlock(&trace_lock);
+    my_ring = p_ring;
+    return p_ring;
+}
+
+
+/***
+	Record a complete event that started at t0 (WRH5_TRACE_END).
+***/
+void wrh5_trace_record(const char * name, uint64_t t0, int64_t arg) {
+    trace_ring_t *  p_ring = get_ring();
+    trace_event_t * p_event;
+    uint64_t        t1 = wrh5_trace_now();
+
+    if(p_ring == NULL)
+        return;
+    p_event = &p_ring->events[p_ring->head % trace_nevents];
+    p_event->ts = t0;
+    p_event->dur = t1 - t0;
+    p_event->name = name;
+    p_event->arg = arg;
+    __atomic_store_n(&p_ring->head, p_ring->head + 1, __ATOMIC_RELEASE);
+}
+
+
+/***
+	Name the calling thread in the trace (E.g. "wrh5 worker 3").
+***/
+void wrh5_trace_thread_name(const char * name) {
+    trace_ring_t * p_ring;
+
+    if(!wrh5_tracing)
+        return;
+    p_ring = get_ring();
+    if(p_ring != NULL)
+        snprintf(p_ring->name, sizeof(p_ring->name), "%s", name);
+}
+
+
+/***
+	Main entry point.
+	Start (or restart) tracing with nevents events per thread (0: default); earlier events are discarded.
+***/
+int wrh5_trace_start(size_t nevents, int debugging) {
+    trace_ring_t * p_ring;
+
+    pthread_mutex_lock(&trace_lock);
+    if(nevents > 0 && nevents != trace_nevents) {
+        if(trace_rings != NULL) {
+            pthread_mutex_unlock(&trace_lock);
+            wrh5_error(__FILE__, __LINE__, "wrh5_trace_start: nevents cannot change once threads have traced");
+            return 1;
+        }
+        trace_nevents = nevents;
+    }
+    for(p_ring = trace_rings; p_ring != NULL; p_ring = p_ring->next)
+        p_ring->head = 0;
+    trace_t0 = wrh5_trace_now();
+    pthread_mutex_unlock(&trace_lock);
+    wrh5_tracing = 1;
+    if(debugging)
+        wrh5_info("wrh5_trace_start: %ld events per thread\n", (long) trace_nevents);
+    return 0;
+}
+
+
+/***
+	Stop recording.  The events stay available to wrh5_trace_dump.
+***/
+void wrh5_trace_stop(void) {
+    wrh5_tracing = 0;
+}
+
+
+/***
+	Write a JSON string: quotes, backslashes and control characters escaped.
+***/
+static void write_json_string(FILE * p_file, const char * str) {
+    const unsigned char * p_char;
+
+    fputc('"', p_file);
+    for(p_char = (const unsigned char *) str; *p_char != '\0'; p_char++) {
+        if(*p_char == '"' || *p_char == '\\')
+            fprintf(p_file, "\\%c", *p_char);
+        else if(*p_char < 0x20)
+            fprintf(p_file, "\\u%04x", *p_char);
+        else
+            fputc(*p_char, p_file);
+    }
+    fputc('"', p_file);
+}
+
+
+/***
+	Write the events of every thread to path as Chrome trace JSON.
+***/
+int wrh5_trace_dump(const char * path, int debugging) {
+    FILE *          p_file;
+    trace_ring_t *  p_ring;
+    trace_event_t * p_event;
+    uint64_t        head, first, ix;
+    unsigned long   nwritten = 0, noverwritten = 0;
+    int             pid = (int) getpid();
+    int             comma = 0;
+    char            msgstr[256];
+
+    p_file = fopen(path, "w");
+    if(p_file == NULL) {
+        sprintf(msgstr, "wrh5_trace_dump: cannot create '%.200s'", path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    fprintf(p_file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    pthread_mutex_lock(&trace_lock);
+    for(p_ring = trace_rings; p_ring != NULL; p_ring = p_ring->next) {
+        head = __atomic_load_n(&p_ring->head, __ATOMIC_ACQUIRE);
+        if(head == 0)
+            continue;
+        fprintf(p_file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %ld, \"args\": {\"name\": ",
+                comma ? ",\n" : "", pid, p_ring->tid);
+        write_json_string(p_file, p_ring->name);
+        fprintf(p_file, "}}");
+        comma = 1;
+        first = (head > trace_nevents) ? head - trace_nevents : 0;
+        noverwritten += first;
+        for(ix = first; ix < head; ix++) {
+            p_event = &p_ring->events[ix % trace_nevents];
+            fprintf(p_file, ",\n{\"name\": ");
+            write_json_string(p_file, p_event->name);
+            fprintf(p_file, ", \"cat\": \"wrh5\", \"ph\": \"X\", \"pid\": %d, \"tid\": %ld, "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"n\": %lld}}",
+                    pid, p_ring->tid, (double) (int64_t) (p_event->ts - trace_t0) / 1000.0, p_event->dur / 1000.0,
+                    (long long) p_event->arg);
+            nwritten += 1;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    fprintf(p_file, "\n], \"otherData\": {\"library\": \"libwrh5 %s\", \"overwritten\": %lu}}\n", VERSION_WRH5, noverwritten);
+    if(fclose(p_file) != 0) {
+        sprintf(msgstr, "wrh5_trace_dump: write of '%.200s' FAILED", path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    if(debugging)
+        wrh5_info("wrh5_trace_dump: %lu events written to %s (%lu overwritten)\n", nwritten, path, noverwritten);
+    return 0;
+}
@@ -0,0 +1,769 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_uring.c                                                                *
+ * ------------                                                                *
+ * HDF5 virtual file driver "wrh5_uring": the sec2 driver, except that large   *
+ * writes are copied into a ring of slots and submitted through io_uring, so   *
+ * that up to io_depth writes are in flight while the caller carries on.       *
+ *                                                                             *
+ * - The slots are the buffers of a wrh5_pool_t (hugepages, pre-faulted,       *
+ *   reserved from the memory budget), registered with the ring when the       *
+ *   memlock limit allows (IORING_OP_WRITE_FIXED), else written with           *
+ *   IORING_OP_WRITEV.                                                         *
+ * - Small writes (metadata) and reads are synchronous.  Any access waits      *
+ *   first for the in-flight writes that overlap it, so the file never sees    *
+ *   two overlapping writes out of order.                                      *
+ * - flush (H5Fflush), truncate and close wait for every write in flight.      *
+ *   A failed write is reported by the next write, flush or close.             *
+ * - Without io_uring (old kernel, seccomp), every write is a pwrite.          *
+ * The ring is driven with the raw system calls: no liburing is needed.        *
+ * io_uring is Linux only: elsewhere, wrh5_set_fapl_uring reports an error.    *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+#ifdef __linux__
+
+#define URING_SMALL_WRITE   (64 * 1024)     // Smaller writes are synchronous
+#define URING_CLASS_VALUE   511             // Driver identifier (HDF5 1.13+), in the range left to users
+
+// Driver properties stored in the file access property list.
+typedef struct {
+    int     depth;              // Writes kept in flight
+    size_t  slot_bytes;         // Byte size of each slot
+    int     debugging;          // Log the driver statistics at close
+} uring_fapl_t;
+
+// One slot: a pool buffer holding a write in flight.
+typedef struct {
+    haddr_t addr;               // File offset
+    size_t  len;                // Byte length
+    int     busy;               // 1: submitted and not yet completed
+    struct iovec iov;           // Buffer (IORING_OP_WRITEV)
+} uring_slot_t;
+
+// The driver's file structure: H5FD_t must come first.
+typedef struct {
+    H5FD_t  pub;                // Public fields, maintained by HDF5
+    int     fd;                 // File descriptor (H5Fget_vfd_handle returns its address)
+    haddr_t eoa;                // End of the address space allocated by HDF5
+    haddr_t eof;                // End of the file as written
+    dev_t   device;             // Identity of the file for cmp
+    ino_t   inode;
+    uring_fapl_t fa;            // Properties the file was opened with
+    int     ring_fd;            // io_uring file descriptor (-1: synchronous fallback)
+    void *  sq_ring;            // Submission queue ring mapping
+    size_t  sq_ring_size;
+    void *  cq_ring;            // Completion queue ring mapping (may be sq_ring)
+    size_t  cq_ring_size;
+    struct io_uring_sqe * sqes; // Submission queue entries mapping
+    size_t  sqes_size;
+    unsigned * sq_head, * sq_tail, * sq_mask, * sq_array;
+    unsigned * cq_head, * cq_tail, * cq_mask;
+    struct io_uring_cqe * cqes;
+    wrh5_pool_t pool;           // Slot buffers
+    uring_slot_t * slots;       // One per pool buffer
+    int     ninflight;          // Slots busy
+    int     error;              // errno of the first failed write, reported by the next write, flush or close
+    wrh5_io_stats_t stats;      // See wrh5_io_stats
+} uring_file_t;
+
+static hid_t uring_driver_id = H5I_INVALID_HID;
+static pthread_mutex_t uring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/***
+	Push an error on the HDF5 error stack, and log it unless the file is being opened:
+	HDF5 probes for an existing file before it creates one, and keeps quiet about that failure.
+***/
+static void uring_error(int line, hid_t min_id, const char * msg, int errnum) {
+    char msgstr[256];
+
+    sprintf(msgstr, "wrh5_uring: %s (%s)", msg, strerror(errnum));
+    if(min_id != H5E_CANTOPENFILE)
+        wrh5_error(__FILE__, line, msgstr);
+    H5Epush2(H5E_DEFAULT, __FILE__, "wrh5_uring", line, H5E_ERR_CLS, H5E_VFL, min_id, "%s", msgstr);
+}
+
+
+/***
+	pwrite/pread all of len bytes at offset.
+***/
+static int write_sync(int fd, const char * p_buf, size_t len, off_t offset) {
+    ssize_t nbytes;
+
+    while(len > 0) {
+        nbytes = pwrite(fd, p_buf, len, offset);
+        if(nbytes < 0 && errno == EINTR)
+            continue;
+        if(nbytes <= 0)
+            return (nbytes < 0) ? errno : EIO;
+        p_buf += nbytes;
+        len -= nbytes;
+        offset += nbytes;
+    }
+    return 0;
+}
+
+static int read_sync(int fd, char * p_buf, size_t len, off_t offset) {
+    ssize_t nbytes;
+
+    while(len > 0) {
+        nbytes = pread(fd, p_buf, len, offset);
+        if(nbytes < 0 && errno == EINTR)
+            continue;
+        if(nbytes < 0)
+            return errno;
+        if(nbytes == 0) {
+            memset(p_buf, 0, len);      // Past the end of the file
+            break;
+        }
+        p_buf += nbytes;
+        len -= nbytes;
+        offset += nbytes;
+    }
+    return 0;
+}
+
+
+/***
+	Set up the ring and register the slot buffers.  Returns 0, or an errno if io_uring is not available.
+***/
+static int ring_setup(uring_file_t * p_file) {
+    struct io_uring_params params;
+    struct iovec * p_iovs;
+    int ix, rc;
+
+    memset(&params, 0, sizeof(params));
+    p_file->ring_fd = (int) syscall(__NR_io_uring_setup, (unsigned) p_file->fa.depth, &params);
+    if(p_file->ring_fd < 0) {
+        p_file->ring_fd = -1;
+        return errno;
+    }
+    p_file->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    p_file->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(p_file->cq_ring_size > p_file->sq_ring_size)
+            p_file->sq_ring_size = p_file->cq_ring_size;
+        p_file->cq_ring_size = 0;
+    }
+    p_file->sq_ring = mmap(NULL, p_file->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           p_file->ring_fd, IORING_OFF_SQ_RING);
+    if(p_file->sq_ring == MAP_FAILED)
+        goto failed;
+    p_file->cq_ring = p_file->sq_ring;
+    if(p_file->cq_ring_size > 0) {
+        p_file->cq_ring = mmap(NULL, p_file->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               p_file->ring_fd, IORING_OFF_CQ_RING);
+        if(p_file->cq_ring == MAP_FAILED)
+            goto failed;
+    }
+    p_file->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    p_file->sqes = mmap(NULL, p_file->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        p_file->ring_fd, IORING_OFF_SQES);
+    if(p_file->sqes == MAP_FAILED)
+        goto failed;
+    p_file->sq_head = (unsigned *) ((char *) p_file->sq_ring + params.sq_off.head);
+    p_file->sq_tail = (unsigned *) ((char *) p_file->sq_ring + params.sq_off.tail);
+    p_file->sq_mask = (unsigned *) ((char *) p_file->sq_ring + params.sq_off.ring_mask);
+    p_file->sq_array = (unsigned *) ((char *) p_file->sq_ring + params.sq_off.array);
+    p_file->cq_head = (unsigned *) ((char *) p_file->cq_ring + params.cq_off.head);
+    p_file->cq_tail = (unsigned *) ((char *) p_file->cq_ring + params.cq_off.tail);
+    p_file->cq_mask = (unsigned *) ((char *) p_file->cq_ring + params.cq_off.ring_mask);
+    p_file->cqes = (struct io_uring_cqe *) ((char *) p_file->cq_ring + params.cq_off.cqes);
+
+    // Register the slots; without enough locked memory, the writes are not fixed.
+    p_iovs = malloc(p_file->pool.nbufs * sizeof(struct iovec));
+    if(p_iovs != NULL) {
+        for(ix = 0; ix < p_file->pool.nbufs; ix++) {
+            p_iovs[ix].iov_base = p_file->pool.base + (size_t) ix * p_file->pool.bufsize;
+            p_iovs[ix].iov_len = p_file->pool.bufsize;
+        }
+        rc = (int) syscall(__NR_io_uring_register, p_file->ring_fd, IORING_REGISTER_BUFFERS, p_iovs, p_file->pool.nbufs);
+        p_file->stats.fixed = (rc == 0);
+        free(p_iovs);
+    }
+    return 0;
+
+failed:
+    rc = errno;
+    if(p_file->sqes != NULL && p_file->sqes != MAP_FAILED)
+        munmap(p_file->sqes, p_file->sqes_size);
+    if(p_file->cq_ring_size > 0 && p_file->cq_ring != NULL && p_file->cq_ring != MAP_FAILED)
+        munmap(p_file->cq_ring, p_file->cq_ring_size);
+    if(p_file->sq_ring != NULL && p_file->sq_ring != MAP_FAILED)
+        munmap(p_file->sq_ring, p_file->sq_ring_size);
+    close(p_file->ring_fd);
+    p_file->ring_fd = -1;
+    return rc;
+}
+
+
+/***
+	Tear the ring down.
+***/
+static void ring_close(uring_file_t * p_file) {
+    if(p_file->ring_fd < 0)
+        return;
+    munmap(p_file->sqes, p_file->sqes_size);
+    if(p_file->cq_ring_size > 0)
+        munmap(p_file->cq_ring, p_file->cq_ring_size);
+    munmap(p_file->sq_ring, p_file->sq_ring_size);
+    close(p_file->ring_fd);     // Also unregisters the buffers
+    p_file->ring_fd = -1;
+}
+
+
+/***
+	Handle the completions that are ready; if wait is nonzero, wait for at least one first.
+***/
+static void ring_reap(uring_file_t * p_file, int wait) {
+    struct io_uring_cqe * p_cqe;
+    uring_slot_t * p_slot;
+    unsigned head;
+    int rc;
+
+    if(wait)
+        while(syscall(__NR_io_uring_enter, p_file->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno == EINTR)
+            ;
+    head = *p_file->cq_head;
+    while(head != __atomic_load_n(p_file->cq_tail, __ATOMIC_ACQUIRE)) {
+        p_cqe = &p_file->cqes[head & *p_file->cq_mask];
+        p_slot = &p_file->slots[p_cqe->user_data];
+        if(p_cqe->res < 0) {
+            if(p_file->error == 0)
+                p_file->error = -p_cqe->res;
+        } else if((size_t) p_cqe->res < p_slot->len) {
+            // Short write: finish it here.
+            p_file->stats.short_writes += 1;
+            rc = write_sync(p_file->fd, (char *) p_slot->iov.iov_base + p_cqe->res,
+                            p_slot->len - p_cqe->res, p_slot->addr + p_cqe->res);
+            if(rc != 0 && p_file->error == 0)
+                p_file->error = rc;
+        }
+        p_slot->busy = 0;
+        p_file->ninflight -= 1;
+        wrh5_pool_put(&p_file->pool, p_slot->iov.iov_base);
+        head += 1;
+    }
+    __atomic_store_n(p_file->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/***
+	Wait for the in-flight writes that overlap [addr, addr + len), or for all of them if len is 0.
+***/
+static void wait_overlap(uring_file_t * p_file, haddr_t addr, size_t len) {
+    int ix, overlap = 1;
+
+    while(p_file->ninflight > 0 && overlap) {
+        overlap = (len == 0);
+        for(ix = 0; ix < p_file->pool.nbufs && !overlap; ix++)
+            if(p_file->slots[ix].busy && p_file->slots[ix].addr < addr + len
+               && addr < p_file->slots[ix].addr + p_file->slots[ix].len)
+                overlap = 1;
+        if(overlap)
+            ring_reap(p_file, 1);
+    }
+}
+
+
+/***
+	Copy one piece (at most one slot) into a free slot and submit it.
+***/
+static int submit_piece(uring_file_t * p_file, haddr_t addr, const char * p_buf, size_t len) {
+    struct io_uring_sqe * p_sqe;
+    uring_slot_t * p_slot;
+    char * p_slotbuf;
+    unsigned tail, ix;
+    int islot, rc;
+
+    wait_overlap(p_file, addr, len);
+    while((p_slotbuf = wrh5_pool_get(&p_file->pool, 0)) == NULL)
+        ring_reap(p_file, 1);
+    islot = (int) ((p_slotbuf - p_file->pool.base) / p_file->pool.bufsize);
+    p_slot = &p_file->slots[islot];
+    memcpy(p_slotbuf, p_buf, len);
+    p_slot->addr = addr;
+    p_slot->len = len;
+    p_slot->iov.iov_base = p_slotbuf;
+    p_slot->iov.iov_len = len;
+
+    tail = *p_file->sq_tail;
+    ix = tail & *p_file->sq_mask;
+    p_sqe = &p_file->sqes[ix];
+    memset(p_sqe, 0, sizeof(struct io_uring_sqe));
+    p_sqe->fd = p_file->fd;
+    p_sqe->off = addr;
+    p_sqe->user_data = (uint64_t) islot;
+    if(p_file->stats.fixed) {
+        p_sqe->opcode = IORING_OP_WRITE_FIXED;
+        p_sqe->addr = (uint64_t) (uintptr_t) p_slotbuf;
+        p_sqe->len = (uint32_t) len;
+        p_sqe->buf_index = (uint16_t) islot;
+    } else {
+        p_sqe->opcode = IORING_OP_WRITEV;
+        p_sqe->addr = (uint64_t) (uintptr_t) &p_slot->iov;
+        p_sqe->len = 1;
+    }
+    p_file->sq_array[ix] = ix;
+    __atomic_store_n(p_file->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    p_slot->busy = 1;
+    p_file->ninflight += 1;
+    while(syscall(__NR_io_uring_enter, p_file->ring_fd, 1, 0, 0, NULL, 0) < 0) {
+        if(errno == EINTR)
+            continue;
+        if(errno == EAGAIN || errno == EBUSY) {
+            ring_reap(p_file, 1);
+            continue;
+        }
+        // Nothing was submitted: take the entry back and free the slot.
+        rc = errno;
+        __atomic_store_n(p_file->sq_tail, tail, __ATOMIC_RELEASE);
+        p_slot->busy = 0;
+        p_file->ninflight -= 1;
+        wrh5_pool_put(&p_file->pool, p_slotbuf);
+        return rc;
+    }
+    p_file->stats.async_writes += 1;
+    p_file->stats.async_bytes += (double) len;
+    if(p_file->ninflight > p_file->stats.max_inflight)
+        p_file->stats.max_inflight = p_file->ninflight;
+    return 0;
+}
+
+
+/*
+ * File access property list callbacks.
+ */
+static void * uring_fapl_get(H5FD_t * p_h5fd) {
+    uring_fapl_t * p_fa = malloc(sizeof(uring_fapl_t));
+
+    if(p_fa != NULL)
+        memcpy(p_fa, &((uring_file_t *) p_h5fd)->fa, sizeof(uring_fapl_t));
+    return p_fa;
+}
+
+static void * uring_fapl_copy(const void * p_old) {
+    uring_fapl_t * p_fa = malloc(sizeof(uring_fapl_t));
+
+    if(p_fa != NULL)
+        memcpy(p_fa, p_old, sizeof(uring_fapl_t));
+    return p_fa;
+}
+
+static herr_t uring_fapl_free(void * p_fa) {
+    free(p_fa);
+    return 0;
+}
+
+
+/***
+	Open or create a file.  Read-write files get the slots and the ring.
+***/
+static H5FD_t * uring_open(const char * name, unsigned flags, hid_t fapl_id, haddr_t maxaddr) {
+    const uring_fapl_t * p_fa;
+    uring_file_t * p_file;
+    struct stat sb;
+    int o_flags, rc;
+
+    if(name == NULL || *name == '\0' || maxaddr == 0 || maxaddr == HADDR_UNDEF) {
+        uring_error(__LINE__, H5E_BADVALUE, "invalid file name or address space", EINVAL);
+        return NULL;
+    }
+    p_fa = H5Pget_driver_info(fapl_id);
+    if(p_fa == NULL) {
+        uring_error(__LINE__, H5E_BADVALUE, "no driver properties", EINVAL);
+        return NULL;
+    }
+    o_flags = (flags & H5F_ACC_RDWR) ? O_RDWR : O_RDONLY;
+    if(flags & H5F_ACC_TRUNC)
+        o_flags |= O_TRUNC;
+    if(flags & H5F_ACC_CREAT)
+        o_flags |= O_CREAT;
+    if(flags & H5F_ACC_EXCL)
+        o_flags |= O_EXCL;
+
+    p_file = calloc(1, sizeof(uring_file_t));
+    if(p_file == NULL) {
+        uring_error(__LINE__, H5E_CANTALLOC, "calloc of the file structure FAILED", ENOMEM);
+        return NULL;
+    }
+    memcpy(&p_file->fa, p_fa, sizeof(uring_fapl_t));
+    p_file->ring_fd = -1;
+    p_file->fd = open(name, o_flags, 0666);
+    if(p_file->fd < 0) {
+        uring_error(__LINE__, H5E_CANTOPENFILE, "open FAILED", errno);
+        free(p_file);
+        return NULL;
+    }
+    if(fstat(p_file->fd, &sb) < 0) {
+        uring_error(__LINE__, H5E_BADFILE, "fstat FAILED", errno);
+        close(p_file->fd);
+        free(p_file);
+        return NULL;
+    }
+    p_file->eof = (haddr_t) sb.st_size;
+    p_file->device = sb.st_dev;
+    p_file->inode = sb.st_ino;
+    p_file->stats.depth = p_file->fa.depth;
+    if(!(flags & H5F_ACC_RDWR))
+        return (H5FD_t *) p_file;
+
+    // The slots are reserved from the memory budget with the pool.
+    if(wrh5_pool_create(&p_file->pool, p_file->fa.slot_bytes, p_file->fa.depth, p_file->fa.debugging) != 0) {
+        uring_error(__LINE__, H5E_CANTALLOC, "no memory for the slots", ENOMEM);
+        close(p_file->fd);
+        free(p_file);
+        return NULL;
+    }
+    p_file->slots = calloc(p_file->fa.depth, sizeof(uring_slot_t));
+    if(p_file->slots == NULL) {
+        uring_error(__LINE__, H5E_CANTALLOC, "calloc of the slots FAILED", ENOMEM);
+        wrh5_pool_destroy(&p_file->pool, 0);
+        close(p_file->fd);
+        free(p_file);
+        return NULL;
+    }
+    p_file->stats.slot_bytes = p_file->pool.bufsize;
+    p_file->stats.queue_bytes = p_file->pool.map_size;
+    rc = ring_setup(p_file);
+    if(rc != 0) {
+        char msgstr[256];
+        sprintf(msgstr, "wrh5_uring: io_uring is not available (%s); every write will be a pwrite", strerror(rc));
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+    }
+    p_file->stats.uring = (p_file->ring_fd >= 0);
+    return (H5FD_t *) p_file;
+}
+
+
+/***
+	Close a file once every write has completed.
+***/
+static herr_t uring_close(H5FD_t * p_h5fd) {
+    uring_file_t * p_file = (uring_file_t *) p_h5fd;
+    herr_t status = 0;
+
+    if(p_file->ring_fd >= 0)
+        wait_overlap(p_file, 0, 0);
+    ring_close(p_file);
+    if(p_file->error != 0) {
+        uring_error(__LINE__, H5E_WRITEERROR, "a write FAILED", p_file->error);
+        status = -1;
+    }
+    if(p_file->fa.debugging && p_file->slots != NULL)
+        wrh5_info("wrh5_uring: io_uring %s, %s buffers, %lu writes (%.2f MiB) in flight up to %d at a time, %lu synchronous, %lu short\n",
+                  p_file->stats.uring ? "on" : "off", p_file->stats.fixed ? "registered" : "unregistered",
+                  p_file->stats.async_writes, p_file->stats.async_bytes / (1024.0 * 1024.0),
+                  p_file->stats.max_inflight, p_file->stats.sync_writes, p_file->stats.short_writes);
+    if(p_file->slots != NULL) {
+        wrh5_pool_destroy(&p_file->pool, 0);
+        free(p_file->slots);
+    }
+    if(close(p_file->fd) < 0) {
+        uring_error(__LINE__, H5E_CANTCLOSEFILE, "close FAILED", errno);
+        status = -1;
+    }
+    free(p_file);
+    return status;
+}
+
+
+/*
+ * Identity, features and address space, as the sec2 driver.
+ */
+static int uring_cmp(const H5FD_t * p_h5fd1, const H5FD_t * p_h5fd2) {
+    const uring_file_t * p_f1 = (const uring_file_t *) p_h5fd1;
+    const uring_file_t * p_f2 = (const uring_file_t *) p_h5fd2;
+
+    if(p_f1->device != p_f2->device)
+        return (p_f1->device < p_f2->device) ? -1 : 1;
+    if(p_f1->inode != p_f2->inode)
+        return (p_f1->inode < p_f2->inode) ? -1 : 1;
+    return 0;
+}
+
+static herr_t uring_query(const H5FD_t * p_h5fd, unsigned long * p_flags) {
+    (void) p_h5fd;
+    *p_flags = H5FD_FEAT_AGGREGATE_METADATA | H5FD_FEAT_ACCUMULATE_METADATA | H5FD_FEAT_DATA_SIEVE
+               | H5FD_FEAT_AGGREGATE_SMALLDATA | H5FD_FEAT_DEFAULT_VFD_COMPATIBLE;
+    return 0;
+}
+
+static haddr_t uring_get_eoa(const H5FD_t * p_h5fd, H5FD_mem_t type) {
+    (void) type;
+    return ((const uring_file_t *) p_h5fd)->eoa;
+}
+
+static herr_t uring_set_eoa(H5FD_t * p_h5fd, H5FD_mem_t type, haddr_t addr) {
+    (void) type;
+    ((uring_file_t *) p_h5fd)->eoa = addr;
+    return 0;
+}
+
+static haddr_t uring_get_eof(const H5FD_t * p_h5fd, H5FD_mem_t type) {
+    (void) type;
+    return ((const uring_file_t *) p_h5fd)->eof;
+}
+
+static herr_t uring_get_handle(H5FD_t * p_h5fd, hid_t fapl, void ** p_handle) {
+    (void) fapl;
+    *p_handle = &((uring_file_t *) p_h5fd)->fd;
+    return 0;
+}
+
+
+/***
+	Read synchronously, after the overlapping writes in flight.
+***/
+static herr_t uring_read(H5FD_t * p_h5fd, H5FD_mem_t type, hid_t dxpl, haddr_t addr, size_t size, void * p_buf) {
+    uring_file_t * p_file = (uring_file_t *) p_h5fd;
+    int rc;
+
+    (void) type;
+    (void) dxpl;
+    if(addr == HADDR_UNDEF || addr + size > p_file->eoa) {
+        uring_error(__LINE__, H5E_OVERFLOW, "read beyond the allocated address space", EINVAL);
+        return -1;
+    }
+    if(p_file->ring_fd >= 0)
+        wait_overlap(p_file, addr, size);
+    rc = read_sync(p_file->fd, p_buf, size, (off_t) addr);
+    if(rc != 0) {
+        uring_error(__LINE__, H5E_READERROR, "pread FAILED", rc);
+        return -1;
+    }
+    return 0;
+}
+
+
+/***
+	Write: large writes go through the ring one slot at a time, small ones are synchronous.
+***/
+static herr_t uring_write(H5FD_t * p_h5fd, H5FD_mem_t type, hid_t dxpl, haddr_t addr, size_t size, const void * p_buf) {
+    uring_file_t * p_file = (uring_file_t *) p_h5fd;
+    const char * p_src = (const char *) p_buf;
+    size_t piece, done;
+    int rc = 0;
+
+    (void) type;
+    (void) dxpl;
+    if(addr == HADDR_UNDEF || addr + size > p_file->eoa) {
+        uring_error(__LINE__, H5E_OVERFLOW, "write beyond the allocated address space", EINVAL);
+        return -1;
+    }
+    if(p_file->error != 0) {
+        uring_error(__LINE__, H5E_WRITEERROR, "an earlier write FAILED", p_file->error);
+        return -1;
+    }
+    if(p_file->ring_fd < 0 || size < URING_SMALL_WRITE) {
+        if(p_file->ring_fd >= 0)
+            wait_overlap(p_file, addr, size);
+        rc = write_sync(p_file->fd, p_src, size, (off_t) addr);
+        p_file->stats.sync_writes += 1;
+    } else
+        for(done = 0; done < size && rc == 0; done += piece) {
+            piece = size - done;
+            if(piece > p_file->pool.bufsize)
+                piece = p_file->pool.bufsize;
+            rc = submit_piece(p_file, addr + done, p_src + done, piece);
+        }
+    if(rc != 0) {
+        uring_error(__LINE__, H5E_WRITEERROR, "write FAILED", rc);
+        return -1;
+    }
+    if(addr + size > p_file->eof)
+        p_file->eof = addr + size;
+    return 0;
+}
+
+
+/***
+	H5Fflush: wait for every write in flight.
+***/
+static herr_t uring_flush(H5FD_t * p_h5fd, hid_t dxpl, hbool_t closing) {
+    uring_file_t * p_file = (uring_file_t *) p_h5fd;
+
+    (void) dxpl;
+    (void) closing;
+    if(p_file->ring_fd >= 0)
+        wait_overlap(p_file, 0, 0);
+    if(p_file->error != 0) {
+        uring_error(__LINE__, H5E_WRITEERROR, "a write FAILED", p_file->error);
+        return -1;
+    }
+    return 0;
+}
+
+
+/***
+	Make the file size match the allocated address space.
+***/
+static herr_t uring_truncate(H5FD_t * p_h5fd, hid_t dxpl, hbool_t closing) {
+    uring_file_t * p_file = (uring_file_t *) p_h5fd;
+
+    (void) dxpl;
+    (void) closing;
+    if(p_file->ring_fd >= 0)
+        wait_overlap(p_file, 0, 0);
+    if(p_file->eoa != p_file->eof) {
+        if(ftruncate(p_file->fd, (off_t) p_file->eoa) < 0) {
+            uring_error(__LINE__, H5E_SEEKERROR, "ftruncate FAILED", errno);
+            return -1;
+        }
+        p_file->eof = p_file->eoa;
+    }
+    return 0;
+}
+
+
+/*
+ * File locking, as the sec2 driver.
+ */
+static herr_t uring_lock_file(H5FD_t * p_h5fd, hbool_t rw) {
+    uring_file_t * p_file = (uring_file_t *) p_h5fd;
+
+    if(flock(p_file->fd, (rw ? LOCK_EX : LOCK_SH) | LOCK_NB) < 0 && errno != ENOSYS) {
+        uring_error(__LINE__, H5E_CANTLOCKFILE, "flock FAILED", errno);
+        return -1;
+    }
+    return 0;
+}
+
+static herr_t uring_unlock_file(H5FD_t * p_h5fd) {
+    uring_file_t * p_file = (uring_file_t *) p_h5fd;
+
+    if(flock(p_file->fd, LOCK_UN) < 0 && errno != ENOSYS) {
+        uring_error(__LINE__, H5E_CANTUNLOCKFILE, "flock FAILED", errno);
+        return -1;
+    }
+    return 0;
+}
+
+
+static const H5FD_class_t uring_class = {
+#ifdef H5FD_CLASS_VERSION
+    .version = H5FD_CLASS_VERSION,
+    .value = URING_CLASS_VALUE,
+#endif
+    .name = "wrh5_uring",
+    .maxaddr = (haddr_t) 0x7fffffffffffffffLL,
+    .fc_degree = H5F_CLOSE_WEAK,
+    .fapl_size = sizeof(uring_fapl_t),
+    .fapl_get = uring_fapl_get,
+    .fapl_copy = uring_fapl_copy,
+    .fapl_free = uring_fapl_free,
+    .open = uring_open,
+    .close = uring_close,
+    .cmp = uring_cmp,
+    .query = uring_query,
+    .get_eoa = uring_get_eoa,
+    .set_eoa = uring_set_eoa,
+    .get_eof = uring_get_eof,
+    .get_handle = uring_get_handle,
+    .read = uring_read,
+    .write = uring_write,
+    .flush = uring_flush,
+    .truncate = uring_truncate,
+    .lock = uring_lock_file,
+    .unlock = uring_unlock_file,
+    .fl_map = H5FD_FLMAP_DICHOTOMY
+};
+
+
+/***
+	Register the driver with HDF5 (again, if HDF5 was closed and reopened).
+***/
+static hid_t uring_driver(void) {
+    pthread_mutex_lock(&uring_lock);
+    if(uring_driver_id < 0 || H5Iis_valid(uring_driver_id) <= 0)
+        uring_driver_id = H5FDregister(&uring_class);
+    pthread_mutex_unlock(&uring_lock);
+    return uring_driver_id;
+}
+
+
+/***
+	Select the io_uring driver in a file access property list.
+	depth: writes kept in flight (>= 1); slot_bytes: byte size of each in-flight write buffer (0 = WRH5_IO_SLOT_BYTES).
+***/
+int wrh5_set_fapl_uring(hid_t fapl, int depth, size_t slot_bytes, int debugging) {
+    uring_fapl_t fa;
+    hid_t driver_id;
+
+    if(depth < 1) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_set_fapl_uring: depth must be > 0");
+        return 1;
+    }
+    driver_id = uring_driver();
+    if(driver_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_set_fapl_uring: H5FDregister FAILED");
+        return 1;
+    }
+    fa.depth = depth;
+    fa.slot_bytes = (slot_bytes > 0) ? slot_bytes : WRH5_IO_SLOT_BYTES;
+    fa.debugging = debugging;
+    if(H5Pset_driver(fapl, driver_id, &fa) < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_set_fapl_uring: H5Pset_driver FAILED");
+        return 1;
+    }
+    return 0;
+}
+
+
+/***
+	Report the io_uring driver statistics of an open context (all zero if it does not use the driver).
+***/
+int wrh5_io_stats(wrh5_context_t * p_wrh5_ctx, wrh5_io_stats_t * p_stats) {
+    hid_t   fapl;
+    void *  p_handle = NULL;
+    int     ours;
+
+    memset(p_stats, 0, sizeof(wrh5_io_stats_t));
+    if(p_wrh5_ctx->file_id <= 0)
+        return 0;
+    fapl = H5Fget_access_plist(p_wrh5_ctx->file_id);
+    if(fapl < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_io_stats: H5Fget_access_plist FAILED");
+        return 1;
+    }
+    ours = (uring_driver_id >= 0 && H5Pget_driver(fapl) == uring_driver_id);
+    if(ours && H5Fget_vfd_handle(p_wrh5_ctx->file_id, fapl, &p_handle) >= 0 && p_handle != NULL)
+        memcpy(p_stats, &((uring_file_t *) ((char *) p_handle - offsetof(uring_file_t, fd)))->stats,
+               sizeof(wrh5_io_stats_t));
+    H5Pclose(fapl);
+    return 0;
+}
+
+#else   // Not Linux: no io_uring
+
+
+int wrh5_set_fapl_uring(hid_t fapl, int depth, size_t slot_bytes, int debugging) {
+    (void) fapl;
+    (void) depth;
+    (void) slot_bytes;
+    (void) debugging;
+    wrh5_error(__FILE__, __LINE__, "wrh5_set_fapl_uring: io_uring is only available on Linux");
+    return 1;
+}
+
+int wrh5_io_stats(wrh5_context_t * p_wrh5_ctx, wrh5_io_stats_t * p_stats) {
+    (void) p_wrh5_ctx;
+    memset(p_stats, 0, sizeof(wrh5_io_stats_t));
+    return 0;
+}
+
+#endif
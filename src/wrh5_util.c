@@ -8,54 +8,111 @@
 #include "wrh5_defs.h"
 
 #define LEN_TIMESTAMP 22
+#define LEN_MESSAGE 1024
+
+static wrh5_log_sink_t log_sink = NULL;     // NULL: stdout (information) and stderr (warnings and errors)
+static void * log_arg = NULL;               // Passed to log_sink
+static int log_min_level = WRH5_LOG_INFO;   // Messages below this level are dropped
 
 
 /***
-    Get a timestamp.
+    Get a timestamp.  localtime and strftime run once per second and thread at most.
 ***/
 void get_timestamp(char * buffer) {
+    static __thread time_t last_time = 0;
+    static __thread char last_stamp[LEN_TIMESTAMP];
     time_t time_t_time;
-    struct tm * tm_struct;
+    struct tm tm_struct;
 
     time(&time_t_time);
-    tm_struct = localtime(&time_t_time);
-    strftime(buffer, LEN_TIMESTAMP, "%Y-%m-%d_%H:%M:%S ", tm_struct);
+    if(time_t_time != last_time) {
+        localtime_r(&time_t_time, &tm_struct);
+        strftime(last_stamp, LEN_TIMESTAMP, "%Y-%m-%d_%H:%M:%S ", &tm_struct);
+        last_time = time_t_time;
+    }
+    strcpy(buffer, last_stamp);
+}
+
+
+/***
+    CPU seconds used so far by the calling thread.
+***/
+double wrh5_thread_cpu_seconds(void) {
+    struct timespec ts;
+
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0.0;
+    return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+
+/***
+	Route the library's messages of min_level and above to sink (NULL: stdout and stderr, with a timestamp).
+	Set once, before the first context is opened.
+***/
+void wrh5_log_set(wrh5_log_sink_t sink, void * p_arg, int min_level) {
+    log_sink = sink;
+    log_arg = p_arg;
+    log_min_level = min_level;
+}
+
+
+/***
+	Hand one formatted message to the sink, or print it with a timestamp.
+***/
+static void log_emit(int level, const char * msg) {
+    char timestamp[LEN_TIMESTAMP];
+
+    if(log_sink != NULL) {
+        log_sink(level, msg, log_arg);
+        return;
+    }
+    get_timestamp(timestamp);
+    fprintf((level == WRH5_LOG_INFO) ? stdout : stderr, "%s%s", timestamp, msg);
 }
 
 
 /***
-	Report information.
+    Report information.
 ***/
 void wrh5_info(const char *format, ...) {
-    char buffer[256];
+    char buffer[LEN_MESSAGE];
     va_list va_array;
-	va_start(va_array, format);
-	get_timestamp(buffer);
-	strcat(buffer, format);
-	vfprintf(stdout, buffer, va_array);
-	va_end(va_array);
+
+    if(log_min_level > WRH5_LOG_INFO)
+        return;
+    va_start(va_array, format);
+    vsnprintf(buffer, sizeof(buffer), format, va_array);
+    va_end(va_array);
+    log_emit(WRH5_LOG_INFO, buffer);
 }
 
 
 /***
-	Report bad news as a warning message.
+    Report bad news as a warning message.
 ***/
 void wrh5_warning(char * srcfile, int linenum, char * msg) {
-    char timestamp[LEN_TIMESTAMP];
-    
-    get_timestamp(timestamp);
-	fprintf(stderr, "%sWRH5-WARNING %s line %d :: %s\n", timestamp, srcfile, linenum, msg);
+    char buffer[LEN_MESSAGE];
+
+    __atomic_fetch_add(&wrh5_metrics_messages[WRH5_LOG_WARNING], 1, __ATOMIC_RELAXED);
+    if(log_min_level > WRH5_LOG_WARNING)
+        return;
+    snprintf(buffer, sizeof(buffer), "WRH5-WARNING %s line %d :: %s\n", srcfile, linenum, msg);
+    log_emit(WRH5_LOG_WARNING, buffer);
 }
 
 
 /***
-	Report bad news as an error message.
+    Report bad news as an error message.
 ***/
 void wrh5_error(char * srcfile, int linenum, char * msg) {
-    char timestamp[LEN_TIMESTAMP];
-    
-    get_timestamp(timestamp);
-	fprintf(stderr, "%sWRH5-ERROR %s line %d :: %s\n", timestamp, srcfile, linenum, msg);
+    char buffer[LEN_MESSAGE];
+
+    __atomic_fetch_add(&wrh5_metrics_messages[WRH5_LOG_ERROR], 1, __ATOMIC_RELAXED);
+    if(log_min_level > WRH5_LOG_ERROR)
+        return;
+    snprintf(buffer, sizeof(buffer), "WRH5-ERROR %s line %d :: %s\n", srcfile, linenum, msg);
+    log_emit(WRH5_LOG_ERROR, buffer);
 }
 
 
@@ -162,6 +219,115 @@ void wrh5_set_dataset_int_attr(hid_t dataset_id, char * tag, int * p_value, int
 }
 
 
+/***
+	Get a file-level or dataset-level attribute as mem_type (numeric types).
+	Return 0 if it exists and was read, else 1.
+***/
+int wrh5_get_attr(hid_t file_or_dataset_id, char * tag, hid_t mem_type, void * p_value) {
+    hid_t  id_attr;
+    herr_t status;
+
+    if(H5Aexists(file_or_dataset_id, tag) <= 0)
+        return 1;
+    id_attr = H5Aopen(file_or_dataset_id, tag, H5P_DEFAULT);
+    if(id_attr < 0)
+        return 1;
+    status = H5Aread(id_attr, mem_type, p_value);
+    H5Aclose(id_attr);
+    return (status < 0) ? 1 : 0;
+}
+
+
+/***
+	Get a file-level or dataset-level string attribute written by wrh5_set_str_attr into p_value[bufsize].
+	Return 0 if it exists and was read, else 1.
+***/
+int wrh5_get_str_attr(hid_t file_or_dataset_id, char * tag, char * p_value, size_t bufsize) {
+    hid_t  id_attr, atype;
+    herr_t status;
+
+    if(H5Aexists(file_or_dataset_id, tag) <= 0)
+        return 1;
+    id_attr = H5Aopen(file_or_dataset_id, tag, H5P_DEFAULT);
+    if(id_attr < 0)
+        return 1;
+    atype = H5Aget_type(id_attr);
+    if(H5Tget_size(atype) >= bufsize) {
+        H5Tclose(atype);
+        H5Aclose(id_attr);
+        return 1;
+    }
+    memset(p_value, 0, bufsize);
+    status = H5Aread(id_attr, atype, p_value);
+    H5Tclose(atype);
+    H5Aclose(id_attr);
+    return (status < 0) ? 1 : 0;
+}
+
+
+/***
+	Create an extensible dataset of rows shaped row_dims[0 .. rank-2], chunked one row at a time
+	(64 rows if rank = 1), each chunk row shaped row_cdims[0 .. rank-2] (NULL: whole rows).
+***/
+hid_t wrh5_create_rows(hid_t file_id, char * name, hid_t type_id, int rank, hsize_t * row_dims, hsize_t * row_cdims) {
+    hsize_t dims[NDIMS], max_dims[NDIMS], cdims[NDIMS];
+    hid_t   space_id, dcpl, dataset_id;
+    int     ix;
+
+    dims[0] = 0;
+    max_dims[0] = H5S_UNLIMITED;
+    cdims[0] = (rank == 1) ? 64 : 1;
+    for(ix = 1; ix < rank; ix++) {
+        dims[ix] = max_dims[ix] = cdims[ix] = row_dims[ix - 1];
+        if(row_cdims != NULL)
+            cdims[ix] = row_cdims[ix - 1];
+    }
+    space_id = H5Screate_simple(rank, dims, max_dims);
+    if(space_id < 0)
+        return -1;
+    dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    if(dcpl < 0 || H5Pset_chunk(dcpl, rank, cdims) < 0) {
+        H5Sclose(space_id);
+        return -1;
+    }
+    dataset_id = H5Dcreate(file_id, name, type_id, space_id, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    H5Pclose(dcpl);
+    H5Sclose(space_id);
+    return dataset_id;
+}
+
+
+/***
+	Append row number irow to an extensible dataset created by wrh5_create_rows.
+***/
+int wrh5_append_row(hid_t dataset_id, hid_t type_id, int rank, hsize_t * row_dims, hsize_t irow, const void * p_row) {
+    hsize_t dims[NDIMS], start[NDIMS], count[NDIMS];
+    hid_t   filespace_id, memspace_id;
+    herr_t  status;
+    int     ix;
+
+    dims[0] = irow + 1;
+    start[0] = irow;
+    count[0] = 1;
+    for(ix = 1; ix < rank; ix++) {
+        dims[ix] = count[ix] = row_dims[ix - 1];
+        start[ix] = 0;
+    }
+    if(H5Dset_extent(dataset_id, dims) < 0)
+        return 1;
+    filespace_id = H5Dget_space(dataset_id);
+    if(filespace_id < 0)
+        return 1;
+    memspace_id = H5Screate_simple(rank, count, NULL);
+    status = H5Sselect_hyperslab(filespace_id, H5S_SELECT_SET, start, NULL, count, NULL);
+    if(status >= 0)
+        status = H5Dwrite(dataset_id, type_id, memspace_id, filespace_id, H5P_DEFAULT, p_row);
+    H5Sclose(memspace_id);
+    H5Sclose(filespace_id);
+    return (status < 0) ? 1 : 0;
+}
+
+
 /***
 	Write metadata to FBH5 file dataset.
 ***/
@@ -231,6 +397,10 @@ void wrh5_show_context(char * caller, wrh5_context_t * p_wrh5_ctx) {
            caller, p_wrh5_ctx->filesz_dims[0], p_wrh5_ctx->filesz_dims[1], p_wrh5_ctx->filesz_dims[2]);
     wrh5_info("wrh5_show_context(%s): byte_count = %ld\n", caller, p_wrh5_ctx->byte_count);
     wrh5_info("wrh5_show_context(%s): dump_count = %ld\n", caller, p_wrh5_ctx->dump_count);
+    if(p_wrh5_ctx->p_pool != NULL)
+        wrh5_info("wrh5_show_context(%s): pool = %d of %d buffers free, bufsize = %ld, hugepages = %d\n",
+               caller, p_wrh5_ctx->p_pool->nfree, p_wrh5_ctx->p_pool->nbufs,
+               (long) p_wrh5_ctx->p_pool->bufsize, p_wrh5_ctx->p_pool->hugepages);
 }
 
 
@@ -285,3 +455,27 @@ void wrh5_blimpy_chunking(wrh5_hdr_t * p_wrh5_hdr, hsize_t * p_cdims) {
         if(p_wrh5_hdr->nchans < 512)
             *(p_cdims + 2) = p_wrh5_hdr->nchans;
 }
+
+
+/***
+    Make the chunk fine channel dimension coarse channel aligned.
+
+    The fine channel dimension is reduced to the largest divisor of nfpc
+    that does not exceed it, so that chunk boundaries always fall on
+    nfpc boundaries and no chunk straddles two coarse channels.
+***/
+void wrh5_cc_align_chunking(wrh5_hdr_t * p_wrh5_hdr, hsize_t * p_cdims) {
+    hsize_t nfpc = (hsize_t) p_wrh5_hdr->nfpc;
+    hsize_t nchan;
+
+    if(nfpc < 1)
+        return;
+    if(*(p_cdims + 2) >= nfpc) {
+        *(p_cdims + 2) = nfpc;
+        return;
+    }
+    for(nchan = *(p_cdims + 2); nchan > 1; nchan--)
+        if(nfpc % nchan == 0)
+            break;
+    *(p_cdims + 2) = nchan;
+}
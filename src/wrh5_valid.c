@@ -0,0 +1,177 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_valid.c                                                                *
+ * ------------                                                                *
+ * Missing time integrations and the "valid" bitmap dataset.                   *
+ *                                                                             *
+ * wrh5_write_missing extends dataset "data" without writing: the chunks stay  *
+ * unallocated and read back as the fill value (0), at no CPU or disk cost.    *
+ * With the elide_fill user option, a written time integration whose bytes are *
+ * all zero (E.g. zero-filled by the producer after packet loss) is also       *
+ * counted as missing, and all-zero whole chunks are not written.              *
+ *                                                                             *
+ * One bit per time integration (1 = real data, 0 = missing), packed 8 per     *
+ * byte with time integration 0 in the least significant bit of byte 0, is     *
+ * kept in memory and written by wrh5_close as the uint8 dataset "valid".      *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define VALID_NAME "valid"
+
+
+/***
+	Are all nbytes bytes at p zero?  1=yes, 0=no.
+***/
+int wrh5_is_fill(const void * p, size_t nbytes) {
+    const unsigned char * p_byte = (const unsigned char *) p;
+    size_t ix = 0;
+
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for(; ix + 64 <= nbytes; ix += 64) {
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *) (p_byte + ix)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *) (p_byte + ix + 16)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *) (p_byte + ix + 32)));
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *) (p_byte + ix + 48)));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF)
+            return 0;
+    }
+#endif
+    for(; ix < nbytes; ix++)
+        if(p_byte[ix] != 0)
+            return 0;
+    return 1;
+}
+
+
+/***
+	Record ntints time integrations starting at tint_start as real (1) or missing (0).
+	If real, elide_fill is set and p_block (on-disk order) is not NULL, an all-zero one is missing.
+***/
+int wrh5_valid_mark(wrh5_context_t * p_wrh5_ctx, hsize_t tint_start, size_t ntints, const void * p_block, int real) {
+    size_t          nbytes_needed = (tint_start + ntints + 7) / 8;
+    size_t          new_size;
+    size_t          disk_tint_size;
+    unsigned char * p_new;
+    hsize_t         itint;
+    size_t          nmissing = 0;   // Time integrations recorded as missing by this call
+    int             is_real;
+
+    if(nbytes_needed > p_wrh5_ctx->valid_size) {
+        new_size = (p_wrh5_ctx->valid_size > 0) ? p_wrh5_ctx->valid_size : 4096;
+        while(new_size < nbytes_needed)
+            new_size *= 2;
+        p_new = realloc(p_wrh5_ctx->p_valid, new_size);
+        if(p_new == NULL) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_valid_mark: realloc of the valid bitmap FAILED");
+            p_wrh5_ctx->usable = 0;
+            return 1;
+        }
+        memset(p_new + p_wrh5_ctx->valid_size, 0, new_size - p_wrh5_ctx->valid_size);
+        p_wrh5_ctx->p_valid = p_new;
+        p_wrh5_ctx->valid_size = new_size;
+    }
+
+    disk_tint_size = p_wrh5_ctx->filesz_dims[1] * p_wrh5_ctx->filesz_dims[2] * H5Tget_size(p_wrh5_ctx->elem_type);
+    for(itint = 0; itint < ntints; itint++) {
+        is_real = real;
+        if(is_real && p_wrh5_ctx->elide_fill && p_block != NULL)
+            is_real = !wrh5_is_fill((const char *) p_block + itint * disk_tint_size, disk_tint_size);
+        if(is_real)
+            p_wrh5_ctx->p_valid[(tint_start + itint) / 8] |= (unsigned char) (1 << ((tint_start + itint) % 8));
+        else {
+            p_wrh5_ctx->p_valid[(tint_start + itint) / 8] &= (unsigned char) ~(1 << ((tint_start + itint) % 8));
+            p_wrh5_ctx->missing_tints += 1;
+            nmissing += 1;
+        }
+    }
+    if(nmissing > 0)
+        wrh5_metrics_missing(p_wrh5_ctx, nmissing);
+    return 0;
+}
+
+
+/***
+	Append missing time integrations (wrh5_write_missing).
+***/
+static int append_missing(wrh5_context_t * p_wrh5_ctx,
+                          size_t ntints,
+                          int debugging) {
+    if(ntints < 1)
+        return 0;
+    if(p_wrh5_ctx->detect != WRH5_DETECT_NONE && p_wrh5_ctx->acc_slot > 0) {
+        // Keep the time order: write what the detection stage holds first.
+        if(wrh5_detect_flush(p_wrh5_ctx, debugging) != 0)
+            return 1;
+    }
+    if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE && wrh5_quant_flush(p_wrh5_ctx, debugging) != 0)
+        return 1;   // The bandpass estimate in progress ends at the gap
+    if(debugging)
+        wrh5_info("wrh5_write_missing: %ld missing time integrations at offset %lld\n",
+                  (long) ntints, p_wrh5_ctx->offset_dims[0]);
+    if(wrh5_extend(p_wrh5_ctx, ntints) != 0)
+        return 1;
+    if(wrh5_valid_mark(p_wrh5_ctx, p_wrh5_ctx->offset_dims[0], ntints, NULL, 0) != 0)
+        return 1;
+    p_wrh5_ctx->offset_dims[0] += ntints;
+    p_wrh5_ctx->usable = 1;
+    return 0;
+}
+
+
+/***
+	Main entry point.
+	Append ntints missing time integrations: nothing is written, and they read back as the fill value.
+***/
+int wrh5_write_missing(wrh5_context_t * p_wrh5_ctx,
+                       wrh5_hdr_t * p_wrh5_hdr,
+                       size_t ntints,
+                       int debugging) {
+    uint64_t    record_t0 = WRH5_RECORD_BEGIN();    // Write-pattern recording (see wrh5_record.c)
+    int         rc;
+
+    (void) p_wrh5_hdr;      // Kept for symmetry with wrh5_write
+    rc = append_missing(p_wrh5_ctx, ntints, debugging);
+    if(record_t0 != 0)
+        wrh5_record_call(p_wrh5_ctx, WRH5_REC_MISSING, record_t0, ntints, NULL, rc);
+    return rc;
+}
+
+
+/***
+	Write the "valid" dataset - called by wrh5_close while the file is still open,
+	if any time integration is missing or elide_fill is set.
+***/
+int wrh5_write_valid(wrh5_context_t * p_wrh5_ctx, int debugging) {
+    hsize_t dims[1];
+    hid_t   space_id, valid_id;
+    herr_t  status = 0;
+    int     ntints = (int) p_wrh5_ctx->offset_dims[0];
+
+    dims[0] = (p_wrh5_ctx->offset_dims[0] + 7) / 8;
+    space_id = H5Screate_simple(1, dims, NULL);
+    if(space_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_valid: H5Screate_simple FAILED");
+        return 1;
+    }
+    valid_id = H5Dcreate(p_wrh5_ctx->file_id, VALID_NAME, H5T_STD_U8LE, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if(valid_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_valid: H5Dcreate FAILED");
+        H5Sclose(space_id);
+        return 1;
+    }
+    if(dims[0] > 0)
+        status = H5Dwrite(valid_id, H5T_NATIVE_UINT8, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_wrh5_ctx->p_valid);
+    if(status < 0)
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_valid: H5Dwrite FAILED");
+    wrh5_set_dataset_int_attr(valid_id, "ntints", &ntints, debugging);
+    H5Dclose(valid_id);
+    H5Sclose(space_id);
+    if(debugging)
+        wrh5_info("wrh5_write_valid: %d time integrations, %ld missing\n", ntints, p_wrh5_ctx->missing_tints);
+    return (status < 0) ? 1 : 0;
+}
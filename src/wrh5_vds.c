@@ -0,0 +1,352 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_vds.c                                                                  *
+ * ----------                                                                  *
+ * Assemble FBH5 part files (one per subband or per compute node) into one     *
+ * master FBH5 file whose dataset "data" is an HDF5 virtual dataset: no data   *
+ * is copied.                                                                  *
+ *                                                                             *
+ * The parts are put in frequency order (fch1 in the direction of foff) and    *
+ * must be adjacent in frequency, with the same nifs, data type, foff and      *
+ * tsamp.  Part k maps into master channels [off_k, off_k + nchans_k) with an  *
+ * unlimited time selection, so the master grows with its parts without being  *
+ * written again; a part shorter than the longest reads as fill (0).           *
+ *                                                                             *
+ * File and "data" attributes are copied from the first part, then merged:     *
+ * fch1 is the first part's, nchans is the sum and nfpc is kept.               *
+ * Each part keeps its other datasets ("valid", "cc_index", ...).              *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+#include <libgen.h>
+#include <math.h>
+#include <limits.h>
+
+/*
+ * What is needed of one part.
+ */
+typedef struct {
+    char *  path;               // As given by the caller
+    char    source[PATH_MAX];   // Source file name recorded in the mapping
+    hsize_t dims[NDIMS];        // Current shape of "data"
+    double  fch1;
+    double  foff;
+    double  tsamp;
+    int     nfpc;
+} vds_part_t;
+
+
+/***
+	Copy one attribute to the object dest_id (H5Aiterate2 callback).
+	Dimension scale bookkeeping attributes are left out: labels are set again.
+***/
+static herr_t copy_attr(hid_t loc_id, const char * name, const H5A_info_t * p_info, void * p_dest) {
+    hid_t   dest_id = *(hid_t *) p_dest;
+    hid_t   attr_id, type_id, space_id, new_id;
+    size_t  nbytes;
+    void *  p_buf;
+    char    msgstr[256];
+
+    (void) p_info;
+    if(strcmp(name, "DIMENSION_LABELS") == 0 || strcmp(name, "DIMENSION_LIST") == 0 || strcmp(name, "REFERENCE_LIST") == 0)
+        return 0;
+    attr_id = H5Aopen(loc_id, name, H5P_DEFAULT);
+    type_id = H5Aget_type(attr_id);
+    space_id = H5Aget_space(attr_id);
+    nbytes = H5Tget_size(type_id) * (size_t) H5Sget_simple_extent_npoints(space_id);
+    p_buf = calloc(nbytes > 0 ? nbytes : 1, 1);
+    new_id = -1;
+    if(p_buf != NULL && H5Aread(attr_id, type_id, p_buf) >= 0) {
+        new_id = H5Acreate2(dest_id, name, type_id, space_id, H5P_DEFAULT, H5P_DEFAULT);
+        if(new_id >= 0 && H5Awrite(new_id, type_id, p_buf) < 0) {
+            H5Aclose(new_id);
+            new_id = -1;
+        }
+        if(H5Tis_variable_str(type_id) > 0 || H5Tdetect_class(type_id, H5T_VLEN) > 0)
+            H5Dvlen_reclaim(type_id, space_id, H5P_DEFAULT, p_buf);
+    }
+    if(new_id < 0) {
+        sprintf(msgstr, "wrh5_vds_create: attribute %.100s not copied", name);
+        wrh5_warning(__FILE__, __LINE__, msgstr);
+    } else
+        H5Aclose(new_id);
+    free(p_buf);
+    H5Sclose(space_id);
+    H5Tclose(type_id);
+    H5Aclose(attr_id);
+    return 0;
+}
+
+
+/***
+	Set the attribute tag of dataset_id to *p_value, replacing it if it exists.
+***/
+static void replace_attr(hid_t dataset_id, char * tag, hid_t mem_type, void * p_value) {
+    hid_t space_id, attr_id;
+
+    if(H5Aexists(dataset_id, tag) > 0)
+        H5Adelete(dataset_id, tag);
+    space_id = H5Screate(H5S_SCALAR);
+    attr_id = H5Acreate2(dataset_id, tag, mem_type, space_id, H5P_DEFAULT, H5P_DEFAULT);
+    if(attr_id < 0 || H5Awrite(attr_id, mem_type, p_value) < 0)
+        wrh5_warning(__FILE__, __LINE__, "wrh5_vds_create: merged attribute not written");
+    if(attr_id >= 0)
+        H5Aclose(attr_id);
+    H5Sclose(space_id);
+}
+
+
+/***
+	Order parts by increasing channel index: decreasing fch1 when foff < 0.
+***/
+static int compare_parts(const void * p_a, const void * p_b) {
+    const vds_part_t * p_pa = (const vds_part_t *) p_a;
+    const vds_part_t * p_pb = (const vds_part_t *) p_b;
+    double diff = (p_pa->fch1 - p_pb->fch1) * p_pa->foff;
+
+    return (diff > 0.0) - (diff < 0.0);
+}
+
+
+/***
+	Read the shape and the frequency attributes of one part; return its "data" type (to be closed) or -1.
+***/
+static hid_t read_part(vds_part_t * p_part) {
+    hid_t   file_id, dataset_id, space_id, type_id = -1;
+    int     rank;
+    char    svalue[81];
+    char    msgstr[512];
+
+    file_id = H5Fopen(p_part->path, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if(file_id < 0) {
+        sprintf(msgstr, "wrh5_vds_create: H5Fopen of part '%.200s' FAILED", p_part->path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return -1;
+    }
+    dataset_id = H5Dopen(file_id, DATASETNAME, H5P_DEFAULT);
+    if(dataset_id < 0) {
+        sprintf(msgstr, "wrh5_vds_create: part '%.200s' has no dataset '%s'", p_part->path, DATASETNAME);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        H5Fclose(file_id);
+        return -1;
+    }
+    space_id = H5Dget_space(dataset_id);
+    rank = H5Sget_simple_extent_ndims(space_id);
+    if(rank == NDIMS)
+        H5Sget_simple_extent_dims(space_id, p_part->dims, NULL);
+    H5Sclose(space_id);
+    p_part->nfpc = 0;
+    wrh5_get_attr(dataset_id, "nfpc", H5T_NATIVE_INT, &p_part->nfpc);
+    if(rank != NDIMS
+       || wrh5_get_attr(dataset_id, "fch1", H5T_NATIVE_DOUBLE, &p_part->fch1) != 0
+       || wrh5_get_attr(dataset_id, "foff", H5T_NATIVE_DOUBLE, &p_part->foff) != 0
+       || wrh5_get_attr(dataset_id, "tsamp", H5T_NATIVE_DOUBLE, &p_part->tsamp) != 0
+       || p_part->foff == 0.0) {
+        sprintf(msgstr, "wrh5_vds_create: part '%.200s' is not an FBH5 file (shape, fch1, foff or tsamp)", p_part->path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+    } else if(wrh5_get_str_attr(dataset_id, "quantize", svalue, sizeof(svalue)) == 0 && strcmp(svalue, "none") != 0) {
+        // Its values are meaningless without its own quant_offset and quant_scale, which the master does not map.
+        sprintf(msgstr, "wrh5_vds_create: part '%.200s' is quantized (%.20s)", p_part->path, svalue);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+    } else
+        type_id = H5Dget_type(dataset_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    return type_id;
+}
+
+
+/***
+	Record the part file name as the master will find it: the base name if both are in the same directory
+	(HDF5 then looks next to the master file), else the absolute path.
+***/
+static int source_name(vds_part_t * p_part, char * master_dir) {
+    char   part_dir[PATH_MAX], work[PATH_MAX];
+    char * p_base;
+
+    if(strlen(p_part->path) >= PATH_MAX)
+        return 1;
+    strcpy(work, p_part->path);
+    if(realpath(dirname(work), part_dir) == NULL)
+        return 1;
+    strcpy(work, p_part->path);
+    p_base = basename(work);
+    if(strcmp(part_dir, master_dir) == 0)
+        strcpy(p_part->source, p_base);
+    else if(strlen(part_dir) + strlen(p_base) + 2 > PATH_MAX)
+        return 1;
+    else {
+        strcpy(p_part->source, part_dir);
+        strcat(p_part->source, "/");
+        strcat(p_part->source, p_base);
+    }
+    return 0;
+}
+
+
+/***
+	Create master_path (replaced if it exists) with dataset "data" mapping the nparts FBH5 files part_paths.
+***/
+int wrh5_vds_create(char * master_path, char ** part_paths, int nparts, int debugging) {
+    vds_part_t * p_parts;
+    hid_t   type_id, part_type_id, file_id = -1, dataset_id = -1, dcpl = -1, vspace_id = -1, sspace_id = -1;
+    hid_t   part_file_id, part_dataset_id;
+    hsize_t dims[NDIMS], max_dims[NDIMS], start[NDIMS], count[NDIMS], block[NDIMS];
+    double  next_fch1;
+    char    master_dir[PATH_MAX], work[PATH_MAX];
+    char    msgstr[512];
+    int     kk, nchans, rc = 1;
+
+    if(nparts < 1 || part_paths == NULL || strlen(master_path) >= PATH_MAX) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_vds_create: need at least one part and a shorter master path");
+        return 1;
+    }
+    strcpy(work, master_path);
+    if(realpath(dirname(work), master_dir) == NULL) {
+        sprintf(msgstr, "wrh5_vds_create: the directory of '%.200s' does not exist", master_path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        return 1;
+    }
+    p_parts = calloc(nparts, sizeof(vds_part_t));
+    if(p_parts == NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_vds_create: calloc FAILED");
+        return 1;
+    }
+
+    /*
+     * Read every part and check that they fit together.
+     */
+    type_id = -1;
+    for(kk = 0; kk < nparts; kk++) {
+        p_parts[kk].path = part_paths[kk];
+        part_type_id = read_part(&p_parts[kk]);
+        if(part_type_id < 0)
+            goto done;
+        if(source_name(&p_parts[kk], master_dir) != 0) {
+            sprintf(msgstr, "wrh5_vds_create: cannot resolve the directory of part '%.200s'", p_parts[kk].path);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            H5Tclose(part_type_id);
+            goto done;
+        }
+        if(type_id < 0) {
+            type_id = part_type_id;
+            continue;
+        }
+        if(H5Tequal(type_id, part_type_id) <= 0 || p_parts[kk].dims[1] != p_parts[0].dims[1]
+           || p_parts[kk].foff != p_parts[0].foff || p_parts[kk].tsamp != p_parts[0].tsamp) {
+            sprintf(msgstr, "wrh5_vds_create: part '%.150s' differs from '%.150s' in data type, nifs, foff or tsamp",
+                    p_parts[kk].path, p_parts[0].path);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            H5Tclose(part_type_id);
+            goto done;
+        }
+        H5Tclose(part_type_id);
+    }
+    qsort(p_parts, nparts, sizeof(vds_part_t), compare_parts);
+    dims[0] = 0;
+    nchans = 0;
+    for(kk = 0; kk < nparts; kk++) {
+        if(kk > 0) {
+            next_fch1 = p_parts[kk - 1].fch1 + p_parts[kk - 1].dims[2] * p_parts[kk - 1].foff;
+            if(fabs(p_parts[kk].fch1 - next_fch1) > 0.5 * fabs(p_parts[0].foff)) {
+                sprintf(msgstr, "wrh5_vds_create: part '%.150s' (fch1 %.9f) does not follow '%.150s' (expected fch1 %.9f)",
+                        p_parts[kk].path, p_parts[kk].fch1, p_parts[kk - 1].path, next_fch1);
+                wrh5_error(__FILE__, __LINE__, msgstr);
+                goto done;
+            }
+            if(p_parts[kk].nfpc != p_parts[0].nfpc) {
+                sprintf(msgstr, "wrh5_vds_create: part '%.200s' nfpc %d differs, %d is kept",
+                        p_parts[kk].path, p_parts[kk].nfpc, p_parts[0].nfpc);
+                wrh5_warning(__FILE__, __LINE__, msgstr);
+            }
+        }
+        if(p_parts[kk].dims[0] > dims[0])
+            dims[0] = p_parts[kk].dims[0];
+        nchans += (int) p_parts[kk].dims[2];
+    }
+    dims[1] = p_parts[0].dims[1];
+    dims[2] = nchans;
+    max_dims[0] = H5S_UNLIMITED;
+    max_dims[1] = dims[1];
+    max_dims[2] = dims[2];
+
+    /*
+     * One mapping per part: [0, unlimited) x all IFs x its channel range.
+     */
+    dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    vspace_id = H5Screate_simple(NDIMS, dims, max_dims);
+    count[0] = count[1] = count[2] = 1;
+    start[0] = start[1] = 0;
+    start[2] = 0;
+    for(kk = 0; kk < nparts; kk++) {
+        block[0] = H5S_UNLIMITED;
+        block[1] = dims[1];
+        block[2] = p_parts[kk].dims[2];
+        max_dims[2] = p_parts[kk].dims[2];
+        sspace_id = H5Screate_simple(NDIMS, p_parts[kk].dims, max_dims);
+        if(H5Sselect_hyperslab(vspace_id, H5S_SELECT_SET, start, NULL, count, block) < 0
+           || H5Sselect_hyperslab(sspace_id, H5S_SELECT_SET, (hsize_t[NDIMS]) {0, 0, 0}, NULL, count, block) < 0
+           || H5Pset_virtual(dcpl, vspace_id, p_parts[kk].source, DATASETNAME, sspace_id) < 0) {
+            sprintf(msgstr, "wrh5_vds_create: mapping of part '%.200s' FAILED", p_parts[kk].path);
+            wrh5_error(__FILE__, __LINE__, msgstr);
+            goto done;
+        }
+        H5Sclose(sspace_id);
+        sspace_id = -1;
+        if(debugging)
+            wrh5_info("wrh5_vds_create: %s --> channels %llu to %llu, %llu time integrations\n", p_parts[kk].source,
+                      (unsigned long long) start[2], (unsigned long long) (start[2] + block[2] - 1),
+                      (unsigned long long) p_parts[kk].dims[0]);
+        start[2] += block[2];
+    }
+    H5Sselect_all(vspace_id);
+
+    /*
+     * Create the master and copy the attributes of the first part.
+     */
+    file_id = H5Fcreate(master_path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if(file_id < 0) {
+        sprintf(msgstr, "wrh5_vds_create: H5Fcreate of '%.200s' FAILED", master_path);
+        wrh5_error(__FILE__, __LINE__, msgstr);
+        goto done;
+    }
+    dataset_id = H5Dcreate(file_id, DATASETNAME, type_id, vspace_id, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    if(dataset_id < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_vds_create: H5Dcreate of the virtual dataset 'data' FAILED");
+        goto done;
+    }
+    part_file_id = H5Fopen(p_parts[0].path, H5F_ACC_RDONLY, H5P_DEFAULT);
+    part_dataset_id = H5Dopen(part_file_id, DATASETNAME, H5P_DEFAULT);
+    H5Aiterate2(part_file_id, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, copy_attr, &file_id);
+    H5Aiterate2(part_dataset_id, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, copy_attr, &dataset_id);
+    H5Dclose(part_dataset_id);
+    H5Fclose(part_file_id);
+    replace_attr(dataset_id, "fch1", H5T_NATIVE_DOUBLE, &p_parts[0].fch1);
+    replace_attr(dataset_id, "nchans", H5T_NATIVE_INT, &nchans);
+    kk = nparts;
+    replace_attr(dataset_id, "vds_nparts", H5T_NATIVE_INT, &kk);
+    if(H5DSset_label(dataset_id, 0, "time") < 0 || H5DSset_label(dataset_id, 1, "feed_id") < 0
+       || H5DSset_label(dataset_id, 2, "frequency") < 0)
+        wrh5_warning(__FILE__, __LINE__, "wrh5_vds_create: H5DSset_label FAILED");
+    if(debugging)
+        wrh5_info("wrh5_vds_create: %s: %d parts, %d channels, fch1 %.9f\n", master_path, nparts, nchans, p_parts[0].fch1);
+    rc = 0;
+
+done:
+    if(dataset_id >= 0)
+        H5Dclose(dataset_id);
+    if(file_id >= 0 && H5Fclose(file_id) < 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_vds_create: H5Fclose FAILED");
+        rc = 1;
+    }
+    if(sspace_id >= 0)
+        H5Sclose(sspace_id);
+    if(vspace_id >= 0)
+        H5Sclose(vspace_id);
+    if(dcpl >= 0)
+        H5Pclose(dcpl);
+    if(type_id >= 0)
+        H5Tclose(type_id);
+    free(p_parts);
+    return rc;
+}
@@ -3,5 +3,5 @@
  * --------------                                                              *
  * Global Definitions       .                                                  *
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
-#define VERSION_WRH5 "1.0"
+#define VERSION_WRH5 "2.0"
 
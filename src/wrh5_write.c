@@ -13,27 +13,24 @@
 
 #include "wrh5_defs.h"
 
+
 /***
-	Main entry point.
+	Extend dataset "data" in the time dimension by ntints time integrations.
 ***/
-int wrh5_write(wrh5_context_t * p_wrh5_ctx, 
-               wrh5_hdr_t * p_wrh5_hdr, void * p_buffer, 
-               size_t bufsize, 
-               int debugging) {
+int wrh5_extend(wrh5_context_t * p_wrh5_ctx, size_t ntints) {
     herr_t      status;          // Status from HDF5 function call
-    size_t      ntints;          // Number of time integrations in the current dump
-    hid_t       filespace_id;    // Identifier for a copy of the dataspace 
-    hsize_t     selection[3];    // Current selection
-    clock_t     clock_1;         // Debug time measurement
-    double      cpu_time_used;   // Debug time measurement
+    uint64_t    trace_t0;        // Trace start (see wrh5_trace.c)
 
     /*
-     * Initialise write loop.
+     * Contiguous layout: the extent is fixed at open.
      */
-    if(debugging)
-        wrh5_show_context("wrh5_write", p_wrh5_ctx);
-    ntints = bufsize / p_wrh5_ctx->tint_size;  // Compute the number of time integrations in the current dump.
-    p_wrh5_ctx->dump_count += 1;               // Bump the dump count.
+    if(p_wrh5_ctx->p_map != NULL) {
+        if(p_wrh5_ctx->offset_dims[0] + ntints <= p_wrh5_ctx->filesz_dims[0])
+            return 0;
+        wrh5_error(__FILE__, __LINE__, "wrh5_extend: more time integrations than contiguous_tints");
+        p_wrh5_ctx->usable = 0;
+        return 1;
+    }
 
     /*
      * Bump the count of time integrations.
@@ -47,50 +44,50 @@ int wrh5_write(wrh5_context_t * p_wrh5_ctx,
     else
         p_wrh5_ctx->filesz_dims[0] += (ntints - 1);
 
-    /*
-     * Define the current slab selection in terms of its shape.
-     */
-    selection[0] = ntints;
-    selection[1] = p_wrh5_hdr->nifs;
-    selection[2] = p_wrh5_hdr->nchans;
-
-    if(debugging) {
-        wrh5_info("wrh5_write: dump %ld, offset=(%lld, %lld, %lld), selection=(%lld, %lld, %lld), filesize=(%lld, %lld, %lld)\n",
-               p_wrh5_ctx->dump_count,
-               p_wrh5_ctx->offset_dims[0], 
-               p_wrh5_ctx->offset_dims[1], 
-               p_wrh5_ctx->offset_dims[2],
-               selection[0], 
-               selection[1], 
-               selection[2],
-               p_wrh5_ctx->filesz_dims[0], 
-               p_wrh5_ctx->filesz_dims[1], 
-               p_wrh5_ctx->filesz_dims[2]);
-        clock_1 = clock();
-     }
-
     /*
      * Extend dataset.
      */
+    trace_t0 = WRH5_TRACE_BEGIN();
     status = H5Dset_extent(p_wrh5_ctx->dataset_id,    // Dataset handle
                            p_wrh5_ctx->filesz_dims);  // New dataset shape
+    WRH5_TRACE_END(trace_t0, "H5Dset_extent", ntints);
     if(status < 0) {
-        wrh5_error(__FILE__, __LINE__, "wrh5_write: H5Dset_extent/dataset_id FAILED");
-        wrh5_show_context("wrh5_write", p_wrh5_ctx);
+        wrh5_error(__FILE__, __LINE__, "wrh5_extend: H5Dset_extent/dataset_id FAILED");
+        wrh5_show_context("wrh5_extend", p_wrh5_ctx);
         p_wrh5_ctx->usable = 0;
         return 1;
     }
+    return 0;
+}
+
+
+/***
+	Write one hyperslab of dataset "data" from a contiguous memory buffer.
+	p_start : file offset dimensions (time, IF, fine channel)
+	p_count : hyperslab shape, which is also the shape of the memory buffer
+***/
+int wrh5_write_hyperslab(wrh5_context_t * p_wrh5_ctx, hsize_t * p_start, hsize_t * p_count, const void * p_buffer) {
+    herr_t      status;          // Status from HDF5 function call
+    hid_t       filespace_id;    // Identifier for a copy of the dataspace 
+    uint64_t    trace_t0 = WRH5_TRACE_BEGIN();  // Trace start (see wrh5_trace.c)
+
+    if(p_wrh5_ctx->p_map != NULL) {
+        if(wrh5_mmap_copy(p_wrh5_ctx, p_start, p_count, p_buffer) != 0)
+            return 1;
+        WRH5_TRACE_END(trace_t0, "mmap_copy", p_count[0] * p_count[1] * p_count[2] * H5Tget_size(p_wrh5_ctx->elem_type));
+        return 0;
+    }
 
     /*
-     * Reset dataspace extent to match current slab selection.
+     * Reset dataspace extent to match the hyperslab selection.
      */
     status = H5Sset_extent_simple(p_wrh5_ctx->dataspace_id, // Dataspace handle
                                   NDIMS,                    // Repeat rank from previous API calls
-                                  selection,                // New dataspace size shape
+                                  p_count,                  // New dataspace size shape
                                   p_wrh5_ctx->filesz_dims); // Max dataspace dimensions
     if(status < 0) {
-        wrh5_error(__FILE__, __LINE__, "wrh5_write: H5Dset_extent/dataset_id FAILED");
-        wrh5_show_context("wrh5_write", p_wrh5_ctx);
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_hyperslab: H5Sset_extent_simple/dataspace_id FAILED");
+        wrh5_show_context("wrh5_write_hyperslab", p_wrh5_ctx);
         p_wrh5_ctx->usable = 0;
         return 1;
     }
@@ -100,8 +97,8 @@ int wrh5_write(wrh5_context_t * p_wrh5_ctx,
      */
     filespace_id = H5Dget_space(p_wrh5_ctx->dataset_id);    // Dataset handle
     if(filespace_id < 0) {
-        wrh5_error(__FILE__, __LINE__, "wrh5_write: H5Dget_space FAILED");
-        wrh5_show_context("wrh5_write", p_wrh5_ctx);
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_hyperslab: H5Dget_space FAILED");
+        wrh5_show_context("wrh5_write_hyperslab", p_wrh5_ctx);
         p_wrh5_ctx->usable = 0;
         return 1;
     }
@@ -111,19 +108,20 @@ int wrh5_write(wrh5_context_t * p_wrh5_ctx,
      */
     status = H5Sselect_hyperslab(filespace_id,              // Filespace handle
                                  H5S_SELECT_SET,            // Replace preexisting selection
-                                 p_wrh5_ctx->offset_dims,   // Starting offset dimensions of first element
+                                 p_start,                   // Starting offset dimensions of first element
                                  NULL,                      // Not "striding"
-                                 selection,                 // Selection dimensions
+                                 p_count,                   // Selection dimensions
                                  NULL);                     // Block parameter : default value
     if(status < 0) {
-        wrh5_error(__FILE__, __LINE__, "wrh5_write: H5Sselect_hyperslab/filespace FAILED");
-        wrh5_show_context("wrh5_write", p_wrh5_ctx);
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_hyperslab: H5Sselect_hyperslab/filespace FAILED");
+        wrh5_show_context("wrh5_write_hyperslab", p_wrh5_ctx);
+        H5Sclose(filespace_id);
         p_wrh5_ctx->usable = 0;
         return 1;
     }
 
     /*
-     * Write out current time integration to the hyperslab.
+     * Write out the buffer to the hyperslab.
      */
     status = H5Dwrite(p_wrh5_ctx->dataset_id,   // Dataset handle
                       p_wrh5_ctx->elem_type,    // HDF5 element type
@@ -132,27 +130,124 @@ int wrh5_write(wrh5_context_t * p_wrh5_ctx,
                       H5P_DEFAULT,              // Default data transfer properties
                       p_buffer);                // Buffer holding the data
     if(status < 0) {
-        wrh5_error(__FILE__, __LINE__, "wrh5_write: H5Dwrite FAILED");
-        wrh5_show_context("wrh5_write", p_wrh5_ctx);
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_hyperslab: H5Dwrite FAILED");
+        wrh5_show_context("wrh5_write_hyperslab", p_wrh5_ctx);
+        H5Sclose(filespace_id);
         p_wrh5_ctx->usable = 0;
         return 1;
     }
 
-    /*
-     * Point ahead for the next call to wrh5_write.
-     */
-    p_wrh5_ctx->offset_dims[0] += ntints;
-
     /*
      * Close temporary filespace handle.
      */
     status = H5Sclose(filespace_id);
     if(status < 0) {
-        wrh5_error(__FILE__, __LINE__, "wrh5_close H5Sclose/filespace_id FAILED\n");
-        wrh5_show_context("wrh5_write", p_wrh5_ctx);
+        wrh5_error(__FILE__, __LINE__, "wrh5_write_hyperslab: H5Sclose/filespace_id FAILED\n");
+        wrh5_show_context("wrh5_write_hyperslab", p_wrh5_ctx);
         p_wrh5_ctx->usable = 0;
         return 1;
     }
+    WRH5_TRACE_END(trace_t0, "H5Dwrite", p_count[0] * p_count[1] * p_count[2] * H5Tget_size(p_wrh5_ctx->elem_type));
+    return 0;
+}
+
+
+/***
+	Write one dump (wrh5_write).
+***/
+static int write_dump(wrh5_context_t * p_wrh5_ctx, 
+                      wrh5_hdr_t * p_wrh5_hdr, void * p_buffer, 
+                      size_t bufsize, 
+                      int debugging) {
+    size_t      ntints;          // Number of time integrations in the current dump
+    size_t      done;            // Number of time integrations staged so far
+    hsize_t     selection[3];    // Current selection
+    hsize_t     start[3] = {0, 0, 0};   // Current staging load offset
+    clock_t     clock_1 = 0;     // Debug time measurement
+    double      cpu_time_used;   // Debug time measurement
+    uint64_t    trace_t0 = WRH5_TRACE_BEGIN();  // Trace start (see wrh5_trace.c)
+
+    /*
+     * Initialise write loop.
+     */
+    if(p_wrh5_ctx->detect != WRH5_DETECT_NONE) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_write: the context has a detection stage; use wrh5_write_detect");
+        return 1;
+    }
+    if(debugging)
+        wrh5_show_context("wrh5_write", p_wrh5_ctx);
+    ntints = bufsize / p_wrh5_ctx->in_tint_size;   // Compute the number of time integrations in the current dump.
+    p_wrh5_ctx->dump_count += 1;               // Bump the dump count.
+
+    /*
+     * Extend the dataset to hold the current dump.
+     */
+    if(wrh5_extend(p_wrh5_ctx, ntints) != 0)
+        return 1;
+
+    /*
+     * Define the current slab selection in terms of its shape.
+     */
+    selection[0] = ntints;
+    selection[1] = p_wrh5_hdr->nifs;
+    selection[2] = p_wrh5_ctx->filesz_dims[2];    // Stored channels (see wrh5_chans.c)
+
+    if(debugging) {
+        wrh5_info("wrh5_write: dump %ld, offset=(%lld, %lld, %lld), selection=(%lld, %lld, %lld), filesize=(%lld, %lld, %lld)\n",
+               p_wrh5_ctx->dump_count,
+               p_wrh5_ctx->offset_dims[0], 
+               p_wrh5_ctx->offset_dims[1], 
+               p_wrh5_ctx->offset_dims[2],
+               selection[0], 
+               selection[1], 
+               selection[2],
+               p_wrh5_ctx->filesz_dims[0], 
+               p_wrh5_ctx->filesz_dims[1], 
+               p_wrh5_ctx->filesz_dims[2]);
+        clock_1 = clock();
+     }
+
+    /*
+     * Write out current time integrations to the hyperslab.
+     * If the context stages its data, go through the staging buffer, one staging load at a time.
+     */
+    if(p_wrh5_ctx->p_staging == NULL) {
+        if(p_wrh5_ctx->sk_m > 0)
+            if(wrh5_sk_update(p_wrh5_ctx, p_buffer, p_wrh5_ctx->offset_dims[0], ntints, debugging) != 0) {
+                p_wrh5_ctx->usable = 0;
+                return 1;
+            }
+        if(wrh5_write_block(p_wrh5_ctx, p_wrh5_ctx->offset_dims[0], ntints, p_buffer, debugging) != 0)
+            return 1;
+    } else {
+        for(done = 0; done < ntints; done += selection[0]) {
+            selection[0] = ntints - done;
+            if(selection[0] > p_wrh5_ctx->staging_tints)
+                selection[0] = p_wrh5_ctx->staging_tints;
+            if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE)
+                selection[0] = wrh5_quant_span(p_wrh5_ctx, p_wrh5_ctx->offset_dims[0] + done, selection[0]);
+            wrh5_stage(p_wrh5_ctx, p_wrh5_hdr, p_buffer, ntints, done, selection[0], p_wrh5_ctx->p_staging);
+            start[0] = p_wrh5_ctx->offset_dims[0] + done;
+            if(p_wrh5_ctx->sk_m > 0)
+                if(wrh5_sk_update(p_wrh5_ctx, p_wrh5_ctx->p_staging, start[0], selection[0], debugging) != 0) {
+                    p_wrh5_ctx->usable = 0;
+                    return 1;
+                }
+            if(p_wrh5_ctx->quantize != WRH5_QUANT_NONE) {
+                // Quantized and written, or held back until the bandpass estimate is complete.
+                if(wrh5_quantize(p_wrh5_ctx, p_wrh5_ctx->p_staging, start[0], selection[0], debugging) != 0) {
+                    p_wrh5_ctx->usable = 0;
+                    return 1;
+                }
+            } else if(wrh5_write_block(p_wrh5_ctx, start[0], selection[0], p_wrh5_ctx->p_staging, debugging) != 0)
+                return 1;
+        }
+    }
+
+    /*
+     * Point ahead for the next call to wrh5_write.
+     */
+    p_wrh5_ctx->offset_dims[0] += ntints;
     if(debugging) {
         cpu_time_used = ((double) (clock() - clock_1)) / CLOCKS_PER_SEC;
         wrh5_info("wrh5_write: dump %ld E.T. = %.3f s\n", p_wrh5_ctx->dump_count, cpu_time_used);
@@ -163,9 +258,54 @@ int wrh5_write(wrh5_context_t * p_wrh5_ctx,
      */
     p_wrh5_ctx->byte_count += bufsize;
     p_wrh5_ctx->usable = 1;
+    WRH5_TRACE_END(trace_t0, "wrh5_write", ntints);
 
     /*
      * Bye-bye.
      */
     return 0;
 }
+
+
+/***
+	Main entry point.
+***/
+int wrh5_write(wrh5_context_t * p_wrh5_ctx, 
+               wrh5_hdr_t * p_wrh5_hdr, void * p_buffer, 
+               size_t bufsize, 
+               int debugging) {
+    uint64_t    metrics_t0 = wrh5_metrics_begin(p_wrh5_ctx);     // Live metrics (see wrh5_metrics.c)
+    uint64_t    record_t0 = WRH5_RECORD_BEGIN();                // Write-pattern recording (see wrh5_record.c)
+    int         rc;
+
+    rc = write_dump(p_wrh5_ctx, p_wrh5_hdr, p_buffer, bufsize, debugging);
+    wrh5_metrics_end(p_wrh5_ctx, metrics_t0, bufsize / p_wrh5_ctx->in_tint_size, bufsize, rc);
+    if(record_t0 != 0)
+        wrh5_record_call(p_wrh5_ctx, WRH5_REC_WRITE, record_t0, bufsize, p_buffer, rc);
+    return rc;
+}
+
+
+/***
+	Write a buffer obtained from the context's pool (wrh5_pool_get) without copying it,
+	then return the buffer to the pool - whether or not the write succeeded.
+***/
+int wrh5_submit(wrh5_context_t * p_wrh5_ctx, 
+                wrh5_hdr_t * p_wrh5_hdr, void * pool_buffer, 
+                size_t bufsize, 
+                int debugging) {
+    int rc;
+
+    if(!wrh5_pool_owns(p_wrh5_ctx->p_pool, pool_buffer)) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_submit: buffer was not obtained from the context's pool");
+        return 1;
+    }
+    if(bufsize > p_wrh5_ctx->p_pool->bufsize) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_submit: bufsize exceeds the pool buffer size");
+        wrh5_pool_put(p_wrh5_ctx->p_pool, pool_buffer);
+        return 1;
+    }
+    rc = wrh5_write(p_wrh5_ctx, p_wrh5_hdr, pool_buffer, bufsize, debugging);
+    wrh5_pool_put(p_wrh5_ctx->p_pool, pool_buffer);
+    return rc;
+}
@@ -0,0 +1,198 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_writev.c                                                               *
+ * -------------                                                               *
+ * Write a Filterbank HDF5 dump held in several caller buffers (segments).     *
+ *                                                                             *
+ * Either every segment holds whole time integrations (WRH5_ROLE_TINTS),       *
+ * appended in segment order, or every segment holds the time integrations of  *
+ * one IF (role = IF index), appended in segment order per IF.  In the second  *
+ * case, every IF must receive the same number of time integrations.           *
+ *                                                                             *
+ * The dataset is extended once; each segment is then written straight from   *
+ * the caller's memory to its own hyperslab, so no gather copy is made.        *
+ * Whole time integration segments go through wrh5_write_block, as the data of *
+ * wrh5_write does (compression bypass, elide_fill); IF segments do not hold   *
+ * whole chunks, so they are refused with those options.                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "wrh5_defs.h"
+
+
+/***
+	Write one dump held in segments (wrh5_writev).
+***/
+static int writev_dump(wrh5_context_t * p_wrh5_ctx,
+                       wrh5_hdr_t * p_wrh5_hdr,
+                       const wrh5_iovec_t * p_iov,
+                       int iovcnt,
+                       int debugging) {
+    size_t      ntints = 0;         // Number of time integrations in the current dump
+    size_t      if_ntints[4];       // Time integrations per IF (IF segments)
+    hsize_t     start[NDIMS];       // Hyperslab offset of the current segment
+    hsize_t     count[NDIMS];       // Hyperslab shape of the current segment
+    size_t      if_size;            // Byte size of one time integration of one IF
+    size_t      bufsize = 0;        // Total bytes presented
+    size_t      seg_ntints;         // Time integrations in the current segment
+    int         by_if;              // 1 : IF segments; 0 : whole time integration segments
+    int         ix, jx;             // Loop controls
+    char        msgstr[256];        // sprintf target
+    uint64_t    trace_t0 = WRH5_TRACE_BEGIN();  // Trace start (see wrh5_trace.c)
+
+    /*
+     * Validate the segments and count the time integrations.
+     */
+    if(p_wrh5_ctx->p_staging != NULL) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_writev: not available when the context stages its data (E.g. input_layout)");
+        return 1;
+    }
+    if(iovcnt < 1) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_writev: no segments presented");
+        return 1;
+    }
+    if_size = p_wrh5_ctx->tint_size / p_wrh5_hdr->nifs;
+    memset(if_ntints, 0, sizeof(if_ntints));
+    by_if = (p_iov[0].role != WRH5_ROLE_TINTS);
+    if(by_if && p_wrh5_ctx->sk_m > 0) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_writev: IF segments are not available with the spectral kurtosis mask");
+        return 1;
+    }
+    if(by_if && (p_wrh5_ctx->bypass_min_ratio > 0.0 || p_wrh5_ctx->elide_fill)) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_writev: IF segments are not available with bypass_min_ratio or elide_fill");
+        return 1;
+    }
+    for(ix = 0; ix < iovcnt; ix++) {
+        if((p_iov[ix].role != WRH5_ROLE_TINTS) != by_if) {
+            wrh5_error(__FILE__, __LINE__, "wrh5_writev: whole time integration and IF segments cannot be mixed");
+            return 1;
+        }
+        if(by_if) {
+            if(p_iov[ix].role < 0 || p_iov[ix].role >= p_wrh5_hdr->nifs) {
+                sprintf(msgstr, "wrh5_writev: segment %d role must be in [0, %d) but I saw %d",
+                        ix, p_wrh5_hdr->nifs, p_iov[ix].role);
+                wrh5_error(__FILE__, __LINE__, msgstr);
+                return 1;
+            }
+            if(p_iov[ix].len % if_size != 0) {
+                sprintf(msgstr, "wrh5_writev: segment %d length %ld is not a multiple of %ld",
+                        ix, (long) p_iov[ix].len, (long) if_size);
+                wrh5_error(__FILE__, __LINE__, msgstr);
+                return 1;
+            }
+            if_ntints[p_iov[ix].role] += p_iov[ix].len / if_size;
+        } else {
+            if(p_iov[ix].len % p_wrh5_ctx->tint_size != 0) {
+                sprintf(msgstr, "wrh5_writev: segment %d length %ld is not a multiple of %ld",
+                        ix, (long) p_iov[ix].len, (long) p_wrh5_ctx->tint_size);
+                wrh5_error(__FILE__, __LINE__, msgstr);
+                return 1;
+            }
+            ntints += p_iov[ix].len / p_wrh5_ctx->tint_size;
+        }
+        bufsize += p_iov[ix].len;
+    }
+    if(by_if) {
+        ntints = if_ntints[0];
+        for(jx = 1; jx < p_wrh5_hdr->nifs; jx++)
+            if(if_ntints[jx] != ntints) {
+                sprintf(msgstr, "wrh5_writev: IF %d has %ld time integrations but IF 0 has %ld",
+                        jx, (long) if_ntints[jx], (long) ntints);
+                wrh5_error(__FILE__, __LINE__, msgstr);
+                return 1;
+            }
+    }
+    if(ntints < 1) {
+        wrh5_error(__FILE__, __LINE__, "wrh5_writev: segments hold no time integration");
+        return 1;
+    }
+
+    /*
+     * Extend the dataset once for the whole dump.
+     */
+    if(debugging)
+        wrh5_show_context("wrh5_writev", p_wrh5_ctx);
+    p_wrh5_ctx->dump_count += 1;
+    if(wrh5_extend(p_wrh5_ctx, ntints) != 0)
+        return 1;
+    if(debugging)
+        wrh5_info("wrh5_writev: dump %ld, %d segments, %ld time integrations at offset %lld\n",
+                  p_wrh5_ctx->dump_count, iovcnt, (long) ntints, p_wrh5_ctx->offset_dims[0]);
+
+    if(by_if)
+        if(wrh5_valid_mark(p_wrh5_ctx, p_wrh5_ctx->offset_dims[0], ntints, NULL, 1) != 0)
+            return 1;
+
+    /*
+     * Write each segment to its own hyperslab.
+     */
+    memset(if_ntints, 0, sizeof(if_ntints));
+    seg_ntints = 0;
+    for(ix = 0; ix < iovcnt; ix++) {
+        if(by_if) {
+            jx = p_iov[ix].role;
+            start[0] = p_wrh5_ctx->offset_dims[0] + if_ntints[jx];
+            start[1] = jx;
+            count[0] = p_iov[ix].len / if_size;
+            count[1] = 1;
+            if_ntints[jx] += count[0];
+        } else {
+            start[0] = p_wrh5_ctx->offset_dims[0] + seg_ntints;
+            count[0] = p_iov[ix].len / p_wrh5_ctx->tint_size;
+            seg_ntints += count[0];
+            if(count[0] == 0)
+                continue;
+            if(p_wrh5_ctx->sk_m > 0)
+                if(wrh5_sk_update(p_wrh5_ctx, p_iov[ix].base, start[0], count[0], debugging) != 0)
+                    return 1;
+            if(wrh5_write_block(p_wrh5_ctx, start[0], count[0], p_iov[ix].base, debugging) != 0)
+                return 1;
+            continue;
+        }
+        start[2] = 0;
+        count[2] = p_wrh5_hdr->nchans;
+        if(count[0] == 0)
+            continue;
+        if(wrh5_write_hyperslab(p_wrh5_ctx, start, count, p_iov[ix].base) != 0)
+            return 1;
+    }
+
+    /*
+     * Point ahead for the next call, bump counters, mark context active.
+     */
+    p_wrh5_ctx->offset_dims[0] += ntints;
+    p_wrh5_ctx->byte_count += bufsize;
+    p_wrh5_ctx->usable = 1;
+    WRH5_TRACE_END(trace_t0, "wrh5_writev", ntints);
+
+    /*
+     * Bye-bye.
+     */
+    return 0;
+}
+
+
+/***
+	Main entry point.
+***/
+int wrh5_writev(wrh5_context_t * p_wrh5_ctx,
+                wrh5_hdr_t * p_wrh5_hdr,
+                const wrh5_iovec_t * p_iov,
+                int iovcnt,
+                int debugging) {
+    uint64_t        metrics_t0 = wrh5_metrics_begin(p_wrh5_ctx);     // Live metrics (see wrh5_metrics.c)
+    hsize_t         tints_before = p_wrh5_ctx->offset_dims[0];
+    unsigned long   bytes_before = p_wrh5_ctx->byte_count;
+    uint64_t        record_t0 = WRH5_RECORD_BEGIN();                // Write-pattern recording (see wrh5_record.c)
+    size_t          bufsize = 0;
+    int             ix, rc;
+
+    rc = writev_dump(p_wrh5_ctx, p_wrh5_hdr, p_iov, iovcnt, debugging);
+    wrh5_metrics_end(p_wrh5_ctx, metrics_t0, p_wrh5_ctx->offset_dims[0] - tints_before,
+                     p_wrh5_ctx->byte_count - bytes_before, rc);
+    if(record_t0 != 0) {
+        for(ix = 0; ix < iovcnt; ix++)
+            bufsize += p_iov[ix].len;
+        wrh5_record_call(p_wrh5_ctx, WRH5_REC_WRITEV, record_t0, bufsize, NULL, rc);
+    }
+    return rc;
+}
@@ -0,0 +1,40 @@
+ifndef INC_DIR_LIBHDF5
+$(info benchmarks.mk: *** INC_DIR_LIBHDF5 was not found.)
+$(error Execute make at the root level only.)
+endif
+
+ifndef LINK_LIBHDF5
+$(info benchmarks.mk: *** LINK_LIBHDF5 was not found.)
+$(error Execute make at the root level only.)
+endif
+
+ifndef INC_DIR_LIBWRH5
+$(info benchmarks.mk: *** INC_DIR_LIBWRH5 was not found.)
+$(error Execute make at the root level only.)
+endif
+
+ifndef LINK_LIBWRH5
+$(info benchmarks.mk: *** LINK_LIBWRH5 was not found.)
+$(error Execute make at the root level only.)
+endif
+
+OBJECTS= jeanette.o
+
+# --- All targets. Default action.
+all:	jeanette
+
+# --- Test program executables.
+jeanette:	$(OBJECTS)
+	gcc -o jeanette jeanette.o $(LINK_LIBWRH5) $(LINK_LIBHDF5) -lm
+
+# --- Remove binaries and data files in testdata subdirectory.
+clean:
+	rm -f jeanette $(OBJECTS)
+
+# --- Store important suffixes in the .SUFFIXES macro.
+.SUFFIXES:	.o .c	
+
+# --- Generate anyfile.o from anyfile.c.
+%.o:    %.c benchmarks.mk $(INC_DIR_LIBWRH5)/wrh5_defs.h
+	gcc $(CFLAGS) -I. -I $(INC_DIR_LIBWRH5) -I $(INC_DIR_LIBHDF5) $<
+
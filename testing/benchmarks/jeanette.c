@@ -0,0 +1,210 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * jeanette.c                                                                  *
+ * ----------                                                                  *
+ * Benchmark wrh5 application.                                                 *
+ * Compression ratio, worst relative error, and write rate of synthetic        *
+ * radiometer noise (bandpass x Gaussian noise) versus keep_mantissa_bits.     *
+ * Each setting writes the same data to its own file in the output directory.  *
+ * Without the Bitshuffle filter plugin, every ratio is 1.0.                   *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <wrh5_defs.h>
+
+#define NBITS           32
+#define NFPC            65536
+#define NCOARSE         4
+#define NCHANS          (NFPC * NCOARSE)
+#define NIFS            1
+#define NTINTS          64
+
+int verbose = 0;            // 1 : verbose logging in libwrh5 calls; 0 : default
+char dir_out[256];          // Output directory
+
+
+/***
+	Initialize metadata to Voyager 1 values.
+***/
+void make_voyager_1_metadata(wrh5_hdr_t * p_wrh5_hdr) {
+    memset(p_wrh5_hdr, 0, sizeof(wrh5_hdr_t));
+    p_wrh5_hdr->az_start = 0.0;
+    p_wrh5_hdr->data_type = 1;
+    p_wrh5_hdr->fch1 = 8421.386717353016;       // MHz
+    p_wrh5_hdr->foff = -2.7939677238464355e-06; // MHz
+    p_wrh5_hdr->ibeam = 1;
+    p_wrh5_hdr->machine_id = 42;
+    p_wrh5_hdr->nbeams = 1;
+    p_wrh5_hdr->nchans = NCHANS;            // # of fine channels
+    p_wrh5_hdr->nfpc = NFPC;                // # of fine channels per coarse channel
+    p_wrh5_hdr->nifs = NIFS;                // # of feeds (E.g. polarisations)
+    p_wrh5_hdr->nbits = NBITS;              // 4 bytes i.e. float32
+    p_wrh5_hdr->src_raj = 171003.984;       // 17:12:40.481
+    p_wrh5_hdr->src_dej = 121058.8;         // 12:24:13.614
+    p_wrh5_hdr->telescope_id = 6;           // GBT
+    p_wrh5_hdr->tsamp = 18.253611008;       // seconds
+    p_wrh5_hdr->tstart = 57650.78209490741; // 2020-07-16T22:13:56.000
+    p_wrh5_hdr->za_start = 0.0;
+
+    strcpy(p_wrh5_hdr->source_name, "Voyager1");
+    strcpy(p_wrh5_hdr->rawdatafile, "guppi_57650_67573_Voyager1_0002.0000.raw");
+}
+
+
+void fatal_error(int linenum, char * msg) {
+    fprintf(stderr, "\n*** jeanette: FATAL ERROR at line %d :: %s.\n", linenum, msg);
+    exit(86);
+}
+
+
+/***
+	Show help and then exit.
+***/
+void show_help(char * msg) {
+    printf("\n%s\n", msg);
+    printf("Usage:  jeanette  [-v]  OutputDirectory\n\n-v : verbose logging\n\n");
+    exit(1);
+}
+
+
+/***
+	Standard normal deviate (Box-Muller).
+***/
+double get_gaussian(void) {
+    double u1 = ((double) rand() + 1.0) / ((double) RAND_MAX + 2.0);
+    double u2 = ((double) rand() + 1.0) / ((double) RAND_MAX + 2.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+/***
+	Elapsed seconds since t0.
+***/
+double seconds_since(struct timespec * p_t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - p_t0->tv_sec) + 1.0e-9 * (t1.tv_nsec - p_t0->tv_nsec);
+}
+
+
+/***
+	Write p_data with keep_bits kept mantissa bits (0 = off) and report on it.
+***/
+void run_one(float * p_data, float * p_back, int keep_bits) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    struct timespec t0;
+    double          elapsed, ratio, rel, max_rel = 0.0;
+    hsize_t         storage;
+    hid_t           file_id, dataset_id;
+    size_t          nbytes = (size_t) NTINTS * NIFS * NCHANS * sizeof(float);
+    size_t          ix;
+
+    sprintf(path_h5, "%s/jeanette_%02d.h5", dir_out, keep_bits);
+    make_voyager_1_metadata(&wrh5_hdr);
+    memset(&options, 0, sizeof(options));
+    options.keep_mantissa_bits = keep_bits;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_data, nbytes, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    elapsed = seconds_since(&t0);
+
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    if(dataset_id < 0)
+        fatal_error(__LINE__, "data dataset is missing");
+    storage = H5Dget_storage_size(dataset_id);
+    if(H5Dread(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_back) < 0)
+        fatal_error(__LINE__, "H5Dread failed");
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    for(ix = 0; ix < nbytes / sizeof(float); ix++) {
+        rel = fabs((double) p_back[ix] - (double) p_data[ix]) / fabs((double) p_data[ix]);
+        if(rel > max_rel)
+            max_rel = rel;
+    }
+    ratio = (storage > 0) ? (double) nbytes / (double) storage : 0.0;
+
+    if(keep_bits == 0)
+        printf("jeanette:  off  %8.3f  %12.3e  %12s  %9.1f\n", ratio, max_rel, "0", nbytes / elapsed / 1.0e6);
+    else
+        printf("jeanette:  %3d  %8.3f  %12.3e  %12.3e  %9.1f\n", keep_bits, ratio, max_rel,
+               ldexp(1.0, -(keep_bits + 1)), nbytes / elapsed / 1.0e6);
+}
+
+
+/***
+	Main entry point.
+***/
+int main(int argc, char **argv) {
+    char    wstr[256];      // sprintf target
+    float   *p_data, *p_back;
+    int     settings[] = {0, 16, 12, 10, 8, 6, 4};
+    size_t  ii, jj;
+    double  bandpass;
+
+    /*
+     * Parse command line.
+     */
+    switch(argc) {
+        case 1:
+            show_help("No parameters provided");
+        case 2:
+            strcpy(wstr, *++argv);
+            if(strcmp(wstr, "-h") == 0)
+                show_help("Help was requested");
+            if(wstr[0] == '-')
+                show_help("An option was specified but the output directory is missing");
+            strcpy(dir_out, wstr);
+            break;
+        case 3:
+            strcpy(wstr, *++argv);
+            if(strcmp(wstr, "-v") == 0) {
+                verbose = 1;
+                strcpy(dir_out, *++argv);
+                break;
+            }
+            show_help("Unrecognizable parameter or extraneous string specified");
+        default:
+            show_help("Too many parameters specified");
+    }
+
+    /*
+     * Synthetic spectra: a smooth coarse channel bandpass around 5e9 with 1% noise.
+     */
+    p_data = malloc((size_t) NTINTS * NIFS * NCHANS * sizeof(float));
+    p_back = malloc((size_t) NTINTS * NIFS * NCHANS * sizeof(float));
+    if(p_data == NULL || p_back == NULL)
+        fatal_error(__LINE__, "malloc failed");
+    for(jj = 0; jj < NCHANS; jj++) {
+        bandpass = 5.0e9 * (1.0 - 0.5 * pow(2.0 * (jj % NFPC) / NFPC - 1.0, 8));
+        for(ii = 0; ii < NTINTS; ii++)
+            p_data[ii * NCHANS + jj] = (float) (bandpass * (1.0 + 0.01 * get_gaussian()));
+    }
+
+    /*
+     * One file per setting.
+     */
+    printf("jeanette: %d time integrations of %d channels (%ld MB)\n",
+           NTINTS, NCHANS, (long) NTINTS * NIFS * NCHANS * sizeof(float) / 1000000);
+    printf("jeanette: keep     ratio  max_rel_err     err_bound       MB/s\n");
+    for(ii = 0; ii < sizeof(settings) / sizeof(settings[0]); ii++)
+        run_one(p_data, p_back, settings[ii]);
+
+    /*
+     * Bye-bye.
+     */
+    free(p_data);
+    free(p_back);
+    return 0;
+}
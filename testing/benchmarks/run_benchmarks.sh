@@ -0,0 +1,12 @@
+set -e
+nargs=$#
+
+if [ $nargs -ne 1 ]; then
+	echo \*\*\* Number of arguments must be 1; observed $nargs \!\!\!
+	exit 1
+fi
+
+TEST_DATA=$1
+
+# Run jeanette (compression ratio versus kept mantissa bits):
+./jeanette $TEST_DATA
@@ -0,0 +1,2472 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * brittany.c                                                                  *
+ * ----------                                                                  *
+ * Sample wrh5 application.                                                    *
+ * Exercise the wrh5_open_ext user options and read the results back.          *
+ * Each test writes its own file in the output directory.                      *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <wrh5_defs.h>
+#include <wrh5_shm.h>
+
+#define NBITS           32
+#define NFPC            65536
+#define NCOARSE         8
+#define NCHANS          (NFPC * NCOARSE)
+#define NIFS            1
+#define NTINTS          16
+
+int verbose = 0;            // 1 : verbose logging in libwrh5 calls; 0 : default
+char dir_out[256];          // Output directory
+
+
+/***
+	Initialize metadata to Voyager 1 values.
+***/
+void make_voyager_1_metadata(wrh5_hdr_t * p_wrh5_hdr) {
+    memset(p_wrh5_hdr, 0, sizeof(wrh5_hdr_t));
+    p_wrh5_hdr->az_start = 0.0;
+    p_wrh5_hdr->data_type = 1;
+    p_wrh5_hdr->fch1 = 8421.386717353016;       // MHz
+    p_wrh5_hdr->foff = -2.7939677238464355e-06; // MHz
+    p_wrh5_hdr->ibeam = 1;
+    p_wrh5_hdr->machine_id = 42;
+    p_wrh5_hdr->nbeams = 1;
+    p_wrh5_hdr->nchans = NCHANS;            // # of fine channels
+    p_wrh5_hdr->nfpc = NFPC;                // # of fine channels per coarse channel
+    p_wrh5_hdr->nifs = NIFS;                // # of feeds (E.g. polarisations)
+    p_wrh5_hdr->nbits = NBITS;              // 4 bytes i.e. float32
+    p_wrh5_hdr->src_raj = 171003.984;       // 17:12:40.481
+    p_wrh5_hdr->src_dej = 121058.8;         // 12:24:13.614
+    p_wrh5_hdr->telescope_id = 6;           // GBT
+    p_wrh5_hdr->tsamp = 18.253611008;       // seconds
+    p_wrh5_hdr->tstart = 57650.78209490741; // 2020-07-16T22:13:56.000
+    p_wrh5_hdr->za_start = 0.0;
+
+    strcpy(p_wrh5_hdr->source_name, "Voyager1");
+    strcpy(p_wrh5_hdr->rawdatafile, "guppi_57650_67573_Voyager1_0002.0000.raw");
+}
+
+
+void fatal_error(int linenum, char * msg) {
+    fprintf(stderr, "\n*** brittany: FATAL ERROR at line %d :: %s.\n", linenum, msg);
+    exit(86);
+}
+
+
+/***
+	Show help and then exit.
+***/
+void show_help(char * msg) {
+    printf("\n%s\n", msg);
+    printf("Usage:  brittany  [-v]  OutputDirectory\n\n-v : verbose logging\n\n");
+    exit(1);
+}
+
+
+/***
+	Get a random float between low and high.
+***/
+float get_random(float low, float high) {
+    float wk = ((float)rand() / (float)RAND_MAX);
+    return low + wk * (high - low);
+}
+
+
+/***
+	Coarse channel aligned chunking and the "cc_index" dataset, also on resume.
+***/
+void test_cc_index(void) {
+    char            path_h5[512];
+    float           *p_data;
+    size_t          tint_size = NIFS * NCHANS * sizeof(float);
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    hid_t           file_id, index_id, space_id, dtype_id;
+    hsize_t         nrows;
+    wrh5_cc_index_t *p_rows;
+    long            ii;
+
+    sprintf(path_h5, "%s/brittany_cc_index.h5", dir_out);
+    p_data = malloc(tint_size);
+    if(p_data == NULL)
+        fatal_error(__LINE__, "malloc failed");
+    for(ii = 0; ii < NIFS * NCHANS; ii++)
+        p_data[ii] = get_random(4.0e9, 9.0e9);
+
+    make_voyager_1_metadata(&wrh5_hdr);
+    memset(&options, 0, sizeof(options));
+    options.cc_aligned = 1;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    if(wrh5_ctx.cdims[2] != NFPC)
+        fatal_error(__LINE__, "chunk fine channel dimension is not coarse channel aligned");
+    for(ii = 0; ii < NTINTS; ii++)
+        if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_data, tint_size, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    /*
+     * Read the index back: one row per (time, coarse channel) chunk, sorted by coarse channel.
+     */
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    index_id = H5Dopen(file_id, "cc_index", H5P_DEFAULT);
+    if(index_id < 0)
+        fatal_error(__LINE__, "cc_index dataset is missing");
+    space_id = H5Dget_space(index_id);
+    H5Sget_simple_extent_dims(space_id, &nrows, NULL);
+    if(nrows != NTINTS * NCOARSE)
+        fatal_error(__LINE__, "cc_index row count is wrong");
+    p_rows = malloc(nrows * sizeof(wrh5_cc_index_t));
+    dtype_id = H5Dget_type(index_id);
+    H5Dread(index_id, dtype_id, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_rows);
+    for(ii = 0; ii < (long) nrows; ii++) {
+        if(p_rows[ii].coarse_chan != ii / NTINTS)
+            fatal_error(__LINE__, "cc_index is not sorted by coarse channel");
+        if(p_rows[ii].chan_offset != (uint64_t) p_rows[ii].coarse_chan * NFPC)
+            fatal_error(__LINE__, "cc_index chunk does not start on a coarse channel boundary");
+        if(p_rows[ii].time_offset != (uint64_t) (ii % NTINTS))
+            fatal_error(__LINE__, "cc_index time offset is wrong");
+        if(p_rows[ii].nbytes == 0 || p_rows[ii].file_addr == 0)
+            fatal_error(__LINE__, "cc_index byte range is empty");
+    }
+    free(p_rows);
+    H5Tclose(dtype_id);
+    H5Sclose(space_id);
+    H5Dclose(index_id);
+    H5Fclose(file_id);
+
+    /*
+     * Resume: refused without cc_aligned, leaving the index alone; with it, the index is written again.
+     */
+    options.resume = 1;
+    options.cc_aligned = 0;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "resuming without cc_aligned should have failed");
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if(H5Lexists(file_id, "cc_index", H5P_DEFAULT) <= 0)
+        fatal_error(__LINE__, "a refused resume removed cc_index");
+    H5Fclose(file_id);
+    options.cc_aligned = 1;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext (resume) failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_data, tint_size, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    index_id = H5Dopen(file_id, "cc_index", H5P_DEFAULT);
+    if(index_id < 0)
+        fatal_error(__LINE__, "cc_index dataset is missing after resume");
+    space_id = H5Dget_space(index_id);
+    H5Sget_simple_extent_dims(space_id, &nrows, NULL);
+    if(nrows != (NTINTS + 1) * NCOARSE)
+        fatal_error(__LINE__, "cc_index row count is wrong after resume");
+    H5Sclose(space_id);
+    H5Dclose(index_id);
+    H5Fclose(file_id);
+    free(p_data);
+    printf("brittany: cc_index OK\n");
+}
+
+
+/***
+	Read back time integration itint of "data" (float32) into p_tint.
+***/
+void read_tint(char * path_h5, long itint, float * p_tint, int nifs, int nchans) {
+    hid_t   file_id, dataset_id, filespace_id, memspace_id;
+    hsize_t offset[3] = {0, 0, 0};
+    hsize_t count[3] = {1, 0, 0};
+    hsize_t mdims[1];
+
+    offset[0] = itint;
+    count[1] = nifs;
+    count[2] = nchans;
+    mdims[0] = (hsize_t) nifs * nchans;
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    if(dataset_id < 0)
+        fatal_error(__LINE__, "data dataset is missing");
+    filespace_id = H5Dget_space(dataset_id);
+    H5Sselect_hyperslab(filespace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
+    memspace_id = H5Screate_simple(1, mdims, NULL);
+    if(H5Dread(dataset_id, H5T_NATIVE_FLOAT, memspace_id, filespace_id, H5P_DEFAULT, p_tint) < 0)
+        fatal_error(__LINE__, "H5Dread of a time integration failed");
+    H5Sclose(memspace_id);
+    H5Sclose(filespace_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+}
+
+
+/***
+	Buffer pool shared by two contexts, buffers submitted without copying.
+***/
+void test_pool(void) {
+    char            path_h5[2][512];
+    size_t          tint_size = NIFS * NCHANS * sizeof(float);
+    wrh5_pool_t     pool;
+    wrh5_context_t  wrh5_ctx[2];
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    float           *p_buf, *p_tint;
+    long            ii, jj, kk;
+
+    if(wrh5_pool_create(&pool, tint_size, 4, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_pool_create failed");
+    if(pool.bufsize % WRH5_HUGEPAGE_SIZE != 0 || pool.nfree != 4)
+        fatal_error(__LINE__, "pool geometry is wrong");
+    make_voyager_1_metadata(&wrh5_hdr);
+    memset(&options, 0, sizeof(options));
+    options.p_pool = &pool;
+    for(kk = 0; kk < 2; kk++) {
+        sprintf(path_h5[kk], "%s/brittany_pool_%ld.h5", dir_out, kk);
+        if(wrh5_open_ext(&wrh5_ctx[kk], &wrh5_hdr, path_h5[kk], NULL, NULL, &options, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_open_ext failed");
+    }
+    for(ii = 0; ii < NTINTS; ii++)
+        for(kk = 0; kk < 2; kk++) {
+            p_buf = wrh5_pool_get(&pool, 0);
+            if(p_buf == NULL)
+                fatal_error(__LINE__, "wrh5_pool_get returned NULL");
+            for(jj = 0; jj < NIFS * NCHANS; jj++)
+                p_buf[jj] = (float) (ii * 1000 + kk * 100 + jj % 97);
+            if(wrh5_submit(&wrh5_ctx[kk], &wrh5_hdr, p_buf, tint_size, verbose) != 0)
+                fatal_error(__LINE__, "wrh5_submit failed");
+        }
+    if(pool.nfree != 4)
+        fatal_error(__LINE__, "wrh5_submit did not return its buffer to the pool");
+    for(kk = 0; kk < 2; kk++)
+        if(wrh5_close(&wrh5_ctx[kk], verbose) != 0)
+            fatal_error(__LINE__, "wrh5_close failed");
+    if(wrh5_pool_destroy(&pool, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_pool_destroy failed");
+
+    /*
+     * Check the last time integration of the second file.
+     */
+    p_tint = malloc(tint_size);
+    read_tint(path_h5[1], NTINTS - 1, p_tint, NIFS, NCHANS);
+    for(jj = 0; jj < NIFS * NCHANS; jj++)
+        if(p_tint[jj] != (float) ((NTINTS - 1) * 1000 + 100 + jj % 97))
+            fatal_error(__LINE__, "pool data read back does not match");
+    free(p_tint);
+
+    /*
+     * Context-owned pool.
+     */
+    options.p_pool = NULL;
+    options.pool_nbufs = 2;
+    options.pool_tints = 3;
+    if(wrh5_open_ext(&wrh5_ctx[0], &wrh5_hdr, path_h5[0], NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext with an own pool failed");
+    if(wrh5_ctx[0].p_pool == NULL || wrh5_ctx[0].p_pool->bufsize < 3 * tint_size)
+        fatal_error(__LINE__, "context-owned pool is missing or too small");
+    p_buf = wrh5_pool_get(wrh5_ctx[0].p_pool, 1);
+    memset(p_buf, 0, 3 * tint_size);
+    if(wrh5_submit(&wrh5_ctx[0], &wrh5_hdr, p_buf, 3 * tint_size, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_submit to an own pool failed");
+    if(wrh5_close(&wrh5_ctx[0], verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close with an own pool failed");
+    printf("brittany: pool OK\n");
+}
+
+
+/***
+	Scatter/gather writes: one buffer per IF, then one buffer per time integration.
+***/
+void test_writev(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    wrh5_iovec_t    iov[4];
+    int             nifs = 2, nchans = 4096, ntints = 3;
+    float           *p_pol[2], *p_tint;
+    long            ii, jj, kk;
+
+    sprintf(path_h5, "%s/brittany_writev.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 1024;
+    for(kk = 0; kk < nifs; kk++) {
+        p_pol[kk] = malloc(ntints * nchans * sizeof(float));
+        for(ii = 0; ii < ntints; ii++)
+            for(jj = 0; jj < nchans; jj++)
+                p_pol[kk][ii * nchans + jj] = (float) (ii * 100000 + kk * 10000 + jj);
+    }
+    if(wrh5_open(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open failed");
+
+    // Dump 1: one segment per IF, IF 1 first.
+    iov[0].base = p_pol[1];
+    iov[0].len = ntints * nchans * sizeof(float);
+    iov[0].role = 1;
+    iov[1].base = p_pol[0];
+    iov[1].len = ntints * nchans * sizeof(float);
+    iov[1].role = 0;
+    if(wrh5_writev(&wrh5_ctx, &wrh5_hdr, iov, 2, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_writev by IF failed");
+
+    // Dump 2: one segment per time integration.
+    p_tint = malloc(2 * nifs * nchans * sizeof(float));
+    for(jj = 0; jj < 2 * nifs * nchans; jj++)
+        p_tint[jj] = (float) -jj;
+    iov[0].base = p_tint;
+    iov[0].len = nifs * nchans * sizeof(float);
+    iov[0].role = WRH5_ROLE_TINTS;
+    iov[1].base = p_tint + nifs * nchans;
+    iov[1].len = nifs * nchans * sizeof(float);
+    iov[1].role = WRH5_ROLE_TINTS;
+    if(wrh5_writev(&wrh5_ctx, &wrh5_hdr, iov, 2, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_writev by time integration failed");
+
+    // Mixed roles must be refused.
+    iov[1].role = 0;
+    if(wrh5_writev(&wrh5_ctx, &wrh5_hdr, iov, 2, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_writev accepted mixed roles");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    /*
+     * Read back.
+     */
+    for(ii = 0; ii < ntints + 2; ii++) {
+        read_tint(path_h5, ii, p_tint, nifs, nchans);
+        for(kk = 0; kk < nifs; kk++)
+            for(jj = 0; jj < nchans; jj++) {
+                float expected = (ii < ntints) ? (float) (ii * 100000 + kk * 10000 + jj)
+                                               : (float) -((ii - ntints) * nifs * nchans + kk * nchans + jj);
+                if(p_tint[kk * nchans + jj] != expected)
+                    fatal_error(__LINE__, "wrh5_writev data read back does not match");
+            }
+    }
+    free(p_tint);
+    free(p_pol[0]);
+    free(p_pol[1]);
+    printf("brittany: writev OK\n");
+}
+
+
+/***
+	Input layouts: IF-interleaved [time][chan][ifs] and channel-major [ifs][chan][time].
+***/
+void test_layout(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    int             nifs = 4, nchans = 1003, ntints = 7;
+    int             layouts[2] = {WRH5_LAYOUT_TCI, WRH5_LAYOUT_ICT};
+    float           *p_in, *p_tint;
+    long            ii, jj, kk, ll;
+
+    p_in = malloc(ntints * nifs * nchans * sizeof(float));
+    p_tint = malloc(nifs * nchans * sizeof(float));
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    for(ll = 0; ll < 2; ll++) {
+        for(ii = 0; ii < ntints; ii++)
+            for(kk = 0; kk < nifs; kk++)
+                for(jj = 0; jj < nchans; jj++) {
+                    float value = (float) (ii * 100000 + kk * 10000 + jj);
+                    if(layouts[ll] == WRH5_LAYOUT_TCI)
+                        p_in[(ii * nchans + jj) * nifs + kk] = value;
+                    else
+                        p_in[(kk * nchans + jj) * ntints + ii] = value;
+                }
+        sprintf(path_h5, "%s/brittany_layout_%d.h5", dir_out, layouts[ll]);
+        memset(&options, 0, sizeof(options));
+        options.input_layout = layouts[ll];
+        options.pool_tints = 3;     // Force several staging loads per dump
+        if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_open_ext failed");
+        if(wrh5_ctx.p_staging == NULL || wrh5_ctx.staging_tints < 3)
+            fatal_error(__LINE__, "staging buffer is missing");
+        if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, ntints * nifs * nchans * sizeof(float), verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write failed");
+        if(wrh5_close(&wrh5_ctx, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_close failed");
+        for(ii = 0; ii < ntints; ii++) {
+            read_tint(path_h5, ii, p_tint, nifs, nchans);
+            for(kk = 0; kk < nifs; kk++)
+                for(jj = 0; jj < nchans; jj++)
+                    if(p_tint[kk * nchans + jj] != (float) (ii * 100000 + kk * 10000 + jj))
+                        fatal_error(__LINE__, "transposed data read back does not match");
+        }
+    }
+    free(p_in);
+    free(p_tint);
+    printf("brittany: layout OK\n");
+}
+
+
+/***
+	Fused Stokes IQUV detection of dual-polarization complex spectra.
+***/
+void test_detect(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    int             nchans = 1027, nint = 3, ntints = 5;
+    float           *p_x, *p_y, *p_tint;
+    double          expected[4], xr, xi, yr, yi;
+    long            ii, jj, kk, ss;
+
+    p_x = malloc(2 * (ntints * nint + 1) * nchans * sizeof(float));
+    p_y = malloc(2 * (ntints * nint + 1) * nchans * sizeof(float));
+    p_tint = malloc(4 * nchans * sizeof(float));
+    for(jj = 0; jj < 2 * (ntints * nint + 1) * nchans; jj++) {
+        p_x[jj] = get_random(-1.0, 1.0);
+        p_y[jj] = get_random(-1.0, 1.0);
+    }
+    sprintf(path_h5, "%s/brittany_detect.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = 4;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&options, 0, sizeof(options));
+    options.detect = WRH5_DETECT_IQUV;
+    options.detect_nint = nint;
+    options.pool_tints = 2;     // Force staging flushes between calls
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+
+    // Present the spectra in uneven batches, plus one spectrum that never completes an integration.
+    for(ss = 0; ss < ntints * nint + 1; ss += 4) {
+        size_t nspectra = (ss + 4 <= ntints * nint + 1) ? 4 : ntints * nint + 1 - ss;
+        if(wrh5_write_detect(&wrh5_ctx, &wrh5_hdr, p_x + 2 * ss * nchans, p_y + 2 * ss * nchans, nspectra, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write_detect failed");
+    }
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    for(ii = 0; ii < ntints; ii++) {
+        read_tint(path_h5, ii, p_tint, 4, nchans);
+        for(jj = 0; jj < nchans; jj++) {
+            memset(expected, 0, sizeof(expected));
+            for(ss = ii * nint; ss < (ii + 1) * nint; ss++) {
+                xr = p_x[2 * (ss * nchans + jj)];
+                xi = p_x[2 * (ss * nchans + jj) + 1];
+                yr = p_y[2 * (ss * nchans + jj)];
+                yi = p_y[2 * (ss * nchans + jj) + 1];
+                expected[0] += xr * xr + xi * xi + yr * yr + yi * yi;
+                expected[1] += xr * xr + xi * xi - yr * yr - yi * yi;
+                expected[2] += 2.0 * (xr * yr + xi * yi);
+                expected[3] += 2.0 * (xr * yi - xi * yr);
+            }
+            for(kk = 0; kk < 4; kk++)
+                if(fabs(p_tint[kk * nchans + jj] - expected[kk]) > 1.0e-4)
+                    fatal_error(__LINE__, "detected Stokes parameter does not match");
+        }
+    }
+    free(p_x);
+    free(p_y);
+    free(p_tint);
+    printf("brittany: detect OK\n");
+}
+
+
+/***
+	Mantissa trimming: bounded relative error, low bits zeroed, attribute recorded.
+***/
+void test_trim(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    int             nchans = 1029, ntints = 6, keep_bits = 8, attr_value = 0;
+    float           *p_in, *p_tint;
+    double          bound = ldexp(1.0, -(keep_bits + 1));
+    uint32_t        bits;
+    hid_t           file_id, dataset_id, attr_id;
+    long            ii, jj;
+
+    p_in = malloc(ntints * nchans * sizeof(float));
+    p_tint = malloc(nchans * sizeof(float));
+    for(jj = 0; jj < ntints * nchans; jj++)
+        p_in[jj] = get_random(-1.0e6, 1.0e6);
+    p_in[0] = INFINITY;
+    p_in[1] = 0.0;
+    sprintf(path_h5, "%s/brittany_trim.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&options, 0, sizeof(options));
+    options.keep_mantissa_bits = keep_bits;
+    options.pool_tints = 4;     // Force several staging loads per dump
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, ntints * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    for(ii = 0; ii < ntints; ii++) {
+        read_tint(path_h5, ii, p_tint, 1, nchans);
+        for(jj = 0; jj < nchans; jj++) {
+            float expected = p_in[ii * nchans + jj];
+            if(isinf(expected) || expected == 0.0) {
+                if(p_tint[jj] != expected)
+                    fatal_error(__LINE__, "special value was altered");
+                continue;
+            }
+            if(fabs(p_tint[jj] - expected) > bound * fabs(expected))
+                fatal_error(__LINE__, "trimmed value exceeds the error bound");
+            memcpy(&bits, &p_tint[jj], sizeof(bits));
+            if((bits & ((1u << (23 - keep_bits)) - 1)) != 0)
+                fatal_error(__LINE__, "trimmed mantissa bits are not zero");
+        }
+    }
+
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    attr_id = H5Aopen(dataset_id, "keep_mantissa_bits", H5P_DEFAULT);
+    if(attr_id < 0 || H5Aread(attr_id, H5T_NATIVE_INT, &attr_value) < 0 || attr_value != keep_bits)
+        fatal_error(__LINE__, "keep_mantissa_bits attribute is missing or wrong");
+    H5Aclose(attr_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+
+    // Out of range for float32.
+    options.keep_mantissa_bits = 23;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext accepted keep_mantissa_bits = 23");
+    free(p_in);
+    free(p_tint);
+    printf("brittany: trim OK\n");
+}
+
+
+/***
+	Read all of dataset name into p_buffer as mem_type; return its first dimension.
+***/
+long read_dataset(char * path_h5, char * name, hid_t mem_type, void * p_buffer) {
+    hid_t   file_id, dataset_id, filespace_id;
+    hsize_t dims[3];
+
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, name, H5P_DEFAULT);
+    if(dataset_id < 0)
+        fatal_error(__LINE__, "auxiliary dataset is missing");
+    filespace_id = H5Dget_space(dataset_id);
+    H5Sget_simple_extent_dims(filespace_id, dims, NULL);
+    if(H5Dread(dataset_id, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_buffer) < 0)
+        fatal_error(__LINE__, "H5Dread of an auxiliary dataset failed");
+    H5Sclose(filespace_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    return (long) dims[0];
+}
+
+
+/***
+	8-bit quantization with per-channel bandpass scale/offset, updated and frozen.
+	Then the same with staging loads shorter than quant_nint: one time integration per wrh5_write,
+	and pool_tints < quant_nint.  The estimates span the loads and the file is the same.
+***/
+void test_quantize(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    int             nifs = 2, nchans = 1031, ntints = 12, nint = 4;
+    int             modes[4] = {WRH5_QUANT_UINT8, WRH5_QUANT_INT8, WRH5_QUANT_UINT8, WRH5_QUANT_INT8};
+    char            path_ref[512];
+    float           *p_in, *p_tint, *p_offset, *p_scale, *p_ref_tint, *p_ref_offset, *p_ref_scale;
+    uint64_t        tints[16];
+    double          bandpass, physical;
+    long            ii, jj, ll, nrows, irow, nelems = nifs * nchans;
+
+    p_in = malloc(ntints * nelems * sizeof(float));
+    p_tint = malloc(nelems * sizeof(float));
+    p_offset = malloc(16 * nelems * sizeof(float));
+    p_scale = malloc(16 * nelems * sizeof(float));
+    p_ref_tint = malloc(nelems * sizeof(float));
+    p_ref_offset = malloc(16 * nelems * sizeof(float));
+    p_ref_scale = malloc(16 * nelems * sizeof(float));
+    for(jj = 0; jj < nelems; jj++) {
+        bandpass = 1.0e9 * (1.5 + sin(0.01 * jj));
+        for(ii = 0; ii < ntints; ii++)
+            p_in[ii * nelems + jj] = (float) (bandpass * (1.0 + 0.01 * get_random(-1.0, 1.0)));
+    }
+    p_in[5 * nelems + 17] = 1.0e12;     // RFI spike : saturates unless it is part of the estimate
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    for(ll = 0; ll < 4; ll++) {
+        sprintf(path_ref, "%s/brittany_quantize_%d.h5", dir_out, modes[ll]);
+        if(ll < 2)
+            strcpy(path_h5, path_ref);
+        else
+            sprintf(path_h5, "%s/brittany_quantize_short_%d.h5", dir_out, modes[ll]);
+        memset(&options, 0, sizeof(options));
+        options.quantize = modes[ll];
+        options.quant_nint = nint;
+        options.quant_update = (modes[ll] == WRH5_QUANT_UINT8);
+        options.pool_tints = (ll == 3) ? 1 : nint;
+        if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_open_ext failed");
+        if(ll == 2) {
+            // One time integration per call.
+            for(ii = 0; ii < ntints; ii++)
+                if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in + ii * nelems, nelems * sizeof(float), verbose) != 0)
+                    fatal_error(__LINE__, "wrh5_write failed");
+        } else {
+            // Two uneven dumps.
+            if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, 7 * nelems * sizeof(float), verbose) != 0)
+                fatal_error(__LINE__, "wrh5_write failed");
+            if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in + 7 * nelems, (ntints - 7) * nelems * sizeof(float), verbose) != 0)
+                fatal_error(__LINE__, "wrh5_write failed");
+        }
+        if(wrh5_close(&wrh5_ctx, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_close failed");
+
+        nrows = read_dataset(path_h5, "quant_tint", H5T_NATIVE_UINT64, tints);
+        if(nrows != (options.quant_update ? 3 : 1))
+            fatal_error(__LINE__, "unexpected number of bandpass estimates");
+        read_dataset(path_h5, "quant_offset", H5T_NATIVE_FLOAT, p_offset);
+        read_dataset(path_h5, "quant_scale", H5T_NATIVE_FLOAT, p_scale);
+        for(ii = 0; ii < ntints; ii++) {
+            read_tint(path_h5, ii, p_tint, nifs, nchans);     // Stored values converted to float by HDF5
+            for(irow = nrows - 1; irow > 0 && tints[irow] > (uint64_t) ii; irow--)
+                ;
+            for(jj = 0; jj < nelems; jj++) {
+                physical = p_offset[irow * nelems + jj] + p_scale[irow * nelems + jj] * (double) p_tint[jj];
+                if(ii == 5 && jj == 17 && !options.quant_update) {
+                    if(p_tint[jj] != 127.0)
+                        fatal_error(__LINE__, "RFI spike did not saturate");
+                    continue;
+                }
+                if(p_tint[jj] == 0.0 || p_tint[jj] == 255.0 || p_tint[jj] == -128.0 || p_tint[jj] == 127.0)
+                    continue;   // Saturated : outside the estimated range
+                if(fabs(physical - p_in[ii * nelems + jj]) > 0.51 * p_scale[irow * nelems + jj])
+                    fatal_error(__LINE__, "reconstructed value exceeds half a quantization step");
+            }
+        }
+        if(ll < 2)
+            continue;
+
+        // Short loads: same estimates and stored values as with whole-estimate loads.
+        read_dataset(path_ref, "quant_offset", H5T_NATIVE_FLOAT, p_ref_offset);
+        read_dataset(path_ref, "quant_scale", H5T_NATIVE_FLOAT, p_ref_scale);
+        if(memcmp(p_offset, p_ref_offset, nrows * nelems * sizeof(float)) != 0
+           || memcmp(p_scale, p_ref_scale, nrows * nelems * sizeof(float)) != 0)
+            fatal_error(__LINE__, "bandpass estimated from short loads differs");
+        for(ii = 0; ii < ntints; ii++) {
+            read_tint(path_h5, ii, p_tint, nifs, nchans);
+            read_tint(path_ref, ii, p_ref_tint, nifs, nchans);
+            if(memcmp(p_tint, p_ref_tint, nelems * sizeof(float)) != 0)
+                fatal_error(__LINE__, "data quantized from short loads differs");
+        }
+    }
+    free(p_in);
+    free(p_tint);
+    free(p_offset);
+    free(p_scale);
+    free(p_ref_tint);
+    free(p_ref_offset);
+    free(p_ref_scale);
+    printf("brittany: quantize OK\n");
+}
+
+
+/***
+	Compression bypass: whole chunks judged one by one, partial chunk rows through the filter.
+***/
+void test_bypass(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    user_chunking_t chunking;
+    int             nifs = 2, nchans = 1000, ntints = 13;
+    float           *p_in, *p_tint;
+    long            ii, jj, nelems = nifs * nchans;
+
+    p_in = malloc(ntints * nelems * sizeof(float));
+    p_tint = malloc(nelems * sizeof(float));
+    for(ii = 0; ii < ntints; ii++)
+        for(jj = 0; jj < nelems; jj++)   // IF 0 constant (compressible), IF 1 noise (not)
+            p_in[ii * nelems + jj] = (jj < nchans) ? 42.0 : get_random(1.0e9, 2.0e9);
+    sprintf(path_h5, "%s/brittany_bypass.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    chunking.n_time = 4;
+    chunking.n_nifs = 1;
+    chunking.n_fine_chan = 256;     // Edge chunks: 1000 = 3 x 256 + 232
+    memset(&options, 0, sizeof(options));
+    options.bypass_min_ratio = 1.5;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    // Dumps of 6 and 7 time integrations: whole chunk rows [0, 4) and [8, 12).
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, 6 * nelems * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in + 6 * nelems, 7 * nelems * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    if(wrh5_ctx.bypass_chunks + wrh5_ctx.compress_chunks != 16)
+        fatal_error(__LINE__, "whole chunk count is wrong");
+    if(wrh5_ctx.filtered && (wrh5_ctx.bypass_chunks != 8 || wrh5_ctx.compress_chunks != 8))
+        fatal_error(__LINE__, "noise chunks should be stored raw and constant chunks compressed");
+    for(ii = 0; ii < ntints; ii++) {
+        read_tint(path_h5, ii, p_tint, nifs, nchans);
+        for(jj = 0; jj < nelems; jj++)
+            if(p_tint[jj] != p_in[ii * nelems + jj])
+                fatal_error(__LINE__, "data read back does not match");
+    }
+    free(p_in);
+    free(p_tint);
+    printf("brittany: bypass OK\n");
+}
+
+
+/***
+	Missing time integrations: wrh5_write_missing, elide_fill and the "valid" bitmap.
+***/
+void test_missing(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    user_chunking_t chunking;
+    int             nchans = 256;
+    float           *p_in, *p_zero, *p_tint;
+    unsigned char   valid[8];
+    wrh5_iovec_t    iov[2];
+    hsize_t         nchunks;
+    hid_t           file_id, dataset_id, space_id;
+    long            ii, jj;
+
+    p_in = malloc(4 * nchans * sizeof(float));
+    p_zero = calloc(4 * nchans, sizeof(float));
+    p_tint = malloc(nchans * sizeof(float));
+    sprintf(path_h5, "%s/brittany_missing.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = 1;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    chunking.n_time = 4;
+    chunking.n_nifs = 1;
+    chunking.n_fine_chan = nchans;
+    memset(&options, 0, sizeof(options));
+    options.elide_fill = 1;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    // Time integrations 0-3 real, 4-11 dropped, 12-15 zero-filled by the producer, 16-17 real.
+    for(jj = 0; jj < 4 * nchans; jj++)
+        p_in[jj] = get_random(1.0, 2.0);
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, 4 * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_write_missing(&wrh5_ctx, &wrh5_hdr, 8, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write_missing failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_zero, 4 * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, 2 * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    if(wrh5_ctx.missing_tints != 12)
+        fatal_error(__LINE__, "missing time integration count is wrong");
+    if(wrh5_ctx.elided_chunks != 1)
+        fatal_error(__LINE__, "the all-zero chunk should not have been written");
+    if(read_dataset(path_h5, "valid", H5T_NATIVE_UINT8, valid) != 3)
+        fatal_error(__LINE__, "valid dataset size is wrong");
+    if(valid[0] != 0x0F || valid[1] != 0x00 || valid[2] != 0x03)
+        fatal_error(__LINE__, "valid bitmap is wrong");
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    space_id = H5Dget_space(dataset_id);
+    if(H5Dget_num_chunks(dataset_id, space_id, &nchunks) < 0 || nchunks != 2)
+        fatal_error(__LINE__, "only the chunks of real data should be allocated");
+    H5Sclose(space_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    for(ii = 0; ii < 18; ii++) {
+        read_tint(path_h5, ii, p_tint, 1, nchans);
+        for(jj = 0; jj < nchans; jj++)
+            if(p_tint[jj] != ((ii < 4) ? p_in[ii * nchans + jj] : (ii < 16) ? 0.0 : p_in[(ii - 16) * nchans + jj]))
+                fatal_error(__LINE__, "data read back does not match");
+    }
+
+    // wrh5_writev: whole time integration segments are elided like wrh5_write data; IF segments are refused.
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    iov[0].base = p_in;
+    iov[0].len = 4 * nchans * sizeof(float);
+    iov[0].role = WRH5_ROLE_TINTS;
+    iov[1].base = p_zero;
+    iov[1].len = 4 * nchans * sizeof(float);
+    iov[1].role = WRH5_ROLE_TINTS;
+    if(wrh5_writev(&wrh5_ctx, &wrh5_hdr, iov, 2, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_writev failed");
+    iov[0].role = 0;
+    if(wrh5_writev(&wrh5_ctx, &wrh5_hdr, iov, 1, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_writev accepted IF segments with elide_fill");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    if(wrh5_ctx.missing_tints != 4 || wrh5_ctx.elided_chunks != 1)
+        fatal_error(__LINE__, "wrh5_writev did not elide the all-zero segment");
+    if(read_dataset(path_h5, "valid", H5T_NATIVE_UINT8, valid) != 1 || valid[0] != 0x0F)
+        fatal_error(__LINE__, "valid bitmap is wrong after wrh5_writev");
+    free(p_in);
+    free(p_zero);
+    free(p_tint);
+    printf("brittany: missing OK\n");
+}
+
+
+/***
+	Resume: append to an existing file in place, including its valid bitmap and bandpass rows.
+***/
+void test_resume(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    user_chunking_t chunking;
+    int             nchans = 64;
+    float           *p_in, *p_tint;
+    unsigned char   valid[8];
+    uint64_t        quant_tint[8];
+    long            ii, jj;
+
+    p_in = malloc(16 * nchans * sizeof(float));
+    p_tint = malloc(nchans * sizeof(float));
+    for(jj = 0; jj < 16 * nchans; jj++)
+        p_in[jj] = get_random(1.0, 2.0);
+    sprintf(path_h5, "%s/brittany_resume.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = 1;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    chunking.n_time = 4;
+    chunking.n_nifs = 1;
+    chunking.n_fine_chan = nchans;
+    memset(&options, 0, sizeof(options));
+    options.resume = 1;
+    remove(path_h5);
+
+    // First session (resume of a file that does not exist creates it): 6 real, 2 missing.
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, 6 * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_write_missing(&wrh5_ctx, &wrh5_hdr, 2, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write_missing failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    // A different header is refused.
+    wrh5_hdr.nchans = 2 * nchans;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "resuming with a different header should have failed");
+    wrh5_hdr.nchans = nchans;
+
+    // Second session: 3 more real.
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext (resume) failed");
+    if(wrh5_ctx.offset_dims[0] != 8 || wrh5_ctx.missing_tints != 2 || wrh5_ctx.cdims[0] != 4)
+        fatal_error(__LINE__, "resumed context is wrong");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in + 8 * nchans, 3 * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    if(read_dataset(path_h5, "valid", H5T_NATIVE_UINT8, valid) != 2 || valid[0] != 0x3F || valid[1] != 0x07)
+        fatal_error(__LINE__, "valid bitmap is wrong");
+    for(ii = 0; ii < 11; ii++) {
+        read_tint(path_h5, ii, p_tint, 1, nchans);
+        for(jj = 0; jj < nchans; jj++)
+            if(p_tint[jj] != ((ii == 6 || ii == 7) ? 0.0 : p_in[ii * nchans + jj]))
+                fatal_error(__LINE__, "data read back does not match");
+    }
+
+    // Quantized file: bandpass rows carry on from where they stopped.
+    sprintf(path_h5, "%s/brittany_resume_quant.h5", dir_out);
+    remove(path_h5);
+    options.quantize = WRH5_QUANT_UINT8;
+    options.quant_update = 1;
+    for(ii = 0; ii < 2; ii++) {
+        if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_open_ext failed");
+        if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in + ii * 8 * nchans, 8 * nchans * sizeof(float), verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write failed");
+        if(wrh5_close(&wrh5_ctx, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_close failed");
+    }
+    if(read_dataset(path_h5, "quant_tint", H5T_NATIVE_UINT64, quant_tint) != 4)
+        fatal_error(__LINE__, "quant_tint row count is wrong");
+    for(ii = 0; ii < 4; ii++)
+        if(quant_tint[ii] != (uint64_t) (4 * ii))
+            fatal_error(__LINE__, "quant_tint is wrong");
+    free(p_in);
+    free(p_tint);
+    printf("brittany: resume OK\n");
+}
+
+
+/***
+	Check that a rechunked file has the expected chunk dimensions, filter, data, attributes and labels.
+***/
+void check_rechunked(char * path_h5, hsize_t * p_cdims, int deflated, float * p_in, int ntints, int nifs, int nchans) {
+    hid_t   file_id, dataset_id, dcpl;
+    hsize_t cdims[NDIMS];
+    int     nchans_attr;
+    char    label[64];
+    float   *p_tint;
+    long    ii, jj;
+
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    if(dataset_id < 0)
+        fatal_error(__LINE__, "data dataset is missing");
+    dcpl = H5Dget_create_plist(dataset_id);
+    H5Pget_chunk(dcpl, NDIMS, cdims);
+    if(cdims[0] != p_cdims[0] || cdims[1] != p_cdims[1] || cdims[2] != p_cdims[2])
+        fatal_error(__LINE__, "chunk dimensions are wrong");
+    if(H5Pget_nfilters(dcpl) != deflated)
+        fatal_error(__LINE__, "filter pipeline is wrong");
+    H5Pclose(dcpl);
+    if(wrh5_get_attr(dataset_id, "nchans", H5T_NATIVE_INT, &nchans_attr) != 0 || nchans_attr != nchans)
+        fatal_error(__LINE__, "nchans attribute was not copied");
+    if(H5DSget_label(dataset_id, 0, label, sizeof(label)) <= 0 || strcmp(label, "time") != 0)
+        fatal_error(__LINE__, "time dimension label was not copied");
+    if(H5Aexists(file_id, "CLASS") <= 0)
+        fatal_error(__LINE__, "file attributes were not copied");
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+
+    p_tint = malloc(nifs * nchans * sizeof(float));
+    for(ii = 0; ii < ntints; ii++) {
+        read_tint(path_h5, ii, p_tint, nifs, nchans);
+        for(jj = 0; jj < nifs * nchans; jj++)
+            if(p_tint[jj] != ((ii < ntints - 1) ? p_in[ii * nifs * nchans + jj] : 0.0))
+                fatal_error(__LINE__, "data read back does not match");
+    }
+    free(p_tint);
+}
+
+
+/***
+	Rechunk: new chunk shape and codec, several threads, small memory budget; then back again.
+***/
+void test_rechunk(void) {
+    char            path_h5[512], path_a[512], path_b[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_chunking_t chunking;
+    user_rechunk_t  params;
+    hsize_t         cdims[NDIMS];
+    unsigned char   valid[8];
+    int             nifs = 2, nchans = 1000, ntints = 13;
+    float           *p_in;
+    long            jj, nelems = nifs * nchans;
+
+    p_in = malloc(ntints * nelems * sizeof(float));
+    for(jj = 0; jj < ntints * nelems; jj++)
+        p_in[jj] = get_random(1.0e9, 2.0e9);
+    sprintf(path_h5, "%s/brittany_rechunk_in.h5", dir_out);
+    sprintf(path_a, "%s/brittany_rechunk_a.h5", dir_out);
+    sprintf(path_b, "%s/brittany_rechunk_b.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    chunking.n_time = 1;
+    chunking.n_nifs = 1;
+    chunking.n_fine_chan = 256;
+    if(wrh5_open(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, ntints * nelems * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_write_missing(&wrh5_ctx, &wrh5_hdr, 1, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write_missing failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    // (1, 1, 256) not compressed --> (4, 1, 128) deflated, 3 threads, 64 KiB: many tiles.
+    memset(&params, 0, sizeof(params));
+    params.chunking.n_time = 4;
+    params.chunking.n_nifs = 1;
+    params.chunking.n_fine_chan = 128;
+    params.codec = WRH5_CODEC_DEFLATE;
+    params.nthreads = 3;
+    params.mem_budget = 64 * 1024;
+    if(wrh5_rechunk(path_h5, path_a, &params, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_rechunk failed");
+    cdims[0] = 4;
+    cdims[1] = 1;
+    cdims[2] = 128;
+    check_rechunked(path_a, cdims, 1, p_in, ntints + 1, nifs, nchans);
+    if(read_dataset(path_a, "valid", H5T_NATIVE_UINT8, valid) != 2 || valid[0] != 0xFF || valid[1] != 0x1F)
+        fatal_error(__LINE__, "valid bitmap was not copied");
+
+    // Deflated (read directly) --> (14, 2, 1000) not compressed, default threads and budget.
+    memset(&params, 0, sizeof(params));
+    params.chunking.n_time = ntints + 1;
+    params.chunking.n_nifs = nifs;
+    params.chunking.n_fine_chan = nchans;
+    params.codec = WRH5_CODEC_NONE;
+    if(wrh5_rechunk(path_a, path_b, &params, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_rechunk failed");
+    cdims[0] = ntints + 1;
+    cdims[1] = nifs;
+    cdims[2] = nchans;
+    check_rechunked(path_b, cdims, 0, p_in, ntints + 1, nifs, nchans);
+    free(p_in);
+    printf("brittany: rechunk OK\n");
+}
+
+
+/***
+	Spectral kurtosis mask: intermittent RFI (high), a steady tone (low), missing time integrations, a partial last block.
+***/
+void test_sk(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    int             nifs = 2, nchans = 64, sk_m = 64;
+    int             ntints[2] = {2 * 64, 64 + 10};
+    float           *p_data;
+    unsigned char   mask[4 * 64];
+    uint64_t        sk_tint[4];
+    long            t, jj, c, tint, nrows, others = 0;
+    int             iw;
+
+    sprintf(path_h5, "%s/brittany_sk.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&options, 0, sizeof(options));
+    options.sk_m = sk_m;
+    options.sk_n = nifs;                    // Power summed over the IFs
+    options.quantize = WRH5_QUANT_UINT8;    // SK must see the float32 values
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    p_data = malloc(ntints[0] * nifs * nchans * sizeof(float));
+    tint = 0;
+    for(iw = 0; iw < 2; iw++) {
+        // Noise: exponential power in every IF.
+        for(t = 0; t < ntints[iw]; t++, tint++)
+            for(jj = 0; jj < nifs; jj++)
+                for(c = 0; c < nchans; c++) {
+                    p_data[(t * nifs + jj) * nchans + c] = -logf(get_random(1.0e-6, 1.0));
+                    if(c == 20)
+                        p_data[(t * nifs + jj) * nchans + c] = 3.0;     // Steady tone
+                    if(c == 10 && tint >= 64 && tint < 128 && tint % 8 == 0)
+                        p_data[(t * nifs + jj) * nchans + c] += 50.0;   // Bursts
+                }
+        if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_data, ntints[iw] * nifs * nchans * sizeof(float), verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write failed");
+        if(iw == 0 && wrh5_write_missing(&wrh5_ctx, &wrh5_hdr, 5, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write_missing failed");
+    }
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    free(p_data);
+
+    // Blocks: [0, 64), [64, 128), 5 missing, [133, 197), [197, 207) partial.
+    nrows = read_dataset(path_h5, "sk_tint", H5T_NATIVE_UINT64, sk_tint);
+    if(nrows != 4 || sk_tint[0] != 0 || sk_tint[1] != 64 || sk_tint[2] != 133 || sk_tint[3] != 197)
+        fatal_error(__LINE__, "sk_tint is wrong");
+    if(read_dataset(path_h5, "sk_mask", H5T_NATIVE_UINT8, mask) != 4)
+        fatal_error(__LINE__, "sk_mask has the wrong number of rows");
+    for(t = 0; t < 4; t++) {
+        if(t < 3 && mask[t * nchans + 20] != WRH5_SK_LOW)    // The partial block's lower threshold is < 0
+            fatal_error(__LINE__, "steady tone was not flagged low");
+        if(t == 1 && mask[t * nchans + 10] != WRH5_SK_HIGH)
+            fatal_error(__LINE__, "bursts were not flagged high");
+        for(c = 0; c < nchans; c++)
+            if(c != 10 && c != 20 && mask[t * nchans + c] != WRH5_SK_CLEAN)
+                others++;
+    }
+    if(others > 10)
+        fatal_error(__LINE__, "too many noise channels flagged");
+
+    // Resuming with other thresholds would mix two masks in one dataset.
+    options.resume = 1;
+    options.sk_nsigma = 2.0 * WRH5_SK_NSIGMA;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "resume accepted another sk_nsigma");
+    printf("brittany: sk OK (%ld noise block-channels flagged of %ld)\n", others, 4L * (nchans - 2));
+}
+
+
+/***
+	Memory budget: per-context usage, a reduced chunk cache, refusal and backpressure.
+***/
+typedef struct {
+    wrh5_context_t * p_wrh5_ctx;
+    double  delay;
+} closer_args_t;
+
+void * close_later(void * p_args) {
+    closer_args_t * p_closer = (closer_args_t *) p_args;
+
+    usleep((useconds_t) (p_closer->delay * 1e6));
+    if(wrh5_close(p_closer->p_wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close in the closer thread failed");
+    return NULL;
+}
+
+void test_budget(void) {
+    char             path_h5[3][512];
+    wrh5_context_t   wrh5_ctx[3];
+    wrh5_hdr_t       wrh5_hdr;
+    user_options_t   options;
+    user_chunking_t  chunking = {16, 1, 1024};
+    wrh5_budget_t    base, budget;
+    wrh5_mem_usage_t usage;
+    size_t           one_chunk = 16 * 1024 * sizeof(float), nslots, nbytes;
+    double           w0;
+    hid_t            dapl;
+    pthread_t        closer;
+    closer_args_t    closer_args;
+    struct timespec  t0, t1;
+    float            p_data[16 * 1024];
+    wrh5_pool_t      pool;
+    void *           p_held;
+    long             kk;
+
+    for(kk = 0; kk < 3; kk++)
+        sprintf(path_h5[kk], "%s/brittany_budget_%ld.h5", dir_out, kk);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nchans = 1024;
+    wrh5_hdr.nfpc = 0;
+    for(kk = 0; kk < 16 * 1024; kk++)
+        p_data[kk] = (float) kk;
+    wrh5_budget_get(&base);
+
+    /*
+     * Unlimited (default): every reservation is counted.
+     */
+    memset(&options, 0, sizeof(options));
+    options.pool_nbufs = 1;
+    options.elide_fill = 1;
+    if(wrh5_open_ext(&wrh5_ctx[0], &wrh5_hdr, path_h5[0], &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    if(wrh5_memory_usage(&wrh5_ctx[0], &usage) != 0)
+        fatal_error(__LINE__, "wrh5_memory_usage failed");
+    if(usage.pool != wrh5_ctx[0].p_pool->map_size || usage.chunk_buffer != one_chunk || usage.chunk_cache < one_chunk
+       || usage.total != usage.pool + usage.chunk_buffer + usage.chunk_cache + usage.other)
+        fatal_error(__LINE__, "per-context memory usage is wrong");
+    wrh5_budget_get(&budget);
+    if(budget.reserved != base.reserved + usage.pool + usage.chunk_buffer + usage.chunk_cache
+       || budget.nreservations != base.nreservations + 2)
+        fatal_error(__LINE__, "memory budget reservations are wrong");
+
+    /*
+     * A budget with little room left: the second context gets less chunk cache than HDF5's default.
+     */
+    wrh5_budget_set(budget.reserved + 3 * one_chunk / 2, 0.0, verbose);
+    memset(&options, 0, sizeof(options));
+    if(wrh5_open_ext(&wrh5_ctx[1], &wrh5_hdr, path_h5[1], &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext within the budget failed");
+    dapl = H5Dget_access_plist(wrh5_ctx[1].dataset_id);
+    H5Pget_chunk_cache(dapl, &nslots, &nbytes, &w0);
+    H5Pclose(dapl);
+    if(wrh5_ctx[1].chunk_cache_bytes != one_chunk || nbytes != one_chunk)
+        fatal_error(__LINE__, "the chunk cache was not reduced to one chunk");
+    if(wrh5_write(&wrh5_ctx[1], &wrh5_hdr, p_data, sizeof(p_data), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write within the budget failed");
+
+    /*
+     * No room and no wait: refused.  Then backpressure: wait until another context is closed.
+     */
+    wrh5_budget_get(&budget);
+    if(wrh5_open_ext(&wrh5_ctx[2], &wrh5_hdr, path_h5[2], &chunking, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext beyond the budget succeeded");
+    wrh5_budget_set(budget.budget, 10.0, verbose);
+    closer_args.p_wrh5_ctx = &wrh5_ctx[1];
+    closer_args.delay = 0.2;
+    pthread_create(&closer, NULL, close_later, &closer_args);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if(wrh5_open_ext(&wrh5_ctx[2], &wrh5_hdr, path_h5[2], &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext did not wait for the budget");
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_join(closer, NULL);
+    if((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9 < 0.1)
+        fatal_error(__LINE__, "wrh5_open_ext did not wait for the closed context");
+    wrh5_budget_get(&budget);
+    if(budget.nrefused != base.nrefused + 1 || budget.peak < budget.reserved || budget.reserved > budget.budget)
+        fatal_error(__LINE__, "memory budget statistics are wrong");
+    if(wrh5_write(&wrh5_ctx[2], &wrh5_hdr, p_data, sizeof(p_data), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write after waiting failed");
+    for(kk = 0; kk < 3; kk += 2)
+        if(wrh5_close(&wrh5_ctx[kk], verbose) != 0)
+            fatal_error(__LINE__, "wrh5_close failed");
+    wrh5_budget_set(0, 0.0, verbose);
+    wrh5_budget_get(&budget);
+    if(budget.reserved != base.reserved || budget.nreservations != base.nreservations)
+        fatal_error(__LINE__, "memory budget was not given back");
+
+    /*
+     * A failed open gives back what it reserved: here, the caller's pool has no buffer free for staging.
+     */
+    if(wrh5_pool_create(&pool, 16 * 1024 * sizeof(float), 1, verbose) != 0 || (p_held = wrh5_pool_get(&pool, 0)) == NULL)
+        fatal_error(__LINE__, "wrh5_pool_create failed");
+    memset(&options, 0, sizeof(options));
+    options.p_pool = &pool;
+    options.input_layout = WRH5_LAYOUT_TCI;
+    options.elide_fill = 1;
+    if(wrh5_open_ext(&wrh5_ctx[0], &wrh5_hdr, path_h5[0], &chunking, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext without a free staging buffer succeeded");
+    wrh5_budget_get(&budget);
+    if(budget.reserved != base.reserved + pool.map_size || budget.nreservations != base.nreservations + 1
+       || wrh5_ctx[0].p_chunk != NULL || wrh5_ctx[0].budget_bytes != 0)
+        fatal_error(__LINE__, "a failed open kept its memory");
+    wrh5_pool_put(&pool, p_held);
+    wrh5_pool_destroy(&pool, verbose);
+    printf("brittany: budget OK\n");
+}
+
+
+/***
+	io_uring file driver: writes in flight, flush, resume, read back.
+***/
+void test_uring(void) {
+    char             path_h5[512];
+    wrh5_context_t   wrh5_ctx;
+    wrh5_hdr_t       wrh5_hdr;
+    user_options_t   options;
+    user_chunking_t  chunking = {16, 1, 65536};
+    wrh5_io_stats_t  io_stats;
+    wrh5_mem_usage_t usage;
+    int              nchans = 65536;
+    float            *p_in, *p_tint;
+    long             ii, jj;
+
+    p_in = malloc(96L * nchans * sizeof(float));
+    p_tint = malloc(nchans * sizeof(float));
+    for(jj = 0; jj < 96L * nchans; jj++)
+        p_in[jj] = (float) (jj % 10007);
+    sprintf(path_h5, "%s/brittany_uring.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&options, 0, sizeof(options));
+    options.io_depth = 4;
+    options.io_slot_bytes = 1024 * 1024;    // Rounded up to 2 MiB: each 4 MiB chunk takes two slots
+    options.resume = 1;
+    remove(path_h5);
+
+    // First session: 64 time integrations (4 chunks), with a flush half way.
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext with io_uring failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, 32L * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(H5Fflush(wrh5_ctx.file_id, H5F_SCOPE_LOCAL) < 0)
+        fatal_error(__LINE__, "H5Fflush failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in + 32L * nchans, 32L * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_io_stats(&wrh5_ctx, &io_stats) != 0 || wrh5_memory_usage(&wrh5_ctx, &usage) != 0)
+        fatal_error(__LINE__, "wrh5_io_stats or wrh5_memory_usage failed");
+    if(io_stats.depth != 4 || io_stats.slot_bytes != WRH5_HUGEPAGE_SIZE || usage.io_queue != 4 * WRH5_HUGEPAGE_SIZE)
+        fatal_error(__LINE__, "io_uring driver geometry is wrong");
+    if(io_stats.uring && (io_stats.async_writes < 8 || io_stats.max_inflight < 1))
+        fatal_error(__LINE__, "chunks were not written through io_uring");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    // Second session (resumed): 32 more.
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext (resume) with io_uring failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in + 64L * nchans, 32L * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    for(ii = 0; ii < 96; ii++) {
+        read_tint(path_h5, ii, p_tint, 1, nchans);
+        for(jj = 0; jj < nchans; jj++)
+            if(p_tint[jj] != p_in[ii * nchans + jj])
+                fatal_error(__LINE__, "io_uring data read back does not match");
+    }
+    free(p_in);
+    free(p_tint);
+    printf("brittany: uring OK (io_uring %s, %s buffers)\n", io_stats.uring ? "on" : "off, pwrite fallback",
+           io_stats.fixed ? "registered" : "unregistered");
+}
+
+
+/***
+	Thread body of test_serve: the daemon.
+***/
+void * serve_thread(void * p_arg) {
+    user_serve_t * p_params = (user_serve_t *) p_arg;
+
+    return (void *) (long) wrh5_serve(p_params, verbose);
+}
+
+
+/***
+	Shared-memory streams: two producers (libwrh5c only) and wrh5_serve writing both files.
+***/
+void test_serve(void) {
+    char             path_h5[2][512], name[2][64];
+    wrh5c_stream_t   stream[2];
+    wrh5_shm_stats_t stats[2];
+    wrh5_hdr_t       wrh5_hdr;
+    user_chunking_t  chunking = {8, 1, 4096};
+    user_serve_t     params;
+    pthread_t        server;
+    void *           p_rc;
+    int              nchans = 4096, ndumps = 32, tints_per_dump = 4;
+    size_t           dump_bytes = (size_t) tints_per_dump * nchans * sizeof(float);
+    float            *p_slot, *p_tint;
+    long             ii, jj, kk, done[2] = {0, 0};
+
+    p_tint = malloc(nchans * sizeof(float));
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&params, 0, sizeof(params));
+    sprintf(params.prefix, "%sbrittany%d.", WRH5_SHM_PREFIX, (int) getpid());
+    params.scan_ms = 10;
+    params.burst = 2;
+    params.exit_when_idle = 1;
+    if(pthread_create(&server, NULL, serve_thread, &params) != 0)
+        fatal_error(__LINE__, "pthread_create failed");
+
+    // Small rings (4 slots) so that the producers have to wait for the daemon.
+    for(kk = 0; kk < 2; kk++) {
+        sprintf(path_h5[kk], "%s/brittany_serve_%ld.h5", dir_out, kk);
+        sprintf(name[kk], "brittany%d.beam%ld", (int) getpid(), kk);
+        remove(path_h5[kk]);
+        if(wrh5c_open(&stream[kk], name[kk], path_h5[kk], &wrh5_hdr, &chunking, dump_bytes, 4) != 0)
+            fatal_error(__LINE__, "wrh5c_open failed");
+    }
+    while(done[0] < ndumps || done[1] < ndumps) {
+        for(kk = 0; kk < 2; kk++) {
+            if(done[kk] >= ndumps)
+                continue;
+            p_slot = wrh5c_claim(&stream[kk]);
+            if(p_slot == NULL)
+                continue;
+            for(jj = 0; jj < (long) tints_per_dump * nchans; jj++)
+                p_slot[jj] = (float) (kk * 100000 + done[kk] * tints_per_dump * nchans + jj);
+            if(wrh5c_commit(&stream[kk], dump_bytes) != 0)
+                fatal_error(__LINE__, "wrh5c_commit failed");
+            done[kk] += 1;
+        }
+        usleep(100);
+    }
+    for(kk = 0; kk < 2; kk++)
+        if(wrh5c_close(&stream[kk], 30.0, &stats[kk]) != 0)
+            fatal_error(__LINE__, "wrh5c_close failed");
+    pthread_join(server, &p_rc);
+    if(p_rc != NULL)
+        fatal_error(__LINE__, "wrh5_serve failed");
+
+    for(kk = 0; kk < 2; kk++) {
+        if(stats[kk].dumps != (uint64_t) ndumps || stats[kk].bytes != (uint64_t) ndumps * dump_bytes
+           || stats[kk].max_backlog > 4)
+            fatal_error(__LINE__, "shared-memory stream statistics are wrong");
+        for(ii = 0; ii < (long) ndumps * tints_per_dump; ii++) {
+            read_tint(path_h5[kk], ii, p_tint, 1, nchans);
+            for(jj = 0; jj < nchans; jj++)
+                if(p_tint[jj] != (float) (kk * 100000 + ii * nchans + jj))
+                    fatal_error(__LINE__, "shared-memory stream data read back does not match");
+        }
+    }
+    free(p_tint);
+    printf("brittany: serve OK (%ld + %ld full claims, max backlog %ld)\n", (long) stats[0].full_claims,
+           (long) stats[1].full_claims, (long) (stats[0].max_backlog > stats[1].max_backlog
+                                                ? stats[0].max_backlog : stats[1].max_backlog));
+}
+
+
+/***
+	Writer manager: three streams (worker-encoded deflate, worker-gathered raw, wrh5_write) on one worker pool.
+***/
+void test_manager(void) {
+    char                 path_h5[3][512];
+    wrh5_manager_t       mgr;
+    user_manager_t       params;
+    user_options_t       options[3];
+    user_chunking_t      chunking = {8, 1, 1024};
+    wrh5_hdr_t           wrh5_hdr;
+    wrh5_manager_stats_t stats[3], totals;
+    int                  stream[3];
+    int                  nifs = 2, nchans = 3000, ndumps = 10, tints_per_dump = 12;
+    size_t               dump_elems = (size_t) tints_per_dump * nifs * nchans;
+    float                *p_dump, *p_tint;
+    hid_t                file_id, dataset_id;
+    hsize_t              storage;
+    long                 ii, jj, kk, dd;
+
+    p_dump = malloc(dump_elems * sizeof(float));
+    p_tint = malloc(nifs * nchans * sizeof(float));
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&params, 0, sizeof(params));
+    params.nthreads = 4;
+    params.queue_depth = 3;
+    if(wrh5_manager_create(&mgr, &params, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_manager_create failed");
+
+    memset(options, 0, sizeof(options));
+    options[0].deflate_level = 4;       // Chunks deflated by the workers
+    options[2].elide_fill = 1;          // Needs wrh5_write: stored by the I/O thread alone
+    for(kk = 0; kk < 3; kk++) {
+        sprintf(path_h5[kk], "%s/brittany_manager_%ld.h5", dir_out, kk);
+        if(wrh5_manager_open(&mgr, &stream[kk], &wrh5_hdr, path_h5[kk], &chunking, NULL, &options[kk],
+                             dump_elems * sizeof(float)) != 0)
+            fatal_error(__LINE__, "wrh5_manager_open failed");
+    }
+
+    // 12 time integrations per dump: one whole chunk row of 8 each, the other rows straddle two dumps.
+    for(dd = 0; dd < ndumps; dd++)
+        for(kk = 0; kk < 3; kk++) {
+            float * p_fill = (kk == 1) ? wrh5_manager_get_buffer(&mgr, stream[kk]) : p_dump;
+
+            if(p_fill == NULL)
+                fatal_error(__LINE__, "wrh5_manager_get_buffer failed");
+            for(jj = 0; jj < (long) dump_elems; jj++)
+                p_fill[jj] = (float) (kk * 100 + (dd * dump_elems + jj) % 13);
+            if(kk == 1) {
+                if(wrh5_manager_submit(&mgr, stream[kk], p_fill, dump_elems * sizeof(float)) != 0)
+                    fatal_error(__LINE__, "wrh5_manager_submit failed");
+            } else if(wrh5_manager_write(&mgr, stream[kk], p_fill, dump_elems * sizeof(float)) != 0)
+                fatal_error(__LINE__, "wrh5_manager_write failed");
+        }
+    for(kk = 0; kk < 3; kk++)
+        if(wrh5_manager_drain(&mgr, stream[kk]) != 0 || wrh5_manager_stats(&mgr, stream[kk], &stats[kk]) != 0
+           || wrh5_manager_close(&mgr, stream[kk]) != 0)
+            fatal_error(__LINE__, "wrh5_manager_drain, wrh5_manager_stats or wrh5_manager_close failed");
+    if(wrh5_manager_stats(&mgr, -1, &totals) != 0 || wrh5_manager_destroy(&mgr) != 0)
+        fatal_error(__LINE__, "wrh5_manager_stats or wrh5_manager_destroy failed");
+    if(totals.dumps != (unsigned long) (3 * ndumps) || stats[2].encoded_dumps != 0
+       || stats[0].encoded_dumps != (unsigned long) ndumps
+       || stats[0].chunks != (unsigned long) (ndumps * 2 * 3) || totals.max_queued > 3)
+        fatal_error(__LINE__, "writer manager statistics are wrong");
+
+    // Read back, and check that the deflate stream is compressed.
+    for(kk = 0; kk < 3; kk++)
+        for(ii = 0; ii < (long) ndumps * tints_per_dump; ii++) {
+            read_tint(path_h5[kk], ii, p_tint, nifs, nchans);
+            for(jj = 0; jj < (long) nifs * nchans; jj++)
+                if(p_tint[jj] != (float) (kk * 100 + (ii * nifs * nchans + jj) % 13))
+                    fatal_error(__LINE__, "writer manager data read back does not match");
+        }
+    file_id = H5Fopen(path_h5[0], H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    storage = H5Dget_storage_size(dataset_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    if(storage * 4 > (hsize_t) ndumps * dump_elems * sizeof(float))
+        fatal_error(__LINE__, "the deflate stream is not compressed");
+    free(p_dump);
+    free(p_tint);
+    printf("brittany: manager OK (%ld chunks encoded, %ld stolen, deflate ratio %.1f)\n", totals.chunks, totals.steals,
+           (double) ndumps * dump_elems * sizeof(float) / (double) storage);
+}
+
+
+/***
+	Write one part of test_vds: channels [chan0, chan0 + nchans) of the whole band, time integrations [tint0, tint0 + ntints).
+***/
+void write_vds_part(char * path_h5, int resume, int chan0, int nchans, int tint0, int ntints, int nifs, int nchans_all) {
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    user_chunking_t chunking = {4, 1, 20};
+    float           *p_in;
+    long            ii, jj, kk;
+
+    p_in = malloc((size_t) ntints * nifs * nchans * sizeof(float));
+    for(ii = 0; ii < ntints; ii++)
+        for(jj = 0; jj < nifs; jj++)
+            for(kk = 0; kk < nchans; kk++)
+                p_in[(ii * nifs + jj) * nchans + kk] = (float) (((tint0 + ii) * nifs + jj) * nchans_all + chan0 + kk + 1);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 20;
+    wrh5_hdr.fch1 += chan0 * wrh5_hdr.foff;
+    memset(&options, 0, sizeof(options));
+    options.resume = resume;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, (size_t) ntints * nifs * nchans * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    free(p_in);
+}
+
+
+/***
+	Check the master of test_vds: ntints time integrations, part k filled up to part_tints[k].
+***/
+void check_vds(char * path_master, int ntints, int nifs, int nchans_all, int * p_chan0, int * p_part_tints, int nparts) {
+    hid_t   file_id, dataset_id, space_id;
+    hsize_t dims[NDIMS];
+    float   *p_out, expected;
+    double  fch1;
+    int     nchans, kk;
+    long    ii, jj, cc;
+    wrh5_hdr_t wrh5_hdr;
+
+    file_id = H5Fopen(path_master, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    if(dataset_id < 0)
+        fatal_error(__LINE__, "master has no dataset data");
+    space_id = H5Dget_space(dataset_id);
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    if(dims[0] != (hsize_t) ntints || dims[1] != (hsize_t) nifs || dims[2] != (hsize_t) nchans_all)
+        fatal_error(__LINE__, "master shape is wrong");
+    make_voyager_1_metadata(&wrh5_hdr);
+    if(wrh5_get_attr(dataset_id, "nchans", H5T_NATIVE_INT, &nchans) != 0 || nchans != nchans_all
+       || wrh5_get_attr(dataset_id, "fch1", H5T_NATIVE_DOUBLE, &fch1) != 0 || fch1 != wrh5_hdr.fch1)
+        fatal_error(__LINE__, "master nchans or fch1 is wrong");
+    p_out = malloc((size_t) ntints * nifs * nchans_all * sizeof(float));
+    if(H5Dread(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_out) < 0)
+        fatal_error(__LINE__, "H5Dread of the master failed");
+    for(cc = 0; cc < nchans_all; cc++) {
+        for(kk = nparts - 1; kk > 0 && cc < p_chan0[kk]; kk--)
+            ;
+        for(ii = 0; ii < ntints; ii++)
+            for(jj = 0; jj < nifs; jj++) {
+                expected = (ii < p_part_tints[kk]) ? (float) ((ii * nifs + jj) * nchans_all + cc + 1) : 0.0;
+                if(p_out[(ii * nifs + jj) * nchans_all + cc] != expected)
+                    fatal_error(__LINE__, "master data differs from the parts");
+            }
+    }
+    free(p_out);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+}
+
+
+/***
+	Virtual dataset master: three subband parts given out of order, then one part grows.
+	Parts that are not adjacent, or quantized, are refused.
+***/
+void test_vds(void) {
+    char    path_part[3][512], path_master[512];
+    char    *p_paths[3];
+    int     chan0[3] = {0, 100, 160}, nchans[3] = {100, 60, 40}, part_tints[3] = {12, 8, 12};
+    int     nifs = 2, nchans_all = 200, kk;
+    float   tint[16];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+
+    for(kk = 0; kk < 3; kk++) {
+        sprintf(path_part[kk], "%s/brittany_vds_part%d.h5", dir_out, kk);
+        remove(path_part[kk]);
+        write_vds_part(path_part[kk], 0, chan0[kk], nchans[kk], 0, part_tints[kk], nifs, nchans_all);
+    }
+    sprintf(path_master, "%s/brittany_vds.h5", dir_out);
+    p_paths[0] = path_part[2];
+    p_paths[1] = path_part[0];
+    p_paths[2] = path_part[1];
+    if(wrh5_vds_create(path_master, p_paths, 3, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_vds_create failed");
+    check_vds(path_master, 12, nifs, nchans_all, chan0, part_tints, 3);
+
+    // The middle part grows past the others: the master follows without being written again.
+    write_vds_part(path_part[1], 1, chan0[1], nchans[1], part_tints[1], 8, nifs, nchans_all);
+    part_tints[1] += 8;
+    check_vds(path_master, 16, nifs, nchans_all, chan0, part_tints, 3);
+
+    // A gap in frequency is refused.
+    p_paths[0] = path_part[0];
+    p_paths[1] = path_part[2];
+    if(wrh5_vds_create(path_master, p_paths, 2, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_vds_create accepted parts that are not adjacent");
+
+    // A quantized part is refused.
+    sprintf(path_part[0], "%s/brittany_vds_quant.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = 1;
+    wrh5_hdr.nchans = 16;
+    wrh5_hdr.nfpc = 0;
+    memset(&options, 0, sizeof(options));
+    options.quantize = WRH5_QUANT_UINT8;
+    for(kk = 0; kk < 16; kk++)
+        tint[kk] = get_random(1.0, 2.0);
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_part[0], NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, tint, sizeof(tint), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    p_paths[0] = path_part[0];
+    if(wrh5_vds_create(path_master, p_paths, 1, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_vds_create accepted a quantized part");
+    printf("brittany: vds OK\n");
+}
+
+
+/***
+	Contiguous layout: copied dumps, in-place time integrations, missing ones and a short last session.
+***/
+void test_contiguous(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    hid_t           file_id, dataset_id, dcpl, space_id;
+    hsize_t         dims[NDIMS];
+    unsigned char   valid[8];
+    int             nifs = 2, nchans = 1000, ntints = 20;
+    long            jj, nelems = nifs * nchans;
+    float           *p_in, *p_out, *p_tints;
+
+    p_in = malloc(ntints * nelems * sizeof(float));
+    p_out = malloc(ntints * nelems * sizeof(float));
+    for(jj = 0; jj < ntints * nelems; jj++)
+        p_in[jj] = get_random(1.0, 2.0);
+    sprintf(path_h5, "%s/brittany_contiguous.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&options, 0, sizeof(options));
+    options.contiguous_tints = ntints;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+
+    // 5 copied, 6 in place, 2 missing, 4 in place; the last 3 are never written.
+    if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, 5 * nelems * sizeof(float), verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write failed");
+    p_tints = wrh5_mmap_next(&wrh5_ctx, 6, verbose);
+    if(p_tints == NULL)
+        fatal_error(__LINE__, "wrh5_mmap_next failed");
+    memcpy(p_tints, p_in + 5 * nelems, 6 * nelems * sizeof(float));
+    if(wrh5_write_missing(&wrh5_ctx, &wrh5_hdr, 2, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write_missing failed");
+    p_tints = wrh5_mmap_next(&wrh5_ctx, 4, verbose);
+    if(p_tints == NULL)
+        fatal_error(__LINE__, "wrh5_mmap_next failed");
+    memcpy(p_tints, p_in + 13 * nelems, 4 * nelems * sizeof(float));
+    if(wrh5_mmap_next(&wrh5_ctx, 4, verbose) != NULL)
+        fatal_error(__LINE__, "wrh5_mmap_next went past contiguous_tints");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+
+    // Contiguous, page aligned, full size; the missing time integrations read back as 0.
+    file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    dcpl = H5Dget_create_plist(dataset_id);
+    if(H5Pget_layout(dcpl) != H5D_CONTIGUOUS || H5Dget_offset(dataset_id) % 4096 != 0)
+        fatal_error(__LINE__, "data is not contiguous and page aligned");
+    H5Pclose(dcpl);
+    space_id = H5Dget_space(dataset_id);
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    if(dims[0] != (hsize_t) ntints || dims[1] != (hsize_t) nifs || dims[2] != (hsize_t) nchans)
+        fatal_error(__LINE__, "data shape is wrong");
+    if(H5Dread(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, p_out) < 0)
+        fatal_error(__LINE__, "H5Dread failed");
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    for(jj = 0; jj < ntints * nelems; jj++)
+        if(p_out[jj] != ((jj < 11 * nelems || (jj >= 13 * nelems && jj < 17 * nelems)) ? p_in[jj] : 0.0))
+            fatal_error(__LINE__, "data differs from what was written");
+    if(read_dataset(path_h5, "valid", H5T_NATIVE_UINT8, valid) != 3 || valid[0] != 0xFF || valid[1] != 0xE7 || valid[2] != 0x01)
+        fatal_error(__LINE__, "valid bitmap is wrong");
+
+    // Options that need chunks are refused.
+    options.deflate_level = 4;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext accepted contiguous_tints with deflate_level");
+    free(p_in);
+    free(p_out);
+    printf("brittany: contiguous OK\n");
+}
+
+
+/***
+	Read a whole text file (NULL if missing).  The caller frees it.
+***/
+char * read_text(const char * path) {
+    FILE    *p_file;
+    char    *p_text;
+    long    nbytes;
+
+    p_file = fopen(path, "r");
+    if(p_file == NULL)
+        return NULL;
+    fseek(p_file, 0, SEEK_END);
+    nbytes = ftell(p_file);
+    rewind(p_file);
+    p_text = calloc(nbytes + 1, 1);
+    if(fread(p_text, 1, nbytes, p_file) != (size_t) nbytes)
+        fatal_error(__LINE__, "fread failed");
+    fclose(p_file);
+    return p_text;
+}
+
+
+/***
+	Log sink for test_trace: count the messages of each level.
+***/
+void count_messages(int level, const char * msg, void * p_arg) {
+    (void) msg;
+    ((int *) p_arg)[level] += 1;
+}
+
+
+/***
+	Trace a small recording, export it as Chrome trace JSON and route the library's messages to a sink.
+***/
+void test_trace(void) {
+    char            path_h5[512], path_json[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_chunking_t chunking = {4, 1, 1000};
+    int             nifs = 1, nchans = 1000, ntints = 16;
+    int             counts[WRH5_LOG_NONE] = {0, 0, 0};
+    long            jj;
+    float           *p_data;
+    char            *p_json;
+
+    p_data = malloc(ntints * nifs * nchans * sizeof(float));
+    for(jj = 0; jj < ntints * nifs * nchans; jj++)
+        p_data[jj] = get_random(1.0, 2.0);
+    sprintf(path_h5, "%s/brittany_trace.h5", dir_out);
+    sprintf(path_json, "%s/brittany_trace.json", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    if(wrh5_trace_start(1024, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_trace_start failed");
+    wrh5_trace_thread_name("brittany \"main\"");    // Escaped in the JSON
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, NULL, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    for(jj = 0; jj < ntints / 4; jj++)
+        if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_data + jj * 4 * nifs * nchans, 4 * nifs * nchans * sizeof(float), verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    wrh5_trace_stop();
+    if(wrh5_trace_dump(path_json, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_trace_dump failed");
+
+    // Every traced call is there, on the named thread.
+    p_json = read_text(path_json);
+    if(p_json == NULL)
+        fatal_error(__LINE__, "cannot open the trace");
+    if(strstr(p_json, "\"traceEvents\"") == NULL || strstr(p_json, "\"brittany \\\"main\\\"\"") == NULL
+       || strstr(p_json, "\"name\": \"wrh5_write\"") == NULL || strstr(p_json, "\"name\": \"H5Dwrite\"") == NULL
+       || strstr(p_json, "\"name\": \"H5Fclose\"") == NULL || strstr(p_json, "\"overwritten\": 0") == NULL)
+        fatal_error(__LINE__, "the trace misses events");
+    free(p_json);
+
+    // The sink gets what passes the level; restore the default.
+    wrh5_log_set(count_messages, counts, WRH5_LOG_WARNING);
+    wrh5_info("brittany: dropped\n");
+    wrh5_warning(__FILE__, __LINE__, "brittany: counted");
+    if(wrh5_trace_dump("/nonexistent/brittany_trace.json", 0) == 0)
+        fatal_error(__LINE__, "wrh5_trace_dump wrote into a missing directory");
+    wrh5_log_set(NULL, NULL, WRH5_LOG_INFO);
+    if(counts[WRH5_LOG_INFO] != 0 || counts[WRH5_LOG_WARNING] != 1 || counts[WRH5_LOG_ERROR] != 1)
+        fatal_error(__LINE__, "the log sink counts are wrong");
+    free(p_data);
+    printf("brittany: trace OK\n");
+}
+
+/***
+	Export live metrics while writing a file: formatted, through the Unix socket and in the textfile.
+***/
+void test_metrics(void) {
+    char            path_h5[512], line[768];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_chunking_t chunking = {4, 1, 1000};
+    user_metrics_t  params;
+    struct sockaddr_un addr;
+    int             nifs = 1, nchans = 1000, fd;
+    long            jj, nread;
+    float           *p_data;
+    char            *p_text;
+
+    p_data = malloc(4 * nifs * nchans * sizeof(float));
+    for(jj = 0; jj < 4 * nifs * nchans; jj++)
+        p_data[jj] = get_random(1.0, 2.0);
+    sprintf(path_h5, "%s/brittany_metrics.h5", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&params, 0, sizeof(params));
+    if(snprintf(params.textfile, sizeof(params.textfile), "%s/brittany_metrics.prom", dir_out) >= (int) sizeof(params.textfile)
+       || snprintf(params.socket_path, sizeof(params.socket_path), "%s/brittany_metrics.sock", dir_out) >= (int) sizeof(params.socket_path))
+        fatal_error(__LINE__, "output directory path is too long for the metrics paths");
+    params.interval_ms = 50;
+    if(wrh5_metrics_start(&params, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_metrics_start failed");
+
+    // 4 dumps of 4 time integrations, then 2 missing.
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, NULL, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open_ext failed");
+    for(jj = 0; jj < 4; jj++)
+        if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_data, 4 * nifs * nchans * sizeof(float), verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_write_missing(&wrh5_ctx, &wrh5_hdr, 2, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write_missing failed");
+    p_text = malloc(1 << 16);
+    if(wrh5_metrics_format(p_text, 100) < 100)
+        fatal_error(__LINE__, "wrh5_metrics_format did not report the whole length");
+    if(wrh5_metrics_format(p_text, 1 << 16) >= (1 << 16) || strstr(p_text, "wrh5_files_open 1\n") == NULL)
+        fatal_error(__LINE__, "wrh5_metrics_format failed");
+    sprintf(line, "wrh5_dumps_total{file=\"%s\"} 4\n", path_h5);
+    if(strstr(p_text, line) == NULL)
+        fatal_error(__LINE__, "wrh5_dumps_total is wrong");
+    sprintf(line, "wrh5_time_integrations_total{file=\"%s\"} 16\n", path_h5);
+    if(strstr(p_text, line) == NULL)
+        fatal_error(__LINE__, "wrh5_time_integrations_total is wrong");
+    sprintf(line, "wrh5_missing_time_integrations_total{file=\"%s\"} 2\n", path_h5);
+    if(strstr(p_text, line) == NULL)
+        fatal_error(__LINE__, "wrh5_missing_time_integrations_total is wrong");
+    sprintf(line, "wrh5_write_duration_seconds_bucket{file=\"%s\",le=\"+Inf\"} 4\n", path_h5);
+    if(strstr(p_text, line) == NULL)
+        fatal_error(__LINE__, "wrh5_write_duration_seconds is wrong");
+    sprintf(line, "wrh5_write_in_progress_seconds{file=\"%s\"} 0.000000\n", path_h5);
+    if(strstr(p_text, line) == NULL)
+        fatal_error(__LINE__, "wrh5_write_in_progress_seconds is wrong");
+
+    // Scrape the socket over HTTP.
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, params.socket_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+        fatal_error(__LINE__, "cannot connect to the metrics socket");
+    sprintf(line, "GET /metrics HTTP/1.0\r\n\r\n");
+    if(write(fd, line, strlen(line)) != (ssize_t) strlen(line))
+        fatal_error(__LINE__, "cannot send the request");
+    nread = 0;
+    for(jj = 1; jj > 0 && nread < (1 << 16) - 1; nread += jj)
+        jj = read(fd, p_text + nread, (1 << 16) - 1 - nread);
+    close(fd);
+    p_text[nread] = '\0';
+    if(strncmp(p_text, "HTTP/1.0 200 OK\r\n", 17) != 0 || strstr(p_text, "# TYPE wrh5_bytes_written_total counter\n") == NULL)
+        fatal_error(__LINE__, "the socket answer is wrong");
+    free(p_text);
+
+    // Closed: gone from the textfile, which is rewritten every interval.
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    usleep(200000);
+    p_text = read_text(params.textfile);
+    if(p_text == NULL || strstr(p_text, "wrh5_files_open 0\n") == NULL || strstr(p_text, "wrh5_files_closed_total 1\n") == NULL)
+        fatal_error(__LINE__, "the textfile is wrong");
+    free(p_text);
+    if(wrh5_metrics_stop(verbose) != 0)
+        fatal_error(__LINE__, "wrh5_metrics_stop failed");
+    if(access(params.socket_path, F_OK) == 0)
+        fatal_error(__LINE__, "the metrics socket was not removed");
+    free(p_data);
+    printf("brittany: metrics OK\n");
+}
+
+/***
+	Record a write pattern (data of one write in 2), replay it as recorded and with deflate, paced.
+***/
+void test_record(void) {
+    char                path_h5[512], path_rec[512], path_out[512];
+    wrh5_context_t      wrh5_ctx;
+    wrh5_hdr_t          wrh5_hdr;
+    user_chunking_t     chunking = {4, 1, 500};
+    user_replay_t       params;
+    wrh5_replay_stats_t stats;
+    hid_t               file_id, dataset_id, dcpl;
+    int                 nifs = 2, nchans = 1000, ndumps = 6, tints_per_dump = 4;
+    long                jj, dd, dump_elems = tints_per_dump * nifs * nchans;
+    float               *p_in, *p_out;
+    unsigned char       valid[4];
+
+    p_in = malloc(ndumps * dump_elems * sizeof(float));
+    p_out = malloc((ndumps * tints_per_dump + 2) * nifs * nchans * sizeof(float));
+    for(jj = 0; jj < ndumps * dump_elems; jj++)
+        p_in[jj] = get_random(1.0, 2.0);
+    sprintf(path_h5, "%s/brittany_record.h5", dir_out);
+    sprintf(path_rec, "%s/brittany_record.rec", dir_out);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+
+    // Record: 6 dumps, 2 missing time integrations, close.
+    if(wrh5_record_start(path_rec, 2, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_record_start failed");
+    if(wrh5_open(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_open failed");
+    for(dd = 0; dd < ndumps; dd++)
+        if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in + dd * dump_elems, dump_elems * sizeof(float), verbose) != 0)
+            fatal_error(__LINE__, "wrh5_write failed");
+    if(wrh5_write_missing(&wrh5_ctx, &wrh5_hdr, 2, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_write_missing failed");
+    if(wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_close failed");
+    if(wrh5_record_stop(verbose) != 0)
+        fatal_error(__LINE__, "wrh5_record_stop failed");
+
+    // Replay as fast as possible: dumps 0, 2, 4 were sampled; 1, 3, 5 replay the sample before them.
+    memset(&params, 0, sizeof(params));
+    if(snprintf(params.out_dir, sizeof(params.out_dir), "%s/brittany_replay", dir_out) >= (int) sizeof(params.out_dir))
+        fatal_error(__LINE__, "output directory path is too long for the replay directory");
+    mkdir(params.out_dir, 0755);
+    sprintf(path_out, "%s/brittany_record.h5", params.out_dir);
+    if(wrh5_replay(path_rec, &params, &stats, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_replay failed");
+    if(stats.opens != 1 || stats.closes != 1 || stats.writes != (unsigned long) ndumps || stats.errors != 0
+       || stats.bytes != (double) (ndumps * dump_elems * sizeof(float)) || stats.lat_max <= 0.0 || stats.rec_max <= 0.0)
+        fatal_error(__LINE__, "wrh5_replay statistics are wrong");
+    if(read_dataset(path_out, "data", H5T_NATIVE_FLOAT, p_out) != ndumps * tints_per_dump + 2)
+        fatal_error(__LINE__, "the replayed file has the wrong shape");
+    for(dd = 0; dd < ndumps; dd++)
+        if(memcmp(p_out + dd * dump_elems, p_in + (dd - dd % 2) * dump_elems, dump_elems * sizeof(float)) != 0)
+            fatal_error(__LINE__, "the replayed data differs from the samples");
+    if(read_dataset(path_out, "valid", H5T_NATIVE_UINT8, valid) != 4 || valid[0] != 0xFF || valid[2] != 0xFF || valid[3] != 0x00)
+        fatal_error(__LINE__, "the replayed valid bitmap is wrong");
+
+    // Replay paced, with deflate instead of the recorded configuration.
+    params.paced = 1;
+    params.deflate_level = 4;
+    if(wrh5_replay(path_rec, &params, &stats, verbose) != 0 || stats.seconds < stats.recorded_seconds * 0.9)
+        fatal_error(__LINE__, "paced wrh5_replay failed");
+    file_id = H5Fopen(path_out, H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    dcpl = H5Dget_create_plist(dataset_id);
+    if(H5Pget_nfilters(dcpl) != 1 || H5Pget_filter2(dcpl, 0, NULL, NULL, NULL, 0, NULL, NULL) != H5Z_FILTER_DEFLATE)
+        fatal_error(__LINE__, "the replay did not use deflate");
+    H5Pclose(dcpl);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    free(p_in);
+    free(p_out);
+    printf("brittany: record OK\n");
+}
+
+/***
+	test_realtime: a producer writing dumps [first, end) to a writer manager stream.
+***/
+typedef struct {
+    wrh5_manager_t * p_mgr;
+    int     stream;
+    float * p_dumps;        // Consecutive dumps of dump_elems floats
+    size_t  dump_elems;
+    int     first;          // Dumps written: [first, end)
+    int     end;
+    int     threaded;       // 1: rt_stall starts a producer thread and waits for it to block; 0: rt_stall is the producer
+    pthread_t thread;       // The producer thread
+    volatile int nwritten;  // Dumps written so far
+    double  max_seconds;    // Longest wrh5_manager_write call
+} rt_writer_t;
+
+void * rt_write(void * p_arg) {
+    rt_writer_t *   p_w = (rt_writer_t *) p_arg;
+    struct timespec t0, t1;
+    double          seconds;
+    int             dd;
+
+    for(dd = p_w->first; dd < p_w->end; dd++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if(wrh5_manager_write(p_w->p_mgr, p_w->stream, p_w->p_dumps + dd * p_w->dump_elems,
+                              p_w->dump_elems * sizeof(float)) != 0)
+            fatal_error(__LINE__, "wrh5_manager_write failed");
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        seconds = (double) (t1.tv_sec - t0.tv_sec) + 1e-9 * (double) (t1.tv_nsec - t0.tv_nsec);
+        if(seconds > p_w->max_seconds)
+            p_w->max_seconds = seconds;
+        p_w->nwritten += 1;
+    }
+    return NULL;
+}
+
+
+/***
+	H5Literate callback: while it runs, it holds the HDF5 library lock, so the manager's I/O thread is stalled.
+***/
+herr_t rt_stall(hid_t group_id, const char * name, const H5L_info_t * p_info, void * p_arg) {
+    rt_writer_t * p_w = (rt_writer_t *) p_arg;
+
+    (void) group_id;
+    (void) name;
+    (void) p_info;
+    if(!p_w->threaded)
+        rt_write(p_w);
+    else {
+        if(pthread_create(&p_w->thread, NULL, rt_write, p_w) != 0)
+            fatal_error(__LINE__, "pthread_create failed");
+        while(p_w->nwritten < 2)
+            usleep(1000);
+        usleep(100000);     // The producer waits for a buffer
+    }
+    return 1;
+}
+
+
+/***
+	Real-time manager policies while the I/O thread is stalled (a disk stall): drop newest, drop oldest, degrade.
+***/
+void test_realtime(void) {
+    char                 path_h5[512], path_lock[512];
+    wrh5_manager_t       mgr;
+    user_manager_t       params;
+    user_options_t       options;
+    user_chunking_t      chunking;
+    wrh5_hdr_t           wrh5_hdr;
+    wrh5_manager_stats_t stats;
+    rt_writer_t          writer;
+    hid_t                file_id, dataset_id;
+    hsize_t              offset[3] = {0, 0, 0};
+    unsigned             mask2, mask4;
+    int                  nchans = 1000, ndumps = 6, tints_per_dump = 4, policy;
+    size_t               dump_elems = (size_t) tints_per_dump * nchans;
+    float                *p_dumps, *p_tint;
+    unsigned char        valid[3];
+    long                 ii, jj, nmissing;
+
+    p_dumps = malloc(ndumps * dump_elems * sizeof(float));
+    p_tint = malloc(nchans * sizeof(float));
+    for(jj = 0; jj < (long) (ndumps * dump_elems); jj++)
+        p_dumps[jj] = (float) (jj % 13 + jj / dump_elems);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = 1;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    chunking.n_time = tints_per_dump;
+    chunking.n_nifs = 1;
+    chunking.n_fine_chan = nchans;
+    sprintf(path_lock, "%s/brittany_realtime_lock.h5", dir_out);
+    file_id = H5Fcreate(path_lock, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    H5Gclose(H5Gcreate(file_id, "lock", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT));
+    H5Fclose(file_id);
+
+    for(policy = WRH5_RT_DROP_NEWEST; policy <= WRH5_RT_DEGRADE; policy++) {
+        memset(&params, 0, sizeof(params));
+        params.nthreads = 2;
+        params.queue_depth = 2;
+        params.rt_policy = policy;
+        params.rt_budget_ms = (policy == WRH5_RT_DEGRADE) ? 5000.0 : 200.0;
+        memset(&options, 0, sizeof(options));
+        options.deflate_level = (policy == WRH5_RT_DEGRADE) ? 4 : 0;
+        sprintf(path_h5, "%s/brittany_realtime_%d.h5", dir_out, policy);
+        if(wrh5_manager_create(&mgr, &params, verbose) != 0)
+            fatal_error(__LINE__, "wrh5_manager_create failed");
+        memset(&writer, 0, sizeof(writer));
+        writer.p_mgr = &mgr;
+        writer.p_dumps = p_dumps;
+        writer.dump_elems = dump_elems;
+        if(wrh5_manager_open(&mgr, &writer.stream, &wrh5_hdr, path_h5, &chunking, NULL, &options,
+                             dump_elems * sizeof(float)) != 0)
+            fatal_error(__LINE__, "wrh5_manager_open failed");
+
+        // Dumps 0-3 while the I/O thread is stalled (for degrade, until the producer waits for a buffer).
+        writer.end = 4;
+        writer.threaded = (policy == WRH5_RT_DEGRADE);
+        file_id = H5Fopen(path_lock, H5F_ACC_RDONLY, H5P_DEFAULT);
+        if(H5Literate(file_id, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, rt_stall, &writer) < 0)
+            fatal_error(__LINE__, "H5Literate failed");
+        H5Fclose(file_id);
+        if(writer.threaded)
+            pthread_join(writer.thread, NULL);
+
+        // Then dumps 4-5 to an empty queue.
+        if(wrh5_manager_drain(&mgr, writer.stream) != 0)
+            fatal_error(__LINE__, "wrh5_manager_drain failed");
+        writer.first = 4;
+        writer.end = ndumps;
+        writer.threaded = 0;
+        rt_write(&writer);
+        if(wrh5_manager_drain(&mgr, writer.stream) != 0 || wrh5_manager_stats(&mgr, writer.stream, &stats) != 0
+           || wrh5_manager_close(&mgr, writer.stream) != 0
+           || wrh5_manager_destroy(&mgr) != 0)
+            fatal_error(__LINE__, "wrh5_manager_drain, wrh5_manager_stats, wrh5_manager_close or wrh5_manager_destroy failed");
+
+        // Dropped dumps: 2 (dump 2 and 3, or two of 0-2 for drop oldest), each after the budget, none for degrade.
+        if(policy == WRH5_RT_DEGRADE) {
+            if(stats.dropped_dumps != 0 || stats.dumps != (unsigned long) ndumps || stats.raw_dumps < 1 || stats.raw_dumps > 2
+               || stats.max_wait_seconds < 0.05)
+                fatal_error(__LINE__, "degrade policy statistics are wrong");
+        } else if(stats.dropped_dumps != 2 || stats.dropped_tints != 2 * (unsigned long) tints_per_dump || stats.dumps != 4
+                  || stats.max_wait_seconds < 0.19 || writer.max_seconds < 0.19 || writer.max_seconds > 2.0)
+            fatal_error(__LINE__, "drop policy statistics are wrong");
+
+        // Every time integration is either missing or its dump's data.
+        nmissing = 0;
+        if(policy != WRH5_RT_DEGRADE && read_dataset(path_h5, "valid", H5T_NATIVE_UINT8, valid) != 3)
+            fatal_error(__LINE__, "the valid dataset is missing");
+        for(ii = 0; ii < (long) ndumps * tints_per_dump; ii++) {
+            if(policy != WRH5_RT_DEGRADE && !(valid[ii / 8] & (1 << (ii % 8)))) {
+                nmissing += 1;
+                continue;
+            }
+            read_tint(path_h5, ii, p_tint, 1, nchans);
+            for(jj = 0; jj < nchans; jj++)
+                if(p_tint[jj] != p_dumps[ii * nchans + jj])
+                    fatal_error(__LINE__, "real-time manager data read back does not match");
+        }
+        if(nmissing != ((policy == WRH5_RT_DEGRADE) ? 0 : 2 * tints_per_dump))
+            fatal_error(__LINE__, "wrong number of missing time integrations");
+        if(policy == WRH5_RT_DROP_NEWEST && (valid[0] != 0xFF || valid[1] != 0x00 || valid[2] != 0xFF))
+            fatal_error(__LINE__, "drop newest did not drop dumps 2 and 3");
+        if(policy == WRH5_RT_DROP_OLDEST && (valid[1] & 0xF0) != 0xF0)
+            fatal_error(__LINE__, "drop oldest dropped dump 3");
+
+        // Degrade: dump 2 (the producer waited for its buffer) is stored raw, dump 4 (empty queue) compressed.
+        if(policy == WRH5_RT_DEGRADE) {
+            file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+            dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+            offset[0] = 2 * tints_per_dump;
+            H5Dget_chunk_info_by_coord(dataset_id, offset, &mask2, NULL, NULL);
+            offset[0] = 4 * tints_per_dump;
+            H5Dget_chunk_info_by_coord(dataset_id, offset, &mask4, NULL, NULL);
+            H5Dclose(dataset_id);
+            H5Fclose(file_id);
+            if(mask2 != 1 || mask4 != 0)
+                fatal_error(__LINE__, "degrade did not store the dump raw, then compressed again");
+        }
+    }
+    free(p_dumps);
+    free(p_tint);
+    printf("brittany: realtime OK\n");
+}
+
+/***
+	Placement: CPU and node lists, pinned manager threads, per-thread CPU time, and graceful fallbacks.
+***/
+void test_placement(void) {
+    char                 path_h5[512];
+    wrh5_manager_t       mgr;
+    user_manager_t       params;
+    user_options_t       options;
+    user_chunking_t      chunking = {8, 1, 1000};
+    wrh5_hdr_t           wrh5_hdr;
+    wrh5_manager_stats_t totals;
+    wrh5_thread_stats_t  threads[4];
+    wrh5_context_t       wrh5_ctx;
+    uint64_t             mask[2];
+    int                  stream, nthreads, nchans = 1000, ndumps = 20, tints_per_dump = 16;
+    size_t               dump_elems = (size_t) tints_per_dump * nchans;
+    float                *p_dump;
+    long                 ii, jj;
+
+    // Lists as for taskset -c and numactl.
+    if(wrh5_parse_list("0-3,8,66-67", mask, 128) != 0 || mask[0] != 0x10F || mask[1] != 0xC)
+        fatal_error(__LINE__, "wrh5_parse_list of a valid list is wrong");
+    if(wrh5_parse_list("", mask, 128) != 0 || mask[0] != 0 || wrh5_parse_list("3-1", NULL, 128) == 0
+       || wrh5_parse_list("1,", NULL, 128) == 0 || wrh5_parse_list("0-", NULL, 128) == 0
+       || wrh5_parse_list("128", NULL, 128) == 0 || wrh5_parse_list("a", NULL, 128) == 0)
+        fatal_error(__LINE__, "wrh5_parse_list accepted a malformed list");
+
+    p_dump = malloc(dump_elems * sizeof(float));
+    for(jj = 0; jj < (long) dump_elems; jj++)
+        p_dump[jj] = (float) (jj % 17);
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = 1;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = 0;
+    memset(&params, 0, sizeof(params));
+    strcpy(params.worker_cpus, "0-");
+    if(wrh5_manager_create(&mgr, &params, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_manager_create accepted a malformed CPU list");
+
+    // Workers and I/O thread pinned to the CPU this thread runs on; memory bound to node 0 (nothing to do on one node).
+    sprintf(params.worker_cpus, "%d", sched_getcpu());
+    sprintf(params.io_cpus, "%d", sched_getcpu());
+    strcpy(params.numa_nodes, "0");
+    params.nthreads = 2;
+    if(wrh5_manager_create(&mgr, &params, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_manager_create failed");
+    memset(&options, 0, sizeof(options));
+    options.deflate_level = 6;
+    sprintf(path_h5, "%s/brittany_placement.h5", dir_out);
+    if(wrh5_manager_open(&mgr, &stream, &wrh5_hdr, path_h5, &chunking, NULL, &options, dump_elems * sizeof(float)) != 0)
+        fatal_error(__LINE__, "wrh5_manager_open failed");
+    for(ii = 0; ii < ndumps; ii++)
+        if(wrh5_manager_write(&mgr, stream, p_dump, dump_elems * sizeof(float)) != 0)
+            fatal_error(__LINE__, "wrh5_manager_write failed");
+    if(wrh5_manager_close(&mgr, stream) != 0)
+        fatal_error(__LINE__, "wrh5_manager_close failed");
+    nthreads = wrh5_manager_threads(&mgr, threads, 4);
+    if(nthreads != 3 || wrh5_manager_threads(&mgr, threads, 2) != 2)
+        fatal_error(__LINE__, "wrh5_manager_threads returned the wrong number of threads");
+    nthreads = wrh5_manager_threads(&mgr, threads, 4);
+    for(ii = 0; ii < nthreads; ii++)
+        if(!threads[ii].pinned || threads[ii].tid <= 0 || threads[ii].cpu != sched_getcpu())
+            fatal_error(__LINE__, "a manager thread is not pinned");
+    if(strcmp(threads[2].name, "wrh5 io") != 0 || threads[2].cpu_seconds <= 0.0
+       || threads[0].cpu_seconds + threads[1].cpu_seconds <= 0.0)
+        fatal_error(__LINE__, "manager thread statistics are wrong");
+    if(wrh5_manager_stats(&mgr, -1, &totals) != 0 || totals.io_cpu_seconds <= 0.0 || totals.worker_cpu_seconds <= 0.0)
+        fatal_error(__LINE__, "manager CPU time statistics are wrong");
+    if(wrh5_manager_destroy(&mgr) != 0)
+        fatal_error(__LINE__, "wrh5_manager_destroy failed");
+
+    // A CPU list naming no usable CPU only costs a warning: the threads run unpinned.
+    strcpy(params.worker_cpus, "1023");
+    params.io_cpus[0] = '\0';
+    if(wrh5_manager_create(&mgr, &params, verbose) != 0)
+        fatal_error(__LINE__, "wrh5_manager_create failed");
+    if(wrh5_manager_open(&mgr, &stream, &wrh5_hdr, path_h5, &chunking, NULL, &options, dump_elems * sizeof(float)) != 0
+       || wrh5_manager_write(&mgr, stream, p_dump, dump_elems * sizeof(float)) != 0 || wrh5_manager_close(&mgr, stream) != 0)
+        fatal_error(__LINE__, "the manager failed with unusable CPU lists");
+    nthreads = wrh5_manager_threads(&mgr, threads, 4);
+    if(threads[0].pinned || threads[2].pinned || wrh5_manager_destroy(&mgr) != 0)
+        fatal_error(__LINE__, "a thread was pinned to an unusable CPU list");
+
+    // Context option: bind its own pool; a malformed node list is refused.
+    options.deflate_level = 0;
+    options.pool_nbufs = 2;
+    strcpy(options.numa_nodes, "0,63");
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) != 0
+       || wrh5_write(&wrh5_ctx, &wrh5_hdr, p_dump, dump_elems * sizeof(float), verbose) != 0
+       || wrh5_close(&wrh5_ctx, verbose) != 0)
+        fatal_error(__LINE__, "a context with numa_nodes failed");
+    strcpy(options.numa_nodes, "0;1");
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, &chunking, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext accepted a malformed numa_nodes");
+    free(p_dump);
+    printf("brittany: placement OK (I/O thread %.3f s CPU, workers %.3f s)\n", totals.io_cpu_seconds, totals.worker_cpu_seconds);
+}
+
+/***
+	Channel selection: is presented channel chan kept in case ll of test_chans?
+***/
+int chan_kept(int ll, int chan) {
+    switch(ll) {
+        case 0:
+            return chan % 16 >= 2 && chan % 16 < 14;
+        case 1:
+            return chan >= 8 && chan <= 55 && chan % 16 >= 2 && chan % 16 < 14;
+        default:
+            return chan == 0 || chan == 5 || chan == 9 || chan == 10 || chan == 63;
+    }
+}
+
+
+/***
+	Channel selection: guard channels of every coarse channel, a band with guards in a transposed layout,
+	scattered channels through the writer manager; stored header, "chan_index" and data read back.
+***/
+void test_chans(void) {
+    char            path_h5[512];
+    wrh5_context_t  wrh5_ctx;
+    wrh5_hdr_t      wrh5_hdr;
+    user_options_t  options;
+    wrh5_manager_t  mgr;
+    hid_t           file_id, dataset_id;
+    int             nifs = 2, nchans = 64, nfpc = 16, ntints = 7, stream, nkept, nfpc_attr, nchans_attr;
+    int             expect_nfpc[3] = {12, 0, 0};
+    uint32_t        chan_index[64];
+    double          fch1;
+    float           *p_in, *p_tint;
+    long            ii, jj, kk, ll, nstored;
+
+    p_in = malloc(ntints * nifs * nchans * sizeof(float));
+    p_tint = malloc(nifs * nchans * sizeof(float));
+    make_voyager_1_metadata(&wrh5_hdr);
+    wrh5_hdr.nifs = nifs;
+    wrh5_hdr.nchans = nchans;
+    wrh5_hdr.nfpc = nfpc;
+    for(ll = 0; ll < 3; ll++) {
+        for(ii = 0; ii < ntints; ii++)
+            for(kk = 0; kk < nifs; kk++)
+                for(jj = 0; jj < nchans; jj++) {
+                    float value = (float) (ii * 100000 + kk * 1000 + jj);
+                    if(ll == 1)
+                        p_in[(kk * nchans + jj) * ntints + ii] = value;
+                    else
+                        p_in[(ii * nifs + kk) * nchans + jj] = value;
+                }
+        sprintf(path_h5, "%s/brittany_chans_%ld.h5", dir_out, ll);
+        memset(&options, 0, sizeof(options));
+        options.pool_tints = 3;     // Force several staging loads per dump
+        if(ll == 0)
+            options.guard_chans = 2;
+        else if(ll == 1) {
+            options.guard_chans = 2;
+            strcpy(options.keep_chans, "8-55");
+            options.input_layout = WRH5_LAYOUT_ICT;
+        } else {
+            strcpy(options.keep_chans, "0,5,9-10,63");
+            options.deflate_level = 6;
+        }
+        if(ll < 2) {
+            if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) != 0)
+                fatal_error(__LINE__, "wrh5_open_ext failed");
+            if(wrh5_write(&wrh5_ctx, &wrh5_hdr, p_in, ntints * nifs * nchans * sizeof(float), verbose) != 0)
+                fatal_error(__LINE__, "wrh5_write failed");
+            if(wrh5_close(&wrh5_ctx, verbose) != 0)
+                fatal_error(__LINE__, "wrh5_close failed");
+        } else {
+            if(wrh5_manager_create(&mgr, NULL, verbose) != 0)
+                fatal_error(__LINE__, "wrh5_manager_create failed");
+            if(wrh5_manager_open(&mgr, &stream, &wrh5_hdr, path_h5, NULL, NULL, &options, 4 * nifs * nchans * sizeof(float)) != 0)
+                fatal_error(__LINE__, "wrh5_manager_open failed");
+            if(wrh5_manager_write(&mgr, stream, p_in, 4 * nifs * nchans * sizeof(float)) != 0
+               || wrh5_manager_write(&mgr, stream, p_in + 4 * nifs * nchans, 3 * nifs * nchans * sizeof(float)) != 0)
+                fatal_error(__LINE__, "wrh5_manager_write failed");
+            if(wrh5_manager_close(&mgr, stream) != 0 || wrh5_manager_destroy(&mgr) != 0)
+                fatal_error(__LINE__, "wrh5_manager_close failed");
+        }
+
+        // Stored header and channel index.
+        for(jj = 0, nkept = 0; jj < nchans; jj++)
+            nkept += chan_kept(ll, jj);
+        nstored = read_dataset(path_h5, "chan_index", H5T_NATIVE_UINT32, chan_index);
+        for(jj = 0, kk = 0; jj < nchans; jj++)
+            if(chan_kept(ll, jj) && (kk >= nstored || chan_index[kk++] != (uint32_t) jj))
+                fatal_error(__LINE__, "chan_index does not list the kept channels");
+        if(nstored != nkept)
+            fatal_error(__LINE__, "chan_index has the wrong length");
+        file_id = H5Fopen(path_h5, H5F_ACC_RDONLY, H5P_DEFAULT);
+        dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+        if(wrh5_get_attr(dataset_id, "nchans", H5T_NATIVE_INT, &nchans_attr) != 0 || nchans_attr != nkept
+           || wrh5_get_attr(dataset_id, "fch1", H5T_NATIVE_DOUBLE, &fch1) != 0
+           || fabs(fch1 - (wrh5_hdr.fch1 + wrh5_hdr.foff * chan_index[0])) > 1e-9)
+            fatal_error(__LINE__, "stored nchans or fch1 is wrong");
+        nfpc_attr = 0;
+        H5E_BEGIN_TRY {
+            wrh5_get_attr(dataset_id, "nfpc", H5T_NATIVE_INT, &nfpc_attr);
+        } H5E_END_TRY;
+        if(nfpc_attr != expect_nfpc[ll])
+            fatal_error(__LINE__, "stored nfpc is wrong");
+        H5Dclose(dataset_id);
+        H5Fclose(file_id);
+
+        // Data.
+        for(ii = 0; ii < ntints; ii++) {
+            read_tint(path_h5, ii, p_tint, nifs, nkept);
+            for(kk = 0; kk < nifs; kk++)
+                for(jj = 0; jj < nkept; jj++)
+                    if(p_tint[kk * nkept + jj] != (float) (ii * 100000 + kk * 1000 + chan_index[jj]))
+                        fatal_error(__LINE__, "kept channels read back do not match");
+        }
+    }
+
+    // Refused selections.
+    memset(&options, 0, sizeof(options));
+    options.guard_chans = 8;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext accepted guard_chans = nfpc / 2");
+    options.guard_chans = 0;
+    strcpy(options.keep_chans, "60-64");
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext accepted a channel past nchans");
+    strcpy(options.keep_chans, "0,5,20");     // Coarse channels 0 and 1 keep different fine channels: nfpc 0
+    options.cc_aligned = 1;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext accepted cc_aligned without whole coarse channels");
+    options.cc_aligned = 0;
+    options.resume = 1;
+    if(wrh5_open_ext(&wrh5_ctx, &wrh5_hdr, path_h5, NULL, NULL, &options, verbose) == 0)
+        fatal_error(__LINE__, "wrh5_open_ext accepted keep_chans with resume");
+    free(p_in);
+    free(p_tint);
+    printf("brittany: chans OK\n");
+}
+
+/***
+	Main entry point.
+***/
+int main(int argc, char **argv) {
+    char    wstr[256];      // sprintf target
+    time_t  time1, time2;   // elapsed time calculation (seconds)
+
+    /*
+     * Parse command line.
+     */
+    switch(argc) {
+        case 1:
+            show_help("No parameters provided");
+            break;
+        case 2:
+            strcpy(wstr, *++argv);
+            if(strcmp(wstr, "-h") == 0)
+                show_help("Help was requested");
+            if(wstr[0] == '-')
+                show_help("An option was specified but the output directory is missing");
+            strcpy(dir_out, wstr);
+            break;
+        case 3:
+            strcpy(wstr, *++argv);
+            if(strcmp(wstr, "-v") == 0) {
+                verbose = 1;
+                strcpy(dir_out, *++argv);
+                break;
+            }
+            show_help("Unrecognizable parameter or extraneous string specified");
+            break;
+        default:
+            show_help("Too many parameters specified");
+    }
+
+    /*
+     * Run the tests.
+     */
+    time(&time1);
+    test_cc_index();
+    test_pool();
+    test_writev();
+    test_layout();
+    test_detect();
+    test_trim();
+    test_quantize();
+    test_bypass();
+    test_missing();
+    test_resume();
+    test_rechunk();
+    test_sk();
+    test_budget();
+    test_uring();
+    test_serve();
+    test_manager();
+    test_vds();
+    test_contiguous();
+    test_trace();
+    test_metrics();
+    test_record();
+    test_realtime();
+    test_placement();
+    test_chans();
+
+    /*
+     * Compute elapsed time.
+     */
+    time(&time2);
+    printf("brittany: End, e.t. = %.2f seconds.\n", difftime(time2, time1));
+
+    /*
+     * Bye-bye.
+     */
+    return 0;
+}
@@ -0,0 +1,217 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * eleanor.cpp                                                                 *
+ * -----------                                                                 *
+ * Sample wrh5 C++ application (wrh5.hpp, C++17).                              *
+ * Exercise wrh5::Writer and read the results back.                            *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <wrh5.hpp>
+
+static int verbose = 0;         // 1 : verbose logging in libwrh5 calls; 0 : default
+static std::string dir_out;     // Output directory
+
+/*
+ * Compile-time checks.
+ */
+using Recorder = wrh5::Writer<float, 2, 1024>;
+static constexpr user_chunking_t recorder_chunking = {16, 1, 1024};
+static_assert(Recorder::nbits == 32 && Recorder::nifs == 2, "element type and IFs");
+static_assert(Recorder::tint_elems() == 2048 && Recorder::tint_bytes() == 8192, "time integration size");
+static_assert(Recorder::chunk_bytes(recorder_chunking) == 16 * 1024 * 4, "chunk size");
+static_assert(wrh5::Writer<std::uint8_t, 4>::tint_bytes(100) == 400, "time integration size (uint8)");
+static_assert(!std::is_copy_constructible_v<Recorder> && !std::is_copy_assignable_v<Recorder>, "move-only");
+static_assert(std::is_nothrow_move_constructible_v<Recorder> && std::is_nothrow_move_assignable_v<Recorder>, "movable");
+
+
+/***
+	Report a failure and exit.
+***/
+static void fatal_error(int linenum, const char * msg) {
+    std::fprintf(stderr, "\n*** eleanor: FATAL ERROR at line %d :: %s.\n", linenum, msg);
+    std::exit(86);
+}
+
+
+/***
+	Initialize metadata to Voyager 1 values (nbits and nifs are set by wrh5::Writer).
+***/
+static wrh5_hdr_t make_metadata(int nchans) {
+    wrh5_hdr_t hdr;
+
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.data_type = 1;
+    hdr.fch1 = 8421.386717353016;
+    hdr.foff = -2.7939677238464355e-06;
+    hdr.ibeam = 1;
+    hdr.machine_id = 42;
+    hdr.nbeams = 1;
+    hdr.nchans = nchans;
+    hdr.telescope_id = 6;
+    hdr.tsamp = 18.253611008;
+    hdr.tstart = 57650.78209490741;
+    std::strcpy(hdr.source_name, "Voyager1");
+    std::strcpy(hdr.rawdatafile, "guppi_57650_67573_Voyager1_0002.0000.raw");
+    return hdr;
+}
+
+
+/***
+	Read the whole dataset "data" as float32 and return its number of time integrations.
+***/
+static long read_data(const std::string & path_h5, std::vector<float> & data) {
+    hid_t   file_id, dataset_id, space_id;
+    hsize_t dims[3];
+
+    file_id = H5Fopen(path_h5.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    dataset_id = H5Dopen(file_id, "data", H5P_DEFAULT);
+    if(dataset_id < 0)
+        fatal_error(__LINE__, "data dataset is missing");
+    space_id = H5Dget_space(dataset_id);
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    data.resize(dims[0] * dims[1] * dims[2]);
+    if(H5Dread(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data()) < 0)
+        fatal_error(__LINE__, "H5Dread failed");
+    H5Sclose(space_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    return (long) dims[0];
+}
+
+
+/***
+	write, writev, write_missing, the zero-copy pool, moves and errors.
+***/
+static void test_writer(void) {
+    std::string        path_h5 = dir_out + "/eleanor_writer.h5";
+    wrh5_hdr_t         hdr = make_metadata(1024);
+    user_options_t     options;
+    std::vector<float> dump(3 * Recorder::tint_elems()), seg_a(Recorder::tint_elems()), seg_b(2 * Recorder::tint_elems());
+    std::vector<float> back;
+    size_t             ix, tint;
+
+    for(ix = 0; ix < dump.size(); ix++)
+        dump[ix] = (float) ix;
+    for(ix = 0; ix < seg_a.size(); ix++)
+        seg_a[ix] = -1.0f - (float) ix;
+    for(ix = 0; ix < seg_b.size(); ix++)
+        seg_b[ix] = 0.5f * (float) ix;
+    std::memset(&options, 0, sizeof(options));
+    options.pool_nbufs = 1;
+
+    Recorder first(path_h5, hdr, &recorder_chunking, nullptr, &options, verbose);
+    first.write(dump);                              // Tints 0-2
+    first.writev(seg_a, seg_b);                     // Tints 3-5
+    first.write_missing(1);                         // Tint 6
+    try {
+        first.write(wrh5::span<const float>(dump.data(), 100));
+        fatal_error(__LINE__, "a partial time integration was accepted");
+    } catch(const wrh5::error &) {
+    }
+
+    Recorder second(std::move(first));              // The context moves; nothing is closed
+    if(first.is_open() || !second.is_open() || second.ntints() != 7)
+        fatal_error(__LINE__, "move construction did not transfer the context");
+    wrh5::span<float> pool_buffer = second.get_buffer();
+    if(pool_buffer.size() < Recorder::tint_elems())
+        fatal_error(__LINE__, "pool buffer is too small");
+    for(ix = 0; ix < Recorder::tint_elems(); ix++)
+        pool_buffer[ix] = 7.0f;
+    second.submit(pool_buffer.first(Recorder::tint_elems()));   // Tint 7, no copy
+    if(second.memory_usage().pool != second.context().p_pool->map_size)
+        fatal_error(__LINE__, "memory usage does not count the context's own pool");
+    second.close();
+    second.close();                                 // Closing twice is harmless
+
+    if(read_data(path_h5, back) != 8)
+        fatal_error(__LINE__, "wrong number of time integrations");
+    for(tint = 0; tint < 8; tint++)
+        for(ix = 0; ix < Recorder::tint_elems(); ix++) {
+            float expected;
+            if(tint < 3)
+                expected = dump[tint * Recorder::tint_elems() + ix];
+            else if(tint == 3)
+                expected = seg_a[ix];
+            else if(tint < 6)
+                expected = seg_b[(tint - 4) * Recorder::tint_elems() + ix];
+            else if(tint == 6)
+                expected = 0.0f;
+            else
+                expected = 7.0f;
+            if(back[tint * Recorder::tint_elems() + ix] != expected)
+                fatal_error(__LINE__, "data read back does not match");
+        }
+    std::printf("eleanor: writer OK\n");
+}
+
+
+/***
+	Detection stage through write_detect, and an element type other than float.
+***/
+static void test_detect_and_types(void) {
+    std::string                      path_h5 = dir_out + "/eleanor_detect.h5";
+    std::string                      path_u8 = dir_out + "/eleanor_uint8.h5";
+    int                              nchans = 64;
+    wrh5_hdr_t                       hdr = make_metadata(nchans);
+    user_options_t                   options;
+    std::vector<std::complex<float>> x(4 * nchans), y(4 * nchans);
+    std::vector<std::uint8_t>        bytes(3 * 4 * nchans);
+    std::vector<float>               back;
+    int                              c;
+
+    for(c = 0; c < 4 * nchans; c++) {
+        x[c] = std::complex<float>(1.0f, 1.0f);     // |X|^2 = 2
+        y[c] = std::complex<float>(0.0f, 1.0f);     // |Y|^2 = 1
+    }
+    std::memset(&options, 0, sizeof(options));
+    options.detect = WRH5_DETECT_I;
+    options.detect_nint = 2;
+    {
+        wrh5::Writer<float, 1> writer(path_h5, hdr, nullptr, nullptr, &options, verbose);
+        writer.write_detect(x, y);                  // 4 spectra --> 2 time integrations
+    }                                               // Closed by the destructor
+    if(read_data(path_h5, back) != 2)
+        fatal_error(__LINE__, "wrong number of detected time integrations");
+    for(c = 0; c < 2 * nchans; c++)
+        if(back[c] != 6.0f)
+            fatal_error(__LINE__, "detected Stokes I is wrong");
+
+    wrh5::Writer<std::uint8_t, 4> writer_u8(path_u8, hdr);
+    if(writer_u8.hdr().nbits != 8 || writer_u8.hdr().nifs != 4)
+        fatal_error(__LINE__, "nbits and nifs were not set from the template arguments");
+    writer_u8.write(bytes);
+    if(writer_u8.ntints() != 3)
+        fatal_error(__LINE__, "wrong number of uint8 time integrations");
+    writer_u8.close();
+    std::printf("eleanor: detect and types OK\n");
+}
+
+
+/***
+	Main entry point.
+***/
+int main(int argc, char **argv) {
+    if(argc != 2 && argc != 3) {
+        std::printf("\nUsage:  eleanor  OutputDirectory  [-v]\n\n");
+        return 1;
+    }
+    dir_out = argv[1];
+    if(argc == 3 && std::strcmp(argv[2], "-v") == 0)
+        verbose = 1;
+    try {
+        test_writer();
+        test_detect_and_types();
+    } catch(const wrh5::error & e) {
+        fatal_error(__LINE__, e.what());
+    }
+    std::printf("eleanor: End.\n");
+    return 0;
+}
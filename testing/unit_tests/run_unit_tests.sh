@@ -16,3 +16,9 @@ h5dump -A $TEST_DATA/simon.h5
 ./alvin $TEST_DATA/alvin.h5
 h5dump -A $TEST_DATA/alvin.h5
 
+
+# Run brittany (user options) which reads back and checks its own output:
+./brittany $TEST_DATA
+
+# Run eleanor (C++ wrh5::Writer) which reads back and checks its own output:
+./eleanor $TEST_DATA
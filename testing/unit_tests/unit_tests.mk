@@ -18,25 +18,33 @@ $(info unit_tests.mk: *** LINK_LIBWRH5 was not found.)
 $(error Execute make at the root level only.)
 endif
 
-OBJECTS= alvin.o simon.o
+OBJECTS= alvin.o simon.o brittany.o eleanor.o
 
 # --- All targets. Default action.
-all:	alvin simon
+all:	alvin simon brittany eleanor
 
 # --- Test program executables.
 alvin:	$(OBJECTS)
 	gcc -o alvin alvin.o $(LINK_LIBWRH5)
 simon:	$(OBJECTS)
 	gcc -o simon simon.o $(LINK_LIBWRH5)
+brittany:	$(OBJECTS)
+	gcc -o brittany brittany.o $(LINK_LIBWRH5) $(LINK_LIBHDF5) -lm -lpthread
+eleanor:	$(OBJECTS)
+	g++ -o eleanor eleanor.o $(LINK_LIBWRH5) $(LINK_LIBHDF5)
 
 # --- Remove binaries and data files in testdata subdirectory.
 clean:
-	rm -f alvin simon $(OBJECTS)
+	rm -f alvin simon brittany eleanor $(OBJECTS)
 
 # --- Store important suffixes in the .SUFFIXES macro.
-.SUFFIXES:	.o .c	
+.SUFFIXES:	.o .c .cpp	
 
 # --- Generate anyfile.o from anyfile.c.
-%.o:    %.c unit_tests.mk $(INCDIR_WRH5)
+%.o:    %.c unit_tests.mk $(INC_DIR_LIBWRH5)/wrh5_defs.h
 	gcc $(CFLAGS) -I. -I $(INC_DIR_LIBWRH5) -I $(INC_DIR_LIBHDF5) $<
 
+# --- Generate anyfile.o from anyfile.cpp (C++17, wrh5.hpp).
+%.o:    %.cpp unit_tests.mk $(INC_DIR_LIBWRH5)/wrh5_defs.h $(INC_DIR_LIBWRH5)/wrh5.hpp
+	g++ -std=c++17 $(CFLAGS) -I. -I $(INC_DIR_LIBWRH5) -I $(INC_DIR_LIBHDF5) $<
+
@@ -35,6 +35,6 @@ clean:
 .SUFFIXES:	.o .c	
 
 # --- Generate anyfile.o from anyfile.c.
-%.o:    %.c voyager.mk $(INCDIR_WRH5)
+%.o:    %.c voyager.mk $(INC_DIR_LIBWRH5)/wrh5_defs.h
 	gcc $(CFLAGS) -I. -I $(INC_DIR_LIBWRH5) -I $(INC_DIR_LIBHDF5) $<
 
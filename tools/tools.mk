@@ -0,0 +1,46 @@
+ifndef INC_DIR_LIBHDF5
+$(info tools.mk: *** INC_DIR_LIBHDF5 was not found.)
+$(error Execute make at the root level only.)
+endif
+
+ifndef LINK_LIBHDF5
+$(info tools.mk: *** LINK_LIBHDF5 was not found.)
+$(error Execute make at the root level only.)
+endif
+
+ifndef INC_DIR_LIBWRH5
+$(info tools.mk: *** INC_DIR_LIBWRH5 was not found.)
+$(error Execute make at the root level only.)
+endif
+
+ifndef LINK_LIBWRH5
+$(info tools.mk: *** LINK_LIBWRH5 was not found.)
+$(error Execute make at the root level only.)
+endif
+
+OBJECTS= wrh5_rechunk.o wrh5d.o wrh5_replay.o
+
+# --- All targets. Default action.
+all:	wrh5_rechunk wrh5d wrh5_replay
+
+# --- Tool executables.
+wrh5_rechunk:	$(OBJECTS)
+	gcc -o wrh5_rechunk wrh5_rechunk.o $(LINK_LIBWRH5) $(LINK_LIBHDF5)
+
+wrh5d:	$(OBJECTS)
+	gcc -o wrh5d wrh5d.o $(LINK_LIBWRH5) $(LINK_LIBHDF5)
+
+wrh5_replay:	$(OBJECTS)
+	gcc -o wrh5_replay wrh5_replay.o $(LINK_LIBWRH5) $(LINK_LIBHDF5)
+
+# --- Remove binaries.
+clean:
+	rm -f wrh5_rechunk wrh5d wrh5_replay $(OBJECTS)
+
+# --- Store important suffixes in the .SUFFIXES macro.
+.SUFFIXES:	.o .c	
+
+# --- Generate anyfile.o from anyfile.c.
+%.o:    %.c tools.mk $(INC_DIR_LIBWRH5)/wrh5_defs.h
+	gcc $(CFLAGS) -I. -I $(INC_DIR_LIBWRH5) -I $(INC_DIR_LIBHDF5) $<
+
@@ -0,0 +1,96 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_rechunk.c                                                              *
+ * --------------                                                              *
+ * Command-line tool: copy an existing FBH5 file into a new chunk shape and/or *
+ * codec with wrh5_rechunk (multithreaded, bounded memory).                    *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wrh5_defs.h>
+
+
+/***
+	Show help and then exit.
+***/
+void show_help(char * msg) {
+    printf("\n%s\n", msg);
+    printf("Usage:  wrh5_rechunk  [options]  InputFile  OutputFile\n\n");
+    printf("-t n : chunk time dimension (default: as the input)\n");
+    printf("-i n : chunk IF dimension (default: as the input)\n");
+    printf("-c n : chunk fine channel dimension (default: as the input)\n");
+    printf("-z codec : keep (default), none, bitshuffle or deflate\n");
+    printf("-l n : deflate level, 1 to 9 (default 4, or the input's when kept)\n");
+    printf("-j n : worker threads (default: online CPUs)\n");
+    printf("-m n : memory budget in MiB for all threads (default 256)\n");
+    printf("-v : verbose logging\n\n");
+    printf("E.g. drift-rate search layout of a high frequency resolution file:\n");
+    printf("     wrh5_rechunk -t 16 -c 65536 hfr.h5 hfr_16x64k.h5\n\n");
+    exit(1);
+}
+
+
+/***
+	Main entry point.
+***/
+int main(int argc, char **argv) {
+    user_rechunk_t params;
+    int            opt, verbose = 0;
+
+    memset(&params, 0, sizeof(params));
+    while((opt = getopt(argc, argv, "t:i:c:z:l:j:m:vh")) != -1) {
+        switch(opt) {
+            case 't':
+                params.chunking.n_time = atol(optarg);
+                break;
+            case 'i':
+                params.chunking.n_nifs = atol(optarg);
+                break;
+            case 'c':
+                params.chunking.n_fine_chan = atol(optarg);
+                break;
+            case 'z':
+                if(strcmp(optarg, "keep") == 0)
+                    params.codec = WRH5_CODEC_KEEP;
+                else if(strcmp(optarg, "none") == 0)
+                    params.codec = WRH5_CODEC_NONE;
+                else if(strcmp(optarg, "bitshuffle") == 0)
+                    params.codec = WRH5_CODEC_BITSHUFFLE;
+                else if(strcmp(optarg, "deflate") == 0)
+                    params.codec = WRH5_CODEC_DEFLATE;
+                else
+                    show_help("Unrecognizable codec");
+                break;
+            case 'l':
+                params.deflate_level = atoi(optarg);
+                break;
+            case 'j':
+                params.nthreads = atoi(optarg);
+                break;
+            case 'm':
+                params.mem_budget = (size_t) atol(optarg) * 1024 * 1024;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':
+                show_help("Help was requested");
+                break;
+            default:
+                show_help("Unrecognizable option");
+        }
+    }
+    if(argc - optind != 2)
+        show_help("The input and output files must be specified");
+    if(strcmp(argv[optind], argv[optind + 1]) == 0)
+        show_help("The output file must not be the input file");
+
+    if(wrh5_rechunk(argv[optind], argv[optind + 1], &params, verbose) != 0) {
+        fprintf(stderr, "\n*** wrh5_rechunk: FAILED.\n");
+        return 86;
+    }
+    return 0;
+}
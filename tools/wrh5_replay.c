@@ -0,0 +1,98 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5_replay.c                                                               *
+ * -------------                                                               *
+ * Command-line tool: replay a write-pattern recording (WRH5_RECORD or         *
+ * wrh5_record_start) with wrh5_replay and report throughput and latency.      *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wrh5_defs.h>
+
+
+/***
+	Show help and then exit.
+***/
+void show_help(char * msg) {
+    printf("\n%s\n", msg);
+    printf("Usage:  wrh5_replay  [options]  RecordingFile\n\n");
+    printf("-o dir : directory of the replayed files (default: current directory)\n");
+    printf("-p : paced: start each call at its recorded time (default: as fast as possible)\n");
+    printf("-t n : chunk time dimension (default: as recorded)\n");
+    printf("-i n : chunk IF dimension (default: as recorded)\n");
+    printf("-c n : chunk fine channel dimension (default: as recorded)\n");
+    printf("-l n : deflate level, 1 to 9 (default: as recorded)\n");
+    printf("-d n : io_uring writes in flight per file (default: as recorded)\n");
+    printf("-v : verbose logging\n\n");
+    printf("E.g. record a run, then replay it with deflate on a scratch disk:\n");
+    printf("     WRH5_RECORD=/tmp/run.rec WRH5_RECORD_SAMPLE=100 ./acquire ...\n");
+    printf("     wrh5_replay -o /scratch -l 4 /tmp/run.rec\n\n");
+    exit(1);
+}
+
+
+/***
+	Main entry point.
+***/
+int main(int argc, char **argv) {
+    user_replay_t       params;
+    wrh5_replay_stats_t stats;
+    int                 opt, verbose = 0, rc;
+
+    memset(&params, 0, sizeof(params));
+    while((opt = getopt(argc, argv, "o:pt:i:c:l:d:vh")) != -1) {
+        switch(opt) {
+            case 'o':
+                if(strlen(optarg) >= sizeof(params.out_dir))
+                    show_help("The output directory path is too long");
+                strcpy(params.out_dir, optarg);
+                break;
+            case 'p':
+                params.paced = 1;
+                break;
+            case 't':
+                params.chunking.n_time = atol(optarg);
+                break;
+            case 'i':
+                params.chunking.n_nifs = atol(optarg);
+                break;
+            case 'c':
+                params.chunking.n_fine_chan = atol(optarg);
+                break;
+            case 'l':
+                params.deflate_level = atoi(optarg);
+                break;
+            case 'd':
+                params.io_depth = atoi(optarg);
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':
+                show_help("Help was requested");
+                break;
+            default:
+                show_help("Unrecognizable option");
+        }
+    }
+    if(argc - optind != 1)
+        show_help("The recording file is required");
+
+    rc = wrh5_replay(argv[optind], &params, &stats, verbose);
+    printf("wrh5_replay: %lu files, %lu write calls, %.2f MiB in %.3f s (recorded: %.3f s)\n",
+           stats.opens, stats.writes, stats.bytes / 1048576.0, stats.seconds, stats.recorded_seconds);
+    if(stats.seconds > 0.0)
+        printf("wrh5_replay: throughput %.2f MiB/s\n", stats.bytes / 1048576.0 / stats.seconds);
+    printf("wrh5_replay: write latency ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+           1e3 * stats.lat_p50, 1e3 * stats.lat_p90, 1e3 * stats.lat_p99, 1e3 * stats.lat_max);
+    printf("wrh5_replay: recorded latency ms: p50 %.3f, p99 %.3f, max %.3f\n",
+           1e3 * stats.rec_p50, 1e3 * stats.rec_p99, 1e3 * stats.rec_max);
+    if(rc != 0) {
+        fprintf(stderr, "\n*** wrh5_replay: %lu calls FAILED.\n", stats.errors);
+        return 86;
+    }
+    return 0;
+}
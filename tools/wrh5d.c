@@ -0,0 +1,125 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * wrh5d.c                                                                     *
+ * -------                                                                     *
+ * Daemon: write the shared-memory streams of acquisition processes (linked    *
+ * with libwrh5c only) to FBH5 files with wrh5_serve.  SIGINT and SIGTERM      *
+ * write what is committed, close every file and exit.                         *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wrh5_defs.h>
+#include <wrh5_shm.h>
+
+static volatile int stop_requested = 0;
+
+
+/***
+	Signal handler: ask wrh5_serve to finish.
+***/
+static void on_signal(int signum) {
+    (void) signum;
+    stop_requested = 1;
+}
+
+
+/***
+	Show help and then exit.
+***/
+void show_help(char * msg) {
+    printf("\n%s\n", msg);
+    printf("Usage:  wrh5d  [options]\n\n");
+    printf("-p prefix : serve /dev/shm/<prefix>* (default %s)\n", WRH5_SHM_PREFIX);
+    printf("-s n : milliseconds between scans for new streams (default 100)\n");
+    printf("-n n : streams served at once (default 64)\n");
+    printf("-b n : slots written per stream per round (default 4)\n");
+    printf("-d n : io_uring writes in flight per file (default 0: sec2 driver)\n");
+    printf("-m path : rewrite Prometheus metrics into this textfile every 5 s\n");
+    printf("-u path : answer Prometheus metrics on this Unix socket\n");
+    printf("-1 : exit once every stream served so far is closed\n");
+    printf("-v : verbose logging\n\n");
+    printf("E.g. serve the streams of the beams of one host:\n");
+    printf("     wrh5d -p %sbeam -d 8\n\n", WRH5_SHM_PREFIX);
+    exit(1);
+}
+
+
+/***
+	Main entry point.
+***/
+int main(int argc, char **argv) {
+    user_serve_t   params;
+    user_options_t options;
+    user_metrics_t metrics;
+    int            opt, verbose = 0, rc;
+
+    memset(&params, 0, sizeof(params));
+    memset(&options, 0, sizeof(options));
+    memset(&metrics, 0, sizeof(metrics));
+    while((opt = getopt(argc, argv, "p:s:n:b:d:m:u:1vh")) != -1) {
+        switch(opt) {
+            case 'p':
+                if(strlen(optarg) >= sizeof(params.prefix))
+                    show_help("The prefix is too long");
+                strcpy(params.prefix, optarg);
+                break;
+            case 's':
+                params.scan_ms = atoi(optarg);
+                break;
+            case 'n':
+                params.max_streams = atoi(optarg);
+                break;
+            case 'b':
+                params.burst = atoi(optarg);
+                break;
+            case 'd':
+                options.io_depth = atoi(optarg);
+                break;
+            case 'm':
+                if(strlen(optarg) >= sizeof(metrics.textfile))
+                    show_help("The metrics textfile path is too long");
+                strcpy(metrics.textfile, optarg);
+                break;
+            case 'u':
+                if(strlen(optarg) >= sizeof(metrics.socket_path))
+                    show_help("The metrics socket path is too long");
+                strcpy(metrics.socket_path, optarg);
+                break;
+            case '1':
+                params.exit_when_idle = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':
+                show_help("Help was requested");
+                break;
+            default:
+                show_help("Unrecognizable option");
+        }
+    }
+    if(argc != optind)
+        show_help("No arguments are expected");
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    params.p_stop = &stop_requested;
+    params.p_options = &options;
+    if(metrics.textfile[0] != '\0' || metrics.socket_path[0] != '\0')
+        if(wrh5_metrics_start(&metrics, verbose) != 0) {
+            fprintf(stderr, "\n*** wrh5d: the metrics exporter could not start.\n");
+            return 86;
+        }
+    rc = wrh5_serve(&params, verbose);
+    if(metrics.textfile[0] != '\0' || metrics.socket_path[0] != '\0')
+        wrh5_metrics_stop(verbose);
+    if(rc != 0) {
+        fprintf(stderr, "\n*** wrh5d: at least one stream FAILED.\n");
+        return 86;
+    }
+    return 0;
+}